@@ -0,0 +1,94 @@
+//go:build linux
+
+package bench
+
+import (
+	"fmt"
+	"io"
+	"os"
+	"regexp"
+	"sort"
+	"time"
+
+	mnet "github.com/HQarroum/microbox/net"
+)
+
+/**
+ * Options of a benchmark run.
+ */
+type Options struct {
+	// Group of benchmarks to run.
+	Group string
+
+	// Regular expression selecting the benchmarks of the group to run.
+	Filter string
+
+	// Run time of the benchmarks measuring traffic.
+	Benchtime time.Duration
+
+	// Number of sandboxes started by the groups measuring sandboxes.
+	Sandboxes int
+
+	// Number of concurrent creations, network mode and command of the
+	// sandboxes started by the stress group.
+	Concurrency int
+	Net         mnet.NetworkMode
+	Command     []string
+
+	// Root filesystem, storage size and read-only mode of the sandboxes
+	// measured by the fs group.
+	Rootfs   string
+	Storage  uint64
+	ReadOnly bool
+}
+
+/**
+ * Runners of the benchmark groups, which measure sandboxes and the host
+ * end to end. The benchmarks of the control plane are Go benchmarks of
+ * their packages, so that the testing package is not linked in.
+ */
+var harnesses = map[string]func(opts Options, filter *regexp.Regexp, w io.Writer) error{}
+
+/**
+ * @return the sorted names of the benchmark groups.
+ */
+func Groups() []string {
+	out := make([]string, 0, len(harnesses))
+	for g := range harnesses {
+		out = append(out, g)
+	}
+	sort.Strings(out)
+	return out
+}
+
+/**
+ * Creates a scratch directory, on tmpfs when available as the runtime
+ * state of microbox is, so that disk syncs do not dominate.
+ * @return the directory path, or error if any
+ */
+func scratchDir() (string, error) {
+	if st, err := os.Stat("/dev/shm"); err == nil && st.IsDir() {
+		if dir, err := os.MkdirTemp("/dev/shm", "microbox-bench-"); err == nil {
+			return dir, nil
+		}
+	}
+	return os.MkdirTemp("", "microbox-bench-")
+}
+
+/**
+ * Runs the benchmarks of a group.
+ * @param opts the run options
+ * @param w where to write the results
+ * @return error if any
+ */
+func Run(opts Options, w io.Writer) error {
+	filter, err := regexp.Compile(opts.Filter)
+	if err != nil {
+		return fmt.Errorf("bad benchmark filter %q: %w", opts.Filter, err)
+	}
+	h, ok := harnesses[opts.Group]
+	if !ok {
+		return fmt.Errorf("unknown benchmark group %q (one of %v)", opts.Group, Groups())
+	}
+	return h(opts, filter, w)
+}
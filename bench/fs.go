@@ -0,0 +1,510 @@
+//go:build linux
+
+package bench
+
+import (
+	"bufio"
+	"context"
+	"errors"
+	"fmt"
+	"io"
+	"log/slog"
+	"os"
+	"path/filepath"
+	"regexp"
+	"sort"
+	"strconv"
+	"strings"
+	"time"
+
+	"github.com/HQarroum/microbox/fs"
+	mnet "github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/sandbox"
+	"github.com/HQarroum/microbox/tracing"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// Number of sandboxes created to time the setup of each mode.
+	fsSetupRuns = 5
+
+	// Number of files of the metadata and small file tests.
+	fsFiles = 1000
+
+	// Size of the files of the small file test.
+	fsSmall = 4 << 10
+
+	// Size of the file of the large file and copy-up tests, and of its blocks.
+	fsLarge = 64 << 20
+	fsBlock = 1 << 20
+
+	// Name of the lower-layer file of the copy-up test.
+	fsLowerFile = ".microbox-bench-lower"
+)
+
+/**
+ * Measures the filesystem of sandboxes in each mode: the setup time,
+ * metadata operations, small and large file I/O, and the copy-up of
+ * lower-layer files by the overlay. The sandboxes are set up and left
+ * waiting to be started, so that no command is needed in their root
+ * filesystem, and the tests access it through `/proc/<pid>/root`,
+ * resolving paths in the mount namespace of the sandbox.
+ */
+func init() {
+	harnesses["fs"] = runFS
+}
+
+/**
+ * A filesystem mode under test.
+ */
+type fsMode struct {
+	name  string
+	mount fs.FsMount
+}
+
+/**
+ * A test of the files of a sandbox, in a scratch directory given as
+ * seen from the host.
+ */
+type fsTest struct {
+	name      string
+	writes    bool
+	lowerOnly bool
+	run       func(path string) (string, error)
+}
+
+var fsTests = []fsTest{
+	{name: "meta", writes: true, run: fsMeta},
+	{name: "small", writes: true, run: fsSmallFiles},
+	{name: "large", writes: true, run: fsLargeFile},
+	{name: "copy-up", writes: true, lowerOnly: true, run: fsCopyUp},
+}
+
+/**
+ * Runs the filesystem tests in each mode.
+ * @param opts the run options
+ * @param filter selects the tests, as `<mode>/<test>`
+ * @param w where to write the results
+ * @return error if any
+ */
+func runFS(opts Options, filter *regexp.Regexp, w io.Writer) error {
+	if os.Geteuid() != 0 {
+		return errors.New("the fs benchmarks require root")
+	}
+	modes := []fsMode{
+		{"host", fs.FsMount{Mode: fs.FsHost}},
+		{"tmpfs", fs.FsMount{Mode: fs.FsTmpfs}},
+	}
+	if opts.Rootfs != "" {
+		root, release, err := scratchRootfs(opts.Rootfs)
+		if err != nil {
+			return err
+		}
+		defer release()
+		modes = append(modes, fsMode{"rootfs", fs.FsMount{Mode: fs.FsRootfs, Path: root}})
+	}
+
+	rt := sandbox.NewRuntime(sandbox.RuntimeOptions{Logger: slog.New(slog.NewTextHandler(io.Discard, nil))})
+	for _, m := range modes {
+		if err := runFSMode(rt, m, opts, filter, w); err != nil {
+			fmt.Fprintf(w, "%-32s error: %v\n", "fs/"+m.name, err)
+		}
+	}
+	return nil
+}
+
+/**
+ * Builds the root filesystem of the rootfs mode in a temporary
+ * directory: a read-only overlay of a layer holding the lower-layer
+ * file of the copy-up test on top of the root filesystem, which is
+ * left untouched.
+ * @param rootfs the root filesystem
+ * @return the path of the root filesystem, the function releasing it, or error if any
+ */
+func scratchRootfs(rootfs string) (string, func(), error) {
+	dir, err := os.MkdirTemp("", "microbox-bench-")
+	if err != nil {
+		return "", nil, err
+	}
+	layer, root := filepath.Join(dir, "layer"), filepath.Join(dir, "root")
+	release := func() {
+		_ = unix.Unmount(root, unix.MNT_DETACH)
+		_ = os.RemoveAll(dir)
+	}
+	for _, d := range []string{layer, root} {
+		if err := os.Mkdir(d, 0o755); err != nil {
+			release()
+			return "", nil, err
+		}
+	}
+	if err := writeFile(filepath.Join(layer, fsLowerFile), fsLarge, fsBlock, false); err != nil {
+		release()
+		return "", nil, fmt.Errorf("create lower file: %w", err)
+	}
+	data := fmt.Sprintf("lowerdir=%s:%s", layer, rootfs)
+	if err := unix.Mount("overlay", root, "overlay", unix.MS_RDONLY, data); err != nil {
+		release()
+		return "", nil, fmt.Errorf("mount lower layers: %w", err)
+	}
+	return root, release, nil
+}
+
+/**
+ * Creates a sandbox set up in a mode, and waiting to be started.
+ * @param rt the runtime creating the sandbox
+ * @param m the mode
+ * @param opts the run options
+ * @param tracer the tracer recording the setup, if any
+ * @param dir the directory of the start FIFO
+ * @return the sandbox, the path of its start FIFO, or error if any
+ */
+func createFSSandbox(rt *sandbox.Runtime, m fsMode, opts Options, tracer *tracing.Tracer, dir string) (*sandbox.SandboxProcess, string, error) {
+	fifo := filepath.Join(dir, fmt.Sprintf("start-%d", time.Now().UnixNano()))
+	if err := unix.Mkfifo(fifo, 0o600); err != nil {
+		return nil, "", err
+	}
+	p, err := rt.NewSandbox(context.Background(), &sandbox.SandboxOptions{
+		FS:        m.mount,
+		Net:       mnet.NetNone,
+		Storage:   opts.Storage,
+		ReadOnly:  opts.ReadOnly,
+		Commands:  []string{"/bin/true"},
+		StartFifo: fifo,
+		Tracer:    tracer,
+	})
+	if err != nil {
+		return nil, "", err
+	}
+	if !p.WaitSetup() {
+		_, _ = p.Wait()
+		return nil, "", errors.New("sandbox exited during setup")
+	}
+	return p, fifo, nil
+}
+
+/**
+ * Runs the tests of a mode.
+ */
+func runFSMode(rt *sandbox.Runtime, m fsMode, opts Options, filter *regexp.Regexp, w io.Writer) error {
+	dir, err := scratchDir()
+	if err != nil {
+		return err
+	}
+	defer os.RemoveAll(dir)
+
+	// Time the setup of sandboxes, until they wait to be started.
+	if filter.MatchString(m.name + "/setup") {
+		line, err := fsSetup(rt, m, opts, dir)
+		if err != nil {
+			return err
+		}
+		fmt.Fprintf(w, "%-32s %s\n", "fs/"+m.name+"/setup", line)
+	}
+
+	// Run the file tests in a sandbox.
+	p, _, err := createFSSandbox(rt, m, opts, nil, dir)
+	if err != nil {
+		return err
+	}
+	defer func() {
+		_ = p.Kill()
+		_, _ = p.Wait()
+	}()
+	root := fmt.Sprintf("/proc/%d/root", p.Pid())
+
+	for _, t := range fsTests {
+		name := "fs/" + m.name + "/" + t.name
+		if !filter.MatchString(m.name + "/" + t.name) {
+			continue
+		}
+		if t.lowerOnly && m.mount.Mode != fs.FsRootfs {
+			continue
+		}
+		if t.writes && opts.ReadOnly {
+			fmt.Fprintf(w, "%-32s skipped (read-only)\n", name)
+			continue
+		}
+
+		// The copy-up test modifies the file of the lower layer.
+		work := "/" + fsLowerFile
+		if !t.lowerOnly {
+			if err := os.MkdirAll(root+"/var/tmp", 0o1777); err != nil {
+				return err
+			}
+			tmp, err := os.MkdirTemp(root+"/var/tmp", "microbox-bench-")
+			if err != nil {
+				return err
+			}
+			work = strings.TrimPrefix(tmp, root)
+		}
+		line, err := t.run(root + work)
+		if !t.lowerOnly {
+			_ = os.RemoveAll(root + work)
+		}
+		if err != nil {
+			fmt.Fprintf(w, "%-32s error: %v\n", name, err)
+			continue
+		}
+		fmt.Fprintf(w, "%-32s %s\t%s\n", name, line, mountOf(p.Pid(), work))
+	}
+	return nil
+}
+
+/**
+ * Times the setup of sandboxes in a mode: the filesystem phase of the
+ * child, and the whole setup until the sandbox waits to be started.
+ */
+func fsSetup(rt *sandbox.Runtime, m fsMode, opts Options, dir string) (string, error) {
+	var setups, phases []time.Duration
+	var mount string
+	for i := 0; i < fsSetupRuns; i++ {
+		tracer := tracing.New(tracing.FormatChrome)
+		start := time.Now()
+		p, fifo, err := createFSSandbox(rt, m, opts, tracer, dir)
+		if err != nil {
+			return "", err
+		}
+		setups = append(setups, time.Since(start))
+		if mount == "" {
+			mount = mountOf(p.Pid(), "/")
+		}
+
+		// Start the sandbox, so that it ships the timings of its phases.
+		fd, err := unix.Open(fifo, unix.O_WRONLY|unix.O_NONBLOCK|unix.O_CLOEXEC, 0)
+		if err == nil {
+			err = sandbox.SignalChild(fd)
+		}
+		if err != nil {
+			_ = p.Kill()
+		}
+		_, _ = p.Wait()
+		if d, ok := childPhase(tracer, "fs"); ok {
+			phases = append(phases, d)
+		}
+	}
+
+	line := fmt.Sprintf("%10.2f ms/setup", ms(median(setups)))
+	if len(phases) > 0 {
+		line += fmt.Sprintf("\t%10.2f ms/fs-phase", ms(median(phases)))
+	}
+	return line + "\t" + mount, nil
+}
+
+/**
+ * Waits for the timing of a child phase to be recorded, once the child
+ * has closed its trace pipe.
+ */
+func childPhase(tracer *tracing.Tracer, name string) (time.Duration, bool) {
+	for i := 0; i < 100; i++ {
+		for _, s := range tracer.Spans() {
+			if s.Name == name {
+				return s.End.Sub(s.Start), true
+			}
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+	return 0, false
+}
+
+/**
+ * Creates, stats, lists and unlinks empty files.
+ */
+func fsMeta(dir string) (string, error) {
+	names := make([]string, fsFiles)
+	for i := range names {
+		names[i] = filepath.Join(dir, "f"+strconv.Itoa(i))
+	}
+
+	start := time.Now()
+	for _, n := range names {
+		f, err := os.Create(n)
+		if err != nil {
+			return "", err
+		}
+		_ = f.Close()
+	}
+	create := time.Since(start)
+
+	start = time.Now()
+	for _, n := range names {
+		if _, err := os.Stat(n); err != nil {
+			return "", err
+		}
+	}
+	stat := time.Since(start)
+
+	start = time.Now()
+	entries, err := os.ReadDir(dir)
+	if err != nil {
+		return "", err
+	}
+	readdir := time.Since(start)
+
+	start = time.Now()
+	for _, n := range names {
+		if err := os.Remove(n); err != nil {
+			return "", err
+		}
+	}
+	unlink := time.Since(start)
+
+	per := func(d time.Duration, n int) float64 { return float64(d) / float64(time.Microsecond) / float64(n) }
+	return fmt.Sprintf("%8.2f us/create\t%8.2f us/stat\t%8.2f us/readdir-entry\t%8.2f us/unlink",
+		per(create, fsFiles), per(stat, fsFiles), per(readdir, len(entries)), per(unlink, fsFiles)), nil
+}
+
+/**
+ * Writes then reads back small files.
+ */
+func fsSmallFiles(dir string) (string, error) {
+	buf := make([]byte, fsSmall)
+	start := time.Now()
+	for i := 0; i < fsFiles; i++ {
+		if err := os.WriteFile(filepath.Join(dir, "f"+strconv.Itoa(i)), buf, 0o644); err != nil {
+			return "", err
+		}
+	}
+	write := time.Since(start)
+
+	start = time.Now()
+	for i := 0; i < fsFiles; i++ {
+		if _, err := os.ReadFile(filepath.Join(dir, "f"+strconv.Itoa(i))); err != nil {
+			return "", err
+		}
+	}
+	read := time.Since(start)
+
+	return fmt.Sprintf("%10.0f files/s write\t%10.0f files/s read",
+		fsFiles/write.Seconds(), fsFiles/read.Seconds()), nil
+}
+
+/**
+ * Writes sequentially then reads back a large file, evicted from the
+ * page cache in between where the filesystem allows it.
+ */
+func fsLargeFile(dir string) (string, error) {
+	path := filepath.Join(dir, "large")
+	start := time.Now()
+	if err := writeFile(path, fsLarge, fsBlock, true); err != nil {
+		return "", err
+	}
+	write := time.Since(start)
+
+	f, err := os.Open(path)
+	if err != nil {
+		return "", err
+	}
+	defer f.Close()
+	_ = unix.Fadvise(int(f.Fd()), 0, 0, unix.FADV_DONTNEED)
+	buf := make([]byte, fsBlock)
+	start = time.Now()
+	for {
+		_, err := f.Read(buf)
+		if err == io.EOF {
+			break
+		}
+		if err != nil {
+			return "", err
+		}
+	}
+	read := time.Since(start)
+
+	mb := float64(fsLarge) / 1e6
+	return fmt.Sprintf("%10.0f MB/s write\t%10.0f MB/s read", mb/write.Seconds(), mb/read.Seconds()), nil
+}
+
+/**
+ * Modifies a byte of a lower-layer file, copying it up to the upper layer.
+ */
+func fsCopyUp(path string) (string, error) {
+	start := time.Now()
+	f, err := os.OpenFile(path, os.O_WRONLY, 0)
+	if err != nil {
+		return "", err
+	}
+	_, err = f.WriteAt([]byte{1}, 0)
+	if cerr := f.Close(); err == nil {
+		err = cerr
+	}
+	if err != nil {
+		return "", err
+	}
+	d := time.Since(start)
+	return fmt.Sprintf("%10.2f ms/copy-up\t%10.0f MB/s", ms(d), float64(fsLarge)/1e6/d.Seconds()), nil
+}
+
+/**
+ * Writes a file of the given size in blocks.
+ * @param path the file path
+ * @param size the file size
+ * @param block the block size
+ * @param sync whether to sync the file once written
+ * @return error if any
+ */
+func writeFile(path string, size, block int, sync bool) error {
+	f, err := os.Create(path)
+	if err != nil {
+		return err
+	}
+	buf := make([]byte, block)
+	for n := 0; n < size && err == nil; n += block {
+		_, err = f.Write(buf)
+	}
+	if err == nil && sync {
+		err = f.Sync()
+	}
+	if cerr := f.Close(); err == nil {
+		err = cerr
+	}
+	return err
+}
+
+/**
+ * Describes the mount holding a path of a sandbox, with its mount and
+ * superblock options, from the mount table of the sandbox.
+ * @param pid the PID of the sandbox
+ * @param path the path, as seen from the sandbox
+ * @return the description, or `?` if not found
+ */
+func mountOf(pid int, path string) string {
+	f, err := os.Open(fmt.Sprintf("/proc/%d/mountinfo", pid))
+	if err != nil {
+		return "?"
+	}
+	defer f.Close()
+
+	// The last mount on the longest matching mount point is visible.
+	best, desc := -1, "?"
+	sc := bufio.NewScanner(f)
+	for sc.Scan() {
+		pre, post, ok := strings.Cut(sc.Text(), " - ")
+		fields, tail := strings.Fields(pre), strings.Fields(post)
+		if !ok || len(fields) < 6 || len(tail) < 3 {
+			continue
+		}
+		mp := fields[4]
+		if mp != "/" && path != mp && !strings.HasPrefix(path, mp+"/") {
+			continue
+		}
+		if len(mp) >= best {
+			best = len(mp)
+			desc = fmt.Sprintf("%s on %s (%s %s)", tail[0], mp, fields[5], tail[2])
+		}
+	}
+	return desc
+}
+
+/**
+ * @return the median of durations.
+ */
+func median(d []time.Duration) time.Duration {
+	sort.Slice(d, func(i, j int) bool { return d[i] < d[j] })
+	return d[len(d)/2]
+}
+
+/**
+ * @return a duration in milliseconds.
+ */
+func ms(d time.Duration) float64 {
+	return float64(d) / float64(time.Millisecond)
+}
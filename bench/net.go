@@ -0,0 +1,567 @@
+//go:build linux
+
+package bench
+
+import (
+	"bytes"
+	"context"
+	"errors"
+	"fmt"
+	"io"
+	stdnet "net"
+	"os"
+	"os/exec"
+	"regexp"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/HQarroum/microbox/fs"
+	mnet "github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/sandbox"
+)
+
+const (
+	// Size of the writes of the TCP stream test.
+	netChunk = 128 << 10
+
+	// Size of the datagrams of the UDP stream test, within the bridge MTU.
+	netDatagram = 1400
+
+	// Size of the requests and responses of the request/response tests.
+	netMessage = 64
+
+	// Clock ticks per second of /proc/stat.
+	userHZ = 100
+)
+
+/**
+ * Measures the data path of bridged sandboxes: throughput and
+ * request/response latency over TCP and UDP, between sandboxes and
+ * from sandboxes to the host. The sandboxes only hold network
+ * namespaces; their sockets are created by the benchmark after entering
+ * their namespace, so that no traffic generator is needed in the root
+ * filesystem, while the traffic takes the path of sandbox traffic.
+ */
+func init() {
+	harnesses["net"] = runNet
+}
+
+/**
+ * An endpoint of the traffic, a sandbox or the host.
+ */
+type netPeer struct {
+	// Host PID of the sandbox, 0 for the host.
+	pid int
+
+	// Address on the bridge.
+	addr string
+
+	// Sandbox, nil for the host.
+	box *sandbox.Sandbox
+}
+
+/**
+ * A client and the server it sends traffic to.
+ */
+type netPair struct {
+	client, server netPeer
+}
+
+/**
+ * The measures of a test, summed over its pairs.
+ */
+type netResult struct {
+	elapsed time.Duration
+
+	// Bytes received by the servers.
+	bytes uint64
+
+	// Packets transmitted by the clients on their bridged interface.
+	packets uint64
+
+	// Datagrams sent by the clients and received by the servers.
+	sent, received uint64
+
+	// Busy CPU time of the host.
+	cpu time.Duration
+
+	// Round-trip times of the requests, for request/response tests.
+	rr   bool
+	rtts []time.Duration
+}
+
+/**
+ * A traffic test, run on each pair concurrently until the deadline.
+ */
+type netTest struct {
+	name string
+	rr   bool
+	run  func(p netPair, deadline time.Time, r *netResult, mu *sync.Mutex) error
+}
+
+var netTests = []netTest{
+	{"tcp-stream", false, tcpStream},
+	{"udp-stream", false, udpStream},
+	{"tcp-rr", true, tcpRR},
+	{"udp-rr", true, udpRR},
+}
+
+/**
+ * Runs the traffic tests between bridged sandboxes.
+ * @param opts the run options
+ * @param filter selects the tests, as `<path>/<test>`
+ * @param w where to write the results
+ * @return error if any
+ */
+func runNet(opts Options, filter *regexp.Regexp, w io.Writer) error {
+	if os.Geteuid() != 0 {
+		return errors.New("the net benchmarks require root")
+	}
+	duration := opts.Benchtime
+	if duration <= 0 {
+		duration = time.Second
+	}
+	count := opts.Sandboxes
+	if count < 2 {
+		count = 2
+	}
+	sleep, err := exec.LookPath("sleep")
+	if err != nil {
+		return err
+	}
+
+	rt := sandbox.NewRuntime(sandbox.RuntimeOptions{})
+	defer func() {
+		ctx, cancel := context.WithTimeout(context.Background(), 10*time.Second)
+		defer cancel()
+		_ = rt.Close(ctx)
+	}()
+
+	// Sandboxes holding the network namespaces.
+	peers := make([]netPeer, count)
+	for i := range peers {
+		box, err := rt.Create(context.Background(), &sandbox.SandboxOptions{
+			FS:       fs.FsMount{Mode: fs.FsHost},
+			Net:      mnet.NetBridge,
+			Commands: []string{sleep, "infinity"},
+		})
+		if err != nil {
+			return fmt.Errorf("create sandbox: %w", err)
+		}
+		peers[i] = netPeer{pid: box.Pid(), addr: box.Addr(), box: box}
+	}
+
+	// Each sandbox sends to the next one, and to the host.
+	paths := map[string][]netPair{}
+	host := netPeer{addr: mnet.BridgeAddr()}
+	for i, p := range peers {
+		paths["sandbox"] = append(paths["sandbox"], netPair{p, peers[(i+1)%count]})
+		paths["host"] = append(paths["host"], netPair{p, host})
+	}
+
+	for _, path := range []string{"sandbox", "host"} {
+		for _, t := range netTests {
+			if !filter.MatchString(path + "/" + t.name) {
+				continue
+			}
+			name := "net/" + path + "/" + t.name
+			r, err := runNetTest(t, paths[path], duration)
+			if err != nil {
+				fmt.Fprintf(w, "%-32s error: %v\n", name, err)
+				continue
+			}
+			fmt.Fprintf(w, "%-32s %s\n", name, r)
+		}
+	}
+	return nil
+}
+
+/**
+ * Runs a test on pairs concurrently.
+ * @param t the test
+ * @param pairs the pairs
+ * @param duration the duration of the test
+ * @return the measures, or error if any
+ */
+func runNetTest(t netTest, pairs []netPair, duration time.Duration) (*netResult, error) {
+	r := &netResult{rr: t.rr}
+	var (
+		mu   sync.Mutex
+		wg   sync.WaitGroup
+		errs = make(chan error, len(pairs))
+	)
+
+	cpu, err := cpuBusy()
+	if err != nil {
+		return nil, err
+	}
+	packets := txPackets(pairs)
+	start := time.Now()
+	deadline := start.Add(duration)
+
+	for _, p := range pairs {
+		wg.Add(1)
+		go func(p netPair) {
+			defer wg.Done()
+			if err := t.run(p, deadline, r, &mu); err != nil {
+				errs <- err
+			}
+		}(p)
+	}
+	wg.Wait()
+
+	r.elapsed = time.Since(start)
+	r.packets = txPackets(pairs) - packets
+	if busy, err := cpuBusy(); err == nil {
+		r.cpu = busy - cpu
+	}
+	select {
+	case err := <-errs:
+		return nil, err
+	default:
+	}
+	return r, nil
+}
+
+/**
+ * Formats the measures in the format of `go test -bench`.
+ */
+func (r *netResult) String() string {
+	secs := r.elapsed.Seconds()
+	var b strings.Builder
+
+	if r.rr {
+		sort.Slice(r.rtts, func(i, j int) bool { return r.rtts[i] < r.rtts[j] })
+		fmt.Fprintf(&b, "%12.0f req/s", float64(len(r.rtts))/secs)
+		if len(r.rtts) > 0 {
+			us := func(q float64) float64 {
+				return float64(r.rtts[int(q*float64(len(r.rtts)-1))]) / float64(time.Microsecond)
+			}
+			fmt.Fprintf(&b, "\t%10.1f p50-us\t%10.1f p99-us", us(0.50), us(0.99))
+		}
+		return b.String()
+	}
+
+	fmt.Fprintf(&b, "%12.2f Gbit/s\t%12.0f pkt/s", float64(r.bytes)*8/secs/1e9, float64(r.packets)/secs)
+	if r.bytes > 0 {
+		fmt.Fprintf(&b, "\t%8.3f cpu-s/GB", r.cpu.Seconds()/(float64(r.bytes)/1e9))
+	}
+	if r.sent > 0 {
+		fmt.Fprintf(&b, "\t%6.2f %%loss", 100*(1-float64(r.received)/float64(r.sent)))
+	}
+	return b.String()
+}
+
+/**
+ * Runs a function in the network namespace of a peer.
+ */
+func (p netPeer) in(f func() error) error {
+	if p.pid == 0 {
+		return f()
+	}
+	return mnet.RunInNetns(p.pid, f)
+}
+
+/**
+ * Listens on an ephemeral port of the server of a pair.
+ * @param p the pair
+ * @param network `tcp` or `udp`
+ * @return the listener or packet connection, and its address
+ */
+func (p netPair) listen(network string) (io.Closer, string, error) {
+	var (
+		c    io.Closer
+		addr string
+	)
+	err := p.server.in(func() error {
+		hostport := stdnet.JoinHostPort(p.server.addr, "0")
+		if network == "udp" {
+			pc, err := stdnet.ListenPacket("udp", hostport)
+			if err != nil {
+				return err
+			}
+			c, addr = pc, pc.LocalAddr().String()
+			return nil
+		}
+		l, err := stdnet.Listen("tcp", hostport)
+		if err != nil {
+			return err
+		}
+		c, addr = l, l.Addr().String()
+		return nil
+	})
+	return c, addr, err
+}
+
+/**
+ * Connects the client of a pair to an address.
+ */
+func (p netPair) dial(network, addr string) (stdnet.Conn, error) {
+	var conn stdnet.Conn
+	err := p.client.in(func() (err error) {
+		conn, err = stdnet.DialTimeout(network, addr, 5*time.Second)
+		return err
+	})
+	return conn, err
+}
+
+/**
+ * Streams data over TCP until the deadline.
+ */
+func tcpStream(p netPair, deadline time.Time, r *netResult, mu *sync.Mutex) error {
+	c, addr, err := p.listen("tcp")
+	if err != nil {
+		return err
+	}
+	l := c.(stdnet.Listener)
+	defer l.Close()
+
+	var received atomic.Uint64
+	done := make(chan struct{})
+	go func() {
+		defer close(done)
+		conn, err := l.Accept()
+		if err != nil {
+			return
+		}
+		defer conn.Close()
+		buf := make([]byte, netChunk)
+		for {
+			n, err := conn.Read(buf)
+			received.Add(uint64(n))
+			if err != nil {
+				return
+			}
+		}
+	}()
+
+	conn, err := p.dial("tcp", addr)
+	if err != nil {
+		_ = l.Close()
+		<-done
+		return err
+	}
+	chunk := make([]byte, netChunk)
+	_ = conn.SetWriteDeadline(deadline)
+	for time.Now().Before(deadline) {
+		if _, err := conn.Write(chunk); err != nil {
+			break
+		}
+	}
+	_ = conn.Close()
+	<-done
+
+	mu.Lock()
+	r.bytes += received.Load()
+	mu.Unlock()
+	return nil
+}
+
+/**
+ * Streams datagrams over UDP until the deadline, counting the
+ * datagrams received.
+ */
+func udpStream(p netPair, deadline time.Time, r *netResult, mu *sync.Mutex) error {
+	c, addr, err := p.listen("udp")
+	if err != nil {
+		return err
+	}
+	pc := c.(stdnet.PacketConn)
+	defer pc.Close()
+
+	var size, received atomic.Uint64
+	done := make(chan struct{})
+	go func() {
+		defer close(done)
+		buf := make([]byte, netDatagram)
+		_ = pc.SetReadDeadline(deadline.Add(500 * time.Millisecond))
+		for {
+			n, _, err := pc.ReadFrom(buf)
+			if err != nil {
+				return
+			}
+			size.Add(uint64(n))
+			received.Add(1)
+		}
+	}()
+
+	conn, err := p.dial("udp", addr)
+	if err != nil {
+		_ = pc.Close()
+		<-done
+		return err
+	}
+	defer conn.Close()
+	datagram := make([]byte, netDatagram)
+	var sent uint64
+	for time.Now().Before(deadline) {
+		// Writes fail transiently when the socket buffer is full.
+		if _, err := conn.Write(datagram); err == nil {
+			sent++
+		}
+	}
+	<-done
+
+	mu.Lock()
+	r.bytes += size.Load()
+	r.sent += sent
+	r.received += received.Load()
+	mu.Unlock()
+	return nil
+}
+
+/**
+ * Sends requests over TCP until the deadline, each waiting for its
+ * response.
+ */
+func tcpRR(p netPair, deadline time.Time, r *netResult, mu *sync.Mutex) error {
+	c, addr, err := p.listen("tcp")
+	if err != nil {
+		return err
+	}
+	l := c.(stdnet.Listener)
+	defer l.Close()
+
+	go func() {
+		conn, err := l.Accept()
+		if err != nil {
+			return
+		}
+		defer conn.Close()
+		buf := make([]byte, netMessage)
+		for {
+			if _, err := io.ReadFull(conn, buf); err != nil {
+				return
+			}
+			if _, err := conn.Write(buf); err != nil {
+				return
+			}
+		}
+	}()
+
+	conn, err := p.dial("tcp", addr)
+	if err != nil {
+		return err
+	}
+	defer conn.Close()
+	_ = conn.SetDeadline(deadline.Add(time.Second))
+
+	msg := make([]byte, netMessage)
+	var rtts []time.Duration
+	for time.Now().Before(deadline) {
+		start := time.Now()
+		if _, err := conn.Write(msg); err != nil {
+			return err
+		}
+		if _, err := io.ReadFull(conn, msg); err != nil {
+			return err
+		}
+		rtts = append(rtts, time.Since(start))
+	}
+
+	mu.Lock()
+	r.rtts = append(r.rtts, rtts...)
+	mu.Unlock()
+	return nil
+}
+
+/**
+ * Sends requests over UDP until the deadline, each waiting for its
+ * response. Lost requests time out, and are not counted.
+ */
+func udpRR(p netPair, deadline time.Time, r *netResult, mu *sync.Mutex) error {
+	c, addr, err := p.listen("udp")
+	if err != nil {
+		return err
+	}
+	pc := c.(stdnet.PacketConn)
+	defer pc.Close()
+
+	go func() {
+		buf := make([]byte, netMessage)
+		for {
+			n, from, err := pc.ReadFrom(buf)
+			if err != nil {
+				return
+			}
+			_, _ = pc.WriteTo(buf[:n], from)
+		}
+	}()
+
+	conn, err := p.dial("udp", addr)
+	if err != nil {
+		return err
+	}
+	defer conn.Close()
+
+	msg := make([]byte, netMessage)
+	var rtts []time.Duration
+	for time.Now().Before(deadline) {
+		start := time.Now()
+		if _, err := conn.Write(msg); err != nil {
+			continue
+		}
+		_ = conn.SetReadDeadline(start.Add(100 * time.Millisecond))
+		if _, err := conn.Read(msg); err != nil {
+			continue
+		}
+		rtts = append(rtts, time.Since(start))
+	}
+
+	mu.Lock()
+	r.rtts = append(r.rtts, rtts...)
+	mu.Unlock()
+	return nil
+}
+
+/**
+ * Sums the packets transmitted by the clients of pairs on their
+ * bridged interface.
+ */
+func txPackets(pairs []netPair) uint64 {
+	var total uint64
+	for _, p := range pairs {
+		if p.client.box == nil {
+			continue
+		}
+		if st, err := p.client.box.Stats(); err == nil {
+			total += st.TxPackets
+		}
+	}
+	return total
+}
+
+/**
+ * Reads the busy CPU time of the host, across all CPUs, including the
+ * time spent in interrupts where most of the data path runs.
+ * @return the busy time since boot, or error if any
+ */
+func cpuBusy() (time.Duration, error) {
+	b, err := os.ReadFile("/proc/stat")
+	if err != nil {
+		return 0, err
+	}
+	line, _, _ := bytes.Cut(b, []byte("\n"))
+	fields := strings.Fields(string(line))
+	if len(fields) < 9 || fields[0] != "cpu" {
+		return 0, fmt.Errorf("bad /proc/stat")
+	}
+
+	// user nice system idle iowait irq softirq steal; guest time is
+	// accounted in user time.
+	var busy uint64
+	for i, f := range fields[1:9] {
+		v, err := strconv.ParseUint(f, 10, 64)
+		if err != nil {
+			return 0, fmt.Errorf("bad /proc/stat: %w", err)
+		}
+		if i != 3 && i != 4 {
+			busy += v
+		}
+	}
+	return time.Duration(busy) * time.Second / userHZ, nil
+}
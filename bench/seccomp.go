@@ -0,0 +1,312 @@
+//go:build linux
+
+package bench
+
+import (
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"io"
+	"log/slog"
+	"os"
+	"regexp"
+	"runtime"
+	"slices"
+	"time"
+	"unsafe"
+
+	"github.com/HQarroum/microbox/fs"
+	mnet "github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/sandbox"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// Environment variable holding the control descriptor of the probe.
+	seccompProbeEnv = "MICROBOX_SECCOMP_PROBE"
+
+	// Iterations of each system call per repeat, and repeats, of which the fastest counts.
+	seccompIterations = 1 << 18
+	seccompRepeats    = 5
+
+	// Maximum time for the probe to measure all the filters.
+	seccompProbeTimeout = 5 * time.Minute
+
+	// FUTEX_WAKE | FUTEX_PRIVATE_FLAG.
+	futexWakePrivate = 1 | 128
+)
+
+/**
+ * System calls measured by the probe.
+ */
+var probeSyscalls = []string{"getpid", "read", "futex", "epoll_pwait"}
+
+/**
+ * System calls left allowed by the large deny list: those of the probe
+ * and of the Go runtime on the thread of the probe.
+ */
+var probeKeep = []string{
+	"getpid", "gettid", "read", "write", "futex", "epoll_pwait", "epoll_wait",
+	"mmap", "munmap", "madvise", "mprotect", "brk", "rt_sigaction",
+	"rt_sigprocmask", "rt_sigreturn", "sigaltstack", "tgkill", "clone", "clone3",
+	"sched_yield", "nanosleep", "clock_gettime", "clock_nanosleep", "exit",
+	"exit_group", "close", "prctl", "seccomp",
+}
+
+/**
+ * Measures the overhead of seccomp filters on system calls. A probe,
+ * the microbox binary itself, runs in a sandbox and times a set of
+ * system calls on threads with no additional filter, then with each
+ * filter loaded, so that the added latency of a filter is measured on
+ * the path of the system calls of sandboxed workloads.
+ */
+func init() {
+	harnesses["seccomp"] = runSeccomp
+}
+
+/**
+ * A seccomp filter measured by the probe.
+ */
+type seccompFilter struct {
+	Name string            `json:"name"`
+	Prog []unix.SockFilter `json:"prog"`
+}
+
+/**
+ * Timings of the system calls under a filter, in nanoseconds, in the
+ * order of probeSyscalls.
+ */
+type seccompTimings struct {
+	Name string    `json:"name"`
+	Ns   []float64 `json:"ns"`
+}
+
+/**
+ * Compiles the filters to compare: the default deny list of sandboxes,
+ * an allow-list of all the other system calls, and a large deny list
+ * of all the system calls unused by the probe.
+ * @return the filters, or error if any
+ */
+func seccompFilters() ([]seccompFilter, error) {
+	deny := sandbox.DefaultDenySyscalls()
+	known := sandbox.KnownSyscalls()
+
+	var allow, large []string
+	for _, s := range known {
+		if !slices.Contains(deny, s) {
+			allow = append(allow, s)
+		}
+		if !slices.Contains(probeKeep, s) {
+			large = append(large, s)
+		}
+	}
+
+	def, err := sandbox.CompileSeccomp(&sandbox.SandboxOptions{})
+	if err != nil {
+		return nil, err
+	}
+	allowList, err := sandbox.CompileAllowList(allow)
+	if err != nil {
+		return nil, err
+	}
+	largeDeny, err := sandbox.CompileSeccomp(&sandbox.SandboxOptions{DenySys: large})
+	if err != nil {
+		return nil, err
+	}
+	return []seccompFilter{
+		{Name: "none"},
+		{Name: "default", Prog: def},
+		{Name: fmt.Sprintf("allow-%d", len(allow)), Prog: allowList},
+		{Name: fmt.Sprintf("deny-%d", len(large)), Prog: largeDeny},
+	}, nil
+}
+
+/**
+ * Runs the probe in a sandbox, and reports the latency of each system
+ * call under each filter, and the latency added to no filter.
+ * @param opts the run options
+ * @param filter selects the results, as `<filter>/<syscall>`
+ * @param w where to write the results
+ * @return error if any
+ */
+func runSeccomp(opts Options, filter *regexp.Regexp, w io.Writer) error {
+	if os.Geteuid() != 0 {
+		return errors.New("the seccomp benchmarks require root")
+	}
+	exe, err := os.Executable()
+	if err != nil {
+		return err
+	}
+	filters, err := seccompFilters()
+	if err != nil {
+		return err
+	}
+	fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_STREAM|unix.SOCK_CLOEXEC, 0)
+	if err != nil {
+		return fmt.Errorf("socketpair: %w", err)
+	}
+	conn := os.NewFile(uintptr(fds[0]), "seccomp-probe")
+	defer conn.Close()
+
+	// The sandbox installs a filter without rules, the probe stacks the
+	// measured filters on top of it.
+	rt := sandbox.NewRuntime(sandbox.RuntimeOptions{
+		Logger: slog.New(slog.NewTextHandler(io.Discard, nil)),
+	})
+	defer func() {
+		ctx, cancel := context.WithTimeout(context.Background(), 10*time.Second)
+		defer cancel()
+		_ = rt.Close(ctx)
+	}()
+	box, err := rt.Create(context.Background(), &sandbox.SandboxOptions{
+		FS:         fs.FsMount{Mode: fs.FsHost},
+		Net:        mnet.NetNone,
+		AllowSys:   sandbox.DefaultDenySyscalls(),
+		Commands:   []string{exe},
+		Env:        sandbox.EnvVars{{Key: seccompProbeEnv, Val: "3"}},
+		InheritFds: []int{fds[1]},
+	})
+	_ = unix.Close(fds[1])
+	if err != nil {
+		return fmt.Errorf("create sandbox: %w", err)
+	}
+
+	// Send the filters, and read the timings until the probe exits.
+	timer := time.AfterFunc(seccompProbeTimeout, func() { _ = box.Kill() })
+	defer timer.Stop()
+	if err := json.NewEncoder(conn).Encode(filters); err != nil {
+		return fmt.Errorf("send filters: %w", err)
+	}
+	_ = unix.Shutdown(fds[0], unix.SHUT_WR)
+	var timings []seccompTimings
+	if err := json.NewDecoder(conn).Decode(&timings); err != nil {
+		code, _ := box.Wait(context.Background())
+		return fmt.Errorf("seccomp probe exited with code %d: %w", code, err)
+	}
+
+	base := timings[0].Ns
+	for i, t := range timings {
+		for j, name := range probeSyscalls {
+			if !filter.MatchString(t.Name + "/" + name) {
+				continue
+			}
+			fmt.Fprintf(w, "%-40s %10.1f ns/op\t%+10.1f ns/op-added\t%6d insns\n",
+				"seccomp/"+t.Name+"/"+name, t.Ns[j], t.Ns[j]-base[j], len(filters[i].Prog))
+		}
+	}
+	return nil
+}
+
+/**
+ * @return whether the process is the seccomp probe, started by the benchmarks in a sandbox.
+ */
+func IsSeccompProbe() bool {
+	return os.Getenv(seccompProbeEnv) != ""
+}
+
+/**
+ * Runs the seccomp probe: reads the filters from the control
+ * descriptor, times the system calls under each, and writes back the
+ * timings.
+ * @return error if any
+ */
+func RunSeccompProbe() error {
+	conn := os.NewFile(3, "seccomp-probe")
+	defer conn.Close()
+
+	var filters []seccompFilter
+	if err := json.NewDecoder(conn).Decode(&filters); err != nil {
+		return fmt.Errorf("read filters: %w", err)
+	}
+	timings := make([]seccompTimings, 0, len(filters))
+	for _, f := range filters {
+		ns, err := probeThread(f.Prog)
+		if err != nil {
+			return fmt.Errorf("filter %s: %w", f.Name, err)
+		}
+		timings = append(timings, seccompTimings{Name: f.Name, Ns: ns})
+	}
+	return json.NewEncoder(conn).Encode(timings)
+}
+
+/**
+ * Times the system calls on a new thread, with a filter loaded on that
+ * thread only. The goroutine exits locked to the thread, so that the
+ * thread and its filter are destroyed with it.
+ * @param prog the filter, none if empty
+ * @return the timings in nanoseconds, or error if any
+ */
+func probeThread(prog []unix.SockFilter) ([]float64, error) {
+	type result struct {
+		ns  []float64
+		err error
+	}
+	done := make(chan result, 1)
+	go func() {
+		runtime.LockOSThread()
+
+		// The descriptors are opened before the filter is loaded, as the
+		// large deny list denies openat and epoll_create1.
+		zero, err := unix.Open("/dev/zero", unix.O_RDONLY|unix.O_CLOEXEC, 0)
+		if err != nil {
+			done <- result{err: err}
+			return
+		}
+		defer unix.Close(zero)
+		epfd, err := unix.EpollCreate1(unix.EPOLL_CLOEXEC)
+		if err != nil {
+			done <- result{err: err}
+			return
+		}
+		defer unix.Close(epfd)
+
+		if len(prog) > 0 {
+			if err := sandbox.LoadSeccomp(prog); err != nil {
+				done <- result{err: err}
+				return
+			}
+		}
+		done <- result{ns: timeSyscalls(zero, epfd)}
+	}()
+	r := <-done
+	return r.ns, r.err
+}
+
+/**
+ * Times each probed system call, as the fastest of several repeats.
+ * @param zero a descriptor of /dev/zero
+ * @param epfd an epoll descriptor with no registered file
+ * @return the timings in nanoseconds
+ */
+func timeSyscalls(zero, epfd int) []float64 {
+	var (
+		buf    [64]byte
+		word   uint32
+		events [1]unix.EpollEvent
+	)
+	calls := []func(){
+		func() { unix.RawSyscall(unix.SYS_GETPID, 0, 0, 0) },
+		func() {
+			unix.RawSyscall(unix.SYS_READ, uintptr(zero), uintptr(unsafe.Pointer(&buf[0])), uintptr(len(buf)))
+		},
+		func() { unix.RawSyscall(unix.SYS_FUTEX, uintptr(unsafe.Pointer(&word)), futexWakePrivate, 1) },
+		func() {
+			unix.RawSyscall6(unix.SYS_EPOLL_PWAIT, uintptr(epfd), uintptr(unsafe.Pointer(&events[0])), 1, 0, 0, 0)
+		},
+	}
+
+	ns := make([]float64, len(calls))
+	for i, call := range calls {
+		best := time.Duration(1<<63 - 1)
+		for r := 0; r < seccompRepeats; r++ {
+			start := time.Now()
+			for n := 0; n < seccompIterations; n++ {
+				call()
+			}
+			best = min(best, time.Since(start))
+		}
+		ns[i] = float64(best) / seccompIterations
+	}
+	return ns
+}
@@ -0,0 +1,366 @@
+//go:build linux
+
+package bench
+
+import (
+	"bufio"
+	"context"
+	"errors"
+	"fmt"
+	"io"
+	"log/slog"
+	"os"
+	"os/exec"
+	"regexp"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/HQarroum/microbox/fs"
+	mnet "github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/sandbox"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// Number of population steps reported up to the target.
+	stressSteps = 10
+
+	// Default number of concurrent creations.
+	stressConcurrency = 8
+)
+
+/**
+ * Ramps concurrent sandboxes up to a target population, reporting at
+ * each step the spawn latency and the kernel and supervisor memory per
+ * sandbox, and stops at the first failure, so that the capacity of a
+ * host is measured by the population reached and what limited it.
+ */
+func init() {
+	harnesses["stress"] = runStress
+}
+
+/**
+ * Memory counters of the host and of the supervisor, in bytes.
+ */
+type stressMem struct {
+	// Slab caches, and the caches of network namespaces and mounts.
+	slab, netns, mount uint64
+
+	// Per-CPU allocations, dominated by the memory cgroups.
+	percpu uint64
+
+	// Resident memory of the supervisor.
+	rss uint64
+}
+
+/**
+ * State of a ramp, shared by the creating goroutines.
+ */
+type stressRamp struct {
+	rt   *sandbox.Runtime
+	opts *sandbox.SandboxOptions
+
+	mu    sync.Mutex
+	boxes int
+
+	// Spawn latencies of the current step.
+	latencies []time.Duration
+
+	// First failure, and the population it happened at.
+	failure  error
+	failedAt int
+
+	// Whether the sandboxes are being torn down.
+	closing bool
+}
+
+/**
+ * Ramps sandboxes up to the target population.
+ * @param opts the run options
+ * @param filter unused, the ramp is a single measure
+ * @param w where to write the results
+ * @return error if any
+ */
+func runStress(opts Options, filter *regexp.Regexp, w io.Writer) error {
+	if os.Geteuid() != 0 {
+		return errors.New("the stress benchmarks require root")
+	}
+	target := opts.Sandboxes
+	if target < 1 {
+		target = 1
+	}
+	concurrency := opts.Concurrency
+	if concurrency < 1 {
+		concurrency = stressConcurrency
+	}
+	command := opts.Command
+	if len(command) == 0 {
+		sleep, err := exec.LookPath("sleep")
+		if err != nil {
+			return err
+		}
+		command = []string{sleep, "infinity"}
+	}
+
+	rt := sandbox.NewRuntime(sandbox.RuntimeOptions{
+		Logger: slog.New(slog.NewTextHandler(io.Discard, nil)),
+	})
+	r := &stressRamp{
+		rt: rt,
+		opts: &sandbox.SandboxOptions{
+			FS:       fs.FsMount{Mode: fs.FsHost},
+			Net:      opts.Net,
+			Commands: command,
+		},
+	}
+	defer func() {
+		r.mu.Lock()
+		r.closing = true
+		r.mu.Unlock()
+		ctx, cancel := context.WithTimeout(context.Background(), 5*time.Minute)
+		defer cancel()
+		_ = rt.Close(ctx)
+	}()
+
+	base, err := readStressMem()
+	if err != nil {
+		return err
+	}
+	step := (target + stressSteps - 1) / stressSteps
+	for pop := 0; pop < target; {
+		r.fill(min(pop+step, target), concurrency)
+
+		r.mu.Lock()
+		var lat []time.Duration
+		var failure error
+		pop, lat, failure = r.boxes, r.latencies, r.failure
+		r.latencies = nil
+		r.mu.Unlock()
+
+		mem, err := readStressMem()
+		if err != nil {
+			return err
+		}
+		if pop > 0 && len(lat) > 0 {
+			fmt.Fprintf(w, "%-32s %s\t%s\n", fmt.Sprintf("stress/pop=%d", pop), spawnLatency(lat), mem.perBox(base, pop))
+		}
+		if failure != nil {
+			break
+		}
+	}
+
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	fmt.Fprintf(w, "%-32s %d sandboxes\n", "stress/capacity", r.boxes)
+	if r.failure != nil {
+		fmt.Fprintf(w, "%-32s at %d sandboxes: %s: %v\n", "stress/failure", r.failedAt, classifyFailure(r.failure), r.failure)
+	}
+	return nil
+}
+
+/**
+ * Creates sandboxes concurrently until the population reaches a count,
+ * or a creation fails.
+ * @param count the population to reach
+ * @param concurrency the number of concurrent creations
+ */
+func (r *stressRamp) fill(count, concurrency int) {
+	var wg sync.WaitGroup
+	for g := 0; g < concurrency; g++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for r.claim(count) {
+				start := time.Now()
+				box, err := r.rt.Create(context.Background(), r.opts)
+				r.created(box, time.Since(start), err)
+			}
+		}()
+	}
+	wg.Wait()
+}
+
+/**
+ * Claims the creation of a sandbox.
+ * @param count the population to reach
+ * @return whether a sandbox is to be created
+ */
+func (r *stressRamp) claim(count int) bool {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	if r.failure != nil || r.boxes >= count {
+		return false
+	}
+	r.boxes++
+	return true
+}
+
+/**
+ * Records the creation of a sandbox, and watches for its exit, which
+ * counts as a failure until the sandboxes are torn down.
+ */
+func (r *stressRamp) created(box *sandbox.Sandbox, latency time.Duration, err error) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	if err != nil {
+		r.boxes--
+		r.fail(err)
+		return
+	}
+	r.latencies = append(r.latencies, latency)
+	go func() {
+		code, err := box.Wait(context.Background())
+		r.mu.Lock()
+		defer r.mu.Unlock()
+		r.boxes--
+		if !r.closing {
+			if err == nil {
+				err = fmt.Errorf("sandbox %s exited with code %d", box.ID(), code)
+			}
+			r.fail(err)
+		}
+	}()
+}
+
+/**
+ * Records the first failure. The lock must be held.
+ */
+func (r *stressRamp) fail(err error) {
+	if r.failure == nil {
+		r.failure, r.failedAt = err, r.boxes
+	}
+}
+
+/**
+ * Names the limit a sandbox creation ran into.
+ * @param err the error of the creation
+ * @return the name of the limit
+ */
+func classifyFailure(err error) string {
+	msg := err.Error()
+	switch {
+	case errors.Is(err, mnet.ErrIpamExhausted):
+		return "ipam-exhausted"
+	case errors.Is(err, mnet.ErrIpamLockTimeout):
+		return "ipam-lock-timeout"
+	case strings.Contains(msg, "veth"):
+		return "veth"
+	case strings.Contains(msg, "cgroup"), strings.Contains(msg, "controllers"):
+		return "cgroup"
+	case errors.Is(err, unix.EAGAIN):
+		return "pid-limit"
+	case errors.Is(err, unix.ENOSPC):
+		return "namespace-limit"
+	case errors.Is(err, unix.ENOMEM):
+		return "memory"
+	case errors.Is(err, unix.EMFILE), errors.Is(err, unix.ENFILE):
+		return "fd-limit"
+	case strings.Contains(msg, "exited"):
+		return "sandbox-exit"
+	}
+	return "other"
+}
+
+/**
+ * @return the p50 and p99 of spawn latencies.
+ */
+func spawnLatency(lat []time.Duration) string {
+	sort.Slice(lat, func(i, j int) bool { return lat[i] < lat[j] })
+	q := func(p float64) float64 { return ms(lat[int(p*float64(len(lat)-1))]) }
+	return fmt.Sprintf("%8.2f p50-ms\t%8.2f p99-ms", q(0.50), q(0.99))
+}
+
+/**
+ * Formats the memory grown since a baseline, per sandbox.
+ * @param base the baseline
+ * @param boxes the population
+ * @return the memory per sandbox, in KiB
+ */
+func (m stressMem) perBox(base stressMem, boxes int) string {
+	kib := func(now, before uint64) float64 {
+		if now < before {
+			return 0
+		}
+		return float64(now-before) / 1024 / float64(boxes)
+	}
+	return fmt.Sprintf("%8.1f slab-KiB/box\t%8.1f netns-KiB/box\t%8.1f mount-KiB/box\t%8.1f percpu-KiB/box\t%8.1f rss-KiB/box",
+		kib(m.slab, base.slab), kib(m.netns, base.netns), kib(m.mount, base.mount),
+		kib(m.percpu, base.percpu), kib(m.rss, base.rss))
+}
+
+/**
+ * Reads the memory counters. The caches of network namespaces and
+ * mounts are zero if merged with other caches by the kernel.
+ * @return the counters, or error if any
+ */
+func readStressMem() (stressMem, error) {
+	var m stressMem
+	meminfo, err := readKiB("/proc/meminfo", "Slab:", "Percpu:")
+	if err != nil {
+		return m, err
+	}
+	m.slab, m.percpu = meminfo[0], meminfo[1]
+	status, err := readKiB("/proc/self/status", "VmRSS:")
+	if err != nil {
+		return m, err
+	}
+	m.rss = status[0]
+	m.netns, m.mount = slabBytes("net_namespace"), slabBytes("mnt_cache")
+	return m, nil
+}
+
+/**
+ * Reads fields in KiB of a file of the proc filesystem.
+ * @param path the file path
+ * @param keys the field names, with their colon
+ * @return the field values in bytes, zero for missing fields, or error if any
+ */
+func readKiB(path string, keys ...string) ([]uint64, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	out := make([]uint64, len(keys))
+	sc := bufio.NewScanner(f)
+	for sc.Scan() {
+		fields := strings.Fields(sc.Text())
+		if len(fields) < 2 {
+			continue
+		}
+		for i, k := range keys {
+			if fields[0] == k {
+				v, _ := strconv.ParseUint(fields[1], 10, 64)
+				out[i] = v << 10
+			}
+		}
+	}
+	return out, sc.Err()
+}
+
+/**
+ * @return the bytes of the objects of a slab cache, zero if not found.
+ */
+func slabBytes(cache string) uint64 {
+	f, err := os.Open("/proc/slabinfo")
+	if err != nil {
+		return 0
+	}
+	defer f.Close()
+
+	// name <active_objs> <num_objs> <objsize> ...
+	sc := bufio.NewScanner(f)
+	for sc.Scan() {
+		fields := strings.Fields(sc.Text())
+		if len(fields) < 4 || fields[0] != cache {
+			continue
+		}
+		objs, _ := strconv.ParseUint(fields[1], 10, 64)
+		size, _ := strconv.ParseUint(fields[3], 10, 64)
+		return objs * size
+	}
+	return 0
+}
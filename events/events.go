@@ -0,0 +1,251 @@
+//go:build linux
+
+package events
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"io"
+	stdnet "net"
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// Maximum number of events pending delivery.
+	queueSize = 4096
+
+	// Maximum time to deliver an event to a socket client.
+	writeTimeout = time.Second
+)
+
+/**
+ * Lifecycle event types.
+ */
+const (
+	Created      = "created"
+	NetworkReady = "network-ready"
+	Execd        = "execd"
+	Failed       = "failed"
+	OOM          = "oom"
+	Paused       = "paused"
+	Resumed      = "resumed"
+	Exited       = "exited"
+	CleanedUp    = "cleanup-complete"
+)
+
+/**
+ * A sandbox lifecycle event.
+ */
+type Event struct {
+	// Sequence number of the event. Gaps denote dropped events.
+	Seq uint64 `json:"seq"`
+
+	// Event type.
+	Type string `json:"type"`
+
+	// Sandbox identifier.
+	ID string `json:"id"`
+
+	// Monotonic (CLOCK_MONOTONIC) timestamp in nanoseconds.
+	Monotonic int64 `json:"monotonic_ns"`
+
+	// Wall-clock timestamp.
+	Time time.Time `json:"time"`
+
+	// Host PID of the sandbox init process.
+	Pid int `json:"pid,omitempty"`
+
+	// Address of the sandbox (network-ready).
+	IP string `json:"ip,omitempty"`
+
+	// Exit code (exited).
+	Code *int `json:"code,omitempty"`
+
+	// Number of OOM kills so far (oom).
+	Count uint64 `json:"count,omitempty"`
+
+	// Error description (failed).
+	Error string `json:"error,omitempty"`
+
+	// Performance counter totals and instructions per cycle (exited).
+	Counters map[string]uint64 `json:"counters,omitempty"`
+	IPC      float64           `json:"ipc,omitempty"`
+}
+
+/**
+ * An ordered stream of lifecycle events, delivered as newline-delimited
+ * JSON to a file descriptor or to the clients of a Unix socket. Events
+ * are queued and delivered in the background, so that publishing never
+ * blocks; they are dropped when the queue is full.
+ */
+type Stream struct {
+	// Sequence counter, and lock ordering sequence numbers in the queue.
+	mu     sync.Mutex
+	seq    uint64
+	closed bool
+
+	queue chan []byte
+
+	// Number of dropped events.
+	dropped atomic.Uint64
+
+	// Output file, if any.
+	out io.Writer
+
+	// Socket listener and clients, if any.
+	listener stdnet.Listener
+	cmu      sync.Mutex
+	clients  map[stdnet.Conn]struct{}
+	path     string
+
+	done chan struct{}
+}
+
+/**
+ * Opens an event stream.
+ * @param addr `fd:N` for a file descriptor, or `unix:PATH` for a Unix socket
+ * @return the stream, or error if any
+ */
+func Open(addr string) (*Stream, error) {
+	s := &Stream{
+		queue:   make(chan []byte, queueSize),
+		clients: make(map[stdnet.Conn]struct{}),
+		done:    make(chan struct{}),
+	}
+
+	switch {
+	case strings.HasPrefix(addr, "fd:"):
+		fd, err := strconv.Atoi(strings.TrimPrefix(addr, "fd:"))
+		if err != nil || fd < 0 {
+			return nil, fmt.Errorf("bad event stream address %q", addr)
+		}
+		if fd > 2 {
+			unix.CloseOnExec(fd)
+		}
+		s.out = os.NewFile(uintptr(fd), addr)
+	case strings.HasPrefix(addr, "unix:"):
+		s.path = strings.TrimPrefix(addr, "unix:")
+		if err := os.Remove(s.path); err != nil && !errors.Is(err, os.ErrNotExist) {
+			return nil, err
+		}
+		l, err := stdnet.Listen("unix", s.path)
+		if err != nil {
+			return nil, fmt.Errorf("listen on %s: %w", s.path, err)
+		}
+		s.listener = l
+		go s.accept()
+	default:
+		return nil, fmt.Errorf("bad event stream address %q (fd:N|unix:PATH)", addr)
+	}
+
+	go s.run()
+	return s, nil
+}
+
+/**
+ * Publishes an event. Safe to call on a nil stream.
+ * @param ev the event, whose sequence number and timestamps are set
+ */
+func (s *Stream) Publish(ev Event) {
+	if s == nil {
+		return
+	}
+	var ts unix.Timespec
+	_ = unix.ClockGettime(unix.CLOCK_MONOTONIC, &ts)
+	ev.Monotonic = ts.Nano()
+	ev.Time = time.Now()
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if s.closed {
+		return
+	}
+	s.seq++
+	ev.Seq = s.seq
+
+	b, err := json.Marshal(&ev)
+	if err != nil {
+		return
+	}
+	select {
+	case s.queue <- append(b, '\n'):
+	default:
+		s.dropped.Add(1)
+	}
+}
+
+/**
+ * Delivers queued events.
+ */
+func (s *Stream) run() {
+	defer close(s.done)
+	for b := range s.queue {
+		if s.out != nil {
+			_, _ = s.out.Write(b)
+			continue
+		}
+		s.cmu.Lock()
+		for c := range s.clients {
+			_ = c.SetWriteDeadline(time.Now().Add(writeTimeout))
+			if _, err := c.Write(b); err != nil {
+				// Disconnect clients which do not keep up.
+				_ = c.Close()
+				delete(s.clients, c)
+			}
+		}
+		s.cmu.Unlock()
+	}
+}
+
+/**
+ * Accepts socket clients, which receive the events published from then on.
+ */
+func (s *Stream) accept() {
+	for {
+		c, err := s.listener.Accept()
+		if err != nil {
+			return
+		}
+		s.cmu.Lock()
+		s.clients[c] = struct{}{}
+		s.cmu.Unlock()
+	}
+}
+
+/**
+ * Delivers pending events and closes the stream.
+ * @return the number of dropped events
+ */
+func (s *Stream) Close() uint64 {
+	if s == nil {
+		return 0
+	}
+	s.mu.Lock()
+	if s.closed {
+		s.mu.Unlock()
+		return s.dropped.Load()
+	}
+	s.closed = true
+	close(s.queue)
+	s.mu.Unlock()
+	<-s.done
+
+	if s.listener != nil {
+		_ = s.listener.Close()
+		_ = os.Remove(s.path)
+		s.cmu.Lock()
+		for c := range s.clients {
+			_ = c.Close()
+		}
+		s.cmu.Unlock()
+	}
+	return s.dropped.Load()
+}
@@ -0,0 +1,289 @@
+//go:build linux
+
+package fakes
+
+import (
+	"cmp"
+	"fmt"
+	iofs "io/fs"
+	"path/filepath"
+	"slices"
+	"strconv"
+	"strings"
+	"sync"
+	"syscall"
+)
+
+/**
+ * An in-memory cgroup tree, implementing the cgroup filesystem operated
+ * on by sandboxes. It enforces the rules the cgroup bookkeeping of
+ * sandboxes depends on: cgroups must be empty to be removed, processes
+ * belong to a single cgroup, and controllers cannot be enabled for the
+ * children of a cgroup holding processes.
+ */
+type CgroupTree struct {
+	mu sync.Mutex
+
+	// Cgroups by path.
+	nodes map[string]*cgroupNode
+
+	// Cgroup of each process.
+	procs map[int]string
+
+	// Root of the tree.
+	root string
+}
+
+/**
+ * A cgroup of the tree.
+ */
+type cgroupNode struct {
+	// Control files, other than the process list.
+	files map[string]string
+
+	// Processes of the cgroup, and names of its children.
+	procs    map[int]struct{}
+	children map[string]struct{}
+
+	// Controllers enabled for the children of the cgroup.
+	subtree map[string]struct{}
+}
+
+/**
+ * Control files of a new cgroup, with their initial content.
+ */
+var cgroupFiles = map[string]string{
+	"cpu.max":         "max 100000\n",
+	"cpu.stat":        "usage_usec 0\nuser_usec 0\nsystem_usec 0\n",
+	"memory.max":      "max\n",
+	"memory.swap.max": "max\n",
+	"memory.current":  "0\n",
+	"memory.events":   "low 0\nhigh 0\nmax 0\noom 0\noom_kill 0\n",
+	"cgroup.freeze":   "0\n",
+}
+
+/**
+ * Creates a cgroup tree.
+ * @param root the path of the root cgroup, such as `/sys/fs/cgroup`
+ * @return the cgroup tree
+ */
+func NewCgroupTree(root string) *CgroupTree {
+	t := &CgroupTree{
+		nodes: make(map[string]*cgroupNode),
+		procs: make(map[int]string),
+		root:  filepath.Clean(root),
+	}
+	t.nodes[t.root] = newCgroupNode()
+	return t
+}
+
+/**
+ * @return a cgroup with the initial control files.
+ */
+func newCgroupNode() *cgroupNode {
+	n := &cgroupNode{
+		files:    make(map[string]string, len(cgroupFiles)),
+		procs:    make(map[int]struct{}),
+		children: make(map[string]struct{}),
+		subtree:  make(map[string]struct{}),
+	}
+	for k, v := range cgroupFiles {
+		n.files[k] = v
+	}
+	return n
+}
+
+/**
+ * @return the number of cgroups in the tree, including the root.
+ */
+func (t *CgroupTree) Len() int {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+	return len(t.nodes)
+}
+
+func (t *CgroupTree) Mkdir(path string) error {
+	path = filepath.Clean(path)
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	if _, ok := t.nodes[path]; ok {
+		return &iofs.PathError{Op: "mkdir", Path: path, Err: syscall.EEXIST}
+	}
+	parent, ok := t.nodes[filepath.Dir(path)]
+	if !ok {
+		return &iofs.PathError{Op: "mkdir", Path: path, Err: syscall.ENOENT}
+	}
+	parent.children[filepath.Base(path)] = struct{}{}
+	t.nodes[path] = newCgroupNode()
+	return nil
+}
+
+func (t *CgroupTree) Remove(path string) error {
+	path = filepath.Clean(path)
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	n, ok := t.nodes[path]
+	if !ok || path == t.root {
+		return &iofs.PathError{Op: "remove", Path: path, Err: syscall.ENOENT}
+	}
+	if len(n.procs) > 0 || len(n.children) > 0 {
+		return &iofs.PathError{Op: "remove", Path: path, Err: syscall.EBUSY}
+	}
+	delete(t.nodes[filepath.Dir(path)].children, filepath.Base(path))
+	delete(t.nodes, path)
+	return nil
+}
+
+func (t *CgroupTree) ReadFile(path string) ([]byte, error) {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	n, name, err := t.file("open", path)
+	if err != nil {
+		return nil, err
+	}
+	switch name {
+	case "cgroup.procs":
+		var b strings.Builder
+		for _, pid := range sortedKeys(n.procs) {
+			fmt.Fprintf(&b, "%d\n", pid)
+		}
+		return []byte(b.String()), nil
+	case "cgroup.subtree_control":
+		return []byte(strings.Join(sortedKeys(n.subtree), " ") + "\n"), nil
+	case "cgroup.events":
+		populated, frozen := 0, 0
+		if t.populated(filepath.Clean(filepath.Dir(path))) {
+			populated = 1
+		}
+		if strings.TrimSpace(n.files["cgroup.freeze"]) == "1" {
+			frozen = 1
+		}
+		return []byte(fmt.Sprintf("populated %d\nfrozen %d\n", populated, frozen)), nil
+	}
+	v, ok := n.files[name]
+	if !ok {
+		return nil, &iofs.PathError{Op: "open", Path: path, Err: syscall.ENOENT}
+	}
+	return []byte(v), nil
+}
+
+func (t *CgroupTree) WriteFile(path string, data []byte) error {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	n, name, err := t.file("write", path)
+	if err != nil {
+		return err
+	}
+	dir := filepath.Clean(filepath.Dir(path))
+	value := strings.TrimSpace(string(data))
+	invalid := &iofs.PathError{Op: "write", Path: path, Err: syscall.EINVAL}
+
+	switch name {
+	// Moves a process from its cgroup.
+	case "cgroup.procs":
+		pid, err := strconv.Atoi(value)
+		if err != nil || pid <= 0 {
+			return invalid
+		}
+		if prev, ok := t.procs[pid]; ok {
+			delete(t.nodes[prev].procs, pid)
+		}
+		n.procs[pid] = struct{}{}
+		t.procs[pid] = dir
+
+	// Kills the processes of the subtree.
+	case "cgroup.kill":
+		if value != "1" {
+			return invalid
+		}
+		for p, node := range t.nodes {
+			if p != dir && !strings.HasPrefix(p, dir+"/") {
+				continue
+			}
+			for pid := range node.procs {
+				delete(t.procs, pid)
+			}
+			clear(node.procs)
+		}
+
+	// Enables or disables controllers for the children.
+	case "cgroup.subtree_control":
+		if len(n.procs) > 0 && dir != t.root {
+			return &iofs.PathError{Op: "write", Path: path, Err: syscall.EBUSY}
+		}
+		for _, tok := range strings.Fields(value) {
+			switch tok[0] {
+			case '+':
+				n.subtree[tok[1:]] = struct{}{}
+			case '-':
+				delete(n.subtree, tok[1:])
+			default:
+				return invalid
+			}
+		}
+
+	default:
+		if _, ok := n.files[name]; !ok {
+			return &iofs.PathError{Op: "open", Path: path, Err: syscall.ENOENT}
+		}
+		n.files[name] = value + "\n"
+	}
+	return nil
+}
+
+func (t *CgroupTree) Children(path string) ([]string, error) {
+	path = filepath.Clean(path)
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	n, ok := t.nodes[path]
+	if !ok {
+		return nil, &iofs.PathError{Op: "open", Path: path, Err: syscall.ENOENT}
+	}
+	return sortedKeys(n.children), nil
+}
+
+/**
+ * Resolves the path of a control file.
+ * @return the cgroup holding the file, the file name, or an error if the cgroup does not exist
+ */
+func (t *CgroupTree) file(op, path string) (*cgroupNode, string, error) {
+	path = filepath.Clean(path)
+	n, ok := t.nodes[filepath.Dir(path)]
+	if !ok {
+		return nil, "", &iofs.PathError{Op: op, Path: path, Err: syscall.ENOENT}
+	}
+	return n, filepath.Base(path), nil
+}
+
+/**
+ * @return whether the subtree of a cgroup holds processes.
+ */
+func (t *CgroupTree) populated(path string) bool {
+	n := t.nodes[path]
+	if len(n.procs) > 0 {
+		return true
+	}
+	for name := range n.children {
+		if t.populated(filepath.Join(path, name)) {
+			return true
+		}
+	}
+	return false
+}
+
+/**
+ * @return the sorted keys of a set.
+ */
+func sortedKeys[K cmp.Ordered](m map[K]struct{}) []K {
+	out := make([]K, 0, len(m))
+	for k := range m {
+		out = append(out, k)
+	}
+	slices.Sort(out)
+	return out
+}
@@ -0,0 +1,112 @@
+//go:build linux
+
+package fakes
+
+import (
+	"path/filepath"
+	"sync"
+
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * A mount operation recorded by a MountRecorder.
+ */
+type MountCall struct {
+	Source string
+	Target string
+	FSType string
+	Flags  uintptr
+	Data   string
+
+	// Whether the call is an unmount.
+	Unmount bool
+}
+
+/**
+ * Records mount operations instead of performing them, tracking the
+ * filesystems mounted at each target. Propagation changes and remounts
+ * apply to mounted targets only, and unmounting a target with nothing
+ * mounted fails with EINVAL, as umount2(2).
+ */
+type MountRecorder struct {
+	mu sync.Mutex
+
+	// Mount stack of each target.
+	mounts map[string][]MountCall
+
+	// Recorded calls, if recording is enabled.
+	calls  []MountCall
+	record bool
+}
+
+/**
+ * Creates a recorder with nothing mounted.
+ * @param record whether to keep the list of calls, which grows with each call
+ * @return the recorder
+ */
+func NewMountRecorder(record bool) *MountRecorder {
+	return &MountRecorder{mounts: make(map[string][]MountCall), record: record}
+}
+
+func (m *MountRecorder) Mount(source, target, fstype string, flags uintptr, data string) error {
+	target = filepath.Clean(target)
+	c := MountCall{Source: source, Target: target, FSType: fstype, Flags: flags, Data: data}
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	if m.record {
+		m.calls = append(m.calls, c)
+	}
+
+	propagation := uintptr(unix.MS_PRIVATE | unix.MS_SHARED | unix.MS_SLAVE | unix.MS_UNBINDABLE)
+	if flags&(propagation|unix.MS_REMOUNT) != 0 {
+		if len(m.mounts[target]) == 0 && target != "/" {
+			return unix.EINVAL
+		}
+		return nil
+	}
+	m.mounts[target] = append(m.mounts[target], c)
+	return nil
+}
+
+func (m *MountRecorder) Unmount(target string, flags int) error {
+	target = filepath.Clean(target)
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	if m.record {
+		m.calls = append(m.calls, MountCall{Target: target, Flags: uintptr(flags), Unmount: true})
+	}
+
+	stack := m.mounts[target]
+	if len(stack) == 0 {
+		return unix.EINVAL
+	}
+	if len(stack) == 1 {
+		delete(m.mounts, target)
+	} else {
+		m.mounts[target] = stack[:len(stack)-1]
+	}
+	return nil
+}
+
+/**
+ * @return the number of filesystems mounted.
+ */
+func (m *MountRecorder) Len() int {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	count := 0
+	for _, stack := range m.mounts {
+		count += len(stack)
+	}
+	return count
+}
+
+/**
+ * @return the recorded calls, in order.
+ */
+func (m *MountRecorder) Calls() []MountCall {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	return append([]MountCall(nil), m.calls...)
+}
@@ -0,0 +1,401 @@
+//go:build linux
+
+package fakes
+
+import (
+	"fmt"
+	stdnet "net"
+	"slices"
+	"sync"
+	"syscall"
+
+	mnet "github.com/HQarroum/microbox/net"
+	"github.com/vishvananda/netlink"
+)
+
+/**
+ * In-memory link, address and route tables of the host and of the
+ * network namespaces of sandboxes, implementing the netlink operations
+ * used to set up sandbox networks. The namespace of a sandbox is created
+ * with a loopback link on first use, and holds the links moved to it
+ * until it is deleted.
+ */
+type Netlink struct {
+	*netState
+
+	// Namespace operated on, empty for the host.
+	ns string
+}
+
+/**
+ * The tables shared by the namespaces.
+ */
+type netState struct {
+	mu sync.Mutex
+
+	// Links of each namespace, by name.
+	spaces map[string]map[string]*fakeLink
+
+	// Default route of each namespace.
+	routes map[string]*netlink.Route
+
+	// Last allocated interface index.
+	index int
+}
+
+/**
+ * A link of a namespace.
+ */
+type fakeLink struct {
+	link  netlink.Link
+	ns    string
+	peer  *fakeLink
+	addrs []netlink.Addr
+}
+
+/**
+ * Creates empty link tables, with no link on the host.
+ * @return the netlink operations of the host namespace
+ */
+func NewNetlink() *Netlink {
+	return &Netlink{netState: &netState{
+		spaces: map[string]map[string]*fakeLink{"": {}},
+		routes: make(map[string]*netlink.Route),
+	}}
+}
+
+/**
+ * @return the number of links across all namespaces.
+ */
+func (n *Netlink) Len() int {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	count := 0
+	for _, links := range n.spaces {
+		count += len(links)
+	}
+	return count
+}
+
+/**
+ * Deletes the network namespace of a sandbox, as when its last process
+ * exits, along with its links and their veth peers.
+ * @param childPID the PID of the sandbox
+ * @param nsPath the path of a persistent namespace, takes precedence over childPID
+ */
+func (n *Netlink) DeleteNetns(childPID int, nsPath string) {
+	key := nsKey(childPID, nsPath)
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	for _, l := range n.spaces[key] {
+		n.remove(l)
+	}
+	delete(n.spaces, key)
+	delete(n.routes, key)
+}
+
+func (n *Netlink) LinkByName(name string) (netlink.Link, error) {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	l, ok := n.links()[name]
+	if !ok {
+		return nil, fmt.Errorf("link %s: %w", name, syscall.ENODEV)
+	}
+	return cloneLink(l.link), nil
+}
+
+func (n *Netlink) LinkAdd(link netlink.Link) error {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	links := n.links()
+	attrs := link.Attrs()
+	if _, ok := links[attrs.Name]; ok {
+		return syscall.EEXIST
+	}
+
+	// Set the index on the given link, as the kernel does.
+	n.index++
+	attrs.Index = n.index
+	l := &fakeLink{link: cloneLink(link), ns: n.ns}
+	links[attrs.Name] = l
+
+	if v, ok := link.(*netlink.Veth); ok {
+		if _, ok := links[v.PeerName]; ok || v.PeerName == "" {
+			delete(links, attrs.Name)
+			return syscall.EEXIST
+		}
+		n.index++
+		peer := &netlink.Veth{
+			LinkAttrs: netlink.LinkAttrs{Name: v.PeerName, MTU: attrs.MTU, Index: n.index},
+			PeerName:  attrs.Name,
+		}
+		l.peer = &fakeLink{link: peer, ns: n.ns, peer: l}
+		links[v.PeerName] = l.peer
+	}
+	return nil
+}
+
+func (n *Netlink) LinkDel(link netlink.Link) error {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	l, err := n.lookup(link)
+	if err != nil {
+		return err
+	}
+	n.remove(l)
+	return nil
+}
+
+func (n *Netlink) LinkSetUp(link netlink.Link) error {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	l, err := n.lookup(link)
+	if err != nil {
+		return err
+	}
+	l.link.Attrs().Flags |= stdnet.FlagUp
+	return nil
+}
+
+func (n *Netlink) LinkSetName(link netlink.Link, name string) error {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	l, err := n.lookup(link)
+	if err != nil {
+		return err
+	}
+	links := n.links()
+	if _, ok := links[name]; ok {
+		return syscall.EEXIST
+	}
+	delete(links, l.link.Attrs().Name)
+	l.link.Attrs().Name = name
+	links[name] = l
+	return nil
+}
+
+func (n *Netlink) LinkSetMaster(link, master netlink.Link) error {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	l, err := n.lookup(link)
+	if err != nil {
+		return err
+	}
+	m, err := n.lookup(master)
+	if err != nil {
+		return err
+	}
+	l.link.Attrs().MasterIndex = m.link.Attrs().Index
+	return nil
+}
+
+func (n *Netlink) AddrList(link netlink.Link, family int) ([]netlink.Addr, error) {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	l, err := n.lookup(link)
+	if err != nil {
+		return nil, err
+	}
+	return slices.Clone(l.addrs), nil
+}
+
+func (n *Netlink) AddrAdd(link netlink.Link, addr *netlink.Addr) error {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	l, err := n.lookup(link)
+	if err != nil {
+		return err
+	}
+	for _, a := range l.addrs {
+		if a.IPNet.String() == addr.IPNet.String() {
+			return syscall.EEXIST
+		}
+	}
+	l.addrs = append(l.addrs, *addr)
+	return nil
+}
+
+func (n *Netlink) RouteReplace(route *netlink.Route) error {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	r := *route
+	n.routes[n.ns] = &r
+	return nil
+}
+
+func (n *Netlink) LinkSetNs(link netlink.Link, childPID int, nsPath string) error {
+	n.mu.Lock()
+	defer n.mu.Unlock()
+	l, err := n.lookup(link)
+	if err != nil {
+		return err
+	}
+	key := nsKey(childPID, nsPath)
+	target := n.space(key)
+	name := l.link.Attrs().Name
+	if _, ok := target[name]; ok {
+		return syscall.EEXIST
+	}
+	delete(n.links(), name)
+	l.ns = key
+	target[name] = l
+	return nil
+}
+
+func (n *Netlink) InNetns(childPID int, nsPath string, f func(mnet.Netlink) error) error {
+	key := nsKey(childPID, nsPath)
+	n.mu.Lock()
+	n.space(key)
+	n.mu.Unlock()
+	return f(&Netlink{netState: n.netState, ns: key})
+}
+
+/**
+ * @return the links of the namespace operated on.
+ */
+func (n *Netlink) links() map[string]*fakeLink {
+	return n.space(n.ns)
+}
+
+/**
+ * Looks up the record of a link in the namespace operated on, by the
+ * index set when it was added.
+ * @return the link record, or ENODEV if no such link exists
+ */
+func (n *Netlink) lookup(link netlink.Link) (*fakeLink, error) {
+	attrs := link.Attrs()
+	if l, ok := n.links()[attrs.Name]; ok && l.link.Attrs().Index == attrs.Index {
+		return l, nil
+	}
+	for _, l := range n.links() {
+		if l.link.Attrs().Index == attrs.Index {
+			return l, nil
+		}
+	}
+	return nil, fmt.Errorf("link %s: %w", attrs.Name, syscall.ENODEV)
+}
+
+/**
+ * Returns the links of a namespace, creating the namespace with a
+ * loopback link if it does not exist.
+ */
+func (s *netState) space(key string) map[string]*fakeLink {
+	links, ok := s.spaces[key]
+	if !ok {
+		s.index++
+		lo := &netlink.Device{LinkAttrs: netlink.LinkAttrs{Name: "lo", Index: s.index}}
+		links = map[string]*fakeLink{"lo": {link: lo, ns: key}}
+		s.spaces[key] = links
+	}
+	return links
+}
+
+/**
+ * Removes a link and its veth peer.
+ */
+func (s *netState) remove(l *fakeLink) {
+	delete(s.spaces[l.ns], l.link.Attrs().Name)
+	if l.peer != nil {
+		delete(s.spaces[l.peer.ns], l.peer.link.Attrs().Name)
+		l.peer.peer = nil
+	}
+}
+
+/**
+ * @return the key of the namespace of a sandbox.
+ */
+func nsKey(childPID int, nsPath string) string {
+	if nsPath != "" {
+		return nsPath
+	}
+	return fmt.Sprintf("pid:%d", childPID)
+}
+
+/**
+ * @return a copy of a link, with its own statistics.
+ */
+func cloneLink(link netlink.Link) netlink.Link {
+	var out netlink.Link
+	switch l := link.(type) {
+	case *netlink.Bridge:
+		c := *l
+		out = &c
+	case *netlink.Veth:
+		c := *l
+		out = &c
+	case *netlink.Device:
+		c := *l
+		out = &c
+	default:
+		c := *link.Attrs()
+		out = &netlink.Device{LinkAttrs: c}
+	}
+	stats := &netlink.LinkStatistics{}
+	if st := link.Attrs().Statistics; st != nil {
+		*stats = *st
+	}
+	out.Attrs().Statistics = stats
+	return out
+}
+
+/**
+ * Records NAT rules instead of installing them on the host.
+ */
+type Firewall struct {
+	mu sync.Mutex
+
+	// Subnets with forwarding and NAT enabled, by bridge.
+	rules map[string]string
+
+	// Network policies, by sandbox IP.
+	policies map[string]*mnet.Policy
+}
+
+/**
+ * Creates a firewall with no rules.
+ * @return the firewall
+ */
+func NewFirewall() *Firewall {
+	return &Firewall{rules: make(map[string]string), policies: make(map[string]*mnet.Policy)}
+}
+
+func (f *Firewall) EnableNAT(bridge, subnetCIDR string) error {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	f.rules[bridge] = subnetCIDR
+	return nil
+}
+
+/**
+ * @return the subnet with NAT enabled on a bridge, empty if none.
+ */
+func (f *Firewall) NAT(bridge string) string {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	return f.rules[bridge]
+}
+
+func (f *Firewall) AddPolicy(bridge, ip string, p *mnet.Policy) error {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	f.policies[ip] = p
+	return nil
+}
+
+func (f *Firewall) RemovePolicy(ip string) error {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	delete(f.policies, ip)
+	return nil
+}
+
+func (f *Firewall) PrunePolicies(keep func(ip string) bool) error {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	for ip := range f.policies {
+		if !keep(ip) {
+			delete(f.policies, ip)
+		}
+	}
+	return nil
+}
@@ -43,10 +43,12 @@ func linkDev(src, dest string) error {
  * Setup /dev in the sandbox rootfs.
  * This includes mounting a tmpfs on /dev, setting up /dev/pts and /dev/shm,
  * and bind-mounting a set of essential device files from the host.
+ * @param mounter the mount operations
  * @param base the root path of the sandbox filesystem
+ * @param huge the `huge=` policy of /dev/shm, empty for the kernel default
  * @return error if any
  */
-func MountDev(base string) error {
+func MountDev(mounter Mounter, base, huge string) error {
 	if base == "" {
 		return unix.EINVAL
 	}
@@ -56,7 +58,7 @@ func MountDev(base string) error {
 	if err := os.MkdirAll(dev, 0o755); err != nil {
 		return err
 	}
-	if err := unix.Mount("tmpfs", dev, "tmpfs", unix.MS_NOSUID|unix.MS_NOEXEC|unix.MS_STRICTATIME, "mode=755,size=65536k"); err != nil {
+	if err := mounter.Mount("tmpfs", dev, "tmpfs", unix.MS_NOSUID|unix.MS_NOEXEC|unix.MS_STRICTATIME, "mode=755,size=65536k"); err != nil {
 		return err
 	}
 
@@ -65,7 +67,7 @@ func MountDev(base string) error {
 	if err := os.MkdirAll(pts, 0o755); err != nil {
 		return err
 	}
-	if err := unix.Mount("devpts", pts, "devpts", unix.MS_NOSUID|unix.MS_NOEXEC, "newinstance,ptmxmode=0666,mode=0620"); err != nil && !errors.Is(err, unix.EINVAL) {
+	if err := mounter.Mount("devpts", pts, "devpts", unix.MS_NOSUID|unix.MS_NOEXEC, "newinstance,ptmxmode=0666,mode=0620"); err != nil && !errors.Is(err, unix.EINVAL) {
 		return err
 	}
 
@@ -79,7 +81,7 @@ func MountDev(base string) error {
 	if err := os.MkdirAll(shm, 0o777); err != nil {
 		return err
 	}
-	if err := unix.Mount("tmpfs", shm, "tmpfs", unix.MS_NOSUID|unix.MS_NOEXEC|unix.MS_NODEV, "mode=1777,size=65536k"); err != nil {
+	if err := mounter.Mount("tmpfs", shm, "tmpfs", unix.MS_NOSUID|unix.MS_NOEXEC|unix.MS_NODEV, withHuge("mode=1777,size=65536k", huge)); err != nil {
 		return err
 	}
 
@@ -88,7 +90,7 @@ func MountDev(base string) error {
 	if err := os.MkdirAll(mqueue, 0o755); err != nil {
 		return err
 	}
-	if err := unix.Mount("mqueue", mqueue, "mqueue", unix.MS_NOSUID|unix.MS_NOEXEC|unix.MS_NODEV, ""); err != nil && !errors.Is(err, unix.EINVAL) {
+	if err := mounter.Mount("mqueue", mqueue, "mqueue", unix.MS_NOSUID|unix.MS_NOEXEC|unix.MS_NODEV, ""); err != nil && !errors.Is(err, unix.EINVAL) {
 		return err
 	}
 
@@ -120,7 +122,7 @@ func MountDev(base string) error {
 	// Bind-mount allow-list of device files from host.
 	for _, p := range devAllowlist {
 		spec := MountSpec{Host: p, Dest: p, RO: false}
-		if err := BindMount(base, spec); err != nil {
+		if err := BindMount(mounter, base, spec); err != nil {
 			// best-effort; continue if a device is missing
 			continue
 		}
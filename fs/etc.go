@@ -8,7 +8,6 @@ import (
 	"os"
 	"path"
 
-	"github.com/HQarroum/microbox/logger"
 	"golang.org/x/sys/unix"
 )
 
@@ -69,11 +68,13 @@ func SetResolvers(base string, nameservers []string) error {
 
 /**
  * Setup essential /etc files in the sandbox rootfs.
+ * @param mounter the mount operations.
+ * @param log the logger of the setup.
  * @param base the root path of the sandbox filesystem.
  * @param opts the sandbox options.
  * @return error if any, nil otherwise.
  */
-func SetupEtc(base string, nameservers []string, hostname string) error {
+func SetupEtc(mounter Mounter, log *slog.Logger, base string, nameservers []string, hostname string) error {
 	if base == "" {
 		return unix.EINVAL
 	}
@@ -86,13 +87,13 @@ func SetupEtc(base string, nameservers []string, hostname string) error {
 
 	// Create /etc/resolv.conf.
 	if err := SetResolvers(base, nameservers); err != nil {
-		logger.Log.Warn("error setting resolvers", slog.Any("err", err))
+		log.Warn("error setting resolvers", slog.Any("err", err))
 	}
 
 	// Bind-mount /etc/hosts
 	if _, err := os.Stat("/etc/hosts"); err == nil {
 		spec := MountSpec{Host: "/etc/hosts", Dest: "/etc/hosts", RO: true}
-		if err := BindMount(base, spec); err != nil {
+		if err := BindMount(mounter, base, spec); err != nil {
 			return fmt.Errorf("error binding /etc/hosts: %w", err)
 		}
 	}
@@ -101,7 +102,7 @@ func SetupEtc(base string, nameservers []string, hostname string) error {
 	if hostname != "" {
 		hostnamePath := path.Join(base, "/etc/hostname")
 		if err := os.WriteFile(hostnamePath, []byte(hostname+"\n"), 0o644); err != nil {
-			logger.Log.Warn("error writing /etc/hostname", slog.Any("err", err))
+			log.Warn("error writing /etc/hostname", slog.Any("err", err))
 		}
 	}
 
@@ -4,6 +4,7 @@ package fs
 
 import (
 	"fmt"
+	"log/slog"
 	"os"
 	"path/filepath"
 
@@ -21,6 +22,41 @@ type FsOpts struct {
 	MountRO     []MountSpec
 	MountRW     []MountSpec
 	Storage     uint64
+	TmpfsHuge   string
+
+	// Pre-mounted writable layer (see PrepareLayer), empty to create one.
+	LayerDir string
+
+	// Huge page reservations, and their pre-mounted filesystems (see PrepareHugePages).
+	HugePages    []HugePages
+	HugePagesDir string
+
+	// Mount operations (defaults to the host ones), not sent to the
+	// init stage of a sandbox.
+	Mounter Mounter `json:"-"`
+
+	// Logger of the setup (defaults to slog.Default()).
+	Logger *slog.Logger `json:"-"`
+}
+
+/**
+ * @return the mount operations of the setup.
+ */
+func (opts *FsOpts) mounter() Mounter {
+	if opts.Mounter != nil {
+		return opts.Mounter
+	}
+	return HostMounter{}
+}
+
+/**
+ * @return the logger of the setup.
+ */
+func (opts *FsOpts) log() *slog.Logger {
+	if opts.Logger != nil {
+		return opts.Logger
+	}
+	return slog.Default()
 }
 
 /**
@@ -98,11 +134,12 @@ func isDir(path string) bool {
 /**
  * Bind-mount a host path to a target path within the sandbox.
  * Creates the target path if it doesn't exist.
+ * @param mounter the mount operations
  * @param base the root path of the sandbox filesystem
  * @param spec the mount specification
  * @return error if any
  */
-func BindMount(base string, spec MountSpec) error {
+func BindMount(mounter Mounter, base string, spec MountSpec) error {
 	if base == "" || spec.Host == "" || spec.Dest == "" {
 		return unix.EINVAL
 	}
@@ -136,43 +173,60 @@ func BindMount(base string, spec MountSpec) error {
 	}
 
 	// Mount the source to the target.
-	if err := unix.Mount(spec.Host, target, "", unix.MS_BIND|unix.MS_REC|unix.MS_NOSUID|unix.MS_NODEV, ""); err != nil {
+	if err := mounter.Mount(spec.Host, target, "", unix.MS_BIND|unix.MS_REC|unix.MS_NOSUID|unix.MS_NODEV, ""); err != nil {
 		return err
 	}
 
 	// Optional read-only remount.
 	if spec.RO {
-		if err := unix.Mount("", target, "", unix.MS_BIND|unix.MS_REMOUNT|unix.MS_RDONLY|unix.MS_NOSUID|unix.MS_NODEV, ""); err != nil {
+		if err := mounter.Mount("", target, "", unix.MS_BIND|unix.MS_REMOUNT|unix.MS_RDONLY|unix.MS_NOSUID|unix.MS_NODEV, ""); err != nil {
 			return err
 		}
 	}
 	return nil
 }
 
+/**
+ * Append the `huge=` option to a set of tmpfs mount options.
+ * @param data the tmpfs mount options
+ * @param huge the `huge=` policy, empty to keep the kernel default
+ * @return the resulting mount options
+ */
+func withHuge(data, huge string) string {
+	if huge == "" {
+		return data
+	}
+	return data + ",huge=" + huge
+}
+
 /**
  * Create a `tmpfs` at the specified path.
+ * @param mounter the mount operations
  * @param path the path to create the `tmpfs` at
  * @param storage the size of the `tmpfs` in megabytes
+ * @param huge the `huge=` policy of the `tmpfs`, empty for the kernel default
  * @return error if any
  */
-func createTmpfs(path string, storage uint64) error {
+func createTmpfs(mounter Mounter, path string, storage uint64, huge string) error {
 	if path == "" {
 		return unix.EINVAL
 	}
 	if err := os.MkdirAll(path, 0o755); err != nil {
 		return err
 	}
-	return unix.Mount("tmpfs", path, "tmpfs", unix.MS_NOSUID|unix.MS_NODEV, fmt.Sprintf("mode=755,size=%dm", storage/1024/1024))
+	data := withHuge(fmt.Sprintf("mode=755,size=%dm", storage/1024/1024), huge)
+	return mounter.Mount("tmpfs", path, "tmpfs", unix.MS_NOSUID|unix.MS_NODEV, data)
 }
 
 /**
  * Create an `overlayfs` with the specified lower (read-only) and upper (read-write) layers.
  * The upper layer is created on a `tmpfs` at the specified mountpoint.
+ * @param mounter the mount operations
  * @param src the lower (read-only) layer
  * @param mountpoint the mountpoint for the `tmpfs` and `overlayfs`
  * @return the created overlayFS structure and error if any
  */
-func createOverlay(src, mountpoint string) (*overlayFS, error) {
+func createOverlay(mounter Mounter, src, mountpoint string) (*overlayFS, error) {
 	if src == "" || mountpoint == "" {
 		return nil, unix.EINVAL
 	}
@@ -197,7 +251,7 @@ func createOverlay(src, mountpoint string) (*overlayFS, error) {
 
 	// Mount overlay.
 	opts := fmt.Sprintf("lowerdir=%s,upperdir=%s,workdir=%s", fs.lower, fs.upper, fs.work)
-	if err := unix.Mount("overlay", fs.merge, "overlay", 0, opts); err != nil {
+	if err := mounter.Mount("overlay", fs.merge, "overlay", 0, opts); err != nil {
 		return nil, err
 	}
 
@@ -206,10 +260,11 @@ func createOverlay(src, mountpoint string) (*overlayFS, error) {
 
 /**
  * Pivot to a new root filesystem.
+ * @param mounter the mount operations
  * @param newRoot the new root filesystem path
  * @return error if any
  */
-func pivotTo(newRoot string) error {
+func pivotTo(mounter Mounter, newRoot string) error {
 	if err := os.Chdir(newRoot); err != nil {
 		return err
 	}
@@ -228,7 +283,7 @@ func pivotTo(newRoot string) error {
 	}
 
 	// Lazy detach old root and remove it.
-	if err := unix.Unmount("/.old_root", unix.MNT_DETACH); err != nil {
+	if err := mounter.Unmount("/.old_root", unix.MNT_DETACH); err != nil {
 		return err
 	}
 
@@ -241,10 +296,11 @@ func pivotTo(newRoot string) error {
  * @return error if any
  */
 func setupRootfs(opts *FsOpts) error {
+	mounter := opts.mounter()
 	// Ensure the root filesystem is mounted as private, so that changes
 	// made within the container do not affect the host filesystem, and
 	// changes made outside the container do not affect the container.
-	if err := unix.Mount("", "/", "", unix.MS_PRIVATE|unix.MS_REC, ""); err != nil {
+	if err := mounter.Mount("", "/", "", unix.MS_PRIVATE|unix.MS_REC, ""); err != nil {
 		return err
 	}
 
@@ -253,65 +309,74 @@ func setupRootfs(opts *FsOpts) error {
 		return fmt.Errorf("rootfs %q not a directory", opts.FS.Path)
 	}
 
-	// We first create a `tmpfs` at /box as a writable, ephemeral filesystem.
-	tmp := "/box"
-	if err := createTmpfs(tmp, opts.Storage); err != nil {
-		return err
-	}
+	// We first create a `tmpfs` at /box as a writable, ephemeral filesystem,
+	// unless a writable layer has been prepared by the supervisor.
+	overlayMP := opts.LayerDir
+	if overlayMP == "" {
+		tmp := "/box"
+		if err := createTmpfs(mounter, tmp, opts.Storage, opts.TmpfsHuge); err != nil {
+			return err
+		}
 
-	overlayMP := "/box/overlay"
-	if err := os.MkdirAll(overlayMP, 0o755); err != nil {
-		return err
+		overlayMP = "/box/overlay"
+		if err := os.MkdirAll(overlayMP, 0o755); err != nil {
+			return err
+		}
 	}
 
 	// We create an `overlayfs` on top of the `tmpfs`.
-	ov, err := createOverlay(opts.FS.Path, overlayMP)
+	ov, err := createOverlay(mounter, opts.FS.Path, overlayMP)
 	if err != nil {
 		return fmt.Errorf("error creating overlayfs: %w", err)
 	}
 
 	// Mount `procfs`.
-	if err := MountProc(ov.merge); err != nil {
+	if err := MountProc(mounter, ov.merge); err != nil {
 		return fmt.Errorf("error mounting procfs: %w", err)
 	}
 
 	// Mount `devfs`.
-	if err := MountDev(ov.merge); err != nil {
+	if err := MountDev(mounter, ov.merge, opts.TmpfsHuge); err != nil {
 		return fmt.Errorf("error mounting devfs: %w", err)
 	}
 
+	// Mount `hugetlbfs`.
+	if err := MountHugePages(mounter, ov.merge, opts.HugePagesDir, opts.HugePages, true); err != nil {
+		return err
+	}
+
 	// Mount `/tmp`.
 	if err := MountTmp(ov.merge); err != nil {
 		return fmt.Errorf("error mounting /tmp: %w", err)
 	}
 
 	// Setup /etc configuration files.
-	if err := SetupEtc(ov.merge, opts.Nameservers, opts.Hostname); err != nil {
+	if err := SetupEtc(mounter, opts.log(), ov.merge, opts.Nameservers, opts.Hostname); err != nil {
 		return fmt.Errorf("error setting up /etc: %w", err)
 	}
 
 	// User read-only bind mounts.
 	for _, m := range opts.MountRO {
-		if err := BindMount(ov.merge, MountSpec{Host: m.Host, Dest: m.Dest, RO: true}); err != nil {
+		if err := BindMount(mounter, ov.merge, MountSpec{Host: m.Host, Dest: m.Dest, RO: true}); err != nil {
 			return err
 		}
 	}
 
 	// User read-write bind mounts.
 	for _, m := range opts.MountRW {
-		if err := BindMount(ov.merge, MountSpec{Host: m.Host, Dest: m.Dest, RO: false}); err != nil {
+		if err := BindMount(mounter, ov.merge, MountSpec{Host: m.Host, Dest: m.Dest, RO: false}); err != nil {
 			return err
 		}
 	}
 
 	// Switch root to merged dir.
-	if err := pivotTo(ov.merge); err != nil {
+	if err := pivotTo(mounter, ov.merge); err != nil {
 		return err
 	}
 
 	// Remount the rootfs as read-only if requested.
 	if opts.ReadOnly {
-		if err := unix.Mount("", "/", "", unix.MS_REMOUNT|unix.MS_RDONLY, ""); err != nil {
+		if err := mounter.Mount("", "/", "", unix.MS_REMOUNT|unix.MS_RDONLY, ""); err != nil {
 			return err
 		}
 	}
@@ -325,27 +390,36 @@ func setupRootfs(opts *FsOpts) error {
  * @return error if any
  */
 func setupTmpfsRoot(opts *FsOpts) error {
+	mounter := opts.mounter()
 	base := "/box"
 
 	// Ensure the root filesystem is mounted as private, so that changes
 	// made within the container do not affect the host filesystem, and
 	// changes made outside the container do not affect the container.
-	if err := unix.Mount("", "/", "", unix.MS_PRIVATE|unix.MS_REC, ""); err != nil {
+	if err := mounter.Mount("", "/", "", unix.MS_PRIVATE|unix.MS_REC, ""); err != nil {
 		return err
 	}
 
-	// Create root filesystem as `tmpfs`.
-	if err := createTmpfs(base, opts.Storage); err != nil {
+	// Create root filesystem as `tmpfs`, unless a writable layer
+	// has been prepared by the supervisor.
+	if opts.LayerDir != "" {
+		base = opts.LayerDir
+	} else if err := createTmpfs(mounter, base, opts.Storage, opts.TmpfsHuge); err != nil {
 		return err
 	}
 
 	// Mount `procfs`.
-	if err := MountProc(base); err != nil {
+	if err := MountProc(mounter, base); err != nil {
 		return err
 	}
 
 	// Mount `devfs`.
-	if err := MountDev(base); err != nil {
+	if err := MountDev(mounter, base, opts.TmpfsHuge); err != nil {
+		return err
+	}
+
+	// Mount `hugetlbfs`.
+	if err := MountHugePages(mounter, base, opts.HugePagesDir, opts.HugePages, true); err != nil {
 		return err
 	}
 
@@ -355,32 +429,32 @@ func setupTmpfsRoot(opts *FsOpts) error {
 	}
 
 	// Setup /etc configuration files.
-	if err := SetupEtc(base, opts.Nameservers, opts.Hostname); err != nil {
+	if err := SetupEtc(mounter, opts.log(), base, opts.Nameservers, opts.Hostname); err != nil {
 		return err
 	}
 
 	// User read-only bind mounts.
 	for _, m := range opts.MountRO {
-		if err := BindMount(base, MountSpec{Host: m.Host, Dest: m.Dest, RO: true}); err != nil {
+		if err := BindMount(mounter, base, MountSpec{Host: m.Host, Dest: m.Dest, RO: true}); err != nil {
 			return err
 		}
 	}
 
 	// User read-write bind mounts.
 	for _, m := range opts.MountRW {
-		if err := BindMount(base, MountSpec{Host: m.Host, Dest: m.Dest, RO: false}); err != nil {
+		if err := BindMount(mounter, base, MountSpec{Host: m.Host, Dest: m.Dest, RO: false}); err != nil {
 			return err
 		}
 	}
 
 	// Switch root to the new `tmpfs`.
-	if err := pivotTo(base); err != nil {
+	if err := pivotTo(mounter, base); err != nil {
 		return err
 	}
 
 	// Remount the rootfs as read-only if requested.
 	if opts.ReadOnly {
-		if err := unix.Mount("", "/", "", unix.MS_REMOUNT|unix.MS_RDONLY, ""); err != nil {
+		if err := mounter.Mount("", "/", "", unix.MS_REMOUNT|unix.MS_RDONLY, ""); err != nil {
 			return err
 		}
 	}
@@ -394,18 +468,19 @@ func setupTmpfsRoot(opts *FsOpts) error {
  * @return error if any
  */
 func setupHostfsRoot(opts *FsOpts) error {
+	mounter := opts.mounter()
 	base := "/box"
 	readOnly := false
 
 	// Ensure the root filesystem is mounted as private, so that changes
 	// made within the container do not affect the host filesystem, and
 	// changes made outside the container do not affect the container.
-	if err := unix.Mount("", "/", "", unix.MS_PRIVATE|unix.MS_REC, ""); err != nil {
+	if err := mounter.Mount("", "/", "", unix.MS_PRIVATE|unix.MS_REC, ""); err != nil {
 		return err
 	}
 
 	// Create root filesystem as `tmpfs`.
-	if err := createTmpfs(base, opts.Storage); err != nil {
+	if err := createTmpfs(mounter, base, opts.Storage, opts.TmpfsHuge); err != nil {
 		return err
 	}
 
@@ -413,11 +488,17 @@ func setupHostfsRoot(opts *FsOpts) error {
 	if opts.ReadOnly {
 		readOnly = true
 	}
-	if err := BindMount(base, MountSpec{Host: "/", Dest: "/", RO: readOnly}); err != nil {
+	if err := BindMount(mounter, base, MountSpec{Host: "/", Dest: "/", RO: readOnly}); err != nil {
+		return err
+	}
+
+	// Mount `hugetlbfs` over the host's /dev/hugepages, without
+	// creating mount points in the host's /dev.
+	if err := MountHugePages(mounter, base, opts.HugePagesDir, opts.HugePages, false); err != nil {
 		return err
 	}
 
-	return pivotTo(base)
+	return pivotTo(mounter, base)
 }
 
 // SetupFS chooses the filesystem strategy based on opts.FS.Mode.
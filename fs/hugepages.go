@@ -0,0 +1,145 @@
+//go:build linux
+
+package fs
+
+import (
+	"errors"
+	"fmt"
+	"os"
+	"path"
+	"path/filepath"
+
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * A reservation of huge pages of a given size.
+ */
+type HugePages struct {
+	// Size of the pages in bytes.
+	Size uint64
+
+	// Number of pages.
+	Count uint64
+}
+
+/**
+ * @return the name of the page size, as in the files of the hugetlb
+ * cgroup controller (e.g. `2MB`, `1GB`).
+ */
+func (h HugePages) Name() string {
+	switch {
+	case h.Size >= 1<<30:
+		return fmt.Sprintf("%dGB", h.Size>>30)
+	case h.Size >= 1<<20:
+		return fmt.Sprintf("%dMB", h.Size>>20)
+	default:
+		return fmt.Sprintf("%dKB", h.Size>>10)
+	}
+}
+
+/**
+ * @return the size of the reservation in bytes.
+ */
+func (h HugePages) Bytes() uint64 {
+	return h.Size * h.Count
+}
+
+/**
+ * @return the sysfs directory of the page size, absent if the kernel
+ * does not support it.
+ */
+func (h HugePages) SysfsDir() string {
+	return fmt.Sprintf("/sys/kernel/mm/hugepages/hugepages-%dkB", h.Size>>10)
+}
+
+/**
+ * Mounts a `hugetlbfs` per page size in the supervisor's mount namespace,
+ * sized to the reservation, to be bind-mounted in the sandbox by
+ * MountHugePages. `hugetlbfs` cannot be mounted from a user namespace.
+ * @param mounter the mount operations
+ * @param dir the directory to mount the filesystems in
+ * @param pages the huge page reservations
+ * @return error if any
+ */
+func PrepareHugePages(mounter Mounter, dir string, pages []HugePages) error {
+	for _, h := range pages {
+		target := filepath.Join(dir, h.Name())
+		if err := os.MkdirAll(target, 0o755); err != nil {
+			_ = ReleaseHugePages(mounter, dir)
+			return err
+		}
+		data := fmt.Sprintf("mode=1777,pagesize=%d,size=%d", h.Size, h.Bytes())
+		if err := mounter.Mount("hugetlbfs", target, "hugetlbfs", unix.MS_NOSUID|unix.MS_NODEV, data); err != nil {
+			_ = ReleaseHugePages(mounter, dir)
+			return fmt.Errorf("mount hugetlbfs %s: %w", target, err)
+		}
+
+		// Do not propagate the filesystem to peer mount namespaces.
+		if err := mounter.Mount("", target, "", unix.MS_PRIVATE, ""); err != nil {
+			_ = ReleaseHugePages(mounter, dir)
+			return fmt.Errorf("make hugetlbfs %s private: %w", target, err)
+		}
+	}
+	return nil
+}
+
+/**
+ * Unmounts and removes the filesystems created by PrepareHugePages.
+ * @param mounter the mount operations
+ * @param dir the directory the filesystems are mounted in
+ * @return error if any
+ */
+func ReleaseHugePages(mounter Mounter, dir string) error {
+	if dir == "" {
+		return nil
+	}
+	entries, err := os.ReadDir(dir)
+	if err != nil {
+		if errors.Is(err, os.ErrNotExist) {
+			return nil
+		}
+		return err
+	}
+	for _, e := range entries {
+		target := filepath.Join(dir, e.Name())
+		if err := mounter.Unmount(target, unix.MNT_DETACH); err != nil && !errors.Is(err, unix.EINVAL) && !errors.Is(err, unix.ENOENT) {
+			return fmt.Errorf("unmount hugetlbfs %s: %w", target, err)
+		}
+		if err := os.Remove(target); err != nil && !errors.Is(err, os.ErrNotExist) {
+			return err
+		}
+	}
+	return os.Remove(dir)
+}
+
+/**
+ * Bind-mounts the filesystems prepared by PrepareHugePages in the
+ * sandbox: the first page size at /dev/hugepages, and the others at
+ * /dev/hugepages-<size>.
+ * @param mounter the mount operations
+ * @param base the root path of the sandbox filesystem
+ * @param dir the directory the filesystems are mounted in
+ * @param pages the huge page reservations
+ * @param create whether to create the mount points, false when /dev is the host's
+ * @return error if any
+ */
+func MountHugePages(mounter Mounter, base, dir string, pages []HugePages, create bool) error {
+	for i, h := range pages {
+		target := path.Join(base, "/dev/hugepages")
+		if i > 0 {
+			target += "-" + h.Name()
+		}
+		if create {
+			if err := os.MkdirAll(target, 0o755); err != nil {
+				return err
+			}
+		} else if !isDir(target) {
+			return fmt.Errorf("no mount point for huge pages at %s", target)
+		}
+		if err := mounter.Mount(filepath.Join(dir, h.Name()), target, "", unix.MS_BIND|unix.MS_NOSUID|unix.MS_NODEV, ""); err != nil {
+			return fmt.Errorf("mount huge pages at %s: %w", target, err)
+		}
+	}
+	return nil
+}
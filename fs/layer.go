@@ -0,0 +1,151 @@
+//go:build linux
+
+package fs
+
+import (
+	"errors"
+	"fmt"
+	"os"
+	"os/exec"
+	"path/filepath"
+
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * Prepares a host-visible writable layer for a sandbox. The layer is a
+ * private `tmpfs` mounted in the supervisor's mount namespace, holding the
+ * overlay upper and work directories (rootfs mode) or the root filesystem
+ * itself (tmpfs mode), so that it can be archived while the sandbox runs.
+ * @param mounter the mount operations
+ * @param dir the directory to mount the layer at
+ * @param storage the size of the layer in bytes
+ * @param huge the `huge=` policy of the layer, empty for the kernel default
+ * @return error if any
+ */
+func PrepareLayer(mounter Mounter, dir string, storage uint64, huge string) error {
+	if err := createTmpfs(mounter, dir, storage, huge); err != nil {
+		return fmt.Errorf("mount layer %s: %w", dir, err)
+	}
+
+	// Do not propagate the layer to peer mount namespaces.
+	if err := mounter.Mount("", dir, "", unix.MS_PRIVATE, ""); err != nil {
+		_ = mounter.Unmount(dir, unix.MNT_DETACH)
+		return fmt.Errorf("make layer %s private: %w", dir, err)
+	}
+	return nil
+}
+
+/**
+ * Unmounts and removes a layer created by PrepareLayer, including a root
+ * assembled on top of it by MountLayerRoot.
+ * @param mounter the mount operations
+ * @param dir the directory the layer is mounted at
+ * @return error if any
+ */
+func ReleaseLayer(mounter Mounter, dir string) error {
+	if dir == "" {
+		return nil
+	}
+	_ = mounter.Unmount(filepath.Join(dir, "merged"), unix.MNT_DETACH)
+	if err := mounter.Unmount(dir, unix.MNT_DETACH); err != nil && !errors.Is(err, unix.EINVAL) && !errors.Is(err, unix.ENOENT) {
+		return fmt.Errorf("unmount layer %s: %w", dir, err)
+	}
+	if err := os.Remove(dir); err != nil && !errors.Is(err, os.ErrNotExist) {
+		return err
+	}
+	return nil
+}
+
+/**
+ * Assembles the root filesystem of a sandbox on top of a layer in the
+ * supervisor's mount namespace.
+ * @param opts the filesystem options
+ * @param dir the directory the layer is mounted at
+ * @return the path of the assembled root, or error if any
+ */
+func MountLayerRoot(opts *FsOpts, dir string) (string, error) {
+	switch opts.FS.Mode {
+	case FsRootfs:
+		ov, err := createOverlay(opts.mounter(), opts.FS.Path, dir)
+		if err != nil {
+			return "", fmt.Errorf("error creating overlayfs: %w", err)
+		}
+		return ov.merge, nil
+	case FsTmpfs:
+		return dir, nil
+	default:
+		return "/", nil
+	}
+}
+
+/**
+ * @return the path, relative to the layer, holding the writable data.
+ */
+func layerData(mode FsType) string {
+	if mode == FsRootfs {
+		return "upper"
+	}
+	return "."
+}
+
+/**
+ * Archives the writable data of a layer, preserving the overlay
+ * whiteouts and opaque directory markers.
+ * @param dir the directory the layer is mounted at
+ * @param mode the filesystem mode of the sandbox
+ * @param archive the path of the archive to write
+ * @return error if any
+ */
+func ArchiveLayer(dir string, mode FsType, archive string) error {
+	out, err := exec.Command("tar",
+		"--xattrs", "--xattrs-include=trusted.*", "--numeric-owner",
+		"-C", dir, "-cpf", archive, layerData(mode),
+	).CombinedOutput()
+	if err != nil {
+		return fmt.Errorf("archive layer: %v\n%s", err, out)
+	}
+	return nil
+}
+
+/**
+ * Extracts an archive created by ArchiveLayer into a layer.
+ * @param dir the directory the layer is mounted at
+ * @param archive the path of the archive to read
+ * @return error if any
+ */
+func ExtractLayer(dir, archive string) error {
+	out, err := exec.Command("tar",
+		"--xattrs", "--xattrs-include=trusted.*", "--numeric-owner",
+		"-C", dir, "-xpf", archive,
+	).CombinedOutput()
+	if err != nil {
+		return fmt.Errorf("extract layer: %v\n%s", err, out)
+	}
+	return nil
+}
+
+/**
+ * Lists the host bind mounts of a sandbox, which are external to its
+ * mount namespace when checkpointing it.
+ * @param opts the filesystem options
+ * @return the bind mounts, with their destination inside the sandbox
+ */
+func ExternalMounts(opts *FsOpts) []MountSpec {
+	var out []MountSpec
+
+	if opts.FS.Mode == FsHost {
+		return nil
+	}
+	for _, p := range devAllowlist {
+		if _, err := os.Stat(p); err == nil {
+			out = append(out, MountSpec{Host: p, Dest: p})
+		}
+	}
+	if _, err := os.Stat("/etc/hosts"); err == nil {
+		out = append(out, MountSpec{Host: "/etc/hosts", Dest: "/etc/hosts", RO: true})
+	}
+	out = append(out, opts.MountRO...)
+	out = append(out, opts.MountRW...)
+	return out
+}
@@ -0,0 +1,33 @@
+//go:build linux
+
+package fs
+
+import (
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * Mount operations. The host implementation calls mount(2) and umount2(2),
+ * and can be replaced by a recorder to exercise the filesystem setup of
+ * sandboxes without root.
+ */
+type Mounter interface {
+	// Mounts a filesystem, as mount(2).
+	Mount(source, target, fstype string, flags uintptr, data string) error
+
+	// Unmounts a filesystem, as umount2(2).
+	Unmount(target string, flags int) error
+}
+
+/**
+ * The mount operations of the host.
+ */
+type HostMounter struct{}
+
+func (HostMounter) Mount(source, target, fstype string, flags uintptr, data string) error {
+	return unix.Mount(source, target, fstype, flags, data)
+}
+
+func (HostMounter) Unmount(target string, flags int) error {
+	return unix.Unmount(target, flags)
+}
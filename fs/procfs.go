@@ -50,10 +50,11 @@ func isDirectory(path string) (bool, error) {
 
 /**
  * Setup /proc in the sandbox rootfs by mounting a proc filesystem.
+ * @param mounter the mount operations
  * @param base the root path of the sandbox filesystem
  * @return error if any, the result of the mount operation otherwise
  */
-func MountProc(base string) error {
+func MountProc(mounter Mounter, base string) error {
 	if base == "" {
 		return unix.EINVAL
 	}
@@ -63,7 +64,7 @@ func MountProc(base string) error {
 		return err
 	}
 
-	if err := unix.Mount("proc", target, "proc", unix.MS_NOSUID|unix.MS_NOEXEC|unix.MS_NODEV, ""); err != nil {
+	if err := mounter.Mount("proc", target, "proc", unix.MS_NOSUID|unix.MS_NOEXEC|unix.MS_NODEV, ""); err != nil {
 		return err
 	}
 
@@ -87,19 +88,19 @@ func MountProc(base string) error {
 		if dir {
 			// Mask directory with an empty (read-only) tmpfs
 			// (read-only avoids writes leaking into the mask)
-			if err := unix.Mount("tmpfs", t, "tmpfs",
+			if err := mounter.Mount("tmpfs", t, "tmpfs",
 				unix.MS_NOSUID|unix.MS_NOEXEC|unix.MS_NODEV|unix.MS_RDONLY, "size=0"); err != nil {
 				// Best-effort: some proc subdirs may refuse; continue
 				continue
 			}
 		} else {
 			// Mask file by bind-mounting /dev/null on top, then RO remount
-			if err := unix.Mount("/dev/null", t, "", unix.MS_BIND, ""); err != nil {
+			if err := mounter.Mount("/dev/null", t, "", unix.MS_BIND, ""); err != nil {
 				continue
 			}
-			if err := unix.Mount("", t, "", unix.MS_BIND|unix.MS_REMOUNT|unix.MS_RDONLY|
+			if err := mounter.Mount("", t, "", unix.MS_BIND|unix.MS_REMOUNT|unix.MS_RDONLY|
 				unix.MS_NOSUID|unix.MS_NODEV|unix.MS_NOEXEC, ""); err != nil {
-				_ = unix.Unmount(t, unix.MNT_DETACH)
+				_ = mounter.Unmount(t, unix.MNT_DETACH)
 				continue
 			}
 		}
@@ -118,7 +119,7 @@ func MountProc(base string) error {
 		}
 
 		// First bind the path to itself
-		if err := unix.Mount(t, t, "", unix.MS_BIND, ""); err != nil {
+		if err := mounter.Mount(t, t, "", unix.MS_BIND, ""); err != nil {
 			// If bind fails, continue to next path
 			continue
 		}
@@ -131,8 +132,8 @@ func MountProc(base string) error {
 			unix.MS_NODEV |
 			unix.MS_NOEXEC)
 
-		if err := unix.Mount("", t, "", flags, ""); err != nil {
-			_ = unix.Unmount(t, unix.MNT_DETACH)
+		if err := mounter.Mount("", t, "", flags, ""); err != nil {
+			_ = mounter.Unmount(t, unix.MNT_DETACH)
 			continue
 		}
 	}
@@ -0,0 +1,100 @@
+//go:build linux
+
+package logger
+
+import (
+	"fmt"
+	"io"
+	"sync"
+	"sync/atomic"
+)
+
+/**
+ * A writer handing log records over to a background goroutine through a
+ * bounded queue, so that logging never blocks the caller on the output.
+ * Records are dropped, and accounted for, when the queue is full.
+ */
+type asyncWriter struct {
+	// The underlying output.
+	out io.Writer
+
+	// Queue of pending records.
+	queue chan []byte
+
+	// Number of dropped records.
+	dropped atomic.Uint64
+
+	// Guards the queue against writes after close.
+	mu     sync.RWMutex
+	closed bool
+
+	// Closed once all pending records have been written.
+	done chan struct{}
+}
+
+/**
+ * Creates an asynchronous writer.
+ * @param out the underlying output
+ * @param size the maximum number of pending records
+ * @return the asynchronous writer
+ */
+func newAsyncWriter(out io.Writer, size int) *asyncWriter {
+	w := &asyncWriter{
+		out:   out,
+		queue: make(chan []byte, size),
+		done:  make(chan struct{}),
+	}
+	go w.run()
+	return w
+}
+
+/**
+ * Writes pending records to the output.
+ */
+func (w *asyncWriter) run() {
+	defer close(w.done)
+	for b := range w.queue {
+		_, _ = w.out.Write(b)
+	}
+}
+
+/**
+ * Enqueues a record. The record is copied, as handlers reuse their buffers.
+ * @param p the record
+ * @return the length of the record, never an error
+ */
+func (w *asyncWriter) Write(p []byte) (int, error) {
+	w.mu.RLock()
+	defer w.mu.RUnlock()
+
+	if w.closed {
+		w.dropped.Add(1)
+		return len(p), nil
+	}
+	select {
+	case w.queue <- append([]byte(nil), p...):
+	default:
+		w.dropped.Add(1)
+	}
+	return len(p), nil
+}
+
+/**
+ * Writes pending records, and reports dropped ones, before returning.
+ */
+func (w *asyncWriter) Close() error {
+	w.mu.Lock()
+	if w.closed {
+		w.mu.Unlock()
+		return nil
+	}
+	w.closed = true
+	close(w.queue)
+	w.mu.Unlock()
+
+	<-w.done
+	if n := w.dropped.Load(); n > 0 {
+		_, _ = fmt.Fprintf(w.out, "microbox: %d log records dropped\n", n)
+	}
+	return nil
+}
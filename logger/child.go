@@ -0,0 +1,167 @@
+//go:build linux
+
+package logger
+
+import (
+	"bufio"
+	"context"
+	"encoding/json"
+	"fmt"
+	"log/slog"
+	"os"
+	"sort"
+
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * A log buffer for the init stage of sandboxed processes. The buffer is
+ * filled without any I/O, and shipped to the supervisor in a single
+ * write before the init stage executes its command or exits.
+ */
+type ChildBuffer struct {
+	// Pre-allocated storage for log records.
+	buf []byte
+
+	// Number of records which did not fit.
+	dropped int
+
+	// Write end of the pipe to the supervisor.
+	fd int
+}
+
+/**
+ * Allocates a child log buffer. Called in the child.
+ * @param fd the write end of the pipe to the supervisor
+ * @param size the capacity of the buffer in bytes
+ * @return the buffer
+ */
+func NewChildBuffer(fd int, size int) *ChildBuffer {
+	return &ChildBuffer{buf: make([]byte, 0, size), fd: fd}
+}
+
+/**
+ * Appends a record to the buffer, dropping it if it does not fit.
+ */
+func (b *ChildBuffer) Write(p []byte) (int, error) {
+	if len(b.buf)+len(p) > cap(b.buf) {
+		b.dropped++
+		return len(p), nil
+	}
+	b.buf = append(b.buf, p...)
+	return len(p), nil
+}
+
+/**
+ * Creates the logger of the child, writing into the buffer. Records are
+ * buffered as JSON, and re-emitted by the supervisor logger once
+ * shipped. Called in the child.
+ * @param level the level of the supervisor logger (see MinLevel)
+ * @return the child logger
+ */
+func (b *ChildBuffer) Attach(level slog.Level) *slog.Logger {
+	return slog.New(slog.NewJSONHandler(b, &slog.HandlerOptions{
+		Level: level,
+	})).With(slog.String("side", "child"))
+}
+
+/**
+ * @return the lowest level enabled on a logger.
+ */
+func MinLevel(l *slog.Logger) slog.Level {
+	for _, level := range []slog.Level{slog.LevelDebug, slog.LevelInfo, slog.LevelWarn} {
+		if l.Enabled(context.Background(), level) {
+			return level
+		}
+	}
+	return slog.LevelError
+}
+
+/**
+ * Ships the buffered records to the supervisor, then reports the
+ * records which did not fit, straight to the pipe as the buffer may be
+ * full. Called in the child.
+ */
+func (b *ChildBuffer) Flush() {
+	b.ship(b.buf)
+	b.buf = b.buf[:0]
+	if b.dropped > 0 {
+		b.ship(fmt.Appendf(nil, `{"level":"WARN","msg":"child log records dropped","count":%d,"side":"child"}`+"\n", b.dropped))
+		b.dropped = 0
+	}
+}
+
+/**
+ * Writes records to the pipe to the supervisor.
+ * @param p the records
+ */
+func (b *ChildBuffer) ship(p []byte) {
+	for len(p) > 0 {
+		n, err := unix.Write(b.fd, p)
+		if err == unix.EINTR {
+			continue
+		}
+		if err != nil {
+			return
+		}
+		p = p[n:]
+	}
+}
+
+/**
+ * Ships the buffered records followed by an empty line, and closes the
+ * write end of the pipe, so that the supervisor stops forwarding records
+ * before the child executes its command. Later records are discarded.
+ * Called in the child.
+ */
+func (b *ChildBuffer) Close() {
+	b.Flush()
+	b.buf = append(b.buf, '\n')
+	b.Flush()
+	_ = unix.Close(b.fd)
+	b.fd = -1
+}
+
+/**
+ * Forwards the records shipped by a child to the supervisor logger,
+ * until the child executes its command, closes its buffer or exits.
+ * @param fd the read end of the child log pipe
+ * @param log the supervisor logger
+ * @return whether the child closed its buffer
+ */
+func ForwardChild(fd int, log *slog.Logger) bool {
+	f := os.NewFile(uintptr(fd), "child-log")
+	defer f.Close()
+
+	sc := bufio.NewScanner(f)
+	sc.Buffer(make([]byte, 0, 4096), 64*1024)
+	for sc.Scan() {
+		if len(sc.Bytes()) == 0 {
+			return true
+		}
+		var rec map[string]any
+		if err := json.Unmarshal(sc.Bytes(), &rec); err != nil {
+			continue
+		}
+		var level slog.Level
+		if s, ok := rec[slog.LevelKey].(string); ok {
+			_ = level.UnmarshalText([]byte(s))
+		}
+		msg, _ := rec[slog.MessageKey].(string)
+		delete(rec, slog.LevelKey)
+		delete(rec, slog.MessageKey)
+		delete(rec, slog.TimeKey)
+
+		keys := make([]string, 0, len(rec))
+		for k := range rec {
+			keys = append(keys, k)
+		}
+		sort.Strings(keys)
+		attrs := make([]slog.Attr, 0, len(keys))
+		for _, k := range keys {
+			attrs = append(attrs, slog.Any(k, rec[k]))
+		}
+		log.LogAttrs(context.Background(), level, msg, attrs...)
+	}
+	return false
+}
@@ -3,8 +3,23 @@
 package logger
 
 import (
+	"fmt"
+	"io"
 	"log/slog"
 	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// Maximum number of log records pending output.
+	logQueueSize = 4096
+
+	// Default log output, apart from the outputs inherited by sandboxed programs.
+	DefaultOutput = "/run/microbox/microbox.log"
 )
 
 /**
@@ -26,46 +41,83 @@ const (
 type LoggerOpts struct {
 	LogLevel  slog.Level
 	LogFormat LogFormat
-}
 
-/**
- * The global logger instance.
- */
-var Log *slog.Logger
+	// Log output: `stdout`, `stderr`, `fd:N` or a file path (defaults to DefaultOutput).
+	Output string
+}
 
 /**
- * Creates a global structured logger.
+ * Creates a structured logger writing to an asynchronous output.
  * @param opts the logger options.
- * @return the created logger instance.
+ * @return the created logger instance, and its output, to close before
+ * the process exits so that pending records are written.
  */
-func CreateLogger(opts *LoggerOpts) *slog.Logger {
-	var logHandler slog.Handler
-
-	if Log != nil {
-		return Log
+func CreateLogger(opts *LoggerOpts) (*slog.Logger, io.Closer) {
+	// Open the log output.
+	out, err := OpenOutput(opts.Output)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "microbox: %v, logging to stderr\n", err)
+		out = os.Stderr
 	}
+	output := newAsyncWriter(out, logQueueSize)
 
+	// Create a new structured logger, with context fields.
+	log := slog.New(newHandler(output, opts)).With(
+		slog.Int("pid", os.Getpid()),
+	)
+	return log, output
+}
+
+/**
+ * Creates a log handler.
+ * @param w the output of the handler
+ * @param opts the logger options
+ * @return the log handler
+ */
+func newHandler(w io.Writer, opts *LoggerOpts) slog.Handler {
 	handlerOpts := &slog.HandlerOptions{
 		Level: opts.LogLevel,
 	}
 
 	// Choose the log format.
 	if opts.LogFormat == LogText {
-		logHandler = slog.NewTextHandler(os.Stdout, handlerOpts)
-	} else {
-		logHandler = slog.NewJSONHandler(os.Stdout, handlerOpts)
+		return slog.NewTextHandler(w, handlerOpts)
 	}
+	return slog.NewJSONHandler(w, handlerOpts)
+}
 
-	// Create a new structured logger.
-	logger := slog.New(logHandler)
-
-	// Add context fields.
-	Log = logger.With(
-		slog.Int("pid", os.Getpid()),
-	)
-
-	// Set as the default logger.
-	slog.SetDefault(Log)
-
-	return Log
+/**
+ * Opens a log output.
+ * @param spec the output: `stdout`, `stderr`, `fd:N` or a file path, DefaultOutput if empty
+ * @return the output, or error if any
+ */
+func OpenOutput(spec string) (io.Writer, error) {
+	switch {
+	case spec == "stderr":
+		return os.Stderr, nil
+	case spec == "stdout":
+		return os.Stdout, nil
+	case strings.HasPrefix(spec, "fd:"):
+		fd, err := strconv.Atoi(strings.TrimPrefix(spec, "fd:"))
+		if err != nil || fd < 0 {
+			return nil, fmt.Errorf("bad log output %q", spec)
+		}
+		// Do not leak the output to sandboxed processes.
+		if fd > 2 {
+			unix.CloseOnExec(fd)
+		}
+		return os.NewFile(uintptr(fd), spec), nil
+	default:
+		if spec == "" {
+			spec = DefaultOutput
+			if err := os.MkdirAll(filepath.Dir(spec), 0o755); err != nil {
+				return nil, fmt.Errorf("open log output: %w", err)
+			}
+		}
+		f, err := os.OpenFile(spec, os.O_WRONLY|os.O_CREATE|os.O_APPEND, 0o640)
+		if err != nil {
+			return nil, fmt.Errorf("open log output: %w", err)
+		}
+		return f, nil
+	}
 }
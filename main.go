@@ -4,49 +4,313 @@ package main
 
 import (
 	"context"
+	"encoding/json"
 	"fmt"
 	"log/slog"
+	"net"
+	"net/http"
 	"os"
+	"strconv"
+	"time"
 
+	"github.com/HQarroum/microbox/bench"
+	"github.com/HQarroum/microbox/events"
 	"github.com/HQarroum/microbox/logger"
+	"github.com/HQarroum/microbox/metrics"
+	mnet "github.com/HQarroum/microbox/net"
 	"github.com/HQarroum/microbox/options"
+	"github.com/HQarroum/microbox/profiling"
 	"github.com/HQarroum/microbox/sandbox"
+	"github.com/HQarroum/microbox/tracing"
 )
 
 /**
  * Application entry point.
  */
 func main() {
+	// Set up the sandbox, when started as its init stage.
+	if sandbox.IsInit() {
+		sandbox.RunInit()
+	}
+
+	// Run the seccomp probe, when started by the benchmarks in a sandbox.
+	if bench.IsSeccompProbe() {
+		if err := bench.RunSeccompProbe(); err != nil {
+			fmt.Fprintln(os.Stderr, "seccomp probe:", err)
+			os.Exit(1)
+		}
+		os.Exit(0)
+	}
+
 	// Parse command-line options.
-	opts, err := options.ParseCli(context.Background(), os.Args)
+	inv, err := options.ParseCli(context.Background(), os.Args)
 	if err != nil {
 		fmt.Fprintln(os.Stderr, "parsing error:", err)
 		os.Exit(1)
-	} else if opts == nil {
+	} else if inv == nil {
 		// No options means help or version was printed.
 		os.Exit(0)
 	}
 
 	// Create the application logger.
-	log := logger.CreateLogger(&logger.LoggerOpts{
-		LogLevel:  opts.LogLevel,
-		LogFormat: opts.LogFormat,
-	})
-	log.Info("Options", slog.Any("opts", opts))
+	log, logOutput := logger.CreateLogger(inv.Logger)
+	slog.SetDefault(log)
+	log.Info("Options", slog.Any("opts", inv))
+
+	// Fatal errors are also written to the terminal, as the log output
+	// is a file by default.
+	fatal := func(msg string, err error) {
+		log.Error(msg, slog.Any("err", err))
+		if inv.Logger.Output != "stderr" {
+			fmt.Fprintf(os.Stderr, "microbox: %s: %v\n", msg, err)
+		}
+		exit(1)
+	}
+
+	// Create the runtime of the sandboxes.
+	rt = sandbox.NewRuntime(sandbox.RuntimeOptions{Logger: log, LogOutput: logOutput})
+
+	// Profile the supervisor.
+	if inv.Profiling != (profiling.Options{}) {
+		stop, err := profiling.Start(inv.Profiling)
+		if err != nil {
+			fatal("error while starting profiling", err)
+		}
+		atExit = append(atExit, func() {
+			if err := stop(); err != nil {
+				log.Error("error while writing profiles", slog.Any("err", err))
+			}
+		})
+	}
+
+	// Expose metrics, and profiles if enabled, in long-running modes.
+	if inv.MetricsAddr != "" {
+		var handlers map[string]http.Handler
+		if inv.Pprof {
+			handlers = profiling.Handlers()
+		}
+		stop, err := metrics.Serve(inv.MetricsAddr, rt.Metrics(), handlers)
+		if err != nil {
+			fatal("error while serving metrics", err)
+		}
+		atExit = append(atExit, stop)
+	}
+
+	// Export the lifecycle of sandboxes as trace spans on exit.
+	if inv.TraceSpans != "" && inv.Sandbox != nil {
+		tracer := tracing.New(inv.TraceFormat)
+		inv.Sandbox.Tracer = tracer
+		onError := func(err error) {
+			log.Error("error while exporting trace spans", slog.Any("err", err))
+		}
+
+		// Long-running modes also export periodically, the tracer only
+		// keeping the most recent spans.
+		var stop func()
+		if inv.Command == options.CommandZygote || inv.Command == options.CommandBatch {
+			stop = tracer.WriteFileEvery(inv.TraceSpans, traceExportInterval, onError)
+		}
+		atExit = append(atExit, func() {
+			if stop != nil {
+				stop()
+			}
+			if err := tracer.WriteFile(inv.TraceSpans); err != nil {
+				onError(err)
+			}
+			if dropped := tracer.Dropped(); dropped > 0 {
+				log.Warn("trace spans dropped", slog.Uint64("count", dropped))
+			}
+		})
+	}
+
+	// Publish the lifecycle events of sandboxes.
+	if inv.Events != "" && inv.Sandbox != nil {
+		stream, err := events.Open(inv.Events)
+		if err != nil {
+			fatal("error while opening event stream", err)
+		}
+		inv.Sandbox.Events = stream
+		atExit = append(atExit, func() {
+			if dropped := stream.Close(); dropped > 0 {
+				log.Warn("lifecycle events dropped", slog.Uint64("count", dropped))
+			}
+		})
+	}
+
+	var box *sandbox.SandboxProcess
+	switch inv.Command {
+
+	// Checkpoint a running sandbox.
+	case options.CommandCheckpoint:
+		if err := rt.Checkpoint(inv.Target, inv.Checkpoint); err != nil {
+			fatal("error while checkpointing sandbox", err)
+		}
+		exit(0)
+
+	// Restore a checkpointed sandbox.
+	case options.CommandRestore:
+		box, err = rt.Restore(inv.ImageDir)
+		if err != nil {
+			fatal("error while restoring sandbox", err)
+		}
+
+	// Create a container from an OCI bundle, waiting to be started.
+	case options.CommandCreate:
+		pid, err := rt.CreateContainer(inv.Target, inv.Bundle, inv.Annotations, inv.Sandbox)
+		if err != nil {
+			fatal("error while creating container", err)
+		}
+		if inv.PidFile != "" {
+			if err := os.WriteFile(inv.PidFile, []byte(strconv.Itoa(pid)), 0o644); err != nil {
+				fatal("error while writing pid file", err)
+			}
+		}
+		exit(0)
+
+	// Start a created container.
+	case options.CommandStart:
+		if err := sandbox.StartContainer(inv.Target); err != nil {
+			fatal("error while starting container", err)
+		}
+		exit(0)
+
+	// Print the state of a container.
+	case options.CommandState:
+		st, err := sandbox.LoadContainerState(inv.Target)
+		if err != nil {
+			fatal("error while reading container state", err)
+		}
+		b, _ := json.MarshalIndent(st, "", "  ")
+		fmt.Println(string(b))
+		exit(0)
+
+	// Signal the process of a container.
+	case options.CommandKill:
+		if err := sandbox.KillContainer(inv.Target, inv.Signal); err != nil {
+			fatal("error while signaling container", err)
+		}
+		exit(0)
+
+	// Delete a stopped container.
+	case options.CommandDelete:
+		if err := rt.DeleteContainer(inv.Target, inv.Force); err != nil {
+			fatal("error while deleting container", err)
+		}
+		exit(0)
+
+	// Run benchmarks.
+	case options.CommandBench:
+		if err := bench.Run(*inv.Bench, os.Stdout); err != nil {
+			fatal("error while running benchmarks", err)
+		}
+		exit(0)
+
+	// Create a named network namespace.
+	case options.CommandNetCreate:
+		ns, err := rt.Network().CreateNamedNetns(context.Background(), inv.Target)
+		if err != nil {
+			fatal("error while creating network namespace", err)
+		}
+		fmt.Printf("%s\t%s\t%s\n", ns.Name, ns.IP, ns.Path)
+		exit(0)
+
+	// Delete a named network namespace.
+	case options.CommandNetDelete:
+		if err := rt.Network().DeleteNamedNetns(inv.Target); err != nil {
+			fatal("error while deleting network namespace", err)
+		}
+		exit(0)
+
+	// List the named network namespaces.
+	case options.CommandNetList:
+		list, err := mnet.ListNamedNetns()
+		if err != nil {
+			fatal("error while listing network namespaces", err)
+		}
+		for _, ns := range list {
+			fmt.Printf("%s\t%s\t%s\n", ns.Name, ns.IP, ns.Path)
+		}
+		exit(0)
+
+	// Run a fork-server serving job requests.
+	case options.CommandZygote:
+		z, err := rt.NewZygote(inv.Sandbox)
+		if err != nil {
+			fatal("error while creating zygote", err)
+		}
+		box = z.Sandbox()
+		_ = os.Remove(inv.Socket)
+		l, err := net.Listen("unix", inv.Socket)
+		if err != nil {
+			log.Error("error while listening for jobs", slog.Any("err", err))
+			_ = box.Kill()
+		} else {
+			go z.Serve(l)
+		}
+
+	// Run a queue of jobs.
+	case options.CommandBatch:
+		failed := rt.RunBatch(inv.Sandbox, inv.Jobs, &sandbox.BatchOptions{
+			Recycle:   inv.Recycle,
+			Admission: sandbox.NewAdmission(*inv.Admission),
+		})
+		log.Info("batch done", slog.Int("jobs", len(inv.Jobs)), slog.Int("failed", failed))
+		if failed > 0 {
+			exit(1)
+		}
+		exit(0)
 
 	// Spawn a new sandboxed process.
-	box, err := sandbox.NewSandbox(opts)
-	if err != nil {
-		log.Error("error while creating sandbox", slog.Any("err", err))
-		os.Exit(1)
+	default:
+		box, err = rt.NewSandbox(context.Background(), inv.Sandbox)
+		if err != nil {
+			fatal("error while creating sandbox", err)
+		}
 	}
 
 	// Wait for the sandboxed process to finish.
 	code, err := box.Wait()
+	if inv.Socket != "" {
+		_ = os.Remove(inv.Socket)
+	}
 	if err != nil {
-		log.Error("error while executing for sandbox", slog.Any("err", err))
-		os.Exit(1)
+		fatal("error while executing for sandbox", err)
+	}
+
+	// Summarize the performance counters, off the output of the sandbox.
+	if counts := box.PerfCounts(); counts != nil {
+		fmt.Fprintln(os.Stderr, "perf:", counts)
 	}
 
+	exit(code)
+}
+
+/**
+ * Interval between the trace exports of long-running modes.
+ */
+const traceExportInterval = 10 * time.Second
+
+/**
+ * Functions run before exiting.
+ */
+var atExit []func()
+
+/**
+ * Runtime of the sandboxes, closed on exit.
+ */
+var rt *sandbox.Runtime
+
+/**
+ * Runs exit functions, closes the runtime, which writes pending logs,
+ * and exits with the given code.
+ * @param code the exit code
+ */
+func exit(code int) {
+	for _, f := range atExit {
+		f()
+	}
+	if rt != nil {
+		_ = rt.Close(context.Background())
+	}
 	os.Exit(code)
 }
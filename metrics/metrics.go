@@ -0,0 +1,405 @@
+//go:build linux
+
+package metrics
+
+import (
+	"bufio"
+	"fmt"
+	"io"
+	"math"
+	"net/http"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+)
+
+/**
+ * A sample of a metric, as reported by a collector function.
+ */
+type Sample struct {
+	// Label values, in the order of the metric label names.
+	Labels []string
+
+	// Sample value.
+	Value float64
+}
+
+/**
+ * A metric family, written in the Prometheus text format.
+ */
+type family interface {
+	write(w *bufio.Writer)
+}
+
+/**
+ * A set of metric families exposed together.
+ */
+type Registry struct {
+	mu       sync.Mutex
+	families []family
+}
+
+/**
+ * Creates an empty registry.
+ * @return the registry
+ */
+func NewRegistry() *Registry {
+	return &Registry{}
+}
+
+/**
+ * Adds a metric family to the registry.
+ */
+func (r *Registry) register(f family) {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	r.families = append(r.families, f)
+}
+
+/**
+ * Writes all metric families in the Prometheus text format.
+ * @param w the writer
+ * @return error if any
+ */
+func (r *Registry) WriteText(w io.Writer) error {
+	r.mu.Lock()
+	families := append([]family(nil), r.families...)
+	r.mu.Unlock()
+
+	bw := bufio.NewWriter(w)
+	for _, f := range families {
+		f.write(bw)
+	}
+	return bw.Flush()
+}
+
+/**
+ * @return an HTTP handler exposing the registry.
+ */
+func (r *Registry) Handler() http.Handler {
+	return http.HandlerFunc(func(w http.ResponseWriter, _ *http.Request) {
+		w.Header().Set("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+		_ = r.WriteText(w)
+	})
+}
+
+/**
+ * The description shared by all metric kinds.
+ */
+type desc struct {
+	name   string
+	help   string
+	kind   string
+	labels []string
+}
+
+/**
+ * Writes the header of a metric family.
+ */
+func (d *desc) header(w *bufio.Writer) {
+	fmt.Fprintf(w, "# HELP %s %s\n# TYPE %s %s\n", d.name, d.help, d.name, d.kind)
+}
+
+/**
+ * Writes a sample line.
+ */
+func (d *desc) sample(w *bufio.Writer, suffix string, values []string, extra string, v float64) {
+	w.WriteString(d.name)
+	w.WriteString(suffix)
+	if len(d.labels) > 0 || extra != "" {
+		w.WriteByte('{')
+		for i, l := range d.labels {
+			if i > 0 {
+				w.WriteByte(',')
+			}
+			w.WriteString(l)
+			w.WriteString(`="`)
+			w.WriteString(escape(values[i]))
+			w.WriteByte('"')
+		}
+		if extra != "" {
+			if len(d.labels) > 0 {
+				w.WriteByte(',')
+			}
+			w.WriteString(extra)
+		}
+		w.WriteByte('}')
+	}
+	w.WriteByte(' ')
+	w.WriteString(formatFloat(v))
+	w.WriteByte('\n')
+}
+
+/**
+ * A set of values indexed by label values.
+ */
+type series[T any] struct {
+	mu     sync.Mutex
+	values map[string]*T
+	keys   map[string][]string
+}
+
+/**
+ * @return the value of the given label values, created if needed.
+ */
+func (s *series[T]) get(values []string) *T {
+	key := strings.Join(values, "\xff")
+	if s.values == nil {
+		s.values = make(map[string]*T)
+		s.keys = make(map[string][]string)
+	}
+	v, ok := s.values[key]
+	if !ok {
+		v = new(T)
+		s.values[key] = v
+		s.keys[key] = append([]string(nil), values...)
+	}
+	return v
+}
+
+/**
+ * Calls f on each value, in a stable order.
+ */
+func (s *series[T]) each(f func(values []string, v *T)) {
+	keys := make([]string, 0, len(s.values))
+	for k := range s.values {
+		keys = append(keys, k)
+	}
+	sort.Strings(keys)
+	for _, k := range keys {
+		f(s.keys[k], s.values[k])
+	}
+}
+
+/**
+ * A monotonically increasing counter.
+ */
+type Counter struct {
+	desc
+	s series[float64]
+}
+
+/**
+ * Creates a counter in the registry.
+ * @param name the metric name
+ * @param help the metric description
+ * @param labels the label names
+ * @return the counter
+ */
+func (r *Registry) NewCounter(name, help string, labels ...string) *Counter {
+	c := &Counter{desc: desc{name, help, "counter", labels}}
+	r.register(c)
+	return c
+}
+
+/**
+ * Adds a value to the counter.
+ * @param v the value to add
+ * @param values the label values
+ */
+func (c *Counter) Add(v float64, values ...string) {
+	c.s.mu.Lock()
+	*c.s.get(values) += v
+	c.s.mu.Unlock()
+}
+
+/**
+ * Increments the counter.
+ * @param values the label values
+ */
+func (c *Counter) Inc(values ...string) {
+	c.Add(1, values...)
+}
+
+func (c *Counter) write(w *bufio.Writer) {
+	c.header(w)
+	c.s.mu.Lock()
+	defer c.s.mu.Unlock()
+	c.s.each(func(values []string, v *float64) {
+		c.sample(w, "", values, "", *v)
+	})
+}
+
+/**
+ * A value which can go up and down.
+ */
+type Gauge struct {
+	desc
+	s series[float64]
+}
+
+/**
+ * Creates a gauge in the registry.
+ * @param name the metric name
+ * @param help the metric description
+ * @param labels the label names
+ * @return the gauge
+ */
+func (r *Registry) NewGauge(name, help string, labels ...string) *Gauge {
+	g := &Gauge{desc: desc{name, help, "gauge", labels}}
+	r.register(g)
+	return g
+}
+
+/**
+ * Adds a value, possibly negative, to the gauge.
+ * @param v the value to add
+ * @param values the label values
+ */
+func (g *Gauge) Add(v float64, values ...string) {
+	g.s.mu.Lock()
+	*g.s.get(values) += v
+	g.s.mu.Unlock()
+}
+
+/**
+ * Sets the value of the gauge.
+ * @param v the value
+ * @param values the label values
+ */
+func (g *Gauge) Set(v float64, values ...string) {
+	g.s.mu.Lock()
+	*g.s.get(values) = v
+	g.s.mu.Unlock()
+}
+
+func (g *Gauge) write(w *bufio.Writer) {
+	g.header(w)
+	g.s.mu.Lock()
+	defer g.s.mu.Unlock()
+	g.s.each(func(values []string, v *float64) {
+		g.sample(w, "", values, "", *v)
+	})
+}
+
+/**
+ * The observations of a histogram for a set of label values.
+ */
+type histogramValue struct {
+	counts []uint64
+	count  uint64
+	sum    float64
+}
+
+/**
+ * A histogram of observed values.
+ */
+type Histogram struct {
+	desc
+	buckets []float64
+	s       series[histogramValue]
+}
+
+/**
+ * Default histogram buckets for latencies, in seconds.
+ */
+var LatencyBuckets = []float64{
+	0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+	0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+}
+
+/**
+ * Creates a histogram in the registry.
+ * @param name the metric name
+ * @param help the metric description
+ * @param buckets the upper bounds of the buckets, in increasing order
+ * @param labels the label names
+ * @return the histogram
+ */
+func (r *Registry) NewHistogram(name, help string, buckets []float64, labels ...string) *Histogram {
+	h := &Histogram{desc: desc{name, help, "histogram", labels}, buckets: buckets}
+	r.register(h)
+	return h
+}
+
+/**
+ * Records an observation.
+ * @param v the observed value
+ * @param values the label values
+ */
+func (h *Histogram) Observe(v float64, values ...string) {
+	h.s.mu.Lock()
+	defer h.s.mu.Unlock()
+
+	hv := h.s.get(values)
+	if hv.counts == nil {
+		hv.counts = make([]uint64, len(h.buckets))
+	}
+	if i := sort.SearchFloat64s(h.buckets, v); i < len(h.buckets) {
+		hv.counts[i]++
+	}
+	hv.count++
+	hv.sum += v
+}
+
+func (h *Histogram) write(w *bufio.Writer) {
+	h.header(w)
+	h.s.mu.Lock()
+	defer h.s.mu.Unlock()
+	h.s.each(func(values []string, hv *histogramValue) {
+		var cum uint64
+		for i, b := range h.buckets {
+			cum += hv.counts[i]
+			h.sample(w, "_bucket", values, `le="`+formatFloat(b)+`"`, float64(cum))
+		}
+		h.sample(w, "_bucket", values, `le="+Inf"`, float64(hv.count))
+		h.sample(w, "_sum", values, "", hv.sum)
+		h.sample(w, "_count", values, "", float64(hv.count))
+	})
+}
+
+/**
+ * A metric whose samples are computed when it is scraped.
+ */
+type Func struct {
+	desc
+	collect func() []Sample
+}
+
+/**
+ * Creates a metric computed on scrape in the registry.
+ * @param name the metric name
+ * @param help the metric description
+ * @param kind the metric type (counter or gauge)
+ * @param collect the function computing the samples
+ * @param labels the label names
+ * @return the metric
+ */
+func (r *Registry) NewFunc(name, help, kind string, collect func() []Sample, labels ...string) *Func {
+	f := &Func{desc: desc{name, help, kind, labels}, collect: collect}
+	r.register(f)
+	return f
+}
+
+func (f *Func) write(w *bufio.Writer) {
+	f.header(w)
+	for _, s := range f.collect() {
+		f.sample(w, "", s.Labels, "", s.Value)
+	}
+}
+
+/**
+ * Escapes a label value.
+ */
+func escape(s string) string {
+	if !strings.ContainsAny(s, "\\\"\n") {
+		return s
+	}
+	return strings.NewReplacer(`\`, `\\`, `"`, `\"`, "\n", `\n`).Replace(s)
+}
+
+/**
+ * Formats a sample value.
+ */
+func formatFloat(v float64) string {
+	switch {
+	case math.IsInf(v, 1):
+		return "+Inf"
+	case math.IsInf(v, -1):
+		return "-Inf"
+	case math.IsNaN(v):
+		return "NaN"
+	}
+	return strconv.FormatFloat(v, 'g', -1, 64)
+}
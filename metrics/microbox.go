@@ -0,0 +1,58 @@
+//go:build linux
+
+package metrics
+
+/**
+ * Metrics recorded by a microbox supervisor.
+ */
+type Supervisor struct {
+	// Latency of each phase of the creation of a sandbox.
+	SpawnPhase *Histogram
+
+	// Failures to release the resources of a sandbox.
+	CleanupFailures *Counter
+
+	// Time waiting for the IPAM database locks.
+	IpamLockWait *Histogram
+
+	// Lookups in the compiled seccomp program cache.
+	SeccompCache *Counter
+
+	// System calls emulated by the supervisor on behalf of sandboxes.
+	SeccompNotifications *Counter
+}
+
+/**
+ * Creates the metrics of a supervisor in a registry.
+ * @param r the registry
+ * @return the metrics
+ */
+func NewSupervisor(r *Registry) *Supervisor {
+	return &Supervisor{
+		SpawnPhase: r.NewHistogram(
+			"microbox_spawn_phase_seconds",
+			"Latency of the phases of the creation of a sandbox.",
+			LatencyBuckets, "phase",
+		),
+		CleanupFailures: r.NewCounter(
+			"microbox_cleanup_failures_total",
+			"Failures to release a resource of a sandbox, by resource (cgroup, veth, lease, policy, layer, hugepages, netns).",
+			"resource",
+		),
+		IpamLockWait: r.NewHistogram(
+			"microbox_ipam_lock_wait_seconds",
+			"Time waiting for the IPAM database locks, within and across supervisors.",
+			LatencyBuckets,
+		),
+		SeccompCache: r.NewCounter(
+			"microbox_seccomp_cache_total",
+			"Lookups in the compiled seccomp program cache, by result (hit, miss).",
+			"result",
+		),
+		SeccompNotifications: r.NewCounter(
+			"microbox_seccomp_notifications_total",
+			"System calls notified to the supervisor by seccomp filters, by system call and result (ok, denied).",
+			"syscall", "result",
+		),
+	}
+}
@@ -0,0 +1,59 @@
+//go:build linux
+
+package metrics
+
+import (
+	"errors"
+	"fmt"
+	stdnet "net"
+	"net/http"
+	"os"
+	"strings"
+	"time"
+)
+
+/**
+ * Listens on a metrics address.
+ * @param addr a TCP `host:port`, or `unix:PATH` for a Unix socket
+ * @return the listener, or error if any
+ */
+func Listen(addr string) (stdnet.Listener, error) {
+	if path, ok := strings.CutPrefix(addr, "unix:"); ok {
+		if err := os.Remove(path); err != nil && !errors.Is(err, os.ErrNotExist) {
+			return nil, err
+		}
+		return stdnet.Listen("unix", path)
+	}
+	return stdnet.Listen("tcp", addr)
+}
+
+/**
+ * Serves a registry on `/metrics` in the background.
+ * @param addr a TCP `host:port`, or `unix:PATH` for a Unix socket
+ * @param r the registry
+ * @param handlers additional handlers to serve, by path
+ * @return a function stopping the server, or error if any
+ */
+func Serve(addr string, r *Registry, handlers map[string]http.Handler) (func(), error) {
+	l, err := Listen(addr)
+	if err != nil {
+		return nil, fmt.Errorf("listen on %s: %w", addr, err)
+	}
+
+	mux := http.NewServeMux()
+	mux.Handle("/metrics", r.Handler())
+	for path, h := range handlers {
+		mux.Handle(path, h)
+	}
+
+	srv := &http.Server{Handler: mux, ReadHeaderTimeout: 5 * time.Second}
+	go func() {
+		_ = srv.Serve(l)
+	}()
+	return func() {
+		_ = srv.Close()
+		if path, ok := strings.CutPrefix(addr, "unix:"); ok {
+			_ = os.Remove(path)
+		}
+	}, nil
+}
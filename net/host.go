@@ -0,0 +1,219 @@
+//go:build linux
+
+package net
+
+import (
+	"runtime"
+	"sync"
+
+	"github.com/HQarroum/microbox/metrics"
+	"github.com/vishvananda/netlink"
+	"github.com/vishvananda/netns"
+)
+
+/**
+ * Netlink operations on links, addresses and routes. The host
+ * implementation operates on the network namespaces of the host, and can
+ * be replaced by in-memory tables to exercise the network setup of
+ * sandboxes without root.
+ */
+type Netlink interface {
+	LinkByName(name string) (netlink.Link, error)
+	LinkAdd(link netlink.Link) error
+	LinkDel(link netlink.Link) error
+	LinkSetUp(link netlink.Link) error
+	LinkSetName(link netlink.Link, name string) error
+	LinkSetMaster(link, master netlink.Link) error
+	AddrList(link netlink.Link, family int) ([]netlink.Addr, error)
+	AddrAdd(link netlink.Link, addr *netlink.Addr) error
+	RouteReplace(route *netlink.Route) error
+
+	// Moves a link to the network namespace of a sandbox, given by
+	// path if set, or by PID otherwise.
+	LinkSetNs(link netlink.Link, childPID int, nsPath string) error
+
+	// Runs a function with the operations of the network namespace of a
+	// sandbox, given by path if set, or by PID otherwise.
+	InNetns(childPID int, nsPath string, f func(Netlink) error) error
+}
+
+/**
+ * Host-wide forwarding and NAT rules.
+ */
+type Firewall interface {
+	// Enables forwarding, and the forwarding and NAT rules of a bridge subnet.
+	EnableNAT(bridge, subnetCIDR string) error
+
+	// Adds the network policy of the sandbox with the given IP on a
+	// bridge, replacing any policy the IP still has.
+	AddPolicy(bridge, ip string, p *Policy) error
+
+	// Removes the network policy added for the given IP, if there is one.
+	RemovePolicy(ip string) error
+
+	// Removes the network policies of the IPs not kept, that supervisors
+	// could not remove before releasing their IP.
+	PrunePolicies(keep func(ip string) bool) error
+}
+
+/**
+ * The netlink operations of the host.
+ */
+type hostNetlink struct{}
+
+/**
+ * The forwarding, NAT and policy rules of the host.
+ */
+type hostFirewall struct {
+	// Serializes the setup of the policy table, and whether it is set up.
+	mu         sync.Mutex
+	tableReady bool
+
+	// Elements of the policy table installed for each IP.
+	policies map[string][]policyElement
+}
+
+/**
+ * Options of the network of a supervisor.
+ */
+type HostOptions struct {
+	// Netlink operations (defaults to the host ones).
+	Netlink Netlink
+
+	// Forwarding, NAT and policy rules (defaults to the host ones).
+	Firewall Firewall
+
+	// Metrics of the supervisor (defaults to unregistered metrics).
+	Metrics *metrics.Supervisor
+}
+
+/**
+ * The network of the host, as set up by a supervisor for its sandboxes.
+ * It serializes the setup of host-wide resources and the accesses to the
+ * IPAM database between the sandboxes it sets up concurrently.
+ */
+type Host struct {
+	nl      Netlink
+	fw      Firewall
+	metrics *metrics.Supervisor
+
+	// Serializes the setup of host-wide resources (bridge, iptables rules).
+	setupMu sync.Mutex
+
+	// Serializes the IPAM database accesses.
+	dbMu sync.Mutex
+
+	// Prunes, once, the network policies left for released IPs.
+	pruneOnce sync.Once
+}
+
+/**
+ * Creates the network of a supervisor.
+ * @param opts the options
+ * @return the network
+ */
+func NewHost(opts HostOptions) *Host {
+	h := &Host{nl: opts.Netlink, fw: opts.Firewall, metrics: opts.Metrics}
+	if h.nl == nil {
+		h.nl = hostNetlink{}
+	}
+	if h.fw == nil {
+		h.fw = &hostFirewall{}
+	}
+	if h.metrics == nil {
+		h.metrics = metrics.NewSupervisor(metrics.NewRegistry())
+	}
+	return h
+}
+
+func (hostNetlink) LinkByName(name string) (netlink.Link, error) {
+	return netlink.LinkByName(name)
+}
+
+func (hostNetlink) LinkAdd(link netlink.Link) error {
+	return netlink.LinkAdd(link)
+}
+
+func (hostNetlink) LinkDel(link netlink.Link) error {
+	return netlink.LinkDel(link)
+}
+
+func (hostNetlink) LinkSetUp(link netlink.Link) error {
+	return netlink.LinkSetUp(link)
+}
+
+func (hostNetlink) LinkSetName(link netlink.Link, name string) error {
+	return netlink.LinkSetName(link, name)
+}
+
+func (hostNetlink) LinkSetMaster(link, master netlink.Link) error {
+	return netlink.LinkSetMaster(link, master)
+}
+
+func (hostNetlink) AddrList(link netlink.Link, family int) ([]netlink.Addr, error) {
+	return netlink.AddrList(link, family)
+}
+
+func (hostNetlink) AddrAdd(link netlink.Link, addr *netlink.Addr) error {
+	return netlink.AddrAdd(link, addr)
+}
+
+func (hostNetlink) RouteReplace(route *netlink.Route) error {
+	return netlink.RouteReplace(route)
+}
+
+func (hostNetlink) LinkSetNs(link netlink.Link, childPID int, nsPath string) error {
+	target, err := openNetns(childPID, nsPath)
+	if err != nil {
+		return err
+	}
+	defer target.Close()
+	return netlink.LinkSetNsFd(link, int(target))
+}
+
+func (h hostNetlink) InNetns(childPID int, nsPath string, f func(Netlink) error) error {
+	// Namespace switches apply to the current thread only.
+	runtime.LockOSThread()
+
+	// Save current netns.
+	hostNS, err := netns.Get()
+	if err != nil {
+		runtime.UnlockOSThread()
+		return err
+	}
+	defer hostNS.Close()
+
+	// Get child netns.
+	targetNS, err := openNetns(childPID, nsPath)
+	if err != nil {
+		runtime.UnlockOSThread()
+		return err
+	}
+	defer targetNS.Close()
+
+	// Switch to child netns.
+	if err := netns.Set(targetNS); err != nil {
+		runtime.UnlockOSThread()
+		return err
+	}
+
+	// Switch back to the host netns. If this fails, the thread is
+	// left locked so that the runtime discards it.
+	defer func() {
+		if err := netns.Set(hostNS); err == nil {
+			runtime.UnlockOSThread()
+		}
+	}()
+
+	return f(h)
+}
+
+func (*hostFirewall) EnableNAT(bridge, subnetCIDR string) error {
+	if err := EnableIPv4Forwarding(); err != nil {
+		return err
+	}
+	if err := AddForwardingRules(bridge, subnetCIDR); err != nil {
+		return err
+	}
+	return AddMasqueradeRule(bridge, subnetCIDR)
+}
@@ -4,18 +4,34 @@ package net
 
 import (
 	"bytes"
+	"errors"
 	"fmt"
 	"net"
 	"os"
 	"path/filepath"
+	"sync"
 	"time"
 
 	"github.com/apparentlymart/go-cidr/cidr"
 	bolt "go.etcd.io/bbolt"
+	berrors "go.etcd.io/bbolt/errors"
+	"golang.org/x/sys/unix"
 )
 
 const (
 	ipamDefaultDBPath = "/var/run/microbox/ipam.db"
+
+	// Time to wait for the database locks, and polling interval of the file lock.
+	ipamLockTimeout = 2 * time.Second
+	ipamLockPoll    = 50 * time.Millisecond
+)
+
+var (
+	// Error returned when a subnet has no free address left.
+	ErrIpamExhausted = errors.New("no free IPs")
+
+	// Error returned when the database locks are not acquired in time.
+	ErrIpamLockTimeout = errors.New("ipam database lock timeout")
 )
 
 /**
@@ -25,6 +41,14 @@ type IpamOptions struct {
 	SubnetCIDR string
 	DBPath     string
 	Reserved   []net.IP
+
+	// Optional lock serializing the database accesses within the process,
+	// which the file lock does not exclude.
+	Lock sync.Locker
+
+	// Optional function called with the time spent waiting for the
+	// database locks, on allocation and release.
+	OnLockWait func(time.Duration)
 }
 
 /**
@@ -48,6 +72,10 @@ type IpamAllocator struct {
 
 	// List of reserved IPs that should not be allocated.
 	reserved map[string]struct{}
+
+	// Process lock and lock wait observer.
+	lock       sync.Locker
+	onLockWait func(time.Duration)
 }
 
 /**
@@ -95,7 +123,7 @@ func AllocateIP(opts IpamOptions) (*IpamAllocator, error) {
 	}
 
 	var picked net.IP
-	if err := withDB(dbPath, func(db *bolt.DB) error {
+	if err := withDB(dbPath, opts.Lock, opts.OnLockWait, func(db *bolt.DB) error {
 		bucket := []byte(opts.SubnetCIDR)
 
 		return db.Update(func(tx *bolt.Tx) error {
@@ -121,22 +149,81 @@ func AllocateIP(opts IpamOptions) (*IpamAllocator, error) {
 				picked = append(net.IP(nil), cur...) // copy
 				return nil
 			}
-			return fmt.Errorf("no free IPs in %s", opts.SubnetCIDR)
+			return fmt.Errorf("%w in %s", ErrIpamExhausted, opts.SubnetCIDR)
 		})
 	}); err != nil {
 		return nil, fmt.Errorf("ipam: open DB: %w", err)
 	}
 
 	return &IpamAllocator{
-		dbPath:   dbPath,
-		bucket:   []byte(opts.SubnetCIDR),
-		subnet:   ipNet,
-		prefix:   prefixLen,
-		ip:       picked,
-		reserved: reserved,
+		dbPath:     dbPath,
+		bucket:     []byte(opts.SubnetCIDR),
+		subnet:     ipNet,
+		prefix:     prefixLen,
+		ip:         picked,
+		reserved:   reserved,
+		lock:       opts.Lock,
+		onLockWait: opts.OnLockWait,
+	}, nil
+}
+
+/**
+ * Returns the allocator of an IP allocated by an earlier process, so
+ * that it can be released.
+ * @param opts configuration, only the subnet and database are used
+ * @param ipCIDR the allocated IP in CIDR notation
+ * @return *IpamAllocator or error.
+ */
+func LeasedIP(opts IpamOptions, ipCIDR string) (*IpamAllocator, error) {
+	dbPath := opts.DBPath
+	if dbPath == "" {
+		dbPath = ipamDefaultDBPath
+	}
+	ip, ipNet, err := net.ParseCIDR(ipCIDR)
+	if err != nil {
+		return nil, fmt.Errorf("invalid lease %q: %w", ipCIDR, err)
+	}
+	prefixLen, _ := ipNet.Mask.Size()
+	return &IpamAllocator{
+		dbPath:     dbPath,
+		bucket:     []byte(opts.SubnetCIDR),
+		subnet:     ipNet,
+		prefix:     prefixLen,
+		ip:         ip.To4(),
+		lock:       opts.Lock,
+		onLockWait: opts.OnLockWait,
 	}, nil
 }
 
+/**
+ * Lists the IPs allocated in a subnet, by any supervisor.
+ * @param opts configuration, only the subnet, database and lock are used
+ * @return the allocated IPs, or error if any
+ */
+func leasedIPs(opts IpamOptions) (map[string]bool, error) {
+	dbPath := opts.DBPath
+	if dbPath == "" {
+		dbPath = ipamDefaultDBPath
+	}
+	leased := map[string]bool{}
+	if _, err := os.Stat(dbPath); errors.Is(err, os.ErrNotExist) {
+		return leased, nil
+	}
+	err := withDB(dbPath, opts.Lock, nil, func(db *bolt.DB) error {
+		return db.View(func(tx *bolt.Tx) error {
+			bkt := tx.Bucket([]byte(opts.SubnetCIDR))
+			if bkt == nil {
+				return nil
+			}
+			return bkt.ForEach(func(k, _ []byte) error {
+				leased[string(k)] = true
+				return nil
+			})
+		})
+	})
+	return leased, err
+}
+
 /**
  * @return the allocated IP in CIDR notation.
  */
@@ -150,7 +237,7 @@ func (ia *IpamAllocator) IP() string {
  * It is safe to call Release multiple times.
  */
 func (ia *IpamAllocator) Release() error {
-	return withDB(ia.dbPath, func(db *bolt.DB) error {
+	return withDB(ia.dbPath, ia.lock, ia.onLockWait, func(db *bolt.DB) error {
 		return db.Update(func(tx *bolt.Tx) error {
 			bkt := tx.Bucket(ia.bucket)
 			if bkt == nil {
@@ -164,9 +251,33 @@ func (ia *IpamAllocator) Release() error {
 /**
  * Helper to open BoltDB with a short timeout, run f, and close it.
  * This avoids holding an exclusive RW lock for the lifetime of the sandbox.
+ * Allocators first take the process lock, then the lock file of the
+ * database, and the time spent on both is recorded as the lock wait,
+ * not the time bolt takes to open and map the database.
  */
-func withDB(path string, f func(*bolt.DB) error) error {
-	db, err := bolt.Open(path, 0o600, &bolt.Options{Timeout: 2 * time.Second})
+func withDB(path string, lock sync.Locker, onLockWait func(time.Duration), f func(*bolt.DB) error) error {
+	start := time.Now()
+
+	// The file lock only excludes other processes, and is polled.
+	if lock != nil {
+		lock.Lock()
+		defer lock.Unlock()
+	}
+	unlock, err := lockFile(path+".lock", ipamLockTimeout)
+	wait := time.Since(start)
+	if onLockWait != nil {
+		onLockWait(wait)
+	}
+	if err != nil {
+		return fmt.Errorf("%w after %s: %w", ErrIpamLockTimeout, wait.Round(time.Millisecond), err)
+	}
+	defer unlock()
+
+	// Readers of the database may still hold its shared lock.
+	db, err := bolt.Open(path, 0o600, &bolt.Options{Timeout: ipamLockTimeout})
+	if errors.Is(err, berrors.ErrTimeout) {
+		return fmt.Errorf("%w: %w", ErrIpamLockTimeout, err)
+	}
 	if err != nil {
 		return err
 	}
@@ -175,3 +286,94 @@ func withDB(path string, f func(*bolt.DB) error) error {
 	}()
 	return f(db)
 }
+
+/**
+ * Takes an exclusive lock on a lock file, polling it as bolt does.
+ * @param path the path of the lock file
+ * @param timeout the time to wait for the lock
+ * @return the function releasing the lock, or error if any
+ */
+func lockFile(path string, timeout time.Duration) (func(), error) {
+	f, err := os.OpenFile(path, os.O_RDWR|os.O_CREATE, 0o600)
+	if err != nil {
+		return nil, err
+	}
+	deadline := time.Now().Add(timeout)
+	for {
+		err := unix.Flock(int(f.Fd()), unix.LOCK_EX|unix.LOCK_NB)
+		if err == nil {
+			return func() { _ = f.Close() }, nil
+		}
+		if !errors.Is(err, unix.EWOULDBLOCK) {
+			_ = f.Close()
+			return nil, fmt.Errorf("flock %s: %w", path, err)
+		}
+		if time.Now().After(deadline) {
+			_ = f.Close()
+			return nil, berrors.ErrTimeout
+		}
+		time.Sleep(ipamLockPoll)
+	}
+}
+
+/**
+ * Address usage of a subnet.
+ */
+type SubnetUsage struct {
+	// Subnet CIDR.
+	Subnet string
+
+	// Number of allocated addresses.
+	Allocated int
+
+	// Number of host addresses of the subnet.
+	Size int
+}
+
+/**
+ * @return the number of host addresses of a subnet, without the network
+ * and broadcast addresses, or 0 if the subnet is invalid.
+ */
+func SubnetSize(subnet string) int {
+	_, ipNet, err := net.ParseCIDR(subnet)
+	if err != nil {
+		return 0
+	}
+	ones, bits := ipNet.Mask.Size()
+	if bits-ones >= 31 || bits-ones < 2 {
+		return 0
+	}
+	return 1<<(bits-ones) - 2
+}
+
+/**
+ * Reports the address usage of the subnets of the default database. The
+ * database is opened read-only, with a shared lock, so that reports do
+ * not hold up allocations within or across supervisors.
+ * @return the usage of each subnet, or error if any.
+ */
+func IpamUsage() ([]SubnetUsage, error) {
+	if _, err := os.Stat(ipamDefaultDBPath); err != nil {
+		return nil, err
+	}
+	db, err := bolt.Open(ipamDefaultDBPath, 0o600, &bolt.Options{ReadOnly: true, Timeout: time.Second})
+	if err != nil {
+		return nil, err
+	}
+	defer func() {
+		_ = db.Close()
+	}()
+
+	var out []SubnetUsage
+	err = db.View(func(tx *bolt.Tx) error {
+		return tx.ForEach(func(name []byte, b *bolt.Bucket) error {
+			out = append(out, SubnetUsage{
+				Subnet:    string(name),
+				Allocated: b.Stats().KeyN,
+				Size:      SubnetSize(string(name)),
+			})
+			return nil
+		})
+	})
+	return out, err
+}
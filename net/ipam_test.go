@@ -0,0 +1,210 @@
+//go:build linux
+
+package net_test
+
+import (
+	"context"
+	"fmt"
+	"os"
+	"path/filepath"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/HQarroum/microbox/fakes"
+	mnet "github.com/HQarroum/microbox/net"
+)
+
+var (
+	// Occupancies of the bridge subnet before allocating, in percent.
+	ipamFills = []int{0, 50, 95}
+
+	// Numbers of concurrent allocators or network setups.
+	ipamConcurrency = []int{1, 4, 16, 64}
+)
+
+/**
+ * Fills a database with addresses of the bridge subnet, leaving one
+ * free address per concurrent allocator.
+ * @param opts the options of the allocators
+ * @param fill the occupancy in percent
+ * @return error if any
+ */
+func fillIpam(opts mnet.IpamOptions, fill int) error {
+	n := (mnet.SubnetSize(opts.SubnetCIDR) - ipamConcurrency[len(ipamConcurrency)-1]) * fill / 100
+	for i := 0; i < n; i++ {
+		if _, err := mnet.AllocateIP(opts); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+/**
+ * Runs the iterations of a benchmark across concurrent goroutines,
+ * failing the benchmark on the first error.
+ * @param b the benchmark
+ * @param concurrency the number of goroutines
+ * @param op the operation of an iteration
+ */
+func runConcurrent(b *testing.B, concurrency int, op func() error) {
+	var (
+		next atomic.Int64
+		wg   sync.WaitGroup
+		errs = make(chan error, 1)
+	)
+	for g := 0; g < concurrency; g++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for next.Add(1) <= int64(b.N) {
+				if err := op(); err != nil {
+					select {
+					case errs <- err:
+					default:
+					}
+					return
+				}
+			}
+		}()
+	}
+	wg.Wait()
+	select {
+	case err := <-errs:
+		b.Fatal(err)
+	default:
+	}
+}
+
+/**
+ * Reports the time waiting for the database locks per operation.
+ */
+func reportLockWait(b *testing.B, wait *atomic.Int64) {
+	b.ReportMetric(float64(wait.Load())/float64(b.N), "lock-ns/op")
+}
+
+/**
+ * Allocates and releases an address of the bridge subnet per iteration,
+ * from 1 to 64 concurrent allocators, on a subnet already partly
+ * allocated.
+ */
+func BenchmarkAllocateIP(b *testing.B) {
+	for _, fill := range ipamFills {
+		for _, c := range ipamConcurrency {
+			b.Run(fmt.Sprintf("fill=%d/conc=%d", fill, c), func(b *testing.B) {
+				var (
+					wait atomic.Int64
+					mu   sync.Mutex
+				)
+				opts := mnet.IpamOptions{
+					SubnetCIDR: mnet.BridgeSubnet(),
+					DBPath:     filepath.Join(b.TempDir(), "ipam.db"),
+					Lock:       &mu,
+				}
+				if err := fillIpam(opts, fill); err != nil {
+					b.Fatal(err)
+				}
+				opts.OnLockWait = func(d time.Duration) { wait.Add(int64(d)) }
+
+				b.ReportAllocs()
+				b.ResetTimer()
+				runConcurrent(b, c, func() error {
+					a, err := mnet.AllocateIP(opts)
+					if err != nil {
+						return err
+					}
+					return a.Release()
+				})
+				b.StopTimer()
+				reportLockWait(b, &wait)
+			})
+		}
+	}
+}
+
+/**
+ * Sets up and releases the bridge network of a sandbox per iteration,
+ * from concurrent supervisors sharing a host, on in-memory fakes of the
+ * links and firewall, so that only the address allocation and the
+ * bookkeeping of microbox are measured.
+ */
+func BenchmarkAllocateIPSetup(b *testing.B) {
+	for _, c := range ipamConcurrency {
+		b.Run(fmt.Sprintf("conc=%d", c), func(b *testing.B) {
+			links := fakes.NewNetlink()
+			host := mnet.NewHost(mnet.HostOptions{Netlink: links, Firewall: fakes.NewFirewall()})
+			db := filepath.Join(b.TempDir(), "ipam.db")
+
+			var pids, wait atomic.Int64
+			pids.Store(100000)
+			onWait := func(d time.Duration) { wait.Add(int64(d)) }
+
+			b.ReportAllocs()
+			b.ResetTimer()
+			runConcurrent(b, c, func() error {
+				pid := int(pids.Add(1))
+				res, err := host.SetupContainerNetworking(context.Background(), mnet.NetworkConfig{
+					ChildPID:       pid,
+					Mode:           mnet.NetBridge,
+					IpamDB:         db,
+					OnIpamLockWait: onWait,
+				})
+				if err == nil {
+					err = res.Cleanup()
+				}
+				links.DeleteNetns(pid, "")
+				return err
+			})
+			b.StopTimer()
+			reportLockWait(b, &wait)
+		})
+	}
+}
+
+/**
+ * Sets up and releases the bridge network of a throwaway network
+ * namespace per iteration, on the links and firewall of the host, from
+ * concurrent setups. The addresses are allocated from the default
+ * database, so that they do not collide with those of running
+ * sandboxes. Requires root, as the supervisor does.
+ */
+func BenchmarkSetupContainerNetworking(b *testing.B) {
+	if os.Geteuid() != 0 {
+		b.Skip("network setup requires root")
+	}
+	for _, c := range ipamConcurrency {
+		b.Run(fmt.Sprintf("conc=%d", c), func(b *testing.B) {
+			dir := b.TempDir()
+			host := mnet.NewHost(mnet.HostOptions{})
+
+			var seq, wait atomic.Int64
+			onWait := func(d time.Duration) { wait.Add(int64(d)) }
+
+			b.ReportAllocs()
+			b.ResetTimer()
+			runConcurrent(b, c, func() error {
+				i := seq.Add(1)
+				path := filepath.Join(dir, fmt.Sprintf("netns%d", i))
+				if err := mnet.CreatePersistentNetns(path); err != nil {
+					return err
+				}
+				res, err := host.SetupContainerNetworking(context.Background(), mnet.NetworkConfig{
+					Mode:           mnet.NetBridge,
+					NetnsPath:      path,
+					HostIf:         fmt.Sprintf("vbn%d", i),
+					OnIpamLockWait: onWait,
+				})
+				if err == nil {
+					err = res.Cleanup()
+				}
+				if derr := mnet.DeletePersistentNetns(path); err == nil {
+					err = derr
+				}
+				return err
+			})
+			b.StopTimer()
+			reportLockWait(b, &wait)
+		})
+	}
+}
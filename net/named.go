@@ -0,0 +1,237 @@
+//go:build linux
+
+package net
+
+import (
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"hash/fnv"
+	"os"
+	"path/filepath"
+	"regexp"
+	"slices"
+	"strings"
+)
+
+/**
+ * Directory of the named network namespaces, and of their state.
+ */
+const NamedNetnsDir = "/run/microbox/netns"
+
+/**
+ * Valid names of network namespaces.
+ */
+var namedNetnsRe = regexp.MustCompile(`^[a-zA-Z0-9][a-zA-Z0-9_-]{0,63}$`)
+
+/**
+ * A persistent network namespace, bridged to the host, which sandboxes
+ * join instead of creating their own. The namespace keeps its veth pair
+ * and its IP lease across sandboxes, until deleted.
+ */
+type NamedNetns struct {
+	// Name of the namespace.
+	Name string `json:"name"`
+
+	// Path the namespace is bind-mounted at.
+	Path string `json:"path"`
+
+	// Name of the host side of the veth pair.
+	HostIf string `json:"hostIf"`
+
+	// Leased IP in CIDR notation, and its subnet.
+	IP     string `json:"ip"`
+	Subnet string `json:"subnet"`
+}
+
+/**
+ * @return the path of the state of a named network namespace.
+ */
+func namedNetnsState(name string) string {
+	return filepath.Join(NamedNetnsDir, name+".json")
+}
+
+/**
+ * @return the name of the host side of the veth pair of a named
+ * network namespace, which must fit in IFNAMSIZ.
+ */
+func namedHostIf(name string) string {
+	h := fnv.New32a()
+	_, _ = h.Write([]byte(name))
+	return fmt.Sprintf("vmbn%08x", h.Sum32())
+}
+
+/**
+ * Saves the state of a named network namespace.
+ * @param ns the namespace
+ * @return error if any
+ */
+func saveNamedNetns(ns *NamedNetns) error {
+	b, err := json.MarshalIndent(ns, "", "  ")
+	if err == nil {
+		err = os.WriteFile(namedNetnsState(ns.Name), b, 0o644)
+	}
+	if err != nil {
+		return fmt.Errorf("save network namespace %q: %w", ns.Name, err)
+	}
+	return nil
+}
+
+/**
+ * Creates a named network namespace, with a veth pair to the bridge and
+ * an IP lease, configured once for all the sandboxes joining it. The
+ * state is saved before the network is set up, then completed with the
+ * lease, so that DeleteNamedNetns can release whatever a failed or
+ * interrupted creation left behind.
+ * @param ctx the context of the setup
+ * @param name the name of the namespace
+ * @return the namespace, or error if any
+ */
+func (h *Host) CreateNamedNetns(ctx context.Context, name string) (*NamedNetns, error) {
+	if !namedNetnsRe.MatchString(name) {
+		return nil, fmt.Errorf("bad network namespace name %q", name)
+	}
+	path := filepath.Join(NamedNetnsDir, name)
+	if err := CreatePersistentNetns(path); err != nil {
+		if errors.Is(err, os.ErrExist) {
+			return nil, fmt.Errorf("network namespace %q already exists", name)
+		}
+		return nil, err
+	}
+	ns := &NamedNetns{
+		Name:   name,
+		Path:   path,
+		HostIf: namedHostIf(name),
+		Subnet: subnetCIDR,
+	}
+	if err := saveNamedNetns(ns); err != nil {
+		_ = DeletePersistentNetns(path)
+		return nil, err
+	}
+
+	result, err := h.SetupContainerNetworking(ctx, NetworkConfig{
+		Mode:      NetBridge,
+		NetnsPath: path,
+		HostIf:    ns.HostIf,
+	})
+	if err == nil {
+		ns.IP = result.IPAM.IP()
+		if err = saveNamedNetns(ns); err != nil {
+			_ = result.Cleanup()
+		}
+	}
+	if err != nil {
+		_ = DeletePersistentNetns(path)
+		_ = os.Remove(namedNetnsState(name))
+		return nil, err
+	}
+	return ns, nil
+}
+
+/**
+ * Loads a named network namespace.
+ * @param name the name of the namespace
+ * @return the namespace, or error if it does not exist
+ */
+func LoadNamedNetns(name string) (*NamedNetns, error) {
+	if !namedNetnsRe.MatchString(name) {
+		return nil, fmt.Errorf("bad network namespace name %q", name)
+	}
+	b, err := os.ReadFile(namedNetnsState(name))
+	if err != nil {
+		if errors.Is(err, os.ErrNotExist) {
+			return nil, fmt.Errorf("network namespace %q does not exist", name)
+		}
+		return nil, err
+	}
+	ns := &NamedNetns{}
+	if err := json.Unmarshal(b, ns); err != nil {
+		return nil, fmt.Errorf("network namespace %q: %w", name, err)
+	}
+	return ns, nil
+}
+
+/**
+ * Lists the named network namespaces.
+ * @return the namespaces, sorted by name, or error if any
+ */
+func ListNamedNetns() ([]*NamedNetns, error) {
+	entries, err := os.ReadDir(NamedNetnsDir)
+	if err != nil {
+		if errors.Is(err, os.ErrNotExist) {
+			return nil, nil
+		}
+		return nil, err
+	}
+	var out []*NamedNetns
+	for _, e := range entries {
+		name, ok := strings.CutSuffix(e.Name(), ".json")
+		if !ok {
+			continue
+		}
+		ns, err := LoadNamedNetns(name)
+		if err != nil {
+			return nil, err
+		}
+		out = append(out, ns)
+	}
+	slices.SortFunc(out, func(a, b *NamedNetns) int {
+		return strings.Compare(a.Name, b.Name)
+	})
+	return out, nil
+}
+
+/**
+ * Deletes a named network namespace: its veth pair, its IP lease and
+ * its bind mount. Sandboxes still in the namespace lose connectivity.
+ * A namespace whose state is missing, as after an interrupted creation,
+ * is still unmounted, and its veth pair deleted.
+ * @param name the name of the namespace
+ * @return error if any
+ */
+func (h *Host) DeleteNamedNetns(name string) error {
+	ns, err := LoadNamedNetns(name)
+	if err != nil {
+		if !namedNetnsRe.MatchString(name) {
+			return err
+		}
+		path := filepath.Join(NamedNetnsDir, name)
+		if _, serr := os.Lstat(path); serr != nil {
+			return err
+		}
+		ns = &NamedNetns{Name: name, Path: path, HostIf: namedHostIf(name)}
+	}
+
+	var errs []error
+	if link, err := h.nl.LinkByName(ns.HostIf); err == nil {
+		if err := h.nl.LinkDel(link); err != nil {
+			h.metrics.CleanupFailures.Inc("veth")
+			errs = append(errs, fmt.Errorf("delete host veth: %w", err))
+		}
+	}
+	if ns.IP != "" {
+		lease, err := LeasedIP(IpamOptions{
+			SubnetCIDR: ns.Subnet,
+			Lock:       &h.dbMu,
+			OnLockWait: h.onLockWait(nil),
+		}, ns.IP)
+		if err == nil {
+			err = lease.Release()
+		}
+		if err != nil {
+			h.metrics.CleanupFailures.Inc("lease")
+			errs = append(errs, err)
+		}
+	}
+	if err := DeletePersistentNetns(ns.Path); err != nil {
+		h.metrics.CleanupFailures.Inc("netns")
+		errs = append(errs, err)
+	}
+	if len(errs) == 0 {
+		if err := os.Remove(namedNetnsState(name)); err != nil && !errors.Is(err, os.ErrNotExist) {
+			errs = append(errs, err)
+		}
+	}
+	return errors.Join(errs...)
+}
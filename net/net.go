@@ -3,12 +3,14 @@
 package net
 
 import (
+	"context"
 	"fmt"
 	stdnet "net"
 	"os"
 	"syscall"
 	"time"
 
+	"github.com/HQarroum/microbox/tracing"
 	"github.com/coreos/go-iptables/iptables"
 	"github.com/vishvananda/netlink"
 	"github.com/vishvananda/netns"
@@ -57,6 +59,25 @@ const (
 type NetworkConfig struct {
 	ChildPID int
 	Mode     NetworkMode
+
+	// Optional bind-mounted namespace to configure instead of the child's.
+	NetnsPath string
+
+	// Optional name of the host side of the veth pair.
+	HostIf string
+
+	// Optional network policy of the sandbox.
+	Policy *Policy
+
+	// Optional path of the IPAM database.
+	IpamDB string
+
+	// Optional function called with the time waiting for the IPAM
+	// database locks.
+	OnIpamLockWait func(time.Duration)
+
+	// Optional span to record the setup steps under.
+	Span *tracing.Span
 }
 
 /**
@@ -64,6 +85,8 @@ type NetworkConfig struct {
  */
 type NetworkResult struct {
 	IPAM *IpamAllocator
+	// Name of the host side of the veth pair.
+	HostIf string
 	// A function to cleanup networking resources.
 	Cleanup func() error
 }
@@ -84,41 +107,83 @@ func EnableIPv4Forwarding() error {
 
 /**
  * Sets up container networking according to the specified mode.
- * @param childPID the PID of the sandboxed process.
- * @param mode the network mode.
- * @return error if any, nil otherwise.
+ * @param ctx the context of the setup, checked between steps.
+ * @param cfg the network configuration.
+ * @return the network stack, or error if any.
  */
-func SetupContainerNetworking(cfg NetworkConfig) (*NetworkResult, error) {
+func (h *Host) SetupContainerNetworking(ctx context.Context, cfg NetworkConfig) (*NetworkResult, error) {
 	switch cfg.Mode {
 
 	// Bridge networking with a veth pair.
 	case NetBridge:
-		ipam, err := AllocateIP(IpamOptions{
+		span := cfg.Span.Child("ipam")
+		ipamOpts := IpamOptions{
 			SubnetCIDR: subnetCIDR,
+			DBPath:     cfg.IpamDB,
 			Reserved:   reservedIPs,
-		})
+			Lock:       &h.dbMu,
+			OnLockWait: h.onLockWait(cfg.OnIpamLockWait),
+		}
+		h.prunePolicies(ipamOpts)
+		ipam, err := AllocateIP(ipamOpts)
+		span.Fail(err)
+		span.Finish()
 		if err != nil {
 			return nil, err
 		}
 
 		// Create veth pair, bridge, assign IP, setup iptables rules.
-		cleanup, err := SetupVethNetworking(cfg.ChildPID, VethConfig{
+		vcfg := VethConfig{
 			SubnetCIDR:  subnetCIDR,
 			BridgeIP:    bridgeIp,
 			ContainerIP: ipam.IP(),
 			EnableNAT:   true,
-		})
+			NetnsPath:   cfg.NetnsPath,
+			HostIf:      cfg.HostIf,
+			Span:        cfg.Span,
+		}
+		cleanup, err := h.SetupVethNetworking(ctx, cfg.ChildPID, vcfg)
+		if err != nil {
+			_ = ipam.Release()
+			return nil, err
+		}
+
+		// Add the policy of the sandbox, keyed by its IP. Without one, the
+		// policy this supervisor may have left for the IP is removed.
+		span = cfg.Span.Child("policy")
+		if !cfg.Policy.IsZero() {
+			err = h.fw.AddPolicy(vethDefaultBridgeName, ipam.ip.String(), cfg.Policy)
+		} else {
+			err = h.fw.RemovePolicy(ipam.ip.String())
+		}
+		span.Fail(err)
+		span.Finish()
 		if err != nil {
+			_ = cleanup()
+			_ = ipam.Release()
 			return nil, err
 		}
 
 		return &NetworkResult{
-			IPAM: ipam,
+			IPAM:   ipam,
+			HostIf: hostIfName(vcfg, cfg.ChildPID),
 			Cleanup: func() error {
+				// Remove the policy before the IP can be reused.
+				if !cfg.Policy.IsZero() {
+					if err := h.fw.RemovePolicy(ipam.ip.String()); err != nil {
+						h.metrics.CleanupFailures.Inc("policy")
+					}
+				}
 				// Release allocated IP.
-				ipam.Release()
+				if err := ipam.Release(); err != nil {
+					h.metrics.CleanupFailures.Inc("lease")
+				}
 				// Cleanup veth and bridge.
-				return cleanup()
+				if err := cleanup(); err != nil {
+					h.metrics.CleanupFailures.Inc("veth")
+					return err
+				}
+				return nil
 			},
 		}, nil
 
@@ -128,12 +193,55 @@ func SetupContainerNetworking(cfg NetworkConfig) (*NetworkResult, error) {
 	}
 }
 
+/**
+ * Removes, at the first bridged sandbox of the supervisor, the network
+ * policies of the IPs that are not allocated, left by supervisors which
+ * released an IP without removing its policy. The policies are indexed
+ * by the supervisor which adds them from then on, so that removing one
+ * does not list the policy table.
+ * @param opts the options of the IPAM database
+ */
+func (h *Host) prunePolicies(opts IpamOptions) {
+	h.pruneOnce.Do(func() {
+		leased, err := leasedIPs(opts)
+		if err == nil {
+			err = h.fw.PrunePolicies(func(ip string) bool { return leased[ip] })
+		}
+		if err != nil {
+			h.metrics.CleanupFailures.Inc("policy")
+		}
+	})
+}
+
+/**
+ * @return a function recording the time waiting for the IPAM database
+ * locks, and passing it to the given function, if any.
+ */
+func (h *Host) onLockWait(f func(time.Duration)) func(time.Duration) {
+	return func(wait time.Duration) {
+		h.metrics.IpamLockWait.Observe(wait.Seconds())
+		if f != nil {
+			f(wait)
+		}
+	}
+}
+
 /**
  * Assigns the given CIDR address to the specified link.
  * @param link the network link
  * @param cidr the CIDR address
  */
-func AssignAddr(link netlink.Link, cidr string) error {
+func (h *Host) AssignAddr(link netlink.Link, cidr string) error {
+	return assignAddr(h.nl, link, cidr)
+}
+
+/**
+ * Assigns the given CIDR address to the specified link.
+ * @param h the netlink operations of the namespace of the link
+ * @param link the network link
+ * @param cidr the CIDR address
+ */
+func assignAddr(h Netlink, link netlink.Link, cidr string) error {
 	ip, ipnet, err := stdnet.ParseCIDR(cidr)
 	if err != nil {
 		return err
@@ -147,7 +255,7 @@ func AssignAddr(link netlink.Link, cidr string) error {
 	}
 
 	// Check if address is already assigned.
-	addrs, _ := netlink.AddrList(link, unix.AF_INET)
+	addrs, _ := h.AddrList(link, unix.AF_INET)
 	for _, a := range addrs {
 		if a.IPNet.String() == addr.IPNet.String() {
 			return nil
@@ -155,7 +263,7 @@ func AssignAddr(link netlink.Link, cidr string) error {
 	}
 
 	// Assign address to link.
-	if err := netlink.AddrAdd(link, addr); err != nil && err != syscall.EEXIST {
+	if err := h.AddrAdd(link, addr); err != nil && err != syscall.EEXIST {
 		return fmt.Errorf("addr add %s: %w", addr.IPNet, err)
 	}
 	return nil
@@ -194,69 +302,79 @@ func DefaultInterface() (string, error) {
 	return "", fmt.Errorf("default route interface not found")
 }
 
+/**
+ * Opens the network namespace of a sandbox.
+ * @param childPID the PID of the containerized process (child).
+ * @param nsPath the path to a bind-mounted namespace, takes precedence over childPID.
+ * @return the namespace handle, or error if any.
+ */
+func openNetns(childPID int, nsPath string) (netns.NsHandle, error) {
+	if nsPath != "" {
+		return netns.GetFromPath(nsPath)
+	}
+	return netns.GetFromPid(childPID)
+}
+
 /**
  * Configures the container interface inside the child network namespace by
  * setting its name, bringing it up, assigning IP, adding default route.
  *
+ * @param ctx the context of the setup.
  * @param childPID the PID of the containerized process (child).
+ * @param nsPath the path to a bind-mounted namespace, takes precedence over childPID.
  * @param tempName the temporary name of the interface inside the container (e.g. "cVETH1234")
  * @param finalName the final name of the interface inside the container (e.g. "eth0")
  * @param addrCIDR the IP address to assign to the interface (e.g. "10.44.0.2/24")
  * @param gwCIDR the gateway IP address (e.g. "10.44.0.1/24")
  */
-func configureContainerInterface(childPID int, tempName, finalName, addrCIDR, gwCIDR string) error {
-	// Save current netns.
-	hostNS, err := netns.Get()
-	if err != nil {
-		return err
-	}
-	defer hostNS.Close()
-
-	// Get child netns.
-	targetNS, err := netns.GetFromPid(childPID)
-	if err != nil {
-		return err
-	}
-	defer targetNS.Close()
-
-	// Switch to child netns.
-	if err := netns.Set(targetNS); err != nil {
-		return err
-	}
-	defer netns.Set(hostNS)
+func (h *Host) configureContainerInterface(ctx context.Context, childPID int, nsPath, tempName, finalName, addrCIDR, gwCIDR string) error {
+	return h.nl.InNetns(childPID, nsPath, func(n Netlink) error {
+		return configureInterface(ctx, n, tempName, finalName, addrCIDR, gwCIDR)
+	})
+}
 
+/**
+ * Configures the container interface from within its network namespace.
+ * @param ctx the context of the setup
+ * @param h the netlink operations of the namespace
+ * @param tempName the temporary name of the interface inside the container
+ * @param finalName the final name of the interface inside the container
+ * @param addrCIDR the IP address to assign to the interface
+ * @param gwCIDR the gateway IP address
+ */
+func configureInterface(ctx context.Context, h Netlink, tempName, finalName, addrCIDR, gwCIDR string) error {
 	// Wait for the device to appear to avoid ENODEV during configuration.
-	link, err := waitLinkByName(tempName, 5000*time.Millisecond)
+	link, err := waitLinkByName(ctx, h, tempName, 5000*time.Millisecond)
 	if err != nil {
 		return fmt.Errorf("wait veth %s in ns: %w", tempName, err)
 	}
 
 	if finalName != tempName {
-		if err := netlink.LinkSetName(link, finalName); err != nil {
+		if err := h.LinkSetName(link, finalName); err != nil {
 			return fmt.Errorf("rename %s->%s: %w", tempName, finalName, err)
 		}
-		link, err = waitLinkByName(finalName, 5000*time.Millisecond)
+		link, err = waitLinkByName(ctx, h, finalName, 5000*time.Millisecond)
 		if err != nil {
 			return err
 		}
 	}
 
 	// Bring lo up early.
-	if lo, _ := netlink.LinkByName("lo"); lo != nil {
-		_ = netlink.LinkSetUp(lo)
+	if lo, _ := h.LinkByName("lo"); lo != nil {
+		_ = h.LinkSetUp(lo)
 	}
 
 	// Bring iface up **before** assigning address (avoids ENODEV on some drivers).
-	if err := netlink.LinkSetUp(link); err != nil && err != syscall.EEXIST {
+	if err := h.LinkSetUp(link); err != nil && err != syscall.EEXIST {
 		return fmt.Errorf("link up: %w", err)
 	}
 
 	// Assign IP.
 	if addrCIDR != "" {
-		if err := AssignAddr(link, addrCIDR); err != nil {
+		if err := assignAddr(h, link, addrCIDR); err != nil {
 			// Retry once after a short delay in case of transient race.
 			time.Sleep(100 * time.Millisecond)
-			if err2 := AssignAddr(link, addrCIDR); err2 != nil {
+			if err2 := assignAddr(h, link, addrCIDR); err2 != nil {
 				return err
 			}
 		}
@@ -277,7 +395,7 @@ func configureContainerInterface(childPID int, tempName, finalName, addrCIDR, gw
 				Mask: stdnet.IPv4Mask(0, 0, 0, 0),
 			},
 		}
-		if err := netlink.RouteReplace(route); err != nil && err != syscall.EEXIST {
+		if err := h.RouteReplace(route); err != nil && err != syscall.EEXIST {
 			return fmt.Errorf("default route via %s: %w", gwIP, err)
 		}
 	}
@@ -366,20 +484,75 @@ func ensureIptRule(ipt *iptables.IPTables, table, chain string, rule []string) e
 
 /**
  * Waits up to 'timeout' for a link by name to appear in the current netns.
+ * @param ctx the context bounding the wait.
+ * @param h the netlink operations of the namespace.
  * @param name the interface name to wait for.
  * @param timeout the maximum wait time.
  * @return error if not found in time, nil otherwise.
  */
-func waitLinkByName(name string, timeout time.Duration) (netlink.Link, error) {
+func waitLinkByName(ctx context.Context, h Netlink, name string, timeout time.Duration) (netlink.Link, error) {
 	deadline := time.Now().Add(timeout)
 	for {
-		if link, err := netlink.LinkByName(name); err == nil {
+		if link, err := h.LinkByName(name); err == nil {
 			return link, nil
 		}
 		if time.Now().After(deadline) {
 			break
 		}
-		time.Sleep(50 * time.Millisecond)
+		select {
+		case <-ctx.Done():
+			return nil, ctx.Err()
+		case <-time.After(50 * time.Millisecond):
+		}
 	}
 	return nil, fmt.Errorf("link %q not found", name)
 }
+
+/**
+ * Reads the traffic counters of a host interface.
+ * @param name the interface name.
+ * @return the received and transmitted bytes, or error if any.
+ */
+func (h *Host) LinkStats(name string) (uint64, uint64, error) {
+	link, err := h.nl.LinkByName(name)
+	if err != nil {
+		return 0, 0, err
+	}
+	st := link.Attrs().Statistics
+	if st == nil {
+		return 0, 0, fmt.Errorf("no statistics for %s", name)
+	}
+	return st.RxBytes, st.TxBytes, nil
+}
+
+/**
+ * Reads the packet counters of a host interface.
+ * @param name the interface name.
+ * @return the received and transmitted packets, or error if any.
+ */
+func (h *Host) LinkPackets(name string) (uint64, uint64, error) {
+	link, err := h.nl.LinkByName(name)
+	if err != nil {
+		return 0, 0, err
+	}
+	st := link.Attrs().Statistics
+	if st == nil {
+		return 0, 0, fmt.Errorf("no statistics for %s", name)
+	}
+	return st.RxPackets, st.TxPackets, nil
+}
+
+/**
+ * @return the subnet of bridged sandboxes, in CIDR notation.
+ */
+func BridgeSubnet() string {
+	return subnetCIDR
+}
+
+/**
+ * @return the address of the bridge, the gateway of bridged sandboxes.
+ */
+func BridgeAddr() string {
+	ip, _, _ := stdnet.ParseCIDR(bridgeIp)
+	return ip.String()
+}
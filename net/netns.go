@@ -0,0 +1,156 @@
+//go:build linux
+
+package net
+
+import (
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"runtime"
+
+	"github.com/vishvananda/netns"
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * Creates a new network namespace and bind-mounts it at the given path,
+ * so that it outlives the processes using it.
+ * @param path the path to bind-mount the namespace at.
+ * @return error if any, nil otherwise.
+ */
+func CreatePersistentNetns(path string) error {
+	if err := os.MkdirAll(filepath.Dir(path), 0o755); err != nil {
+		return fmt.Errorf("mkdir %s: %w", filepath.Dir(path), err)
+	}
+
+	// Create the bind-mount target.
+	f, err := os.OpenFile(path, os.O_CREATE|os.O_EXCL|os.O_RDONLY, 0o444)
+	if err != nil {
+		return err
+	}
+	_ = f.Close()
+
+	// Namespace switches apply to the current thread only.
+	runtime.LockOSThread()
+
+	hostNS, err := netns.Get()
+	if err != nil {
+		runtime.UnlockOSThread()
+		_ = os.Remove(path)
+		return err
+	}
+	defer hostNS.Close()
+
+	// Create and switch to a new network namespace.
+	newNS, err := netns.New()
+	if err != nil {
+		runtime.UnlockOSThread()
+		_ = os.Remove(path)
+		return fmt.Errorf("create netns: %w", err)
+	}
+	defer newNS.Close()
+
+	// Pin the namespace to the target path.
+	src := fmt.Sprintf("/proc/self/task/%d/ns/net", unix.Gettid())
+	mountErr := unix.Mount(src, path, "none", unix.MS_BIND, "")
+
+	// Switch back to the host namespace. If this fails, the thread is
+	// left locked so that the runtime discards it.
+	if err := netns.Set(hostNS); err != nil {
+		return fmt.Errorf("restore host netns: %w", err)
+	}
+	runtime.UnlockOSThread()
+
+	if mountErr != nil {
+		_ = os.Remove(path)
+		return fmt.Errorf("bind netns to %s: %w", path, mountErr)
+	}
+	return nil
+}
+
+/**
+ * Removes a network namespace created by CreatePersistentNetns.
+ * @param path the path the namespace is bind-mounted at.
+ * @return error if any, nil otherwise.
+ */
+func DeletePersistentNetns(path string) error {
+	if path == "" {
+		return nil
+	}
+	if err := unix.Unmount(path, unix.MNT_DETACH); err != nil && !errors.Is(err, unix.EINVAL) && !errors.Is(err, unix.ENOENT) {
+		return fmt.Errorf("unmount %s: %w", path, err)
+	}
+	if err := os.Remove(path); err != nil && !errors.Is(err, os.ErrNotExist) {
+		return err
+	}
+	return nil
+}
+
+/**
+ * Pins the network namespace of a process by bind-mounting it at the
+ * given path, so that it outlives the process.
+ * @param pid the PID of a process in the namespace.
+ * @param path the path to bind-mount the namespace at.
+ * @return error if any, nil otherwise.
+ */
+func PinNetns(pid int, path string) error {
+	if err := os.MkdirAll(filepath.Dir(path), 0o755); err != nil {
+		return fmt.Errorf("mkdir %s: %w", filepath.Dir(path), err)
+	}
+	f, err := os.OpenFile(path, os.O_CREATE|os.O_EXCL|os.O_RDONLY, 0o444)
+	if err != nil {
+		return err
+	}
+	_ = f.Close()
+
+	src := fmt.Sprintf("/proc/%d/ns/net", pid)
+	if err := unix.Mount(src, path, "none", unix.MS_BIND, ""); err != nil {
+		_ = os.Remove(path)
+		return fmt.Errorf("bind netns to %s: %w", path, err)
+	}
+	return nil
+}
+
+/**
+ * Switches the calling thread to the network namespace bind-mounted at
+ * the given path. The caller must have locked the goroutine to its
+ * thread, and must only unlock it if the returned function, which
+ * switches back to the original namespace, succeeds.
+ * @param path the path the namespace is bind-mounted at.
+ * @return a function switching back to the original namespace, or error if any.
+ */
+func EnterNetns(path string) (func() error, error) {
+	origNS, err := netns.Get()
+	if err != nil {
+		return nil, err
+	}
+	targetNS, err := netns.GetFromPath(path)
+	if err != nil {
+		origNS.Close()
+		return nil, fmt.Errorf("open netns %s: %w", path, err)
+	}
+	defer targetNS.Close()
+
+	if err := netns.Set(targetNS); err != nil {
+		origNS.Close()
+		return nil, fmt.Errorf("enter netns %s: %w", path, err)
+	}
+	return func() error {
+		defer origNS.Close()
+		return netns.Set(origNS)
+	}, nil
+}
+
+/**
+ * Runs a function in the network namespace of a sandbox, so that the
+ * sockets it creates belong to that namespace and outlive the switch.
+ * @param childPID the PID of the sandbox.
+ * @param f the function to run.
+ * @return the error of the switch or of the function, if any.
+ */
+func RunInNetns(childPID int, f func() error) error {
+	return hostNetlink{}.InNetns(childPID, "", func(Netlink) error {
+		return f()
+	})
+}
@@ -0,0 +1,398 @@
+//go:build linux
+
+package net
+
+import (
+	"bytes"
+	"encoding/hex"
+	"encoding/json"
+	"fmt"
+	"os/exec"
+	"strings"
+)
+
+/**
+ * Name of the nftables table holding the network policies.
+ */
+const policyTable = "microbox"
+
+/**
+ * Peers allowed to reach a sandbox.
+ */
+type PolicyPeer struct {
+	// Group of the peers.
+	Group string `json:"group"`
+
+	// Protocol (tcp, udp) and destination port, any if 0.
+	Proto string `json:"proto,omitempty"`
+	Port  uint16 `json:"port,omitempty"`
+}
+
+/**
+ * Network policy of a bridged sandbox. Sandboxes belong to a group, and
+ * isolated sandboxes only accept the traffic of other sandboxes allowed
+ * by their peers, connections in either direction being tracked.
+ */
+type Policy struct {
+	// Group of the sandbox, none if empty.
+	Group string `json:"group,omitempty"`
+
+	// Whether to deny the traffic of other sandboxes not allowed by peers.
+	Isolate bool `json:"isolate,omitempty"`
+
+	// Peers allowed to reach the sandbox.
+	Allow []PolicyPeer `json:"allow,omitempty"`
+}
+
+/**
+ * @return whether the policy needs no rule.
+ */
+func (p *Policy) IsZero() bool {
+	return p == nil || (p.Group == "" && !p.Isolate && len(p.Allow) == 0)
+}
+
+/**
+ * @return whether the sandbox only accepts the traffic of its peers.
+ */
+func (p *Policy) isolated() bool {
+	return p.Isolate || len(p.Allow) > 0
+}
+
+/**
+ * Maximum length of the name of a group, so that the names of its chain
+ * and sets fit in the nftables limits.
+ */
+const policyGroupMax = 64
+
+/**
+ * Checks the groups of a policy.
+ * @return error if any
+ */
+func (p *Policy) Validate() error {
+	groups := []string{p.Group}
+	for _, peer := range p.Allow {
+		groups = append(groups, peer.Group)
+	}
+	for _, g := range groups {
+		if len(g) > policyGroupMax {
+			return fmt.Errorf("network group %q is longer than %d bytes", g, policyGroupMax)
+		}
+	}
+	return nil
+}
+
+/**
+ * @return the suffix of the chain and sets of a group. Group names are
+ * hex-encoded, so that distinct groups never share them.
+ */
+func groupID(group string) string {
+	return hex.EncodeToString([]byte(group))
+}
+
+/**
+ * Builds the nftables table of the network policies. The rules are the
+ * same for any number of sandboxes: bridged packets to isolated sandboxes
+ * jump to the chain of the group of their source, found in a verdict map,
+ * which matches them against the sets of destinations, and ports,
+ * allowing the group. Each packet costs a constant number of hash
+ * lookups, sandboxes only add or remove set elements, and the packet
+ * mark is left untouched. The bridge family filters the packets switched
+ * between the ports of the bridge, which do not reach the IP forwarding
+ * path without br_netfilter.
+ * @param bridge the bridge name
+ * @return the nftables script
+ */
+func policyTableScript(bridge string) string {
+	t := "bridge " + policyTable
+	var b strings.Builder
+	fmt.Fprintf(&b, "add table %s\n", t)
+	fmt.Fprintf(&b, "add chain %s forward { type filter hook forward priority 0; policy accept; }\n", t)
+	fmt.Fprintf(&b, "add chain %s policy\n", t)
+	fmt.Fprintf(&b, "add map %s sources { type ipv4_addr : verdict; }\n", t)
+	fmt.Fprintf(&b, "add set %s isolated { type ipv4_addr; }\n", t)
+
+	// Rules are replaced in the same transaction, elements are kept.
+	fmt.Fprintf(&b, "flush chain %s forward\n", t)
+	fmt.Fprintf(&b, "flush chain %s policy\n", t)
+	fmt.Fprintf(&b, "add rule %s forward meta ibrname %q ether type ip ip daddr @isolated jump policy\n", t, bridge)
+	fmt.Fprintf(&b, "add rule %s policy ct state established,related accept\n", t)
+	fmt.Fprintf(&b, "add rule %s policy ip saddr vmap @sources\n", t)
+	fmt.Fprintf(&b, "add rule %s policy drop\n", t)
+	return b.String()
+}
+
+/**
+ * Builds the chain of a group, and the sets of the destinations allowing
+ * it on any port (`a_<id>`) or on a port (`p_<id>`). Packets not accepted
+ * return to the policy chain, which drops them.
+ * @param group the group
+ * @return the nftables script
+ */
+func policyGroupScript(group string) string {
+	t, id := "bridge "+policyTable, groupID(group)
+	var b strings.Builder
+	fmt.Fprintf(&b, "add chain %s g_%s\n", t, id)
+	fmt.Fprintf(&b, "add set %s a_%s { type ipv4_addr; }\n", t, id)
+	fmt.Fprintf(&b, "add set %s p_%s { type ipv4_addr . inet_proto . inet_service; }\n", t, id)
+	fmt.Fprintf(&b, "flush chain %s g_%s\n", t, id)
+	fmt.Fprintf(&b, "add rule %s g_%s ip daddr @a_%s accept\n", t, id, id)
+	fmt.Fprintf(&b, "add rule %s g_%s ip daddr . meta l4proto . th dport @p_%s accept\n", t, id, id)
+	return b.String()
+}
+
+/**
+ * An element of a set or map of the policy table.
+ */
+type policyElement struct {
+	// Set or map of the element.
+	set string
+
+	// Key, and value for map elements.
+	key, value string
+}
+
+/**
+ * Builds the set elements of the policy of a sandbox.
+ * @param ip the IP of the sandbox
+ * @param p the policy
+ * @return the groups the elements refer to, and the elements
+ */
+func policyElements(ip string, p *Policy) ([]string, []policyElement) {
+	var (
+		groups []string
+		elems  []policyElement
+	)
+	seen := map[string]bool{}
+	group := func(g string) string {
+		if !seen[g] {
+			seen[g] = true
+			groups = append(groups, g)
+		}
+		return groupID(g)
+	}
+	if p.Group != "" {
+		id := group(p.Group)
+		elems = append(elems, policyElement{set: "sources", key: ip, value: "jump g_" + id})
+	}
+	if p.isolated() {
+		elems = append(elems, policyElement{set: "isolated", key: ip})
+	}
+	for _, peer := range p.Allow {
+		id := group(peer.Group)
+		if peer.Port == 0 {
+			elems = append(elems, policyElement{set: "a_" + id, key: ip})
+		} else {
+			elems = append(elems, policyElement{set: "p_" + id, key: fmt.Sprintf("%s . %s . %d", ip, peer.Proto, peer.Port)})
+		}
+	}
+	return groups, elems
+}
+
+/**
+ * Builds the chains of groups, and the addition of set elements.
+ * @param groups the groups the elements refer to
+ * @param elems the elements
+ * @return the nftables script
+ */
+func policyAddScript(groups []string, elems []policyElement) string {
+	t := "bridge " + policyTable
+	var b strings.Builder
+	for _, g := range groups {
+		b.WriteString(policyGroupScript(g))
+	}
+	for _, e := range elems {
+		if e.value != "" {
+			fmt.Fprintf(&b, "add element %s %s { %s : %s }\n", t, e.set, e.key, e.value)
+		} else {
+			fmt.Fprintf(&b, "add element %s %s { %s }\n", t, e.set, e.key)
+		}
+	}
+	return b.String()
+}
+
+/**
+ * Builds the deletion of set elements.
+ * @param elems the elements
+ * @return the nftables script
+ */
+func policyDeleteScript(elems []policyElement) string {
+	t := "bridge " + policyTable
+	var b strings.Builder
+	for _, e := range elems {
+		fmt.Fprintf(&b, "delete element %s %s { %s }\n", t, e.set, e.key)
+	}
+	return b.String()
+}
+
+/**
+ * Lists the policy table, with the elements of its sets and maps.
+ * @return the table in the JSON format of nftables, or error if the
+ * table does not exist
+ */
+func listPolicyTable() ([]byte, error) {
+	out, err := exec.Command("nft", "-j", "list", "table", "bridge", policyTable).Output()
+	if err != nil {
+		return nil, fmt.Errorf("nft: list table %s: %w", policyTable, err)
+	}
+	return out, nil
+}
+
+/**
+ * Builds the deletion of the elements keyed by the IPs not kept, as found
+ * in a listing of the policy table.
+ * @param keep whether to keep the elements of an IP
+ * @param table the listing of the policy table
+ * @return the nftables script, or error if any
+ */
+func policyPruneScript(keep func(ip string) bool, table []byte) (string, error) {
+	type set struct {
+		Name string            `json:"name"`
+		Elem []json.RawMessage `json:"elem"`
+	}
+	var doc struct {
+		Nftables []struct {
+			Set *set `json:"set"`
+			Map *set `json:"map"`
+		} `json:"nftables"`
+	}
+	if err := json.Unmarshal(table, &doc); err != nil {
+		return "", fmt.Errorf("nft: parse table %s: %w", policyTable, err)
+	}
+	var elems []policyElement
+	for _, obj := range doc.Nftables {
+		s := obj.Set
+		if s == nil {
+			s = obj.Map
+		}
+		if s == nil {
+			continue
+		}
+		for _, raw := range s.Elem {
+			d := json.NewDecoder(bytes.NewReader(raw))
+			d.UseNumber()
+			var v any
+			if err := d.Decode(&v); err != nil {
+				return "", fmt.Errorf("nft: parse element of %s: %w", s.Name, err)
+			}
+			key := nftElemKey(v)
+			if len(key) > 0 && !keep(key[0]) {
+				elems = append(elems, policyElement{set: s.Name, key: strings.Join(key, " . ")})
+			}
+		}
+	}
+	return policyDeleteScript(elems), nil
+}
+
+/**
+ * @return the components of the key of a set or map element, in the
+ * JSON format of nftables, nil if not understood.
+ */
+func nftElemKey(v any) []string {
+	switch x := v.(type) {
+	case string:
+		return []string{x}
+	case json.Number:
+		return []string{x.String()}
+	case []any:
+		// A map element, as a key and a value.
+		if len(x) == 2 {
+			return nftElemKey(x[0])
+		}
+	case map[string]any:
+		if e, ok := x["elem"].(map[string]any); ok {
+			return nftElemKey(e["val"])
+		}
+		if c, ok := x["concat"].([]any); ok {
+			var key []string
+			for _, part := range c {
+				k := nftElemKey(part)
+				if len(k) != 1 {
+					return nil
+				}
+				key = append(key, k[0])
+			}
+			return key
+		}
+	}
+	return nil
+}
+
+/**
+ * Runs an nftables script as a single transaction.
+ * @param script the script
+ * @return error if any
+ */
+func runNft(script string) error {
+	cmd := exec.Command("nft", "-f", "-")
+	cmd.Stdin = strings.NewReader(script)
+	out, err := cmd.CombinedOutput()
+	if err != nil {
+		return fmt.Errorf("nft: %w: %s", err, bytes.TrimSpace(out))
+	}
+	return nil
+}
+
+func (f *hostFirewall) AddPolicy(bridge, ip string, p *Policy) error {
+	if err := p.Validate(); err != nil {
+		return err
+	}
+	f.mu.Lock()
+	defer f.mu.Unlock()
+	if !f.tableReady {
+		if err := runNft(policyTableScript(bridge)); err != nil {
+			return fmt.Errorf("policy table: %w", err)
+		}
+		f.tableReady = true
+	}
+
+	// Replace the elements installed for the IP in the same transaction.
+	groups, elems := policyElements(ip, p)
+	script := policyDeleteScript(f.policies[ip]) + policyAddScript(groups, elems)
+	if err := runNft(script); err != nil {
+		return fmt.Errorf("add policy of %s: %w", ip, err)
+	}
+	if f.policies == nil {
+		f.policies = map[string][]policyElement{}
+	}
+	f.policies[ip] = elems
+	return nil
+}
+
+func (f *hostFirewall) RemovePolicy(ip string) error {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+
+	// Only the elements installed for the IP are deleted, without nft
+	// when there are none.
+	elems, ok := f.policies[ip]
+	if !ok {
+		return nil
+	}
+	delete(f.policies, ip)
+	if err := runNft(policyDeleteScript(elems)); err != nil {
+		return fmt.Errorf("remove policy of %s: %w", ip, err)
+	}
+	return nil
+}
+
+func (f *hostFirewall) PrunePolicies(keep func(ip string) bool) error {
+	f.mu.Lock()
+	defer f.mu.Unlock()
+
+	// Without the table, or nft, there is nothing to prune.
+	table, err := listPolicyTable()
+	if err != nil {
+		return nil
+	}
+	script, err := policyPruneScript(func(ip string) bool {
+		_, installed := f.policies[ip]
+		return installed || keep(ip)
+	}, table)
+	if err == nil && script != "" {
+		err = runNft(script)
+	}
+	if err != nil {
+		return fmt.Errorf("prune policies: %w", err)
+	}
+	return nil
+}
@@ -3,10 +3,12 @@
 package net
 
 import (
+	"context"
 	"fmt"
 	"os"
 	"syscall"
 
+	"github.com/HQarroum/microbox/tracing"
 	"github.com/vishvananda/netlink"
 )
 
@@ -40,16 +42,27 @@ type VethConfig struct {
 
 	// Whether to enable NAT for outbound traffic
 	EnableNAT bool
+
+	// Path to a bind-mounted network namespace to configure instead
+	// of the namespace of the child process (e.g. "/run/microbox/netns/web")
+	NetnsPath string
+
+	// Name of the host side of the veth pair (defaults to "vmbx<pid>")
+	HostIf string
+
+	// Optional span to record the setup steps under
+	Span *tracing.Span
 }
 
 /**
  * Setup container networking with a bridge and veth pair.
  * @note must be run as root (CAP_NET_ADMIN).
- * @param childPID the PID of the containerized process (child).
+ * @param ctx the context of the setup, checked between steps.
+ * @param childPID the PID of the containerized process (child), ignored if cfg.NetnsPath is set.
  * @param cfg the network configuration.
  * @return error if any, nil otherwise.
  */
-func SetupVethNetworking(childPID int, cfg VethConfig) (func() error, error) {
+func (h *Host) SetupVethNetworking(ctx context.Context, childPID int, cfg VethConfig) (func() error, error) {
 	if cfg.BridgeName == "" {
 		cfg.BridgeName = vethDefaultBridgeName
 	}
@@ -61,43 +74,53 @@ func SetupVethNetworking(childPID int, cfg VethConfig) (func() error, error) {
 	}
 
 	// Create the bridge interface on the host if it doesn't exist.
-	bridge, err := CreateBridge(cfg.BridgeName, cfg.BridgeIP, cfg.MTU)
+	span := cfg.Span.Child("bridge")
+	h.setupMu.Lock()
+	bridge, err := h.CreateBridge(cfg.BridgeName, cfg.BridgeIP, cfg.MTU)
+	h.setupMu.Unlock()
+	span.Finish()
 	if err != nil {
 		return nil, fmt.Errorf("create bridge: %w", err)
 	}
 
+	if err := ctx.Err(); err != nil {
+		return nil, err
+	}
+
 	// Create veth pair, and move one end to the sandbox namespace.
-	hostIf, contIfTemp, err := CreateVethPair(bridge, cfg, childPID)
+	span = cfg.Span.Child("veth")
+	hostIf, contIfTemp, err := h.CreateVethPair(bridge, cfg, childPID)
+	span.Finish()
 	if err != nil {
 		return nil, fmt.Errorf("veth setup: %w", err)
 	}
 
 	// Configure container interface.
-	if err := configureContainerInterface(childPID, contIfTemp, cfg.ContainerIf, cfg.ContainerIP, cfg.BridgeIP); err != nil {
+	span = cfg.Span.Child("configure")
+	err = h.configureContainerInterface(ctx, childPID, cfg.NetnsPath, contIfTemp, cfg.ContainerIf, cfg.ContainerIP, cfg.BridgeIP)
+	span.Finish()
+	if err != nil {
 		return nil, fmt.Errorf("configure container iface: %w", err)
 	}
 
 	// Set host veth UP.
-	if err := netlink.LinkSetUp(hostIf); err != nil {
+	if err := h.nl.LinkSetUp(hostIf); err != nil {
 		return nil, fmt.Errorf("host veth up: %w", err)
 	}
 
 	// Host forwarding + iptables NAT/FORWARD rules
 	if cfg.EnableNAT {
-		if err := EnableIPv4Forwarding(); err != nil {
-			return nil, err
-		}
-		if err := AddForwardingRules(cfg.BridgeName, cfg.SubnetCIDR); err != nil {
-			return nil, err
-		}
-		if err := AddMasqueradeRule(cfg.BridgeName, cfg.SubnetCIDR); err != nil {
+		span = cfg.Span.Child("nat")
+		err := h.enableNAT(cfg)
+		span.Finish()
+		if err != nil {
 			return nil, err
 		}
 	}
 
 	// Cleanup function to remove the veth pair and associated resources.
 	cleanup := func() error {
-		if err := netlink.LinkDel(hostIf); err != nil && !os.IsNotExist(err) {
+		if err := h.nl.LinkDel(hostIf); err != nil && !os.IsNotExist(err) {
 			return fmt.Errorf("delete host veth: %w", err)
 		}
 
@@ -107,6 +130,18 @@ func SetupVethNetworking(childPID int, cfg VethConfig) (func() error, error) {
 	return cleanup, nil
 }
 
+/**
+ * Enables forwarding and NAT for the bridge subnet on the host.
+ * @param cfg the network configuration.
+ * @return error if any, nil otherwise.
+ */
+func (h *Host) enableNAT(cfg VethConfig) error {
+	h.setupMu.Lock()
+	defer h.setupMu.Unlock()
+
+	return h.fw.EnableNAT(cfg.BridgeName, cfg.SubnetCIDR)
+}
+
 /**
  * Creates a new Linux bridge interface with the given name and CIDR
  * if it does not already exist.
@@ -115,13 +150,13 @@ func SetupVethNetworking(childPID int, cfg VethConfig) (func() error, error) {
  * @param mtu the bridge MTU
  * @return the bridge link, or error if any.
  */
-func CreateBridge(name, cidr string, mtu int) (netlink.Link, error) {
-	if l, err := netlink.LinkByName(name); err == nil {
-		if err := netlink.LinkSetUp(l); err != nil {
+func (h *Host) CreateBridge(name, cidr string, mtu int) (netlink.Link, error) {
+	if l, err := h.nl.LinkByName(name); err == nil {
+		if err := h.nl.LinkSetUp(l); err != nil {
 			return nil, err
 		}
 		if cidr != "" {
-			if err := AssignAddr(l, cidr); err != nil {
+			if err := h.AssignAddr(l, cidr); err != nil {
 				return nil, err
 			}
 		}
@@ -137,18 +172,18 @@ func CreateBridge(name, cidr string, mtu int) (netlink.Link, error) {
 	}
 
 	// Create a new bridge interface if it doesn't exist.
-	if err := netlink.LinkAdd(bridge); err != nil && !os.IsExist(err) {
+	if err := h.nl.LinkAdd(bridge); err != nil && !os.IsExist(err) {
 		return nil, err
 	}
 
 	// Turn the bridge interface up.
-	if err := netlink.LinkSetUp(bridge); err != nil {
+	if err := h.nl.LinkSetUp(bridge); err != nil {
 		return nil, err
 	}
 
 	// Assign the CIDR address if given.
 	if cidr != "" {
-		if err := AssignAddr(bridge, cidr); err != nil {
+		if err := h.AssignAddr(bridge, cidr); err != nil {
 			return nil, err
 		}
 	}
@@ -156,6 +191,16 @@ func CreateBridge(name, cidr string, mtu int) (netlink.Link, error) {
 	return bridge, nil
 }
 
+/**
+ * @return the name of the host side of the veth pair of a sandbox.
+ */
+func hostIfName(cfg VethConfig, childPID int) string {
+	if cfg.HostIf != "" {
+		return cfg.HostIf
+	}
+	return fmt.Sprintf("vmbx%d", childPID)
+}
+
 /**
  * Creates a veth pair, with one end attached to the given bridge,
  * and the other end moved to the network namespace of the given PID.
@@ -164,8 +209,8 @@ func CreateBridge(name, cidr string, mtu int) (netlink.Link, error) {
  * @param childPID the PID of the containerized process.
  * @return the host-side link, the name of the peer in the child netns, or error if any.
  */
-func CreateVethPair(bridge netlink.Link, cfg VethConfig, childPID int) (netlink.Link, string, error) {
-	hostName := fmt.Sprintf("vmbx%d", childPID)
+func (h *Host) CreateVethPair(bridge netlink.Link, cfg VethConfig, childPID int) (netlink.Link, string, error) {
+	hostName := hostIfName(cfg, childPID)
 	peerName := fmt.Sprintf("c%s", hostName)
 
 	v := &netlink.Veth{
@@ -178,36 +223,36 @@ func CreateVethPair(bridge netlink.Link, cfg VethConfig, childPID int) (netlink.
 	}
 
 	// Create the veth pair.
-	if err := netlink.LinkAdd(v); err != nil && err != syscall.EEXIST {
+	if err := h.nl.LinkAdd(v); err != nil && err != syscall.EEXIST {
 		return nil, "", err
 	}
 
 	// Lookup the host interface.
-	hostIf, err := netlink.LinkByName(hostName)
+	hostIf, err := h.nl.LinkByName(hostName)
 	if err != nil {
 		return nil, "", err
 	}
 
 	// Lookup the peer interface.
-	peerIf, err := netlink.LinkByName(peerName)
+	peerIf, err := h.nl.LinkByName(peerName)
 	if err != nil {
 		return nil, "", err
 	}
 
 	// Ensure host veth is enslaved to bridge and UP.
 	if hostIf.Attrs().MasterIndex != bridge.Attrs().Index {
-		if err := netlink.LinkSetMaster(hostIf, bridge); err != nil && err != syscall.EEXIST {
+		if err := h.nl.LinkSetMaster(hostIf, bridge); err != nil && err != syscall.EEXIST {
 			return nil, "", fmt.Errorf("attach host veth to bridge: %w", err)
 		}
 	}
 
 	// Bring up the host side.
-	if err := netlink.LinkSetUp(hostIf); err != nil && err != syscall.EEXIST {
+	if err := h.nl.LinkSetUp(hostIf); err != nil && err != syscall.EEXIST {
 		return nil, "", err
 	}
 
 	// Move peer to the sandbox namespace.
-	if err := netlink.LinkSetNsPid(peerIf, childPID); err != nil {
+	if err := h.nl.LinkSetNs(peerIf, childPID, cfg.NetnsPath); err != nil {
 		return nil, "", err
 	}
 
@@ -0,0 +1,217 @@
+//go:build linux
+
+package options
+
+import (
+	"bufio"
+	"context"
+	"encoding/json"
+	"fmt"
+	"io"
+	"os"
+	"strconv"
+	"strings"
+
+	"github.com/HQarroum/microbox/sandbox"
+	"github.com/inhies/go-bytesize"
+	"github.com/urfave/cli/v3"
+)
+
+/**
+ * A job, as described in a jobs file.
+ */
+type jobSpec struct {
+	Args   []string `json:"args"`
+	Env    []string `json:"env,omitempty"`
+	Tenant string   `json:"tenant,omitempty"`
+}
+
+/**
+ * Parses a jobs file, holding one JSON job per line in the form of
+ * `{"args": ["cmd", "arg"], "env": ["KEY=VALUE"], "tenant": "name"}`.
+ * @param r the reader of the jobs file
+ * @return the parsed jobs and error if any
+ */
+func parseJobs(r io.Reader) ([]sandbox.BatchJob, error) {
+	var jobs []sandbox.BatchJob
+
+	sc := bufio.NewScanner(r)
+	sc.Buffer(make([]byte, 64*1024), 1024*1024)
+	for n := 1; sc.Scan(); n++ {
+		line := strings.TrimSpace(sc.Text())
+		if line == "" || strings.HasPrefix(line, "#") {
+			continue
+		}
+		spec := jobSpec{}
+		if err := json.Unmarshal([]byte(line), &spec); err != nil {
+			return nil, fmt.Errorf("bad job on line %d: %w", n, err)
+		}
+		if len(spec.Args) == 0 {
+			return nil, fmt.Errorf("bad job on line %d: missing args", n)
+		}
+		job := sandbox.BatchJob{Args: spec.Args, Tenant: spec.Tenant}
+		for _, e := range spec.Env {
+			ev, err := ParseEnv(e)
+			if err != nil {
+				return nil, fmt.Errorf("bad job on line %d: %w", n, err)
+			}
+			job.Env = append(job.Env, ev)
+		}
+		jobs = append(jobs, job)
+	}
+	if err := sc.Err(); err != nil {
+		return nil, err
+	}
+	return jobs, nil
+}
+
+/**
+ * Builds the admission control options from CLI context.
+ * @param c the CLI context
+ * @return the built admission options and error if any
+ */
+func buildAdmissionOptsFromCLI(c *cli.Command) (*sandbox.AdmissionOptions, error) {
+	o := &sandbox.AdmissionOptions{
+		Capacity: sandbox.Resources{
+			CPUs:  c.Float64("capacity-cpus"),
+			Slots: c.Int("parallel"),
+		},
+		MaxPressure: c.Float64("max-pressure"),
+		Weights:     make(map[string]float64),
+	}
+	if o.Capacity.Slots < 0 {
+		return nil, fmt.Errorf("bad --parallel %d", o.Capacity.Slots)
+	}
+
+	for _, name := range []string{"capacity-memory", "capacity-storage"} {
+		v := c.String(name)
+		if v == "" {
+			continue
+		}
+		size, err := bytesize.Parse(v)
+		if err != nil {
+			return nil, fmt.Errorf("bad --%s %q: %v", name, v, err)
+		}
+		if name == "capacity-memory" {
+			o.Capacity.Memory = uint64(size)
+		} else {
+			o.Capacity.Storage = uint64(size)
+		}
+	}
+
+	for _, tw := range c.StringSlice("tenant-weight") {
+		name, w, ok := strings.Cut(tw, "=")
+		weight, err := strconv.ParseFloat(w, 64)
+		if !ok || name == "" || err != nil || weight <= 0 {
+			return nil, fmt.Errorf("bad --tenant-weight %q (NAME=WEIGHT)", tw)
+		}
+		o.Weights[name] = weight
+	}
+	return o, nil
+}
+
+/**
+ * Creates the `batch` command.
+ * @param result where to store the parsed invocation
+ * @return the command
+ */
+func batchCommand(result **Invocation) *cli.Command {
+	return &cli.Command{
+		Name:  "batch",
+		Usage: "Runs a queue of jobs sharing the same sandbox options",
+		Flags: append(append([]cli.Flag{
+
+			// Jobs file.
+			&cli.StringFlag{
+				Name:     "jobs",
+				Usage:    "JSON lines `FILE` describing the jobs to run, - for stdin",
+				Required: true,
+			},
+
+			// Sandbox recycling.
+			&cli.BoolFlag{
+				Name:  "recycle",
+				Value: false,
+				Usage: "Reuses the network namespace of the sandbox between jobs",
+			},
+
+			// Maximum number of concurrent jobs.
+			&cli.IntFlag{
+				Name:  "parallel",
+				Value: 1,
+				Usage: "Maximum number of jobs running concurrently (0 => bounded by capacity only)",
+			},
+
+			// Host capacity.
+			&cli.Float64Flag{
+				Name:  "capacity-cpus",
+				Usage: "Number of host CPUs which can be committed to jobs (defaults to all CPUs)",
+			},
+			&cli.StringFlag{
+				Name:  "capacity-memory",
+				Usage: "Amount of host memory which can be committed to jobs, e.g. 8GB (defaults to all memory)",
+			},
+			&cli.StringFlag{
+				Name:  "capacity-storage",
+				Usage: "Amount of storage which can be committed to jobs, e.g. 4GB (defaults to unlimited)",
+			},
+
+			// Host memory pressure threshold.
+			&cli.Float64Flag{
+				Name:  "max-pressure",
+				Usage: "Holds new jobs while the host memory pressure exceeds this `PERCENT` (0 => disabled)",
+			},
+
+			// Tenant weights.
+			&cli.StringSliceFlag{
+				Name:  "tenant-weight",
+				Usage: "Sets the fair queueing weight of a tenant as `NAME=WEIGHT`",
+			},
+		}, sandboxFlags()...), append(append(serviceFlags(), tracingFlags()...), loggingFlags()...)...),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			opts, err := buildSandboxOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			// Read the jobs.
+			in := os.Stdin
+			if p := c.String("jobs"); p != "-" {
+				f, err := os.Open(p)
+				if err != nil {
+					return fmt.Errorf("bad --jobs: %w", err)
+				}
+				defer f.Close()
+				in = f
+			}
+			jobs, err := parseJobs(in)
+			if err != nil {
+				return err
+			}
+
+			admission, err := buildAdmissionOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			*result = &Invocation{
+				Command:   CommandBatch,
+				Logger:    logOpts,
+				Sandbox:   opts,
+				Jobs:      jobs,
+				Recycle:   c.Bool("recycle"),
+				Admission: admission,
+			}
+			if err := buildServiceOptsFromCLI(c, *result); err != nil {
+				return err
+			}
+			return buildTracingOptsFromCLI(c, *result)
+		},
+	}
+}
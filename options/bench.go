@@ -0,0 +1,115 @@
+//go:build linux
+
+package options
+
+import (
+	"context"
+	"fmt"
+	"strings"
+	"time"
+
+	"github.com/HQarroum/microbox/bench"
+	"github.com/inhies/go-bytesize"
+	"github.com/urfave/cli/v3"
+)
+
+/**
+ * Creates the `bench` command.
+ * @param result where to store the parsed invocation
+ * @return the command
+ */
+func benchCommand(result **Invocation) *cli.Command {
+	groups := strings.Join(bench.Groups(), "|")
+
+	return &cli.Command{
+		Name:      "bench",
+		Usage:     "Benchmarks microbox",
+		ArgsUsage: "<" + groups + "> [command...]",
+		Flags: append([]cli.Flag{
+
+			// Benchmark filter.
+			&cli.StringFlag{
+				Name:  "filter",
+				Usage: "Runs the benchmarks matching the `REGEXP` only",
+			},
+
+			// Benchmark run time.
+			&cli.DurationFlag{
+				Name:  "benchtime",
+				Value: time.Second,
+				Usage: "Run `TIME` of the traffic benchmarks (net)",
+			},
+
+			// Sandboxes of the traffic benchmarks.
+			&cli.IntFlag{
+				Name:  "sandboxes",
+				Value: 2,
+				Usage: "Number of sandboxes exchanging traffic (net), or to ramp up to (stress)",
+			},
+
+			// Sandboxes of the stress benchmarks.
+			&cli.IntFlag{
+				Name:  "concurrency",
+				Value: 8,
+				Usage: "Number of sandboxes created concurrently (stress)",
+			},
+			&cli.StringFlag{
+				Name:  "net",
+				Value: "bridge",
+				Usage: "Network `MODE` of the ramped sandboxes (stress)",
+			},
+
+			// Filesystem of the measured sandboxes.
+			&cli.StringFlag{
+				Name:  "rootfs",
+				Usage: "Also measures an overlay on the root filesystem at `DIR` (fs)",
+			},
+			&cli.StringFlag{
+				Name:  "storage",
+				Value: "512MB",
+				Usage: "Storage space of the measured sandboxes (fs)",
+			},
+			&cli.BoolFlag{
+				Name:  "readonly",
+				Usage: "Mounts the root filesystem of the measured sandboxes as read-only (fs)",
+			},
+		}, loggingFlags()...),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			if c.Args().Len() < 1 {
+				return fmt.Errorf("usage: microbox bench [options] <%s> [command...]", groups)
+			}
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+			stor, err := bytesize.Parse(c.String("storage"))
+			if err != nil {
+				return fmt.Errorf("bad --storage %q: %v", c.String("storage"), err)
+			}
+			net, err := parseNetMode(c.String("net"))
+			if err != nil {
+				return err
+			}
+
+			*result = &Invocation{
+				Command: CommandBench,
+				Logger:  logOpts,
+				Bench: &bench.Options{
+					Group:     c.Args().First(),
+					Filter:    c.String("filter"),
+					Benchtime: c.Duration("benchtime"),
+					Sandboxes: c.Int("sandboxes"),
+					Rootfs:    c.String("rootfs"),
+					Storage:   uint64(stor),
+					ReadOnly:  c.Bool("readonly"),
+
+					Concurrency: c.Int("concurrency"),
+					Net:         net,
+					Command:     c.Args().Tail(),
+				},
+			}
+			return nil
+		},
+	}
+}
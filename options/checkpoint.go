@@ -0,0 +1,92 @@
+//go:build linux
+
+package options
+
+import (
+	"context"
+	"fmt"
+
+	"github.com/HQarroum/microbox/sandbox"
+	"github.com/urfave/cli/v3"
+)
+
+/**
+ * Creates the `checkpoint` command.
+ * @param result where to store the parsed invocation
+ * @return the command
+ */
+func checkpointCommand(result **Invocation) *cli.Command {
+	return &cli.Command{
+		Name:      "checkpoint",
+		Usage:     "Checkpoints a running sandbox with CRIU",
+		ArgsUsage: "<id|hostname>",
+		Flags: append([]cli.Flag{
+
+			// Image directory.
+			&cli.StringFlag{
+				Name:     "image-dir",
+				Usage:    "Directory to write the checkpoint images to",
+				Required: true,
+			},
+
+			// Leave the sandbox running.
+			&cli.BoolFlag{
+				Name:  "leave-running",
+				Value: false,
+				Usage: "Leaves the sandbox running after the checkpoint",
+			},
+		}, loggingFlags()...),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			if c.Args().Len() != 1 {
+				return fmt.Errorf("usage: microbox checkpoint --image-dir <dir> <id|hostname>")
+			}
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			*result = &Invocation{
+				Command: CommandCheckpoint,
+				Logger:  logOpts,
+				Target:  c.Args().First(),
+				Checkpoint: &sandbox.CheckpointOptions{
+					ImageDir:     c.String("image-dir"),
+					LeaveRunning: c.Bool("leave-running"),
+				},
+			}
+			return nil
+		},
+	}
+}
+
+/**
+ * Creates the `restore` command.
+ * @param result where to store the parsed invocation
+ * @return the command
+ */
+func restoreCommand(result **Invocation) *cli.Command {
+	return &cli.Command{
+		Name:      "restore",
+		Usage:     "Restores a checkpointed sandbox",
+		ArgsUsage: "<image-dir>",
+		Flags:     loggingFlags(),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			if c.Args().Len() != 1 {
+				return fmt.Errorf("usage: microbox restore <image-dir>")
+			}
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			*result = &Invocation{
+				Command:  CommandRestore,
+				Logger:   logOpts,
+				ImageDir: c.Args().First(),
+			}
+			return nil
+		},
+	}
+}
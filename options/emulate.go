@@ -0,0 +1,27 @@
+//go:build linux
+
+package options
+
+import (
+	"fmt"
+	"slices"
+
+	"github.com/HQarroum/microbox/sandbox"
+)
+
+/**
+ * Parse the system calls emulated by the supervisor.
+ * @param names the system call names
+ * @return the emulated system calls and error if any
+ */
+func parseEmulate(names []string) ([]string, error) {
+	known := sandbox.EmulatedSyscalls()
+	for _, name := range names {
+		if !slices.Contains(known, name) {
+			return nil, fmt.Errorf("bad --emulate-syscall %q (%v)", name, known)
+		}
+	}
+	out := slices.Clone(names)
+	slices.Sort(out)
+	return slices.Compact(out), nil
+}
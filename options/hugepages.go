@@ -0,0 +1,72 @@
+//go:build linux
+
+package options
+
+import (
+	"fmt"
+	"os"
+	"strconv"
+	"strings"
+
+	"github.com/HQarroum/microbox/fs"
+)
+
+/**
+ * Parse huge page reservations from strings of the form `SIZE:COUNT`,
+ * with sizes such as `2M` or `1G`.
+ * @param specs the strings to parse
+ * @return the parsed reservations and error if any
+ */
+func parseHugePages(specs []string) ([]fs.HugePages, error) {
+	var out []fs.HugePages
+	for _, spec := range specs {
+		size, count, ok := strings.Cut(spec, ":")
+		if !ok {
+			return nil, fmt.Errorf("bad --hugepages %q (SIZE:COUNT)", spec)
+		}
+		h := fs.HugePages{}
+		var err error
+		if h.Size, err = parsePageSize(size); err != nil {
+			return nil, fmt.Errorf("bad --hugepages %q: %w", spec, err)
+		}
+		if h.Count, err = strconv.ParseUint(count, 10, 64); err != nil || h.Count == 0 {
+			return nil, fmt.Errorf("bad --hugepages %q: bad page count", spec)
+		}
+		if _, err := os.Stat(h.SysfsDir()); err != nil {
+			return nil, fmt.Errorf("bad --hugepages %q: page size not supported by the kernel", spec)
+		}
+		for _, prev := range out {
+			if prev.Size == h.Size {
+				return nil, fmt.Errorf("bad --hugepages %q: page size reserved twice", spec)
+			}
+		}
+		out = append(out, h)
+	}
+	return out, nil
+}
+
+/**
+ * Parse a huge page size, in bytes with a `K`, `M` or `G` suffix.
+ * @param s the string to parse
+ * @return the size in bytes and error if any
+ */
+func parsePageSize(s string) (uint64, error) {
+	s = strings.TrimSuffix(strings.ToUpper(s), "B")
+	shift := 0
+	switch {
+	case strings.HasSuffix(s, "K"):
+		shift = 10
+	case strings.HasSuffix(s, "M"):
+		shift = 20
+	case strings.HasSuffix(s, "G"):
+		shift = 30
+	}
+	if shift > 0 {
+		s = s[:len(s)-1]
+	}
+	v, err := strconv.ParseUint(s, 10, 64)
+	if err != nil || v == 0 || v&(v-1) != 0 || v > 1<<(34-shift) {
+		return 0, fmt.Errorf("bad page size %q", s)
+	}
+	return v << shift, nil
+}
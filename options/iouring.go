@@ -0,0 +1,27 @@
+//go:build linux
+
+package options
+
+import (
+	"fmt"
+
+	"github.com/HQarroum/microbox/sandbox"
+)
+
+/**
+ * Parse the io_uring policy from a string.
+ * @param s the string to parse
+ * @return the parsed io_uring policy and error if any
+ */
+func parseIoUringMode(s string) (sandbox.IoUringMode, error) {
+	switch s {
+	case "deny":
+		return sandbox.IoUringDeny, nil
+	case "filter-register":
+		return sandbox.IoUringFilterRegister, nil
+	case "allow":
+		return sandbox.IoUringAllow, nil
+	default:
+		return sandbox.IoUringDeny, fmt.Errorf("bad --io-uring %q (deny|filter-register|allow)", s)
+	}
+}
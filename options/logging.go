@@ -5,6 +5,8 @@ package options
 import (
 	"fmt"
 	"log/slog"
+	"strconv"
+	"strings"
 
 	"github.com/HQarroum/microbox/logger"
 )
@@ -42,3 +44,24 @@ func parseLogFormat(s string) (logger.LogFormat, error) {
 		return logger.LogText, fmt.Errorf("unknown log format: %q", s)
 	}
 }
+
+/**
+ * Parse the log output from a string.
+ * @param s the string to parse
+ * @return the parsed log output and error if any
+ */
+func parseLogOutput(s string) (string, error) {
+	switch {
+	case s == "stdout" || s == "stderr":
+		return s, nil
+	case strings.HasPrefix(s, "fd:"):
+		if fd, err := strconv.Atoi(strings.TrimPrefix(s, "fd:")); err != nil || fd < 0 {
+			return "", fmt.Errorf("bad log output: %q", s)
+		}
+		return s, nil
+	case s == "":
+		return "", fmt.Errorf("empty log output")
+	default:
+		return s, nil
+	}
+}
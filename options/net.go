@@ -4,6 +4,8 @@ package options
 
 import (
 	"fmt"
+	"strconv"
+	"strings"
 
 	"github.com/HQarroum/microbox/net"
 )
@@ -25,3 +27,54 @@ func parseNetMode(s string) (net.NetworkMode, error) {
 		return net.NetNone, fmt.Errorf("bad --net %q (none|host|bridge)", s)
 	}
 }
+
+/**
+ * Parse the network option, either a network mode, or `ns:<name>` to
+ * join a named network namespace.
+ * @param s the string to parse
+ * @return the parsed NetworkMode, the name of the namespace to join, and error if any
+ */
+func parseNetOption(s string) (net.NetworkMode, string, error) {
+	if name, ok := strings.CutPrefix(s, "ns:"); ok {
+		if _, err := net.LoadNamedNetns(name); err != nil {
+			return net.NetNone, "", fmt.Errorf("bad --net %q: %w", s, err)
+		}
+		return net.NetNone, name, nil
+	}
+	mode, err := parseNetMode(s)
+	return mode, "", err
+}
+
+/**
+ * Parse the network policy of a bridged sandbox.
+ * @param group the group of the sandbox
+ * @param isolate whether to deny the traffic of other sandboxes not allowed
+ * @param allow the allowed peers, as `GROUP[:PORT[/PROTO]]`
+ * @return the parsed policy and error if any
+ */
+func parseNetPolicy(group string, isolate bool, allow []string) (net.Policy, error) {
+	p := net.Policy{Group: group, Isolate: isolate}
+	for _, a := range allow {
+		peer := net.PolicyPeer{}
+		var port string
+		peer.Group, port, _ = strings.Cut(a, ":")
+		if peer.Group == "" {
+			return p, fmt.Errorf("bad --net-allow %q (GROUP[:PORT[/PROTO]])", a)
+		}
+		if port != "" {
+			var proto string
+			port, proto, _ = strings.Cut(port, "/")
+			peer.Proto = strings.ToLower(orDefault(proto, "tcp"))
+			if peer.Proto != "tcp" && peer.Proto != "udp" {
+				return p, fmt.Errorf("bad --net-allow %q: protocol must be tcp or udp", a)
+			}
+			n, err := strconv.ParseUint(port, 10, 16)
+			if err != nil || n == 0 {
+				return p, fmt.Errorf("bad --net-allow %q: bad port", a)
+			}
+			peer.Port = uint16(n)
+		}
+		p.Allow = append(p.Allow, peer)
+	}
+	return p, p.Validate()
+}
@@ -0,0 +1,78 @@
+//go:build linux
+
+package options
+
+import (
+	"context"
+	"fmt"
+
+	"github.com/urfave/cli/v3"
+)
+
+/**
+ * Creates the `net` command, managing named network namespaces.
+ * @param result where to store the parsed invocation
+ * @return the command
+ */
+func netCommand(result **Invocation) *cli.Command {
+	return &cli.Command{
+		Name:  "net",
+		Usage: "Manages named network namespaces, joined by sandboxes with --net ns:<name>",
+		Commands: []*cli.Command{
+			netNameCommand(result, "create", "Creates a bridged network namespace with a persistent IP", CommandNetCreate),
+			netNameCommand(result, "rm", "Deletes a network namespace, its veth pair and its IP lease", CommandNetDelete),
+			{
+				Name:  "ls",
+				Usage: "Lists the network namespaces",
+				Flags: loggingFlags(),
+
+				Action: func(ctx context.Context, c *cli.Command) error {
+					logOpts, err := buildLoggerOptsFromCLI(c)
+					if err != nil {
+						return err
+					}
+
+					*result = &Invocation{
+						Command: CommandNetList,
+						Logger:  logOpts,
+					}
+					return nil
+				},
+			},
+		},
+	}
+}
+
+/**
+ * Creates a `net` subcommand acting on a named network namespace.
+ * @param result where to store the parsed invocation
+ * @param name the name of the subcommand
+ * @param usage the usage of the subcommand
+ * @param command the command of the invocation
+ * @return the command
+ */
+func netNameCommand(result **Invocation, name, usage string, command Command) *cli.Command {
+	return &cli.Command{
+		Name:      name,
+		Usage:     usage,
+		ArgsUsage: "<name>",
+		Flags:     loggingFlags(),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			if c.Args().Len() != 1 {
+				return fmt.Errorf("usage: microbox net %s <name>", name)
+			}
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			*result = &Invocation{
+				Command: command,
+				Logger:  logOpts,
+				Target:  c.Args().First(),
+			}
+			return nil
+		},
+	}
+}
@@ -0,0 +1,486 @@
+//go:build linux
+
+package options
+
+import (
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"slices"
+	"strconv"
+	"strings"
+
+	"github.com/HQarroum/microbox/fs"
+	"github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/sandbox"
+	"github.com/google/uuid"
+	seccomp "github.com/seccomp/libseccomp-golang"
+	"github.com/urfave/cli/v3"
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * Size of the writable layer of containers.
+ */
+const containerStorage = 512 * 1024 * 1024
+
+/**
+ * The subset of the OCI runtime configuration of a bundle mapped onto
+ * sandbox options. Other fields are ignored.
+ */
+type ociConfig struct {
+	Process *struct {
+		Terminal bool `json:"terminal"`
+		User     struct {
+			UID uint32 `json:"uid"`
+			GID uint32 `json:"gid"`
+		} `json:"user"`
+		Args         []string `json:"args"`
+		Env          []string `json:"env"`
+		Cwd          string   `json:"cwd"`
+		Capabilities *struct {
+			Bounding []string `json:"bounding"`
+		} `json:"capabilities"`
+		Rlimits []struct {
+			Type string `json:"type"`
+			Hard uint64 `json:"hard"`
+			Soft uint64 `json:"soft"`
+		} `json:"rlimits"`
+	} `json:"process"`
+
+	Root *struct {
+		Path     string `json:"path"`
+		Readonly bool   `json:"readonly"`
+	} `json:"root"`
+
+	Hostname string `json:"hostname"`
+
+	Mounts []struct {
+		Destination string   `json:"destination"`
+		Type        string   `json:"type"`
+		Source      string   `json:"source"`
+		Options     []string `json:"options"`
+	} `json:"mounts"`
+
+	Annotations map[string]string `json:"annotations"`
+
+	Linux *struct {
+		Namespaces []struct {
+			Type string `json:"type"`
+			Path string `json:"path"`
+		} `json:"namespaces"`
+
+		Resources *struct {
+			Memory *struct {
+				Limit *int64 `json:"limit"`
+			} `json:"memory"`
+			CPU *struct {
+				Quota  *int64  `json:"quota"`
+				Period *uint64 `json:"period"`
+			} `json:"cpu"`
+		} `json:"resources"`
+
+		Seccomp *struct {
+			DefaultAction string `json:"defaultAction"`
+			Syscalls      []struct {
+				Names  []string `json:"names"`
+				Action string   `json:"action"`
+			} `json:"syscalls"`
+		} `json:"seccomp"`
+	} `json:"linux"`
+}
+
+/**
+ * Loads the configuration of an OCI bundle, and maps it onto sandbox
+ * options.
+ * @param bundle the absolute path of the bundle
+ * @return the sandbox options, the annotations of the bundle, and error if any
+ */
+func loadBundle(bundle string) (*sandbox.SandboxOptions, map[string]string, error) {
+	data, err := os.ReadFile(filepath.Join(bundle, "config.json"))
+	if err != nil {
+		return nil, nil, fmt.Errorf("bad bundle: %w", err)
+	}
+	var cfg ociConfig
+	if err := json.Unmarshal(data, &cfg); err != nil {
+		return nil, nil, fmt.Errorf("bad bundle config: %w", err)
+	}
+	o, err := cfg.build(bundle)
+	if err != nil {
+		return nil, nil, fmt.Errorf("bad bundle config: %w", err)
+	}
+	return o, cfg.Annotations, nil
+}
+
+/**
+ * Maps the configuration of a bundle onto sandbox options.
+ * @param bundle the directory relative paths are resolved against
+ * @return the sandbox options, or an error if the configuration is not supported
+ */
+func (cfg *ociConfig) build(bundle string) (*sandbox.SandboxOptions, error) {
+	o := &sandbox.SandboxOptions{
+		UUID:          uuid.New(),
+		Hostname:      cfg.Hostname,
+		Storage:       containerStorage,
+		Net:           net.NetHost,
+		NamespaceMode: sandbox.UserNamespaceHost,
+	}
+
+	// Process.
+	proc := cfg.Process
+	if proc == nil || len(proc.Args) == 0 {
+		return nil, errors.New("missing process.args")
+	}
+	if proc.Terminal {
+		return nil, errors.New("process.terminal is not supported")
+	}
+	if proc.User.UID != 0 || proc.User.GID != 0 {
+		return nil, errors.New("process.user must be root")
+	}
+	if proc.Cwd != "" && !filepath.IsAbs(proc.Cwd) {
+		return nil, fmt.Errorf("process.cwd must be absolute: %q", proc.Cwd)
+	}
+	o.Commands = proc.Args
+	o.Cwd = proc.Cwd
+
+	// The environment of the process is given in full.
+	var env []sandbox.EnvVar
+	for _, e := range proc.Env {
+		ev, err := ParseEnv(e)
+		if err != nil {
+			return nil, err
+		}
+		env = append(env, ev)
+	}
+	o.Env = MergeEnv(nil, env)
+
+	// The process has no capabilities unless listed.
+	var caps []string
+	if proc.Capabilities != nil {
+		caps = proc.Capabilities.Bounding
+	}
+	capOpts, err := sandbox.CapabilitiesFrom(caps)
+	if err != nil {
+		return nil, fmt.Errorf("bad process.capabilities: %w", err)
+	}
+	o.Capabilities = capOpts
+
+	for _, rl := range proc.Rlimits {
+		l, err := sandbox.NewRlimit(rl.Type, rl.Soft, rl.Hard)
+		if err != nil {
+			return nil, err
+		}
+		o.Rlimits = append(o.Rlimits, l)
+	}
+
+	// Root filesystem.
+	if cfg.Root == nil || cfg.Root.Path == "" {
+		return nil, errors.New("missing root.path")
+	}
+	root, err := resolvePath(bundle, cfg.Root.Path)
+	if err != nil {
+		return nil, err
+	}
+	if o.FS, err = parseFsMode(root); err != nil {
+		return nil, err
+	}
+	if o.FS.Mode != fs.FsRootfs {
+		return nil, fmt.Errorf("bad root.path %q", cfg.Root.Path)
+	}
+	o.ReadOnly = cfg.Root.Readonly
+
+	// Bind mounts. The proc, sys, dev and tmp filesystems are set up
+	// by microbox in every sandbox, and other types are ignored.
+	for _, m := range cfg.Mounts {
+		if m.Type != "bind" && !slices.Contains(m.Options, "bind") && !slices.Contains(m.Options, "rbind") {
+			continue
+		}
+		if !filepath.IsAbs(m.Destination) {
+			return nil, fmt.Errorf("mount destination must be absolute: %q", m.Destination)
+		}
+		src, err := resolvePath(bundle, m.Source)
+		if err != nil {
+			return nil, err
+		}
+		ms := fs.MountSpec{Host: src, Dest: m.Destination, RO: slices.Contains(m.Options, "ro")}
+		if ms.RO {
+			o.MountRO = append(o.MountRO, ms)
+		} else {
+			o.MountRW = append(o.MountRW, ms)
+		}
+	}
+
+	if cfg.Linux == nil {
+		return o, nil
+	}
+
+	// Namespaces. The PID, mount, IPC, UTS, cgroup and time namespaces
+	// are always created, while the user and network namespaces are
+	// created if listed, and shared with the host otherwise.
+	for _, ns := range cfg.Linux.Namespaces {
+		switch ns.Type {
+		case "user":
+			if ns.Path != "" {
+				return nil, errors.New("joining a user namespace is not supported")
+			}
+			o.NamespaceMode = sandbox.UserNamespaceIsolated
+		case "network":
+			o.Net = net.NetNone
+			o.JoinNetns = ns.Path
+		case "pid", "mount", "ipc", "uts", "cgroup", "time":
+			if ns.Path != "" {
+				return nil, fmt.Errorf("joining a %s namespace is not supported", ns.Type)
+			}
+		default:
+			return nil, fmt.Errorf("unknown namespace %q", ns.Type)
+		}
+	}
+
+	// Cgroup resources.
+	if res := cfg.Linux.Resources; res != nil {
+		if res.Memory != nil && res.Memory.Limit != nil && *res.Memory.Limit > 0 {
+			o.Memory = uint64(*res.Memory.Limit)
+		}
+		if cpu := res.CPU; cpu != nil && cpu.Quota != nil && cpu.Period != nil && *cpu.Quota > 0 && *cpu.Period > 0 {
+			o.CPUs = float64(*cpu.Quota) / float64(*cpu.Period)
+		}
+	}
+
+	// System calls. Profiles allowing by default are mapped onto their
+	// deny list. Allow lists cannot be expressed, so profiles denying
+	// by default are mapped onto their denied system calls in addition
+	// to the default deny list.
+	if sc := cfg.Linux.Seccomp; sc != nil {
+		allowByDefault := sc.DefaultAction == "SCMP_ACT_ALLOW" || sc.DefaultAction == "SCMP_ACT_LOG"
+		for _, rule := range sc.Syscalls {
+			if rule.Action == "SCMP_ACT_ALLOW" || rule.Action == "SCMP_ACT_LOG" {
+				continue
+			}
+			for _, name := range rule.Names {
+				// Profiles list system calls unknown to older kernels.
+				if _, err := seccomp.GetSyscallFromName(name); err == nil {
+					o.DenySys = append(o.DenySys, name)
+				}
+			}
+		}
+		if allowByDefault {
+			for _, name := range sandbox.DefaultDenySyscalls() {
+				if !slices.Contains(o.DenySys, name) {
+					o.AllowSys = append(o.AllowSys, name)
+				}
+			}
+		}
+	}
+
+	return o, nil
+}
+
+/**
+ * Parses a signal given by name or number.
+ * @param s the signal, such as `TERM`, `SIGTERM` or `15`
+ * @return the signal, or an error if it is unknown
+ */
+func parseSignal(s string) (unix.Signal, error) {
+	if n, err := strconv.Atoi(s); err == nil && n > 0 {
+		return unix.Signal(n), nil
+	}
+	name := strings.ToUpper(s)
+	if !strings.HasPrefix(name, "SIG") {
+		name = "SIG" + name
+	}
+	if sig := unix.SignalNum(name); sig != 0 {
+		return sig, nil
+	}
+	return 0, fmt.Errorf("unknown signal %q", s)
+}
+
+/**
+ * Parses the container identifier of a container command.
+ * @param c the CLI context
+ * @param usage the usage of the command
+ * @return the container identifier, or an error if missing
+ */
+func containerID(c *cli.Command, usage string) (string, error) {
+	if c.Args().Len() != 1 {
+		return "", fmt.Errorf("usage: microbox %s", usage)
+	}
+	return c.Args().First(), nil
+}
+
+/**
+ * Creates the `create` command.
+ * @param result where to store the parsed invocation
+ * @return the command
+ */
+func createCommand(result **Invocation) *cli.Command {
+	return &cli.Command{
+		Name:      "create",
+		Usage:     "Creates a container from an OCI bundle, without starting it",
+		ArgsUsage: "<container-id>",
+		Flags: append([]cli.Flag{
+
+			// Bundle directory.
+			&cli.StringFlag{
+				Name:  "bundle",
+				Value: ".",
+				Usage: "Bundle `DIR` holding config.json and the root filesystem",
+			},
+
+			// PID file.
+			&cli.StringFlag{
+				Name:  "pid-file",
+				Usage: "Writes the PID of the container process to `FILE`",
+			},
+		}, loggingFlags()...),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			id, err := containerID(c, "create [--bundle <dir>] <container-id>")
+			if err != nil {
+				return err
+			}
+			bundle, err := filepath.Abs(c.String("bundle"))
+			if err != nil {
+				return err
+			}
+			opts, annotations, err := loadBundle(bundle)
+			if err != nil {
+				return err
+			}
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+			opts.LogLevel = logOpts.LogLevel
+			opts.LogFormat = logOpts.LogFormat
+
+			*result = &Invocation{
+				Command:     CommandCreate,
+				Logger:      logOpts,
+				Sandbox:     opts,
+				Target:      id,
+				Bundle:      bundle,
+				Annotations: annotations,
+				PidFile:     c.String("pid-file"),
+			}
+			return nil
+		},
+	}
+}
+
+/**
+ * Creates a command operating on a container by identifier.
+ * @param result where to store the parsed invocation
+ * @param name the command name
+ * @param usage the command description
+ * @param command the parsed command
+ * @return the command
+ */
+func containerCommand(result **Invocation, name, usage string, command Command) *cli.Command {
+	return &cli.Command{
+		Name:      name,
+		Usage:     usage,
+		ArgsUsage: "<container-id>",
+		Flags:     loggingFlags(),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			id, err := containerID(c, name+" <container-id>")
+			if err != nil {
+				return err
+			}
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			*result = &Invocation{
+				Command: command,
+				Logger:  logOpts,
+				Target:  id,
+			}
+			return nil
+		},
+	}
+}
+
+/**
+ * Creates the `kill` command.
+ * @param result where to store the parsed invocation
+ * @return the command
+ */
+func killCommand(result **Invocation) *cli.Command {
+	return &cli.Command{
+		Name:      "kill",
+		Usage:     "Sends a signal to the process of a container",
+		ArgsUsage: "<container-id> [signal]",
+		Flags:     loggingFlags(),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			if c.Args().Len() < 1 || c.Args().Len() > 2 {
+				return fmt.Errorf("usage: microbox kill <container-id> [signal]")
+			}
+			sig := unix.SIGTERM
+			if c.Args().Len() == 2 {
+				var err error
+				if sig, err = parseSignal(c.Args().Get(1)); err != nil {
+					return err
+				}
+			}
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			*result = &Invocation{
+				Command: CommandKill,
+				Logger:  logOpts,
+				Target:  c.Args().First(),
+				Signal:  sig,
+			}
+			return nil
+		},
+	}
+}
+
+/**
+ * Creates the `delete` command.
+ * @param result where to store the parsed invocation
+ * @return the command
+ */
+func deleteCommand(result **Invocation) *cli.Command {
+	return &cli.Command{
+		Name:      "delete",
+		Usage:     "Deletes a stopped container",
+		ArgsUsage: "<container-id>",
+		Flags: append([]cli.Flag{
+
+			// Kill running containers.
+			&cli.BoolFlag{
+				Name:  "force",
+				Value: false,
+				Usage: "Kills the container if it is not stopped",
+			},
+		}, loggingFlags()...),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			id, err := containerID(c, "delete [--force] <container-id>")
+			if err != nil {
+				return err
+			}
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			*result = &Invocation{
+				Command: CommandDelete,
+				Logger:  logOpts,
+				Target:  id,
+				Force:   c.Bool("force"),
+			}
+			return nil
+		},
+	}
+}
@@ -8,15 +8,146 @@ import (
 	"fmt"
 	"time"
 
+	"github.com/HQarroum/microbox/bench"
 	"github.com/HQarroum/microbox/fs"
+	"github.com/HQarroum/microbox/logger"
+	"github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/profiling"
 	"github.com/HQarroum/microbox/sandbox"
+	"github.com/HQarroum/microbox/tracing"
 	"github.com/HQarroum/microbox/version"
 	"github.com/google/uuid"
 	"github.com/goombaio/namegenerator"
 	"github.com/inhies/go-bytesize"
 	"github.com/urfave/cli/v3"
+	"golang.org/x/sys/unix"
 )
 
+/**
+ * Commands supported by microbox.
+ */
+type Command int
+
+const (
+	CommandRun Command = iota
+	CommandCheckpoint
+	CommandRestore
+	CommandZygote
+	CommandBatch
+	CommandCreate
+	CommandStart
+	CommandState
+	CommandKill
+	CommandDelete
+	CommandBench
+	CommandNetCreate
+	CommandNetDelete
+	CommandNetList
+)
+
+/**
+ * A parsed microbox invocation.
+ */
+type Invocation struct {
+	// The command to execute.
+	Command Command
+
+	// Logger options.
+	Logger *logger.LoggerOpts
+
+	// Sandbox options (run, create).
+	Sandbox *sandbox.SandboxOptions
+
+	// Target sandbox identifier or hostname (checkpoint), container
+	// identifier (create, start, state, kill, delete), or network
+	// namespace name (net create, net rm).
+	Target string
+
+	// Absolute bundle path, its annotations, and the file to write the
+	// container PID to (create).
+	Bundle      string
+	Annotations map[string]string
+	PidFile     string
+
+	// Signal to send (kill).
+	Signal unix.Signal
+
+	// Whether to kill the container if it is not stopped (delete).
+	Force bool
+
+	// Checkpoint options (checkpoint).
+	Checkpoint *sandbox.CheckpointOptions
+
+	// Checkpoint image directory (restore).
+	ImageDir string
+
+	// Job socket path (zygote).
+	Socket string
+
+	// Jobs to run (batch).
+	Jobs []sandbox.BatchJob
+
+	// Whether to recycle the sandbox between jobs (batch).
+	Recycle bool
+
+	// Admission control options (batch).
+	Admission *sandbox.AdmissionOptions
+
+	// Metrics endpoint address (batch, zygote).
+	MetricsAddr string
+
+	// Trace span file and format (run, batch, zygote).
+	TraceSpans  string
+	TraceFormat tracing.Format
+
+	// Lifecycle event stream address (run, batch, zygote).
+	Events string
+
+	// Profiles of the supervisor to capture (run, batch, zygote).
+	Profiling profiling.Options
+
+	// Whether to serve pprof profiles on the metrics endpoint (batch, zygote).
+	Pprof bool
+
+	// Benchmarks to run (bench).
+	Bench *bench.Options
+}
+
+/**
+ * Builds the sandbox options from a spec file if given, and from
+ * CLI flags otherwise.
+ * @param c the CLI context
+ * @return the sandbox options and error if any
+ */
+func buildSandboxOptsFromCLI(c *cli.Command) (*sandbox.SandboxOptions, error) {
+	path := c.String("spec")
+	if path == "" {
+		return buildOptionsFromCLI(c)
+	}
+
+	// The spec describes the whole sandbox, and its seccomp program is
+	// compiled from it, so sandbox flags cannot amend it.
+	for _, f := range sandboxFlags() {
+		name := f.Names()[0]
+		if name != "spec" && name != "spec-name" && c.IsSet(name) {
+			return nil, fmt.Errorf("--%s conflicts with --spec", name)
+		}
+	}
+	profile, err := loadSpecProfile(path, c.String("spec-name"))
+	if err != nil {
+		return nil, err
+	}
+	o := profile.NewOptions()
+
+	logOpts, err := buildLoggerOptsFromCLI(c)
+	if err != nil {
+		return nil, err
+	}
+	o.LogLevel = logOpts.LogLevel
+	o.LogFormat = logOpts.LogFormat
+	return o, nil
+}
+
 /**
  * Builds an `Options` struct from CLI context.
  * @param c the CLI context
@@ -31,6 +162,9 @@ func buildOptionsFromCLI(c *cli.Command) (*sandbox.SandboxOptions, error) {
 		DenySys:  c.StringSlice("deny-syscall"),
 		NameServ: c.StringSlice("dns"),
 		ReadOnly: c.Bool("readonly"),
+
+		Checkpoint:   c.Bool("checkpointable"),
+		PerfCounters: c.Bool("perf-counters"),
 	}
 
 	// Memory size parsing.
@@ -47,26 +181,52 @@ func buildOptionsFromCLI(c *cli.Command) (*sandbox.SandboxOptions, error) {
 	}
 	o.Storage = uint64(stor)
 
-	// User namespace parsing.
-	ns, err := ParseUserNamespace(c.String("userns"))
+	// Transparent huge page policy parsing.
+	thp, err := parseThpMode(c.String("thp"))
 	if err != nil {
 		return nil, err
 	}
-	o.NamespaceMode = ns
+	o.Thp = thp
+	o.TmpfsHuge = thp.TmpfsHuge()
 
-	// Log level parsing.
-	logLevel, err := parseLogLevel(c.String("log-level"))
+	// Explicit `huge=` option for the sandbox tmpfs mounts.
+	if c.IsSet("tmpfs-huge") {
+		huge, err := parseTmpfsHuge(c.String("tmpfs-huge"))
+		if err != nil {
+			return nil, err
+		}
+		o.TmpfsHuge = huge
+	}
+
+	// Huge page reservations parsing.
+	if o.HugePages, err = parseHugePages(c.StringSlice("hugepages")); err != nil {
+		return nil, err
+	}
+
+	// io_uring policy parsing.
+	if o.IoUring, err = parseIoUringMode(c.String("io-uring")); err != nil {
+		return nil, err
+	}
+
+	// Emulated syscalls parsing.
+	if o.Emulate, err = parseEmulate(c.StringSlice("emulate-syscall")); err != nil {
+		return nil, err
+	}
+
+	// User namespace parsing.
+	ns, err := ParseUserNamespace(c.String("userns"))
 	if err != nil {
 		return nil, err
 	}
-	o.LogLevel = logLevel
+	o.NamespaceMode = ns
 
-	// Log format parsing.
-	logFormat, err := parseLogFormat(c.String("log-format"))
+	// Logger options parsing.
+	logOpts, err := buildLoggerOptsFromCLI(c)
 	if err != nil {
 		return nil, err
 	}
-	o.LogFormat = logFormat
+	o.LogLevel = logOpts.LogLevel
+	o.LogFormat = logOpts.LogFormat
 
 	// Filesystem parsing.
 	mode, err := parseFsMode(c.String("fs"))
@@ -76,11 +236,17 @@ func buildOptionsFromCLI(c *cli.Command) (*sandbox.SandboxOptions, error) {
 	o.FS = mode
 
 	// Network mode parsing.
-	net, err := parseNetMode(c.String("net"))
-	if err != nil {
+	if o.Net, o.NetNs, err = parseNetOption(c.String("net")); err != nil {
 		return nil, err
 	}
-	o.Net = net
+
+	// Network policy parsing.
+	if o.NetPolicy, err = parseNetPolicy(c.String("net-group"), c.Bool("net-isolate"), c.StringSlice("net-allow")); err != nil {
+		return nil, err
+	}
+	if !o.NetPolicy.IsZero() && o.Net != net.NetBridge {
+		return nil, fmt.Errorf("network policies require --net bridge")
+	}
 
 	// Read-only mounts.
 	for _, m := range c.StringSlice("mount-ro") {
@@ -136,157 +302,411 @@ func buildOptionsFromCLI(c *cli.Command) (*sandbox.SandboxOptions, error) {
 }
 
 /**
- * Parses CLI flags into an `Options` struct.
- * @param handler a function invoked to handle the command
- * @return a `Command` instance
+ * Builds the logger options from CLI context.
+ * @param c the CLI context
+ * @return the built logger options and error if any
  */
-func ParseCli(ctx context.Context, args []string) (*sandbox.SandboxOptions, error) {
-	var resultOpts *sandbox.SandboxOptions
+func buildLoggerOptsFromCLI(c *cli.Command) (*logger.LoggerOpts, error) {
+	// Log level parsing.
+	logLevel, err := parseLogLevel(c.String("log-level"))
+	if err != nil {
+		return nil, err
+	}
+
+	// Log format parsing.
+	logFormat, err := parseLogFormat(c.String("log-format"))
+	if err != nil {
+		return nil, err
+	}
+
+	// Log output parsing.
+	logOutput, err := parseLogOutput(c.String("log-output"))
+	if err != nil {
+		return nil, err
+	}
+
+	return &logger.LoggerOpts{
+		LogLevel:  logLevel,
+		LogFormat: logFormat,
+		Output:    logOutput,
+	}, nil
+}
+
+/**
+ * @return the flags controlling logging, shared by all commands.
+ */
+func loggingFlags() []cli.Flag {
+	return []cli.Flag{
+
+		// Verbosity
+		&cli.StringFlag{
+			Name:  "log-level",
+			Value: "error",
+			Usage: "Log verbosity (info|warn|error)",
+		},
+
+		// Log format.
+		&cli.StringFlag{
+			Name:  "log-format",
+			Value: "text",
+			Usage: "Log format (text|json)",
+		},
+
+		// Log output.
+		&cli.StringFlag{
+			Name:  "log-output",
+			Value: logger.DefaultOutput,
+			Usage: "Log output (stdout|stderr|fd:N|file path)",
+		},
+	}
+}
+
+/**
+ * @return the flags controlling tracing, events and profiling, shared by commands creating sandboxes.
+ */
+func tracingFlags() []cli.Flag {
+	return []cli.Flag{
+
+		// Trace span export.
+		&cli.StringFlag{
+			Name:  "trace-spans",
+			Usage: "Exports the lifecycle of sandboxes as trace spans to `FILE`",
+		},
+
+		// Trace span format.
+		&cli.StringFlag{
+			Name:  "trace-format",
+			Value: "chrome",
+			Usage: "Trace span format (chrome|otlp)",
+		},
+
+		// Lifecycle event stream.
+		&cli.StringFlag{
+			Name:  "events",
+			Usage: "Publishes sandbox lifecycle events as JSON lines on a Unix socket (unix:path) or file descriptor (fd:N)",
+		},
+
+		// Supervisor CPU profile.
+		&cli.StringFlag{
+			Name:  "cpuprofile",
+			Usage: "Writes a CPU profile of the supervisor to `FILE`",
+		},
+
+		// Supervisor allocation profile.
+		&cli.StringFlag{
+			Name:  "memprofile",
+			Usage: "Writes an allocation profile of the supervisor to `FILE` on exit",
+		},
+
+		// Supervisor execution trace.
+		&cli.StringFlag{
+			Name:  "trace",
+			Usage: "Writes a Go execution trace of the supervisor to `FILE`",
+		},
+	}
+}
+
+/**
+ * Builds the tracing, event and profiling options of an invocation from CLI context.
+ * @param c the CLI context
+ * @param inv the invocation to fill
+ * @return error if any
+ */
+func buildTracingOptsFromCLI(c *cli.Command, inv *Invocation) error {
+	format, err := tracing.ParseFormat(c.String("trace-format"))
+	if err != nil {
+		return err
+	}
+	inv.TraceSpans = c.String("trace-spans")
+	inv.TraceFormat = format
+	inv.Events = c.String("events")
+	inv.Profiling = profiling.Options{
+		CPUProfile: c.String("cpuprofile"),
+		MemProfile: c.String("memprofile"),
+		Trace:      c.String("trace"),
+	}
+	return nil
+}
+
+/**
+ * Builds the service options of an invocation from CLI context.
+ * @param c the CLI context
+ * @param inv the invocation to fill
+ * @return error if any
+ */
+func buildServiceOptsFromCLI(c *cli.Command, inv *Invocation) error {
+	inv.MetricsAddr = c.String("metrics-addr")
+	inv.Pprof = c.Bool("pprof")
+	if inv.Pprof && inv.MetricsAddr == "" {
+		return fmt.Errorf("--pprof requires --metrics-addr")
+	}
+	return nil
+}
+
+/**
+ * @return the flags of long-running commands.
+ */
+func serviceFlags() []cli.Flag {
+	return []cli.Flag{
+
+		// Metrics endpoint.
+		&cli.StringFlag{
+			Name:  "metrics-addr",
+			Usage: "Exposes Prometheus metrics on a TCP `ADDRESS` (host:port) or Unix socket (unix:path)",
+		},
+
+		// Profiling endpoint.
+		&cli.BoolFlag{
+			Name:  "pprof",
+			Value: false,
+			Usage: "Serves profiles of the supervisor on /debug/pprof/ of the metrics endpoint",
+		},
+	}
+}
+
+/**
+ * @return the flags describing a sandbox.
+ */
+func sandboxFlags() []cli.Flag {
 	var generator = namegenerator.NewNameGenerator(
 		time.Now().UTC().UnixNano(),
 	)
 
+	return []cli.Flag{
+
+		// Sandbox spec file.
+		&cli.StringFlag{
+			Name:  "spec",
+			Usage: "Describes the sandbox with a JSON spec `FILE` instead of flags",
+		},
+
+		// Sandbox selection in a spec file.
+		&cli.StringFlag{
+			Name:  "spec-name",
+			Usage: "Selects the sandbox `NAME` in a spec file describing several sandboxes",
+		},
+
+		// Filesystem
+		&cli.StringFlag{
+			Name:  "fs",
+			Value: "tmpfs",
+			Usage: "Root filesystem (host|tmpfs|<directory path>)",
+		},
+
+		// Network
+		&cli.StringFlag{
+			Name:  "net",
+			Value: "none",
+			Usage: "Network mode (none|host|bridge), or ns:<name> to join a named network namespace",
+		},
+
+		// Network policy
+		&cli.StringFlag{
+			Name:  "net-group",
+			Usage: "Network policy `group` of the sandbox",
+		},
+		&cli.StringSliceFlag{
+			Name:  "net-allow",
+			Usage: "Allows the sandboxes of a group to reach the sandbox, as `GROUP[:PORT[/PROTO]]`",
+		},
+		&cli.BoolFlag{
+			Name:  "net-isolate",
+			Usage: "Denies the traffic of other sandboxes not allowed by --net-allow",
+		},
+
+		// Read-only bind mounts
+		&cli.StringSliceFlag{
+			Name:  "mount-ro",
+			Usage: "Read-only bind mounts from the host (`HOST:SANDBOX`)",
+		},
+
+		// Read-write bind mounts
+		&cli.StringSliceFlag{
+			Name:  "mount-rw",
+			Usage: "Read-write bind mounts from the host (`HOST:SANDBOX`)",
+		},
+
+		// Read-only filesystem.
+		&cli.BoolFlag{
+			Name:  "readonly",
+			Value: false,
+			Usage: "Whether to mount the root filesystem as read-only",
+		},
+
+		// Environment variables
+		&cli.StringSliceFlag{
+			Name:  "env",
+			Usage: "Sets an environment variable as `KEY=VALUE` in the sandbox",
+		},
+
+		// Allowed syscalls
+		&cli.StringSliceFlag{
+			Name:  "allow-syscall",
+			Usage: "A `syscall` to allow in the sandbox",
+		},
+
+		// Denied syscalls
+		&cli.StringSliceFlag{
+			Name:  "deny-syscall",
+			Usage: "A `syscall` to deny in the sandbox",
+		},
+
+		// io_uring policy
+		&cli.StringFlag{
+			Name:  "io-uring",
+			Value: "deny",
+			Usage: "io_uring policy (deny|filter-register|allow)",
+		},
+
+		// Emulated syscalls
+		&cli.StringSliceFlag{
+			Name:  "emulate-syscall",
+			Usage: "A `syscall` emulated by the supervisor on behalf of the sandbox (mount)",
+		},
+
+		// DNS nameservers
+		&cli.StringSliceFlag{
+			Name:  "dns",
+			Usage: "A DNS nameserver to use in the sandbox",
+		},
+
+		// Hostname
+		&cli.StringFlag{
+			Name:  "hostname",
+			Value: generator.Generate(),
+			Usage: "Sets the hostname of the sandbox",
+		},
+
+		// CPUs
+		&cli.Float32Flag{
+			Name:  "cpus",
+			Value: 1.0,
+			Usage: "CPU shares to allocate to the sandbox",
+		},
+
+		// Memory
+		&cli.StringFlag{
+			Name:  "memory",
+			Value: "1GB",
+			Usage: "Memory to allocate to the sandbox (e.g., 512MB, 2GB)",
+		},
+
+		// Storage
+		&cli.StringFlag{
+			Name:  "storage",
+			Value: "512MB",
+			Usage: "Storage space to allocate to the sandbox (e.g., 1GB, 10GB)",
+		},
+
+		// Transparent huge pages.
+		&cli.StringFlag{
+			Name:  "thp",
+			Value: "inherit",
+			Usage: "Transparent huge page policy (inherit|never|madvise|always)",
+		},
+
+		// Huge pages on tmpfs mounts.
+		&cli.StringFlag{
+			Name:  "tmpfs-huge",
+			Usage: "Overrides the `huge=` option of the sandbox tmpfs mounts (never|always|within_size|advise)",
+		},
+
+		// Huge page reservations.
+		&cli.StringSliceFlag{
+			Name:  "hugepages",
+			Usage: "Reserves huge pages for the sandbox as `SIZE:COUNT` (e.g., 2M:512), mounted at /dev/hugepages",
+		},
+
+		// Add capabilities to the sandbox.
+		&cli.StringSliceFlag{
+			Name:  "cap-add",
+			Usage: "Add a capability to the sandbox (e.g., CAP_NET_ADMIN)",
+		},
+
+		// Remove capabilities from the sandbox.
+		&cli.StringSliceFlag{
+			Name:  "cap-drop",
+			Usage: "Drop a capability from the sandbox (e.g., CAP_CHOWN)",
+		},
+
+		// Keep the writable layer visible to the supervisor for checkpoints.
+		&cli.BoolFlag{
+			Name:  "checkpointable",
+			Value: false,
+			Usage: "Allows the sandbox to be checkpointed with microbox checkpoint",
+		},
+
+		// Performance counters of the sandbox.
+		&cli.BoolFlag{
+			Name:  "perf-counters",
+			Value: false,
+			Usage: "Counts cycles, instructions, cache misses, context switches and page faults of the sandbox",
+		},
+
+		// User namespace options.
+		&cli.StringFlag{
+			Name:  "userns",
+			Usage: "Specifies the user namespace mode (isolated|host)",
+			Value: "isolated",
+		},
+	}
+}
+
+/**
+ * Parses CLI flags into an `Invocation` struct.
+ * @param ctx the context of the invocation
+ * @param args the command-line arguments
+ * @return the parsed invocation, nil if help or version was printed, and error if any
+ */
+func ParseCli(ctx context.Context, args []string) (*Invocation, error) {
+	var result *Invocation
+
 	cmd := &cli.Command{
 		Name:    "microbox",
 		Usage:   "Lightweight sandboxes for Linux.",
 		Version: version.Version(),
-		Flags: []cli.Flag{
-
-			// Filesystem
-			&cli.StringFlag{
-				Name:  "fs",
-				Value: "tmpfs",
-				Usage: "Root filesystem (host|tmpfs|<directory path>)",
-			},
-
-			// Network
-			&cli.StringFlag{
-				Name:  "net",
-				Value: "none",
-				Usage: "Network mode (none|host|bridge)",
-			},
-
-			// Read-only bind mounts
-			&cli.StringSliceFlag{
-				Name:  "mount-ro",
-				Usage: "Read-only bind mounts from the host (`HOST:SANDBOX`)",
-			},
-
-			// Read-write bind mounts
-			&cli.StringSliceFlag{
-				Name:  "mount-rw",
-				Usage: "Read-write bind mounts from the host (`HOST:SANDBOX`)",
-			},
-
-			// Read-only filesystem.
-			&cli.BoolFlag{
-				Name:  "readonly",
-				Value: false,
-				Usage: "Whether to mount the root filesystem as read-only",
-			},
-
-			// Environment variables
-			&cli.StringSliceFlag{
-				Name:  "env",
-				Usage: "Sets an environment variable as `KEY=VALUE` in the sandbox",
-			},
-
-			// Allowed syscalls
-			&cli.StringSliceFlag{
-				Name:  "allow-syscall",
-				Usage: "A `syscall` to allow in the sandbox",
-			},
-
-			// Denied syscalls
-			&cli.StringSliceFlag{
-				Name:  "deny-syscall",
-				Usage: "A `syscall` to deny in the sandbox",
-			},
-
-			// DNS nameservers
-			&cli.StringSliceFlag{
-				Name:  "dns",
-				Usage: "A DNS nameserver to use in the sandbox",
-			},
-
-			// Hostname
-			&cli.StringFlag{
-				Name:  "hostname",
-				Value: generator.Generate(),
-				Usage: "Sets the hostname of the sandbox",
-			},
-
-			// CPUs
-			&cli.Float32Flag{
-				Name:  "cpus",
-				Value: 1.0,
-				Usage: "CPU shares to allocate to the sandbox",
-			},
-
-			// Memory
-			&cli.StringFlag{
-				Name:  "memory",
-				Value: "1GB",
-				Usage: "Memory to allocate to the sandbox (e.g., 512MB, 2GB)",
-			},
-
-			// Storage
-			&cli.StringFlag{
-				Name:  "storage",
-				Value: "512MB",
-				Usage: "Storage space to allocate to the sandbox (e.g., 1GB, 10GB)",
-			},
-
-			// Verbosity
-			&cli.StringFlag{
-				Name:  "log-level",
-				Value: "error",
-				Usage: "Log verbosity (info|warn|error)",
-			},
-
-			// Log format.
-			&cli.StringFlag{
-				Name:  "log-format",
-				Value: "text",
-				Usage: "Log format (text|json)",
-			},
-
-			// Add capabilities to the sandbox.
-			&cli.StringSliceFlag{
-				Name:  "cap-add",
-				Usage: "Add a capability to the sandbox (e.g., CAP_NET_ADMIN)",
-			},
-
-			// Remove capabilities from the sandbox.
-			&cli.StringSliceFlag{
-				Name:  "cap-drop",
-				Usage: "Drop a capability from the sandbox (e.g., CAP_CHOWN)",
-			},
-
-			// User namespace options.
-			&cli.StringFlag{
-				Name:  "userns",
-				Usage: "Specifies the user namespace mode (isolated|host)",
-				Value: "isolated",
-			},
-		},
+		Flags:   append(append(sandboxFlags(), tracingFlags()...), loggingFlags()...),
 
 		// Parse arguments into an `Options` struct.
 		Action: func(ctx context.Context, c *cli.Command) error {
-			opts, err := buildOptionsFromCLI(c)
+			opts, err := buildSandboxOptsFromCLI(c)
 			if err != nil {
 				return err
 			}
 
 			// Command to execute in the sandbox.
-			argv := c.Args().Slice()
-			if len(argv) == 0 {
+			if argv := c.Args().Slice(); len(argv) > 0 {
+				opts.Commands = argv
+			}
+			if len(opts.Commands) == 0 {
 				return fmt.Errorf("missing command; usage: microbox [options] -- command [args...]")
 			}
 
-			opts.Commands = argv
-			resultOpts = opts
-			return nil
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			result = &Invocation{
+				Command: CommandRun,
+				Logger:  logOpts,
+				Sandbox: opts,
+			}
+			return buildTracingOptsFromCLI(c, result)
+		},
+
+		Commands: []*cli.Command{
+			checkpointCommand(&result),
+			restoreCommand(&result),
+			zygoteCommand(&result),
+			batchCommand(&result),
+			createCommand(&result),
+			containerCommand(&result, "start", "Starts a created container", CommandStart),
+			containerCommand(&result, "state", "Prints the state of a container", CommandState),
+			killCommand(&result),
+			deleteCommand(&result),
+			benchCommand(&result),
+			netCommand(&result),
 		},
 	}
 
@@ -296,5 +716,5 @@ func ParseCli(ctx context.Context, args []string) (*sandbox.SandboxOptions, erro
 		return nil, err
 	}
 
-	return resultOpts, nil
+	return result, nil
 }
@@ -0,0 +1,401 @@
+//go:build linux
+
+package options
+
+import (
+	"bytes"
+	"crypto/sha256"
+	"encoding/hex"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"io"
+	"os"
+	"path/filepath"
+	"runtime"
+
+	"github.com/HQarroum/microbox/fs"
+	"github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/sandbox"
+	"github.com/HQarroum/microbox/version"
+	"github.com/inhies/go-bytesize"
+	seccomp "github.com/seccomp/libseccomp-golang"
+)
+
+/**
+ * The description of a sandbox in a spec file. Omitted fields take the
+ * default values of the corresponding flags.
+ */
+type sandboxSpec struct {
+	Name     string   `json:"name"`
+	FS       string   `json:"fs"`
+	ReadOnly bool     `json:"readonly"`
+	Net      string   `json:"net"`
+	CPUs     *float64 `json:"cpus"`
+	Memory   string   `json:"memory"`
+	Storage  string   `json:"storage"`
+	Hostname string   `json:"hostname"`
+	DNS      []string `json:"dns"`
+	Env      []string `json:"env"`
+	UserNS   string   `json:"userns"`
+	Thp      string   `json:"thp"`
+
+	// Huge page policy of the tmpfs mounts, overriding the THP policy.
+	TmpfsHuge string `json:"tmpfsHuge"`
+
+	// Huge page reservations, as `SIZE:COUNT`.
+	HugePages []string `json:"hugepages"`
+
+	// Network policy of bridged sandboxes.
+	NetPolicy struct {
+		Group   string   `json:"group"`
+		Isolate bool     `json:"isolate"`
+		Allow   []string `json:"allow"`
+	} `json:"netPolicy"`
+
+	Mounts struct {
+		RO []string `json:"ro"`
+		RW []string `json:"rw"`
+	} `json:"mounts"`
+
+	Seccomp struct {
+		Allow   []string `json:"allow"`
+		Deny    []string `json:"deny"`
+		IoUring string   `json:"ioUring"`
+		Emulate []string `json:"emulate"`
+	} `json:"seccomp"`
+
+	Capabilities struct {
+		Add  []string `json:"add"`
+		Drop []string `json:"drop"`
+	} `json:"capabilities"`
+
+	Checkpointable bool `json:"checkpointable"`
+	PerfCounters   bool `json:"perfCounters"`
+
+	// Command to execute, unless given on the command line.
+	Command []string `json:"command"`
+}
+
+/**
+ * Loads the profile of a sandbox from a spec file. Compiled profiles are
+ * cached by the hash of the spec file, so that launching a sandbox from
+ * an unchanged spec skips its validation and resolution. The host paths
+ * of cached profiles are resolved again, the rootfs and the mounts being
+ * free to move or be retargeted without the spec changing.
+ * @param path the path of the spec file
+ * @param name the name of the sandbox, which may be omitted if the file describes only one
+ * @return the profile, or an error if any
+ */
+func loadSpecProfile(path, name string) (*sandbox.Profile, error) {
+	data, err := os.ReadFile(path)
+	if err != nil {
+		return nil, fmt.Errorf("bad --spec: %w", err)
+	}
+	key := specKey(path, data)
+
+	dir, _ := filepath.Abs(filepath.Dir(path))
+	profiles, err := sandbox.LoadProfiles(key)
+	if err != nil || !pathsResolved(profiles, dir) {
+		if profiles, err = compileSpecs(data, dir); err != nil {
+			return nil, fmt.Errorf("bad spec %s: %w", path, err)
+		}
+		// The cache is an optimization; failing to fill it is not an error.
+		_ = sandbox.SaveProfiles(key, profiles)
+	}
+
+	if name == "" {
+		if len(profiles) != 1 {
+			return nil, fmt.Errorf("spec %s describes %d sandboxes, select one with --spec-name", path, len(profiles))
+		}
+		return profiles[0], nil
+	}
+	for _, p := range profiles {
+		if p.Name == name {
+			return p, nil
+		}
+	}
+	return nil, fmt.Errorf("no sandbox named %q in spec %s", name, path)
+}
+
+/**
+ * Computes the cache key of a spec file. Relative paths in the spec are
+ * resolved against the directory of the file, and the compiled seccomp
+ * programs depend on the microbox and libseccomp versions, and on the
+ * architecture, which are all part of the key.
+ * @param path the path of the spec file
+ * @param data the content of the spec file
+ * @return the cache key
+ */
+func specKey(path string, data []byte) string {
+	dir, _ := filepath.Abs(filepath.Dir(path))
+	major, minor, micro := seccomp.GetLibraryVersion()
+
+	h := sha256.New()
+	fmt.Fprintf(h, "%s\x00%s\x00%d.%d.%d\x00%s\x00", version.Version(), runtime.GOARCH, major, minor, micro, dir)
+	h.Write(data)
+	return hex.EncodeToString(h.Sum(nil))
+}
+
+/**
+ * @param profiles the profiles
+ * @param dir the directory relative paths are resolved against
+ * @return whether the host paths of the profiles still resolve as when compiled.
+ */
+func pathsResolved(profiles []*sandbox.Profile, dir string) bool {
+	for _, p := range profiles {
+		for path, resolved := range p.Paths {
+			if r, err := resolvePath(dir, path); err != nil || r != resolved {
+				return false
+			}
+		}
+	}
+	return true
+}
+
+/**
+ * Validates and compiles the sandboxes of a spec file, which holds
+ * either a single sandbox or an array of sandboxes.
+ * @param data the content of the spec file
+ * @param dir the directory relative paths are resolved against
+ * @return the compiled profiles, or an error if any
+ */
+func compileSpecs(data []byte, dir string) ([]*sandbox.Profile, error) {
+	var specs []sandboxSpec
+	data = bytes.TrimSpace(data)
+	if len(data) > 0 && data[0] == '[' {
+		if err := decodeStrict(data, &specs); err != nil {
+			return nil, err
+		}
+	} else {
+		var spec sandboxSpec
+		if err := decodeStrict(data, &spec); err != nil {
+			return nil, err
+		}
+		specs = append(specs, spec)
+	}
+	if len(specs) == 0 {
+		return nil, errors.New("no sandbox described")
+	}
+
+	names := make(map[string]bool, len(specs))
+	profiles := make([]*sandbox.Profile, 0, len(specs))
+	for i := range specs {
+		spec := &specs[i]
+		if len(specs) > 1 && spec.Name == "" {
+			return nil, fmt.Errorf("sandbox #%d: missing name", i)
+		}
+		if names[spec.Name] {
+			return nil, fmt.Errorf("duplicate sandbox name %q", spec.Name)
+		}
+		names[spec.Name] = true
+
+		paths := make(map[string]string)
+		opts, err := spec.build(dir, paths)
+		if err != nil {
+			return nil, fmt.Errorf("sandbox %q: %w", spec.Name, err)
+		}
+		p, err := sandbox.CompileProfile(spec.Name, opts)
+		if err != nil {
+			return nil, err
+		}
+		p.Paths = paths
+		profiles = append(profiles, p)
+	}
+	return profiles, nil
+}
+
+/**
+ * Decodes JSON, rejecting unknown fields.
+ */
+func decodeStrict(data []byte, v any) error {
+	dec := json.NewDecoder(bytes.NewReader(data))
+	dec.DisallowUnknownFields()
+	if err := dec.Decode(v); err != nil {
+		return err
+	}
+	if _, err := dec.Token(); err != io.EOF {
+		return errors.New("trailing data after JSON value")
+	}
+	return nil
+}
+
+/**
+ * Validates a sandbox spec and resolves it into sandbox options.
+ * @param dir the directory relative paths are resolved against
+ * @param paths receives the resolution of the host paths of the spec
+ * @return the sandbox options, or an error if any
+ */
+func (s *sandboxSpec) build(dir string, paths map[string]string) (*sandbox.SandboxOptions, error) {
+	resolve := func(p string) (string, error) {
+		resolved, err := resolvePath(dir, p)
+		if err == nil {
+			paths[p] = resolved
+		}
+		return resolved, err
+	}
+
+	o := &sandbox.SandboxOptions{
+		Hostname:     s.Hostname,
+		CPUs:         1.0,
+		AllowSys:     s.Seccomp.Allow,
+		DenySys:      s.Seccomp.Deny,
+		NameServ:     s.DNS,
+		ReadOnly:     s.ReadOnly,
+		Commands:     s.Command,
+		Checkpoint:   s.Checkpointable,
+		PerfCounters: s.PerfCounters,
+	}
+	if o.Hostname == "" {
+		o.Hostname = s.Name
+	}
+	if s.CPUs != nil {
+		if *s.CPUs < 0 {
+			return nil, fmt.Errorf("bad cpus %v", *s.CPUs)
+		}
+		o.CPUs = *s.CPUs
+	}
+
+	// Limits.
+	mem, err := bytesize.Parse(orDefault(s.Memory, "1GB"))
+	if err != nil {
+		return nil, fmt.Errorf("bad memory %q: %v", s.Memory, err)
+	}
+	o.Memory = uint64(mem)
+	stor, err := bytesize.Parse(orDefault(s.Storage, "512MB"))
+	if err != nil {
+		return nil, fmt.Errorf("bad storage %q: %v", s.Storage, err)
+	}
+	o.Storage = uint64(stor)
+
+	// Modes.
+	thp, err := parseThpMode(orDefault(s.Thp, "inherit"))
+	if err != nil {
+		return nil, err
+	}
+	o.Thp = thp
+	o.TmpfsHuge = thp.TmpfsHuge()
+	if s.TmpfsHuge != "" {
+		if o.TmpfsHuge, err = parseTmpfsHuge(s.TmpfsHuge); err != nil {
+			return nil, err
+		}
+	}
+	if o.HugePages, err = parseHugePages(s.HugePages); err != nil {
+		return nil, err
+	}
+	if o.IoUring, err = parseIoUringMode(orDefault(s.Seccomp.IoUring, "deny")); err != nil {
+		return nil, err
+	}
+	if o.Emulate, err = parseEmulate(s.Seccomp.Emulate); err != nil {
+		return nil, err
+	}
+	if o.NamespaceMode, err = ParseUserNamespace(orDefault(s.UserNS, "isolated")); err != nil {
+		return nil, err
+	}
+	if o.Net, o.NetNs, err = parseNetOption(orDefault(s.Net, "none")); err != nil {
+		return nil, err
+	}
+	if o.NetPolicy, err = parseNetPolicy(s.NetPolicy.Group, s.NetPolicy.Isolate, s.NetPolicy.Allow); err != nil {
+		return nil, err
+	}
+	if !o.NetPolicy.IsZero() && o.Net != net.NetBridge {
+		return nil, fmt.Errorf("network policies require the bridge network")
+	}
+
+	// Filesystem, resolving the rootfs to an absolute path without links.
+	fsMode := orDefault(s.FS, "tmpfs")
+	if fsMode != "host" && fsMode != "tmpfs" {
+		if fsMode, err = resolve(fsMode); err != nil {
+			return nil, err
+		}
+	}
+	if o.FS, err = parseFsMode(fsMode); err != nil {
+		return nil, err
+	}
+
+	// Mounts.
+	for _, m := range s.Mounts.RO {
+		ms, err := parseMount(m, true)
+		if err != nil {
+			return nil, err
+		}
+		if ms.Host, err = resolve(ms.Host); err != nil {
+			return nil, err
+		}
+		o.MountRO = append(o.MountRO, ms)
+	}
+	for _, m := range s.Mounts.RW {
+		ms, err := parseMount(m, false)
+		if err != nil {
+			return nil, err
+		}
+		if ms.Host, err = resolve(ms.Host); err != nil {
+			return nil, err
+		}
+		o.MountRW = append(o.MountRW, ms)
+	}
+	if o.FS.Mode == fs.FsHost && (len(o.MountRO) > 0 || len(o.MountRW) > 0) {
+		return nil, errors.New("fs host conflicts with mounts (requires private mount ns)")
+	}
+
+	// Environment.
+	var userEnv []sandbox.EnvVar
+	for _, e := range s.Env {
+		ev, err := ParseEnv(e)
+		if err != nil {
+			return nil, err
+		}
+		userEnv = append(userEnv, ev)
+	}
+	o.Env = MergeEnv(defaultEnvironment, userEnv)
+
+	// Capabilities.
+	addIDs, err := sandbox.FromCapabilities(s.Capabilities.Add)
+	if err != nil {
+		return nil, fmt.Errorf("bad capabilities.add: %w", err)
+	}
+	dropIDs, err := sandbox.FromCapabilities(s.Capabilities.Drop)
+	if err != nil {
+		return nil, fmt.Errorf("bad capabilities.drop: %w", err)
+	}
+	o.Capabilities = &sandbox.CapabilityOpts{
+		Add:  sandbox.NewCapSet(addIDs...),
+		Drop: sandbox.NewCapSet(dropIDs...),
+	}
+
+	// System calls, which are otherwise silently ignored when unknown.
+	for _, name := range append(append([]string{}, s.Seccomp.Allow...), s.Seccomp.Deny...) {
+		if _, err := seccomp.GetSyscallFromName(name); err != nil {
+			return nil, fmt.Errorf("unknown syscall %q", name)
+		}
+	}
+
+	return o, nil
+}
+
+/**
+ * @return the value, or the default value if it is empty.
+ */
+func orDefault(v, def string) string {
+	if v == "" {
+		return def
+	}
+	return v
+}
+
+/**
+ * Resolves a host path to an absolute path without symbolic links.
+ * @param dir the directory relative paths are resolved against
+ * @param p the path
+ * @return the resolved path, or an error if it does not exist
+ */
+func resolvePath(dir, p string) (string, error) {
+	if !filepath.IsAbs(p) {
+		p = filepath.Join(dir, p)
+	}
+	resolved, err := filepath.EvalSymlinks(p)
+	if err != nil {
+		return "", fmt.Errorf("bad path %q: %w", p, err)
+	}
+	return resolved, nil
+}
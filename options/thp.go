@@ -0,0 +1,43 @@
+//go:build linux
+
+package options
+
+import (
+	"fmt"
+
+	"github.com/HQarroum/microbox/sandbox"
+)
+
+/**
+ * Parse the transparent huge page policy from a string.
+ * @param s the string to parse
+ * @return the parsed THP policy and error if any
+ */
+func parseThpMode(s string) (sandbox.ThpMode, error) {
+	switch s {
+	case "inherit":
+		return sandbox.ThpInherit, nil
+	case "never":
+		return sandbox.ThpNever, nil
+	case "madvise":
+		return sandbox.ThpMadvise, nil
+	case "always":
+		return sandbox.ThpAlways, nil
+	default:
+		return sandbox.ThpInherit, fmt.Errorf("bad --thp %q (inherit|never|madvise|always)", s)
+	}
+}
+
+/**
+ * Parse the `huge=` tmpfs mount option from a string.
+ * @param s the string to parse
+ * @return the parsed option and error if any
+ */
+func parseTmpfsHuge(s string) (string, error) {
+	switch s {
+	case "never", "always", "within_size", "advise":
+		return s, nil
+	default:
+		return "", fmt.Errorf("bad --tmpfs-huge %q (never|always|within_size|advise)", s)
+	}
+}
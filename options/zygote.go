@@ -0,0 +1,63 @@
+//go:build linux
+
+package options
+
+import (
+	"context"
+	"fmt"
+
+	"github.com/urfave/cli/v3"
+)
+
+/**
+ * Creates the `zygote` command.
+ * @param result where to store the parsed invocation
+ * @return the command
+ */
+func zygoteCommand(result **Invocation) *cli.Command {
+	return &cli.Command{
+		Name:      "zygote",
+		Usage:     "Runs a preloaded fork-server in a sandbox, forking a child per job",
+		ArgsUsage: "-- command [args...]",
+		Flags: append(append([]cli.Flag{
+
+			// Job socket.
+			&cli.StringFlag{
+				Name:     "socket",
+				Usage:    "Unix socket `PATH` to accept job requests on",
+				Required: true,
+			},
+		}, sandboxFlags()...), append(append(serviceFlags(), tracingFlags()...), loggingFlags()...)...),
+
+		Action: func(ctx context.Context, c *cli.Command) error {
+			opts, err := buildSandboxOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			// Zygote command to execute in the sandbox.
+			if argv := c.Args().Slice(); len(argv) > 0 {
+				opts.Commands = argv
+			}
+			if len(opts.Commands) == 0 {
+				return fmt.Errorf("missing command; usage: microbox zygote --socket <path> [options] -- command [args...]")
+			}
+
+			logOpts, err := buildLoggerOptsFromCLI(c)
+			if err != nil {
+				return err
+			}
+
+			*result = &Invocation{
+				Command: CommandZygote,
+				Logger:  logOpts,
+				Sandbox: opts,
+				Socket:  c.String("socket"),
+			}
+			if err := buildServiceOptsFromCLI(c, *result); err != nil {
+				return err
+			}
+			return buildTracingOptsFromCLI(c, *result)
+		},
+	}
+}
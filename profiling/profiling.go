@@ -0,0 +1,133 @@
+//go:build linux
+
+package profiling
+
+import (
+	"context"
+	"errors"
+	"fmt"
+	"net/http"
+	httppprof "net/http/pprof"
+	"os"
+	"runtime"
+	"runtime/pprof"
+	"runtime/trace"
+)
+
+/**
+ * Profiles of the supervisor to capture.
+ */
+type Options struct {
+	// Path of the CPU profile, if any.
+	CPUProfile string
+
+	// Path of the allocation profile, written on stop, if any.
+	MemProfile string
+
+	// Path of the execution trace, if any.
+	Trace string
+}
+
+/**
+ * Starts capturing the profiles of the supervisor. Sandboxed processes
+ * are not profiled, as profiling timers are not inherited by clone.
+ * @param opts the profiles to capture
+ * @return a function stopping the capture and writing the profiles, or error if any
+ */
+func Start(opts Options) (func() error, error) {
+	var stops []func() error
+	stop := func() error {
+		var errs []error
+		for i := len(stops) - 1; i >= 0; i-- {
+			errs = append(errs, stops[i]())
+		}
+		return errors.Join(errs...)
+	}
+
+	if opts.CPUProfile != "" {
+		f, err := os.Create(opts.CPUProfile)
+		if err != nil {
+			return nil, fmt.Errorf("create CPU profile: %w", err)
+		}
+		if err := pprof.StartCPUProfile(f); err != nil {
+			f.Close()
+			return nil, fmt.Errorf("start CPU profile: %w", err)
+		}
+		stops = append(stops, func() error {
+			pprof.StopCPUProfile()
+			return f.Close()
+		})
+	}
+
+	if opts.Trace != "" {
+		f, err := os.Create(opts.Trace)
+		if err != nil {
+			_ = stop()
+			return nil, fmt.Errorf("create execution trace: %w", err)
+		}
+		if err := trace.Start(f); err != nil {
+			f.Close()
+			_ = stop()
+			return nil, fmt.Errorf("start execution trace: %w", err)
+		}
+		stops = append(stops, func() error {
+			trace.Stop()
+			return f.Close()
+		})
+	}
+
+	if opts.MemProfile != "" {
+		path := opts.MemProfile
+		stops = append(stops, func() error {
+			return writeProfile("allocs", path)
+		})
+	}
+
+	return stop, nil
+}
+
+/**
+ * Writes a named profile to a file.
+ * @param name the profile name
+ * @param path the path of the file
+ * @return error if any
+ */
+func writeProfile(name, path string) error {
+	f, err := os.Create(path)
+	if err != nil {
+		return fmt.Errorf("create %s profile: %w", name, err)
+	}
+	// Account for the objects freed since the last collection.
+	runtime.GC()
+	if err := pprof.Lookup(name).WriteTo(f, 0); err != nil {
+		f.Close()
+		return fmt.Errorf("write %s profile: %w", name, err)
+	}
+	return f.Close()
+}
+
+/**
+ * Runs a function labeled with an operation of the supervisor, so that
+ * its samples can be told apart in profiles, and as a region in
+ * execution traces.
+ * @param op the operation name
+ * @param f the function
+ */
+func Do(op string, f func()) {
+	pprof.Do(context.Background(), pprof.Labels("op", op), func(ctx context.Context) {
+		trace.WithRegion(ctx, op, f)
+	})
+}
+
+/**
+ * @return the handlers of the pprof endpoint, by path.
+ */
+func Handlers() map[string]http.Handler {
+	return map[string]http.Handler{
+		"/debug/pprof/":        http.HandlerFunc(httppprof.Index),
+		"/debug/pprof/cmdline": http.HandlerFunc(httppprof.Cmdline),
+		"/debug/pprof/profile": http.HandlerFunc(httppprof.Profile),
+		"/debug/pprof/symbol":  http.HandlerFunc(httppprof.Symbol),
+		"/debug/pprof/trace":   http.HandlerFunc(httppprof.Trace),
+	}
+}
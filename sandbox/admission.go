@@ -0,0 +1,379 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"container/heap"
+	"context"
+	"fmt"
+	"math"
+	"os"
+	"runtime"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// Host memory pressure file.
+	psiMemoryPath = "/proc/pressure/memory"
+
+	// Interval at which pressure is polled while admission is held.
+	psiPollInterval = 250 * time.Millisecond
+
+	// Weight of tenants without an explicit weight.
+	defaultTenantWeight = 1.0
+)
+
+/**
+ * Resources committed to a sandbox, or available on the host.
+ */
+type Resources struct {
+	// Number of CPUs (0 => not accounted).
+	CPUs float64
+
+	// Memory in bytes (0 => not accounted).
+	Memory uint64
+
+	// Writable storage in bytes (0 => not accounted).
+	Storage uint64
+
+	// Number of sandboxes (0 => not accounted).
+	Slots int
+}
+
+/**
+ * Admission control options.
+ */
+type AdmissionOptions struct {
+	// Host capacity. Zero CPUs and memory default to the host resources.
+	Capacity Resources
+
+	// Maximum host memory pressure (PSI `some avg10`, in percent)
+	// under which new sandboxes are admitted (0 => disabled).
+	MaxPressure float64
+
+	// Scheduling weight of each tenant (defaults to 1).
+	Weights map[string]float64
+}
+
+/**
+ * A pending admission request.
+ */
+type admissionRequest struct {
+	// Requested resources.
+	res Resources
+
+	// Virtual finish time of the request.
+	finish float64
+
+	// Arrival order, breaking ties between equal finish times.
+	seq uint64
+
+	// Position in the queue, -1 once dequeued.
+	index int
+
+	// Closed once the request is admitted.
+	ready chan struct{}
+}
+
+/**
+ * Queue of pending requests, ordered by virtual finish time.
+ */
+type admissionQueue []*admissionRequest
+
+func (q admissionQueue) Len() int { return len(q) }
+
+func (q admissionQueue) Less(i, j int) bool {
+	if q[i].finish != q[j].finish {
+		return q[i].finish < q[j].finish
+	}
+	return q[i].seq < q[j].seq
+}
+
+func (q admissionQueue) Swap(i, j int) {
+	q[i], q[j] = q[j], q[i]
+	q[i].index = i
+	q[j].index = j
+}
+
+func (q *admissionQueue) Push(x any) {
+	r := x.(*admissionRequest)
+	r.index = len(*q)
+	*q = append(*q, r)
+}
+
+func (q *admissionQueue) Pop() any {
+	old := *q
+	r := old[len(old)-1]
+	old[len(old)-1] = nil
+	r.index = -1
+	*q = old[:len(old)-1]
+	return r
+}
+
+/**
+ * An admission controller, tracking the resources committed to running
+ * sandboxes against the host capacity. Requests which do not fit are
+ * queued, and admitted in weighted fair queueing order across tenants:
+ * each request is tagged with a virtual finish time advancing by its
+ * dominant resource share divided by the weight of its tenant, and the
+ * request with the earliest tag is admitted first once it fits.
+ */
+type Admission struct {
+	opts AdmissionOptions
+
+	mu sync.Mutex
+
+	// Resources committed to admitted requests.
+	committed Resources
+
+	// Pending requests.
+	queue admissionQueue
+
+	// Virtual time, i.e. the finish time of the last admitted request.
+	vtime float64
+
+	// Last virtual finish time of each tenant.
+	finish map[string]float64
+
+	// Arrival counter.
+	seq uint64
+
+	// Whether a pressure poll is scheduled.
+	polling bool
+}
+
+/**
+ * Creates an admission controller.
+ * @param opts the admission control options
+ * @return the admission controller
+ */
+func NewAdmission(opts AdmissionOptions) *Admission {
+	if opts.Capacity.CPUs <= 0 {
+		opts.Capacity.CPUs = float64(runtime.NumCPU())
+	}
+	if opts.Capacity.Memory == 0 {
+		var si unix.Sysinfo_t
+		if err := unix.Sysinfo(&si); err == nil {
+			opts.Capacity.Memory = uint64(si.Totalram) * uint64(si.Unit)
+		}
+	}
+	return &Admission{
+		opts:   opts,
+		finish: make(map[string]float64),
+	}
+}
+
+/**
+ * Waits until the given resources can be committed on the host.
+ * @param ctx the context, cancelling the wait
+ * @param tenant the tenant the request is accounted to
+ * @param res the requested resources
+ * @return a function releasing the resources, or an error if any
+ */
+func (a *Admission) Admit(ctx context.Context, tenant string, res Resources) (func(), error) {
+	if res.Slots == 0 {
+		res.Slots = 1
+	}
+	if err := a.check(res); err != nil {
+		return nil, err
+	}
+
+	a.mu.Lock()
+	weight := a.opts.Weights[tenant]
+	if weight <= 0 {
+		weight = defaultTenantWeight
+	}
+	start := math.Max(a.vtime, a.finish[tenant])
+	a.seq++
+	r := &admissionRequest{
+		res:    res,
+		finish: start + a.cost(res)/weight,
+		seq:    a.seq,
+		ready:  make(chan struct{}),
+	}
+	a.finish[tenant] = r.finish
+	heap.Push(&a.queue, r)
+	a.dispatch()
+	a.mu.Unlock()
+
+	release := func() {
+		a.mu.Lock()
+		defer a.mu.Unlock()
+		a.committed = a.committed.sub(res)
+		a.dispatch()
+	}
+
+	select {
+	case <-r.ready:
+		return release, nil
+	case <-ctx.Done():
+		a.mu.Lock()
+		if r.index >= 0 {
+			heap.Remove(&a.queue, r.index)
+			a.dispatch()
+			a.mu.Unlock()
+			return nil, ctx.Err()
+		}
+		a.mu.Unlock()
+
+		// Admitted concurrently with the cancellation.
+		release()
+		return nil, ctx.Err()
+	}
+}
+
+/**
+ * Ensures that a request can be admitted at all.
+ */
+func (a *Admission) check(res Resources) error {
+	c := a.opts.Capacity
+	switch {
+	case c.CPUs > 0 && res.CPUs > c.CPUs:
+		return fmt.Errorf("requested %.2f CPUs exceed the host capacity of %.2f", res.CPUs, c.CPUs)
+	case c.Memory > 0 && res.Memory > c.Memory:
+		return fmt.Errorf("requested memory %d exceeds the host capacity of %d", res.Memory, c.Memory)
+	case c.Storage > 0 && res.Storage > c.Storage:
+		return fmt.Errorf("requested storage %d exceeds the host capacity of %d", res.Storage, c.Storage)
+	}
+	return nil
+}
+
+/**
+ * @return the dominant share of the host capacity taken by a request.
+ */
+func (a *Admission) cost(res Resources) float64 {
+	c := a.opts.Capacity
+	share := 0.0
+	if c.CPUs > 0 {
+		share = math.Max(share, res.CPUs/c.CPUs)
+	}
+	if c.Memory > 0 {
+		share = math.Max(share, float64(res.Memory)/float64(c.Memory))
+	}
+	if c.Storage > 0 {
+		share = math.Max(share, float64(res.Storage)/float64(c.Storage))
+	}
+	if c.Slots > 0 {
+		share = math.Max(share, float64(res.Slots)/float64(c.Slots))
+	}
+	// Requests for no accounted resource still take their turn.
+	return math.Max(share, 1e-6)
+}
+
+/**
+ * @return whether the given resources fit in the remaining capacity.
+ */
+func (a *Admission) fits(res Resources) bool {
+	c, u := a.opts.Capacity, a.committed.add(res)
+	return (c.CPUs <= 0 || u.CPUs <= c.CPUs+1e-9) &&
+		(c.Memory == 0 || u.Memory <= c.Memory) &&
+		(c.Storage == 0 || u.Storage <= c.Storage) &&
+		(c.Slots == 0 || u.Slots <= c.Slots)
+}
+
+/**
+ * Admits queued requests in order, as long as they fit. The head of the
+ * queue is never bypassed, so that large requests are not starved.
+ * Must be called with the lock held.
+ */
+func (a *Admission) dispatch() {
+	for a.queue.Len() > 0 {
+		r := a.queue[0]
+		if !a.fits(r.res) {
+			return
+		}
+
+		// Hold admission while the host is under memory pressure, unless
+		// no sandbox is running, in which case the pressure is not ours.
+		if a.committed.Slots > 0 && a.pressured() {
+			a.poll()
+			return
+		}
+
+		heap.Pop(&a.queue)
+		a.committed = a.committed.add(r.res)
+		a.vtime = r.finish
+		close(r.ready)
+	}
+}
+
+/**
+ * @return whether the host memory pressure exceeds the threshold.
+ */
+func (a *Admission) pressured() bool {
+	if a.opts.MaxPressure <= 0 {
+		return false
+	}
+	p, err := readPressure(psiMemoryPath)
+	return err == nil && p > a.opts.MaxPressure
+}
+
+/**
+ * Schedules a new dispatch while admission is held by pressure.
+ * Must be called with the lock held.
+ */
+func (a *Admission) poll() {
+	if a.polling {
+		return
+	}
+	a.polling = true
+	time.AfterFunc(psiPollInterval, func() {
+		a.mu.Lock()
+		defer a.mu.Unlock()
+		a.polling = false
+		a.dispatch()
+	})
+}
+
+/**
+ * Reads the `some avg10` value of a PSI file.
+ * @param path the path of the PSI file
+ * @return the share of time stalled over the last 10 seconds, in percent
+ */
+func readPressure(path string) (float64, error) {
+	b, err := os.ReadFile(path)
+	if err != nil {
+		return 0, err
+	}
+	for _, line := range strings.Split(string(b), "\n") {
+		fields := strings.Fields(line)
+		if len(fields) < 2 || fields[0] != "some" {
+			continue
+		}
+		for _, f := range fields[1:] {
+			if v, ok := strings.CutPrefix(f, "avg10="); ok {
+				return strconv.ParseFloat(v, 64)
+			}
+		}
+	}
+	return 0, fmt.Errorf("no pressure average in %s", path)
+}
+
+/**
+ * @return the sum of two resource sets.
+ */
+func (r Resources) add(o Resources) Resources {
+	return Resources{
+		CPUs:    r.CPUs + o.CPUs,
+		Memory:  r.Memory + o.Memory,
+		Storage: r.Storage + o.Storage,
+		Slots:   r.Slots + o.Slots,
+	}
+}
+
+/**
+ * @return the difference of two resource sets.
+ */
+func (r Resources) sub(o Resources) Resources {
+	return Resources{
+		CPUs:    r.CPUs - o.CPUs,
+		Memory:  r.Memory - o.Memory,
+		Storage: r.Storage - o.Storage,
+		Slots:   r.Slots - o.Slots,
+	}
+}
@@ -0,0 +1,190 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"context"
+	"log/slog"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/HQarroum/microbox/fs"
+	uuid "github.com/google/uuid"
+)
+
+/**
+ * A job of a batch.
+ */
+type BatchJob struct {
+	// Command line of the job.
+	Args []string
+
+	// Additional environment variables of the job.
+	Env EnvVars
+
+	// Tenant the job is accounted to by admission control.
+	Tenant string
+}
+
+/**
+ * Batch options.
+ */
+type BatchOptions struct {
+	// Whether to recycle sandboxes between jobs.
+	Recycle bool
+
+	// Admission controller, bounding the number of concurrent jobs
+	// and the resources committed to them. Jobs run sequentially if nil.
+	Admission *Admission
+}
+
+/**
+ * Runs a batch of jobs, each in its own sandbox, or in recycled
+ * sandboxes if requested. Jobs are started as the admission controller
+ * admits them, or one after the other without admission control.
+ * @param opts the options shared by all jobs
+ * @param jobs the jobs to run
+ * @param bopts the batch options
+ * @return the number of jobs which failed or exited with a non-zero code
+ */
+func (rt *Runtime) RunBatch(opts *SandboxOptions, jobs []BatchJob, bopts *BatchOptions) int {
+	var (
+		failed atomic.Int64
+		pool   = recyclePool{rt: rt}
+		wg     sync.WaitGroup
+		log    = rt.log(opts)
+	)
+	defer pool.close()
+
+	// Resources committed to each job.
+	res := Resources{CPUs: opts.CPUs, Memory: opts.Memory}
+	if opts.FS.Mode != fs.FsHost {
+		res.Storage = opts.Storage
+	}
+
+	run := func(i int, job *BatchJob) {
+		if bopts.Admission != nil {
+			release, err := bopts.Admission.Admit(context.Background(), job.Tenant, res)
+			if err != nil {
+				failed.Add(1)
+				log.Error("job rejected", slog.Int("job", i), slog.Any("err", err))
+				return
+			}
+			defer release()
+		}
+
+		start := time.Now()
+		var (
+			code int
+			err  error
+		)
+		if bopts.Recycle {
+			rs := pool.get(opts)
+			code, err = rs.Run(job.Args, job.Env)
+			pool.put(rs)
+		} else {
+			code, err = rt.runJob(opts, job)
+		}
+
+		if err != nil {
+			failed.Add(1)
+			log.Error("job failed", slog.Int("job", i), slog.Any("err", err))
+			return
+		}
+		if code != 0 {
+			failed.Add(1)
+		}
+		log.Info("job done",
+			slog.Int("job", i),
+			slog.String("tenant", job.Tenant),
+			slog.Int("code", code),
+			slog.Duration("duration", time.Since(start)),
+		)
+	}
+
+	for i := range jobs {
+		if bopts.Admission == nil {
+			run(i, &jobs[i])
+			continue
+		}
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			run(i, &jobs[i])
+		}(i)
+	}
+	wg.Wait()
+
+	return int(failed.Load())
+}
+
+/**
+ * Runs a job in a new sandbox and waits for it to exit.
+ */
+func (rt *Runtime) runJob(opts *SandboxOptions, job *BatchJob) (int, error) {
+	jopts := *opts
+	jopts.UUID = uuid.New()
+	jopts.Commands = job.Args
+	jopts.Env = overrideEnv(opts.Env, job.Env)
+
+	box, err := rt.NewSandbox(context.Background(), &jopts)
+	if err != nil {
+		return 0, err
+	}
+	return box.Wait()
+}
+
+/**
+ * A pool of idle recycled sandboxes, one being created for each
+ * job running concurrently.
+ */
+type recyclePool struct {
+	rt   *Runtime
+	mu   sync.Mutex
+	idle []*RecycledSandbox
+	all  []*RecycledSandbox
+}
+
+/**
+ * @return an idle recycled sandbox, or a new one.
+ */
+func (p *recyclePool) get(opts *SandboxOptions) *RecycledSandbox {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	if n := len(p.idle); n > 0 {
+		rs := p.idle[n-1]
+		p.idle = p.idle[:n-1]
+		return rs
+	}
+	ropts := *opts
+	ropts.UUID = uuid.Nil
+	rs := p.rt.NewRecycledSandbox(&ropts)
+	p.all = append(p.all, rs)
+	return rs
+}
+
+/**
+ * Returns a recycled sandbox to the pool.
+ */
+func (p *recyclePool) put(rs *RecycledSandbox) {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+	p.idle = append(p.idle, rs)
+}
+
+/**
+ * Releases all the recycled sandboxes of the pool.
+ */
+func (p *recyclePool) close() {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	for _, rs := range p.all {
+		if err := rs.Close(); err != nil {
+			p.rt.log(&rs.opts).Warn("failed to release recycled sandbox", slog.Any("err", err))
+		}
+	}
+	p.all, p.idle = nil, nil
+}
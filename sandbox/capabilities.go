@@ -131,12 +131,40 @@ func FromCapabilities(caps []string) ([]capability.Cap, error) {
 	return out, nil
 }
 
+/**
+ * Computes the capability options granting exactly the given capabilities,
+ * as additions to and drops from the defaults.
+ * @param caps the list of capability names
+ * @return the capability options, or an error if any name is unknown
+ */
+func CapabilitiesFrom(caps []string) (*CapabilityOpts, error) {
+	ids, err := FromCapabilities(caps)
+	if err != nil {
+		return nil, err
+	}
+	defCaps, err := FromCapabilities(defaultCaps)
+	if err != nil {
+		return nil, err
+	}
+	o := &CapabilityOpts{Add: NewCapSet(ids...), Drop: NewCapSet()}
+	for _, id := range defCaps {
+		if _, ok := o.Add[id]; !ok {
+			o.Drop.Add(id)
+		}
+	}
+	return o, nil
+}
+
 /**
  * BuildCapSets computes the effective capability sets given the defaults
  * plus user additions/drops.
  * @return a map of capability sets by type, or an error if any capability is unknown
  */
 func (o *CapabilityOpts) BuildCapSets() (map[capability.CapType][]capability.Cap, error) {
+	// No options means the default capabilities.
+	if o == nil {
+		o = &CapabilityOpts{}
+	}
 	defCaps, err := FromCapabilities(defaultCaps)
 	if err != nil {
 		return nil, err
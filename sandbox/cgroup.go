@@ -9,8 +9,11 @@ import (
 	"os"
 	"path/filepath"
 	"strconv"
+	"sync/atomic"
 	"syscall"
 	"time"
+
+	"github.com/HQarroum/microbox/fs"
 )
 
 const (
@@ -18,23 +21,27 @@ const (
 	cgParent = "/sys/fs/cgroup/microbox"
 )
 
+/**
+ * The cgroups of the sandboxes of a runtime, under the microbox parent.
+ */
+type Cgroups struct {
+	fs CgroupFS
+
+	// Whether the cgroup parent has been set up by this runtime.
+	parentReady atomic.Bool
+
+	// Whether the hugetlb controller has been enabled by this runtime.
+	hugetlbReady atomic.Bool
+}
+
 /**
  * Enables controllers for children of parentPath.
  * parentPath is usually the cgroup you’re *currently in* (under systemd with Delegate).
  */
-func enableControllers(parentPath string, ctrls ...string) error {
-	f, err := os.OpenFile(
-		filepath.Join(parentPath, "cgroup.subtree_control"),
-		os.O_WRONLY|syscall.O_CLOEXEC,
-		0,
-	)
-	if err != nil {
-		return err
-	}
-	defer f.Close()
-
+func (cg *Cgroups) enableControllers(parentPath string, ctrls ...string) error {
+	path := filepath.Join(parentPath, "cgroup.subtree_control")
 	for _, c := range ctrls {
-		if _, err := f.WriteString("+" + c); err != nil && !errors.Is(err, syscall.EBUSY) {
+		if err := cg.fs.WriteFile(path, []byte("+"+c)); err != nil && !errors.Is(err, syscall.EBUSY) {
 			return err
 		}
 	}
@@ -45,83 +52,147 @@ func enableControllers(parentPath string, ctrls ...string) error {
 /**
  * Ensures the cgroup parent exists and has controllers enabled.
  */
-func EnsureCgroupParent() error {
-	if err := os.Mkdir(cgParent, 0o755); err != nil && !errors.Is(err, os.ErrExist) {
+func (cg *Cgroups) EnsureParent() error {
+	// Writing subtree_control takes the global cgroup lock,
+	// so only do it once per runtime.
+	if cg.parentReady.Load() {
+		return nil
+	}
+
+	if err := cg.fs.Mkdir(cgParent); err != nil && !errors.Is(err, os.ErrExist) {
 		return fmt.Errorf("mkdir %s: %w", cgParent, err)
 	}
 
 	// Parent’s parent must have controllers enabled for *it* to delegate.
-	if err := enableControllers(cgRoot, "cpu", "memory"); err != nil {
+	if err := cg.enableControllers(cgRoot, "cpu", "memory"); err != nil {
 		return fmt.Errorf("enable controllers on %s: %w", cgRoot, err)
 	}
 
 	// Enable on our parent so children can set limits.
-	if err := enableControllers(cgParent, "cpu", "memory"); err != nil {
+	if err := cg.enableControllers(cgParent, "cpu", "memory"); err != nil {
 		return fmt.Errorf("enable controllers on %s: %w", cgParent, err)
 	}
 
+	cg.parentReady.Store(true)
 	return nil
 }
 
-// SetupCgroupLimits creates a cgroup and applies cpu/memory limits, then moves pid into it.
-// cpus: 0 => unlimited. memory: 0 => unlimited.
-func SetupCgroupLimits(pid int, cpus float64, memory uint64) (string, error) {
-	if err := EnsureCgroupParent(); err != nil {
-		return "", err
+/**
+ * Limits the huge pages of a cgroup to a set of reservations. The
+ * hugetlb controller is only enabled on the cgroup parent when huge
+ * pages are requested, so that hosts without it can run other sandboxes.
+ * @param cgPath the cgroup path
+ * @param pages the huge page reservations
+ * @return error if any
+ */
+func (cg *Cgroups) SetHugetlbLimits(cgPath string, pages []fs.HugePages) error {
+	if len(pages) == 0 {
+		return nil
+	}
+	if !cg.hugetlbReady.Load() {
+		if err := cg.enableControllers(cgRoot, "hugetlb"); err != nil {
+			return fmt.Errorf("enable hugetlb on %s: %w", cgRoot, err)
+		}
+		if err := cg.enableControllers(cgParent, "hugetlb"); err != nil {
+			return fmt.Errorf("enable hugetlb on %s: %w", cgParent, err)
+		}
+		cg.hugetlbReady.Store(true)
+	}
+	for _, h := range pages {
+		limit := []byte(strconv.FormatUint(h.Bytes(), 10))
+		name := "hugetlb." + h.Name() + ".max"
+		if err := cg.fs.WriteFile(filepath.Join(cgPath, name), limit); err != nil {
+			return fmt.Errorf("write %s: %w", name, err)
+		}
+		// Reservations are accounted separately since Linux 5.7.
+		_ = cg.fs.WriteFile(filepath.Join(cgPath, "hugetlb."+h.Name()+".rsvd.max"), limit) // best-effort
 	}
+	return nil
+}
 
+// SetupLimits creates a cgroup and applies cpu/memory limits, then moves pid into it.
+// cpus: 0 => unlimited. memory: 0 => unlimited.
+func (cg *Cgroups) SetupLimits(pid int, cpus float64, memory uint64) (string, error) {
 	// Use a stable, unique name (pid + timestamp to avoid reuse races).
 	name := fmt.Sprintf("%d-%d", pid, time.Now().UnixNano())
-	cgPath := filepath.Join(cgParent, name)
-	if err := os.Mkdir(cgPath, 0o755); err != nil && !errors.Is(err, os.ErrExist) {
+	cgPath, err := cg.Create(name, cpus, memory)
+	if err != nil {
+		return "", err
+	}
+
+	// Move the task into the cgroup *after* limits are set.
+	if err := cg.Attach(cgPath, pid); err != nil {
+		return "", err
+	}
+
+	return cgPath, nil
+}
+
+// Create creates a cgroup named name under the microbox parent and applies cpu/memory limits.
+// cpus: 0 => unlimited. memory: 0 => unlimited.
+func (cg *Cgroups) Create(name string, cpus float64, memory uint64) (string, error) {
+	if err := cg.EnsureParent(); err != nil {
+		return "", err
+	}
+	return cg.CreateChild(cgParent, name, cpus, memory)
+}
+
+// CreateChild creates a cgroup named name under parent and applies cpu/memory limits.
+// cpus: 0 => unlimited. memory: 0 => unlimited.
+func (cg *Cgroups) CreateChild(parent, name string, cpus float64, memory uint64) (string, error) {
+	cgPath := filepath.Join(parent, name)
+	if err := cg.fs.Mkdir(cgPath); err != nil && !errors.Is(err, os.ErrExist) {
 		return "", fmt.Errorf("mkdir %s: %w", cgPath, err)
 	}
 
 	// CPU limits.
 	if cpus <= 0 {
-		if err := os.WriteFile(filepath.Join(cgPath, "cpu.max"), []byte("max 100000"), 0o644); err != nil {
+		if err := cg.fs.WriteFile(filepath.Join(cgPath, "cpu.max"), []byte("max 100000")); err != nil {
 			return "", fmt.Errorf("write cpu.max: %w", err)
 		}
 	} else {
 		const period = 100000 // 100ms
 		quota := uint64(cpus * period)
 		line := strconv.FormatUint(quota, 10) + " " + strconv.Itoa(period)
-		if err := os.WriteFile(filepath.Join(cgPath, "cpu.max"), []byte(line), 0o644); err != nil {
+		if err := cg.fs.WriteFile(filepath.Join(cgPath, "cpu.max"), []byte(line)); err != nil {
 			return "", fmt.Errorf("write cpu.max: %w", err)
 		}
 	}
 
 	// Memory limits.
 	if memory == 0 {
-		if err := os.WriteFile(filepath.Join(cgPath, "memory.max"), []byte("max"), 0o644); err != nil {
+		if err := cg.fs.WriteFile(filepath.Join(cgPath, "memory.max"), []byte("max")); err != nil {
 			return "", fmt.Errorf("write memory.max: %w", err)
 		}
 	} else {
-		if err := os.WriteFile(filepath.Join(cgPath, "memory.max"), []byte(strconv.FormatUint(memory, 10)), 0o644); err != nil {
+		if err := cg.fs.WriteFile(filepath.Join(cgPath, "memory.max"), []byte(strconv.FormatUint(memory, 10))); err != nil {
 			return "", fmt.Errorf("write memory.max: %w", err)
 		}
-		_ = os.WriteFile(filepath.Join(cgPath, "memory.swap.max"), []byte("0"), 0o644) // best-effort
-	}
-
-	// Move the task into the cgroup *after* limits are set.
-	if err := os.WriteFile(filepath.Join(cgPath, "cgroup.procs"), []byte(strconv.Itoa(pid)), 0o644); err != nil {
-		return "", fmt.Errorf("attach pid to cgroup: %w", err)
+		_ = cg.fs.WriteFile(filepath.Join(cgPath, "memory.swap.max"), []byte("0")) // best-effort
 	}
 
 	return cgPath, nil
 }
 
+// Attach moves pid into the cgroup at cgPath.
+func (cg *Cgroups) Attach(cgPath string, pid int) error {
+	if err := cg.fs.WriteFile(filepath.Join(cgPath, "cgroup.procs"), []byte(strconv.Itoa(pid))); err != nil {
+		return fmt.Errorf("attach pid to cgroup: %w", err)
+	}
+	return nil
+}
+
 /**
- * Cleans up a cgroup created by SetupCgroupLimits.
+ * Cleans up a cgroup created by SetupLimits.
  */
-func CleanupCgroup(cgPath string) error {
+func (cg *Cgroups) Cleanup(cgPath string) error {
 	if cgPath == "" {
 		return nil
 	}
-	if err := os.WriteFile(filepath.Join(cgPath, "cgroup.kill"), []byte("1"), 0o644); err != nil && !errors.Is(err, os.ErrNotExist) {
+	if err := cg.fs.WriteFile(filepath.Join(cgPath, "cgroup.kill"), []byte("1")); err != nil && !errors.Is(err, os.ErrNotExist) {
 		// Fallback: try to send signals to procs.
 		_ = func() error {
-			b, err := os.ReadFile(filepath.Join(cgPath, "cgroup.procs"))
+			b, err := cg.fs.ReadFile(filepath.Join(cgPath, "cgroup.procs"))
 			if err != nil {
 				return err
 			}
@@ -135,10 +206,41 @@ func CleanupCgroup(cgPath string) error {
 		}()
 	}
 
+	// Nested cgroups must be removed before their parent.
+	if children, err := cg.fs.Children(cgPath); err == nil {
+		for _, name := range children {
+			_ = cg.Cleanup(filepath.Join(cgPath, name))
+		}
+	}
+
 	// Try to remove; if it fails due to busy, caller can retry later.
-	if err := os.Remove(cgPath); err != nil && !errors.Is(err, os.ErrNotExist) {
+	if err := cg.fs.Remove(cgPath); err != nil && !errors.Is(err, os.ErrNotExist) {
 		return err
 	}
 
 	return nil
 }
+
+/**
+ * Moves the process into a leaf cgroup under the sandbox cgroup, and
+ * enables the controllers of the sandbox cgroup for nested cgroups.
+ * @param cgPath the sandbox cgroup
+ * @param leaf the name of the leaf cgroup
+ * @param pid the process to move
+ * @return the leaf cgroup path, or error if any
+ */
+func (cg *Cgroups) Delegate(cgPath, leaf string, pid int) (string, error) {
+	leafPath, err := cg.CreateChild(cgPath, leaf, 0, 0)
+	if err != nil {
+		return "", err
+	}
+	if err := cg.Attach(leafPath, pid); err != nil {
+		return "", err
+	}
+
+	// The sandbox cgroup has no processes left and can delegate.
+	if err := cg.enableControllers(cgPath, "cpu", "memory"); err != nil {
+		return "", fmt.Errorf("enable controllers on %s: %w", cgPath, err)
+	}
+	return leafPath, nil
+}
@@ -0,0 +1,72 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"os"
+)
+
+/**
+ * Operations on the cgroup filesystem. The host implementation operates
+ * on cgroupfs, and can be replaced by an in-memory tree to exercise the
+ * cgroup bookkeeping of sandboxes without root.
+ */
+type CgroupFS interface {
+	// Creates a cgroup, failing with os.ErrExist if it exists.
+	Mkdir(path string) error
+
+	// Removes a cgroup, failing with EBUSY while it has processes or children.
+	Remove(path string) error
+
+	// Reads a control file.
+	ReadFile(path string) ([]byte, error)
+
+	// Writes a control file, in a single write.
+	WriteFile(path string, data []byte) error
+
+	// Lists the names of the child cgroups of a cgroup.
+	Children(path string) ([]string, error)
+}
+
+/**
+ * The cgroup filesystem of the host.
+ */
+type hostCgroupFS struct{}
+
+func (hostCgroupFS) Mkdir(path string) error {
+	return os.Mkdir(path, 0o755)
+}
+
+func (hostCgroupFS) Remove(path string) error {
+	return os.Remove(path)
+}
+
+func (hostCgroupFS) ReadFile(path string) ([]byte, error) {
+	return os.ReadFile(path)
+}
+
+func (hostCgroupFS) WriteFile(path string, data []byte) error {
+	f, err := os.OpenFile(path, os.O_WRONLY|os.O_TRUNC, 0)
+	if err != nil {
+		return err
+	}
+	_, err = f.Write(data)
+	if cerr := f.Close(); err == nil {
+		err = cerr
+	}
+	return err
+}
+
+func (hostCgroupFS) Children(path string) ([]string, error) {
+	entries, err := os.ReadDir(path)
+	if err != nil {
+		return nil, err
+	}
+	var out []string
+	for _, e := range entries {
+		if e.IsDir() {
+			out = append(out, e.Name())
+		}
+	}
+	return out, nil
+}
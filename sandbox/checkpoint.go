@@ -0,0 +1,403 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"log/slog"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"syscall"
+	"time"
+
+	"github.com/HQarroum/microbox/fs"
+	"github.com/HQarroum/microbox/net"
+	uuid "github.com/google/uuid"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// Manifest describing the checkpointed sandbox.
+	checkpointManifest = "microbox.json"
+
+	// Archive of the checkpointed writable layer.
+	checkpointLayer = "layer.tar"
+
+	// CRIU key of the external network namespace.
+	criuNetKey = "microbox-net"
+)
+
+/**
+ * Checkpoint options.
+ */
+type CheckpointOptions struct {
+	// Directory to write the checkpoint images to.
+	ImageDir string
+
+	// Whether to leave the sandbox running after the checkpoint.
+	LeaveRunning bool
+}
+
+/**
+ * The manifest stored alongside CRIU images.
+ */
+type manifest struct {
+	// Options the sandbox has been created with.
+	Options *SandboxOptions `json:"options"`
+
+	// Whether the writable layer has been archived.
+	Layer bool `json:"layer"`
+}
+
+/**
+ * @return the CRIU key of an external bind mount.
+ */
+func criuMountKey(dest string) string {
+	return "mbx" + strings.ReplaceAll(dest, "/", "_")
+}
+
+/**
+ * @return the path of the CRIU binary.
+ */
+func criuPath() (string, error) {
+	p, err := exec.LookPath("criu")
+	if err != nil {
+		return "", fmt.Errorf("criu is required for checkpoint/restore: %w", err)
+	}
+	return p, nil
+}
+
+/**
+ * Runs CRIU with the given arguments, reporting its log on failure.
+ * @param cmd the CRIU command
+ * @param log the path of the CRIU log file
+ * @return error if any
+ */
+func runCriu(cmd *exec.Cmd, log string) error {
+	out, err := cmd.CombinedOutput()
+	if err != nil {
+		tail, _ := os.ReadFile(log)
+		if len(tail) > 4096 {
+			tail = tail[len(tail)-4096:]
+		}
+		return fmt.Errorf("criu %s: %v\n%s%s", cmd.Args[1], err, out, tail)
+	}
+	return nil
+}
+
+/**
+ * Sets the frozen state of a cgroup.
+ */
+func (cg *Cgroups) freeze(cgPath string, frozen bool) error {
+	v := "0"
+	if frozen {
+		v = "1"
+	}
+	return cg.fs.WriteFile(filepath.Join(cgPath, "cgroup.freeze"), []byte(v))
+}
+
+/**
+ * Checkpoints a running sandbox with CRIU. The process tree and its
+ * namespaces are dumped by CRIU, while the writable layer is archived
+ * by microbox. The network namespace and the cgroup are not dumped:
+ * they are recreated on restore, or, for named network namespaces,
+ * joined again. Unless left running, the sandbox is
+ * killed once both have been saved.
+ * @param ref the sandbox identifier or hostname
+ * @param copts the checkpoint options
+ * @return error if any
+ */
+func (rt *Runtime) Checkpoint(ref string, copts *CheckpointOptions) error {
+	st, err := LoadState(ref)
+	if err != nil {
+		return err
+	}
+	if st.Options == nil {
+		return fmt.Errorf("sandbox %s has no recorded options", st.ID)
+	}
+	criu, err := criuPath()
+	if err != nil {
+		return err
+	}
+	if err := os.MkdirAll(copts.ImageDir, 0o700); err != nil {
+		return fmt.Errorf("mkdir %s: %w", copts.ImageDir, err)
+	}
+
+	log := filepath.Join(copts.ImageDir, "dump.log")
+	args := []string{
+		"dump",
+		"--tree", strconv.Itoa(st.Pid),
+		"--images-dir", copts.ImageDir,
+		"--log-file", log, "-v2",
+		"--shell-job",
+		"--tcp-established",
+		"--file-locks",
+		"--manage-cgroups=ignore",
+		"--freeze-cgroup", st.CgroupPath,
+
+		// The sandbox is killed by microbox once its layer is archived,
+		// as its supervisor releases the layer when it exits.
+		"--leave-running",
+	}
+
+	// The bridged network namespace is recreated by microbox on restore,
+	// and the named network namespace outlives the sandbox.
+	if st.Options.Net == net.NetBridge || st.Options.NetNs != "" {
+		var ns unix.Stat_t
+		if err := unix.Stat(fmt.Sprintf("/proc/%d/ns/net", st.Pid), &ns); err != nil {
+			return fmt.Errorf("stat netns: %w", err)
+		}
+		args = append(args, "--external", fmt.Sprintf("net[%d]:%s", ns.Ino, criuNetKey))
+	}
+
+	// Host bind mounts are external to the sandbox mount namespace.
+	for _, m := range fs.ExternalMounts(st.Options.fsOpts()) {
+		args = append(args, "--external", fmt.Sprintf("mnt[%s]:%s", m.Dest, criuMountKey(m.Dest)))
+	}
+
+	// Keep the sandbox frozen until both the process tree and the
+	// writable layer have been saved, so that they are consistent.
+	if err := rt.cgroups.freeze(st.CgroupPath, true); err != nil {
+		return fmt.Errorf("freeze sandbox: %w", err)
+	}
+	defer func() {
+		_ = rt.cgroups.freeze(st.CgroupPath, false)
+	}()
+
+	start := time.Now()
+	if err := runCriu(exec.Command(criu, args...), log); err != nil {
+		return err
+	}
+
+	// Keep the sandbox frozen while its layer is archived, whatever
+	// freezer state CRIU left it in.
+	if err := rt.cgroups.freeze(st.CgroupPath, true); err != nil {
+		return fmt.Errorf("freeze sandbox: %w", err)
+	}
+
+	// Archive the writable layer.
+	m := manifest{Options: st.Options}
+	if st.LayerDir != "" {
+		if err := fs.ArchiveLayer(st.LayerDir, st.Options.FS.Mode, filepath.Join(copts.ImageDir, checkpointLayer)); err != nil {
+			return err
+		}
+		m.Layer = true
+	} else if st.Options.FS.Mode != fs.FsHost {
+		rt.opts.Logger.Warn("sandbox has no host-visible layer, its filesystem changes are not saved", slog.String("id", st.ID))
+	}
+
+	b, err := json.MarshalIndent(&m, "", "  ")
+	if err != nil {
+		return err
+	}
+	if err := os.WriteFile(filepath.Join(copts.ImageDir, checkpointManifest), b, 0o600); err != nil {
+		return err
+	}
+
+	// Kill the frozen sandbox, now that everything has been saved.
+	if !copts.LeaveRunning {
+		if err := rt.cgroups.fs.WriteFile(filepath.Join(st.CgroupPath, "cgroup.kill"), []byte("1")); err != nil {
+			return fmt.Errorf("kill sandbox: %w", err)
+		}
+	}
+
+	rt.opts.Logger.Info("sandbox checkpointed",
+		slog.String("id", st.ID),
+		slog.String("images", copts.ImageDir),
+		slog.Duration("duration", time.Since(start)),
+	)
+	return nil
+}
+
+/**
+ * Restores a checkpointed sandbox in a fresh cgroup, network namespace
+ * and writable layer, or in its named network namespace, which must
+ * still exist. The restored process tree becomes a child of the
+ * calling process, which can then wait on it as for any sandbox.
+ * @param imageDir the directory holding the checkpoint images
+ * @return the sandbox process descriptor, or an error if any
+ */
+func (rt *Runtime) Restore(imageDir string) (*SandboxProcess, error) {
+	if unix.Geteuid() != 0 {
+		return nil, fmt.Errorf("microbox must be run as root or with sudo")
+	}
+	criu, err := criuPath()
+	if err != nil {
+		return nil, err
+	}
+
+	// Load the manifest.
+	b, err := os.ReadFile(filepath.Join(imageDir, checkpointManifest))
+	if err != nil {
+		return nil, fmt.Errorf("read checkpoint manifest: %w", err)
+	}
+	m := manifest{}
+	if err := json.Unmarshal(b, &m); err != nil || m.Options == nil {
+		return nil, fmt.Errorf("bad checkpoint manifest in %s: %v", imageDir, err)
+	}
+	opts := m.Options
+	opts.UUID = uuid.New()
+	opts.Checkpoint = true
+
+	process := &SandboxProcess{
+		rt:    rt,
+		uuid:  opts.UUID.String(),
+		pidfd: -1,
+		pid:   -1,
+		log:   rt.opts.Logger,
+	}
+	fail := func(err error) (*SandboxProcess, error) {
+		if process.network != nil {
+			_ = process.network.Cleanup()
+		}
+		_ = rt.cgroups.Cleanup(process.cgPath)
+		process.release()
+		_ = RemoveState(process.uuid)
+		return nil, err
+	}
+
+	dir := StateDir(process.uuid)
+	if err := os.MkdirAll(dir, 0o700); err != nil {
+		return nil, fmt.Errorf("mkdir %s: %w", dir, err)
+	}
+
+	// Recreate the writable layer and assemble the root filesystem.
+	fsOpts := opts.fsOpts()
+	fsOpts.Mounter = rt.opts.Mounter
+	root := "/"
+	if opts.FS.Mode != fs.FsHost {
+		process.layerDir = filepath.Join(dir, "layer")
+		if err := fs.PrepareLayer(rt.opts.Mounter, process.layerDir, opts.Storage, opts.TmpfsHuge); err != nil {
+			return fail(err)
+		}
+		if m.Layer {
+			if err := fs.ExtractLayer(process.layerDir, filepath.Join(imageDir, checkpointLayer)); err != nil {
+				return fail(err)
+			}
+		}
+		if root, err = fs.MountLayerRoot(fsOpts, process.layerDir); err != nil {
+			return fail(err)
+		}
+	}
+
+	// Create a fresh cgroup with the sandbox limits.
+	cgPath, err := rt.cgroups.Create(fmt.Sprintf("restore-%d", time.Now().UnixNano()), opts.CPUs, opts.Memory)
+	if err != nil {
+		return fail(err)
+	}
+	process.cgPath = cgPath
+
+	cg, err := os.Open(cgPath)
+	if err != nil {
+		return fail(err)
+	}
+	defer cg.Close()
+
+	pidfile := filepath.Join(dir, "restore.pid")
+	log := filepath.Join(imageDir, "restore.log")
+	args := []string{
+		"restore",
+		"--images-dir", imageDir,
+		"--root", root,
+		"--log-file", log, "-v2",
+		"--shell-job",
+		"--tcp-established",
+		"--file-locks",
+		"--manage-cgroups=ignore",
+		"--restore-detached",
+		"--pidfile", pidfile,
+	}
+	for _, mnt := range fs.ExternalMounts(fsOpts) {
+		args = append(args, "--external", fmt.Sprintf("mnt[%s]:%s", criuMountKey(mnt.Dest), mnt.Host))
+	}
+	cmd := exec.Command(criu, args...)
+
+	// CRIU and the restored tree are spawned directly into the cgroup.
+	cmd.SysProcAttr = &syscall.SysProcAttr{
+		UseCgroupFD: true,
+		CgroupFD:    int(cg.Fd()),
+	}
+
+	// Hand the network namespace to CRIU: the named namespace the sandbox
+	// was in, or a fresh namespace in which the bridged networking is redone.
+	netnsPath := ""
+	switch {
+	case opts.NetNs != "":
+		named, err := net.LoadNamedNetns(opts.NetNs)
+		if err != nil {
+			return fail(err)
+		}
+		netnsPath = named.Path
+		opts.JoinNetns = named.Path
+	case opts.Net == net.NetBridge:
+		process.netnsPath = filepath.Join(dir, "netns")
+		if err := net.CreatePersistentNetns(process.netnsPath); err != nil {
+			return fail(err)
+		}
+		result, err := rt.network.SetupContainerNetworking(context.Background(), net.NetworkConfig{
+			Mode:      opts.Net,
+			NetnsPath: process.netnsPath,
+			HostIf:    "vmbx" + process.uuid[:8],
+			Policy:    &opts.NetPolicy,
+		})
+		if err != nil {
+			return fail(err)
+		}
+		process.network = result
+		netnsPath = process.netnsPath
+	}
+	if netnsPath != "" {
+		ns, err := os.Open(netnsPath)
+		if err != nil {
+			return fail(err)
+		}
+		defer ns.Close()
+		cmd.ExtraFiles = []*os.File{ns}
+		cmd.Args = append(cmd.Args, "--inherit-fd", "fd[3]:"+criuNetKey)
+	}
+
+	// Become the reaper of the detached restored tree.
+	if err := unix.Prctl(unix.PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0); err != nil {
+		return fail(fmt.Errorf("prctl(PR_SET_CHILD_SUBREAPER): %w", err))
+	}
+
+	start := time.Now()
+	if err := runCriu(cmd, log); err != nil {
+		return fail(err)
+	}
+
+	// Retrieve the restored init process.
+	raw, err := os.ReadFile(pidfile)
+	if err != nil {
+		return fail(fmt.Errorf("read restored pid: %w", err))
+	}
+	_ = os.Remove(pidfile)
+	pid, err := strconv.Atoi(strings.TrimSpace(string(raw)))
+	if err != nil {
+		return fail(fmt.Errorf("bad restored pid %q: %w", raw, err))
+	}
+	pidfd, err := unix.PidfdOpen(pid, 0)
+	if err != nil && !errors.Is(err, unix.ENOSYS) {
+		return fail(fmt.Errorf("pidfd_open: %w", err))
+	}
+	process.pid = pid
+	process.pidfd = pidfd
+
+	if err := process.saveState(opts); err != nil {
+		process.log.Warn("failed to save sandbox state", slog.Any("err", err))
+	}
+	process.track()
+
+	process.log.Info("sandbox restored",
+		slog.String("id", process.uuid),
+		slog.Int("pid", pid),
+		slog.Duration("duration", time.Since(start)),
+	)
+	return process, nil
+}
@@ -0,0 +1,190 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"encoding/binary"
+	"time"
+
+	"github.com/HQarroum/microbox/tracing"
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * Phases of the setup of a sandbox, run by its init stage before exec.
+ */
+const (
+	childPhaseHostname byte = iota
+	childPhaseFS
+	childPhaseThp
+	childPhaseCapabilities
+	childPhaseSeccomp
+	childPhaseSignals
+	childPhaseCount
+)
+
+/**
+ * Record shipped by the child when it exits before executing its command.
+ */
+const childPhaseFailed byte = 0xff
+
+/**
+ * Names of the child phases.
+ */
+var childPhaseNames = [childPhaseCount]string{
+	"hostname", "fs", "thp", "capabilities", "seccomp", "signals",
+}
+
+/**
+ * Size of an encoded phase: its identifier, start and end times.
+ */
+const childPhaseSize = 1 + 8 + 8
+
+/**
+ * Phase timings recorded by the child without any I/O, and shipped to
+ * the parent in a single write before exec, as the child cannot
+ * report spans itself. The pipe being closed by exec also tells the
+ * parent when the command starts.
+ */
+type childTrace struct {
+	// Write end of the pipe to the parent.
+	fd int
+
+	// Pre-allocated encoded phases.
+	buf [childPhaseCount * childPhaseSize]byte
+	n   int
+
+	// End of the previous phase, in nanoseconds.
+	last int64
+}
+
+/**
+ * Creates a child trace and the pipe shipping it to the parent.
+ * @return the child trace and the read end of its pipe, or an error if any
+ */
+func newChildTrace() (*childTrace, int, error) {
+	var p [2]int
+	if err := unix.Pipe2(p[:], unix.O_CLOEXEC); err != nil {
+		return nil, -1, err
+	}
+	return &childTrace{fd: p[1]}, p[0], nil
+}
+
+/**
+ * Starts timing the first phase. Called in the child.
+ */
+func (c *childTrace) begin() {
+	if c != nil {
+		c.last = time.Now().UnixNano()
+	}
+}
+
+/**
+ * Records the end of a phase. Called in the child.
+ * @param phase the phase identifier
+ */
+func (c *childTrace) mark(phase byte) {
+	if c == nil || c.n+childPhaseSize > len(c.buf) {
+		return
+	}
+	now := time.Now().UnixNano()
+	b := c.buf[c.n:]
+	b[0] = phase
+	binary.NativeEndian.PutUint64(b[1:], uint64(c.last))
+	binary.NativeEndian.PutUint64(b[9:], uint64(now))
+	c.n += childPhaseSize
+	c.last = now
+}
+
+/**
+ * Ships the recorded phases to the parent. Called in the child.
+ */
+func (c *childTrace) flush() {
+	if c == nil {
+		return
+	}
+	_, _ = unix.Write(c.fd, c.buf[:c.n])
+	c.n = 0
+}
+
+/**
+ * Reports that the child exits without executing its command.
+ * Called in the child.
+ */
+func (c *childTrace) fail() {
+	if c == nil {
+		return
+	}
+	var b [childPhaseSize]byte
+	b[0] = childPhaseFailed
+	_, _ = unix.Write(c.fd, b[:])
+}
+
+/**
+ * Closes the write end of the pipe. Called in the parent.
+ */
+func (c *childTrace) closeParent() {
+	if c != nil {
+		_ = unix.Close(c.fd)
+	}
+}
+
+/**
+ * Reads the phases shipped by the child and records them as spans, until
+ * the child executes its command, which closes the pipe.
+ * @param fd the read end of the pipe
+ * @param span the span to record the phases under
+ * @return the time the command was executed at, or zero if it was not
+ */
+func collectChildTrace(fd int, span *tracing.Span) time.Time {
+	defer unix.Close(fd)
+
+	var (
+		buf  [(childPhaseCount + 1) * childPhaseSize]byte
+		n    int
+		last time.Time
+	)
+	for {
+		// Drain until the pipe is closed by exec.
+		var drain [1]byte
+		dst := drain[:]
+		if n < len(buf) {
+			dst = buf[n:]
+		}
+		r, err := unix.Read(fd, dst)
+		if err == unix.EINTR {
+			continue
+		}
+		if err != nil || r == 0 {
+			break
+		}
+		if n < len(buf) {
+			n += r
+		}
+	}
+	execd := time.Now()
+
+	for i := 0; i+childPhaseSize <= n; i += childPhaseSize {
+		b := buf[i:]
+		if b[0] == childPhaseFailed {
+			execd = time.Time{}
+			continue
+		}
+		if b[0] >= childPhaseCount {
+			continue
+		}
+		start := time.Unix(0, int64(binary.NativeEndian.Uint64(b[1:])))
+		end := time.Unix(0, int64(binary.NativeEndian.Uint64(b[9:])))
+		span.Record(childPhaseNames[b[0]], start, end)
+		last = end
+	}
+	if !last.IsZero() && !execd.IsZero() {
+		span.Record("exec", last, execd)
+	}
+	if execd.IsZero() {
+		span.Finish()
+	} else {
+		span.EndAt(execd)
+	}
+	return execd
+}
@@ -0,0 +1,127 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"os"
+	"path/filepath"
+
+	"github.com/HQarroum/microbox/events"
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * Publishes a lifecycle event of the sandbox, if it has an event stream.
+ * @param ev the event, whose identifier and PID are set
+ */
+func (p *SandboxProcess) publish(ev events.Event) {
+	if p.events == nil {
+		return
+	}
+	ev.ID = p.uuid
+	if ev.Pid == 0 && p.pid > 0 {
+		ev.Pid = p.pid
+	}
+	p.events.Publish(ev)
+}
+
+/**
+ * Watches the cgroup of a sandbox for OOM kills and freezes, which the
+ * kernel signals as modifications of `memory.events` and `cgroup.events`.
+ */
+type cgroupWatch struct {
+	p *SandboxProcess
+
+	// Inotify instance, closed to stop the watch.
+	f    *os.File
+	done chan struct{}
+
+	// Last observed OOM kill count and freeze state.
+	oomKills uint64
+	frozen   bool
+}
+
+/**
+ * Starts watching the cgroup of the sandbox.
+ * @return the watch, or nil if it cannot be set up
+ */
+func (p *SandboxProcess) watchCgroup() *cgroupWatch {
+	fd, err := unix.InotifyInit1(unix.IN_NONBLOCK | unix.IN_CLOEXEC)
+	if err != nil {
+		return nil
+	}
+	for _, name := range []string{"memory.events", "cgroup.events"} {
+		if _, err := unix.InotifyAddWatch(fd, filepath.Join(p.cgPath, name), unix.IN_MODIFY); err != nil {
+			_ = unix.Close(fd)
+			return nil
+		}
+	}
+
+	w := &cgroupWatch{
+		p:    p,
+		f:    os.NewFile(uintptr(fd), "inotify"),
+		done: make(chan struct{}),
+	}
+	go w.run()
+	return w
+}
+
+/**
+ * Publishes an event on each change, until the watch is stopped.
+ */
+func (w *cgroupWatch) run() {
+	defer close(w.done)
+	buf := make([]byte, 4096)
+	for {
+		w.check()
+		if _, err := w.f.Read(buf); err != nil {
+			return
+		}
+	}
+}
+
+/**
+ * Stops the watch, reporting the changes not observed yet.
+ */
+func (w *cgroupWatch) stop() {
+	if w == nil {
+		return
+	}
+	_ = w.f.Close()
+	<-w.done
+	w.check()
+}
+
+/**
+ * Compares the state of the cgroup with the last observed one.
+ */
+func (w *cgroupWatch) check() {
+	if v, ok := w.p.rt.cgroups.readStat(w.p.cgPath, "memory.events", "oom_kill"); ok && v > w.oomKills {
+		w.oomKills = v
+		w.p.publish(events.Event{Type: events.OOM, Count: v})
+	}
+	if v, ok := w.p.rt.cgroups.readStat(w.p.cgPath, "cgroup.events", "frozen"); ok && (v == 1) != w.frozen {
+		w.frozen = v == 1
+		if w.frozen {
+			w.p.publish(events.Event{Type: events.Paused})
+		} else {
+			w.p.publish(events.Event{Type: events.Resumed})
+		}
+	}
+}
+
+/**
+ * Freezes the processes of the sandbox.
+ * @return error if any
+ */
+func (p *SandboxProcess) Pause() error {
+	return p.rt.cgroups.freeze(p.cgPath, true)
+}
+
+/**
+ * Thaws the processes of the sandbox.
+ * @return error if any
+ */
+func (p *SandboxProcess) Resume() error {
+	return p.rt.cgroups.freeze(p.cgPath, false)
+}
@@ -0,0 +1,334 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"encoding/json"
+	"fmt"
+	"io"
+	"log/slog"
+	"os"
+	"runtime"
+	"strconv"
+	"syscall"
+	"unsafe"
+
+	"github.com/HQarroum/microbox/fs"
+	"github.com/HQarroum/microbox/logger"
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * Environment variable marking the init stage of a sandbox, holding the
+ * descriptor of its configuration.
+ */
+const initEnv = "MICROBOX_INIT"
+
+/**
+ * Configuration of the init stage of a sandbox, sent by the supervisor.
+ */
+type initConfig struct {
+	Hostname     string            `json:"hostname"`
+	FS           *fs.FsOpts        `json:"fs"`
+	Cwd          string            `json:"cwd"`
+	Thp          ThpMode           `json:"thp"`
+	Rlimits      []Rlimit          `json:"rlimits"`
+	Capabilities *CapabilityOpts   `json:"capabilities"`
+	Filter       []unix.SockFilter `json:"filter"`
+	Commands     []string          `json:"commands"`
+	Env          []string          `json:"env"`
+	LogLevel     slog.Level        `json:"logLevel"`
+
+	// Descriptors of the child log, of the child trace, of the socket
+	// receiving the seccomp listener and of the start FIFO, -1 if none.
+	LogFd    int `json:"logFd"`
+	TraceFd  int `json:"traceFd"`
+	NotifyFd int `json:"notifyFd"`
+	StartFd  int `json:"startFd"`
+}
+
+/**
+ * Writes the configuration of the init stage to a memory file.
+ * @param cfg the configuration
+ * @return the descriptor of the file, positioned at its start, or an error if any
+ */
+func writeInitConfig(cfg *initConfig) (int, error) {
+	b, err := json.Marshal(cfg)
+	if err != nil {
+		return -1, err
+	}
+	fd, err := unix.MemfdCreate("microbox-init", unix.MFD_CLOEXEC)
+	if err != nil {
+		return -1, err
+	}
+	for p := b; len(p) > 0; {
+		n, err := unix.Write(fd, p)
+		if err == unix.EINTR {
+			continue
+		}
+		if err != nil {
+			_ = unix.Close(fd)
+			return -1, err
+		}
+		p = p[n:]
+	}
+	if _, err := unix.Seek(fd, 0, io.SeekStart); err != nil {
+		_ = unix.Close(fd)
+		return -1, err
+	}
+	return fd, nil
+}
+
+/**
+ * The clone of the child of a sandbox, prepared by the supervisor so
+ * that the child only runs raw system calls until it executes the init
+ * stage. The child is a copy of a multithreaded runtime whose other
+ * threads are gone, so it must not allocate, grow its stack, or take
+ * any lock of the runtime.
+ */
+type initClone struct {
+	// Descriptors placed at 3, 4, ... in the child, without close-on-exec.
+	fds []int
+
+	// Read end of the sync pipe, on which the child waits before executing.
+	sync int
+
+	// Path, arguments and environment of the init stage.
+	path       *byte
+	argv, envp []*byte
+
+	// Signal masks blocking all signals across the clone, and restoring
+	// the mask of the parent thread.
+	mask, oldMask uint64
+}
+
+/**
+ * Prepares the clone of the child of a sandbox. The descriptors are
+ * duplicated above their targets, so that placing one in the child
+ * does not replace another yet to be placed.
+ * @param fds the descriptors of the child, placed at 3, 4, ...
+ * @param sync the read end of the sync pipe
+ * @param cfgFd the index in fds of the configuration
+ * @return the clone, or error if any
+ */
+func newInitClone(fds []int, sync, cfgFd int) (*initClone, error) {
+	c := &initClone{sync: sync, mask: ^uint64(0)}
+	for _, fd := range fds {
+		dup, err := unix.FcntlInt(uintptr(fd), unix.F_DUPFD_CLOEXEC, 3+len(fds))
+		if err != nil {
+			c.close()
+			return nil, err
+		}
+		c.fds = append(c.fds, dup)
+	}
+	var err error
+	if c.path, err = syscall.BytePtrFromString("/proc/self/exe"); err != nil {
+		c.close()
+		return nil, err
+	}
+	if c.argv, err = syscall.SlicePtrFromStrings([]string{"microbox-init"}); err != nil {
+		c.close()
+		return nil, err
+	}
+	if c.envp, err = syscall.SlicePtrFromStrings([]string{initEnv + "=" + strconv.Itoa(3+cfgFd)}); err != nil {
+		c.close()
+		return nil, err
+	}
+	return c, nil
+}
+
+/**
+ * Closes the duplicated descriptors. Called in the parent.
+ */
+func (c *initClone) close() {
+	closeFds(c.fds)
+	c.fds = nil
+}
+
+/**
+ * Clones the child of a sandbox with all signals blocked. The child
+ * waits for the supervisor on the sync pipe, places its descriptors,
+ * then executes the init stage, with signals still blocked until the
+ * init stage unblocks them.
+ * @param args the clone3 arguments
+ * @return the PID of the child, or the error of clone3
+ */
+//go:norace
+//go:nosplit
+func (c *initClone) clone(args *cloneArgs) (uintptr, syscall.Errno) {
+	syscall.RawSyscall6(unix.SYS_RT_SIGPROCMASK, unix.SIG_SETMASK,
+		uintptr(unsafe.Pointer(&c.mask)), uintptr(unsafe.Pointer(&c.oldMask)), 8, 0, 0)
+	pid, _, errno := syscall.RawSyscall(unix.SYS_CLONE3, uintptr(unsafe.Pointer(args)), unsafe.Sizeof(*args), 0)
+	if errno != 0 || pid != 0 {
+		syscall.RawSyscall6(unix.SYS_RT_SIGPROCMASK, unix.SIG_SETMASK,
+			uintptr(unsafe.Pointer(&c.oldMask)), 0, 8, 0, 0)
+		return pid, errno
+	}
+
+	// In the child, wait for the supervisor to finish its setup.
+	var b [1]byte
+	for {
+		n, _, errno := syscall.RawSyscall(unix.SYS_READ, uintptr(c.sync), uintptr(unsafe.Pointer(&b[0])), 1)
+		if errno == syscall.EINTR {
+			continue
+		}
+		if errno != 0 || n != 1 {
+			syscall.RawSyscall(unix.SYS_EXIT_GROUP, 1, 0, 0)
+		}
+		break
+	}
+	for i := 0; i < len(c.fds); i++ {
+		if _, _, errno := syscall.RawSyscall(unix.SYS_DUP3, uintptr(c.fds[i]), uintptr(3+i), 0); errno != 0 {
+			syscall.RawSyscall(unix.SYS_EXIT_GROUP, 1, 0, 0)
+		}
+	}
+	syscall.RawSyscall(unix.SYS_EXECVE, uintptr(unsafe.Pointer(c.path)),
+		uintptr(unsafe.Pointer(&c.argv[0])), uintptr(unsafe.Pointer(&c.envp[0])))
+	syscall.RawSyscall(unix.SYS_EXIT_GROUP, 127, 0, 0)
+	return 0, 0
+}
+
+/**
+ * @return whether the program runs as the init stage of a sandbox.
+ */
+func IsInit() bool {
+	_, ok := os.LookupEnv(initEnv)
+	return ok
+}
+
+/**
+ * Runs the init stage of a sandbox, then executes its command. The
+ * supervisor re-executes its own binary as the child of each sandbox,
+ * so that the setup runs in a fresh runtime rather than in a copy of
+ * the multithreaded supervisor. Programs embedding the runtime must
+ * call it first in main when IsInit is true. Never returns.
+ */
+func RunInit() {
+	// Per-thread state (capabilities, seccomp) is set on the thread
+	// executing the command.
+	runtime.LockOSThread()
+
+	cfgFd, err := strconv.Atoi(os.Getenv(initEnv))
+	if err != nil {
+		os.Exit(1)
+	}
+	unix.CloseOnExec(cfgFd)
+	f := os.NewFile(uintptr(cfgFd), "init-config")
+	b, err := io.ReadAll(f)
+	_ = f.Close()
+	cfg := &initConfig{}
+	if err == nil {
+		err = json.Unmarshal(b, cfg)
+	}
+	if err != nil {
+		fmt.Fprintln(os.Stderr, "microbox init:", err)
+		os.Exit(1)
+	}
+	os.Exit(runInit(cfg))
+}
+
+/**
+ * Sets up the sandbox from its init stage, then executes its command.
+ * @param cfg the configuration of the init stage
+ * @return the exit code, if the command could not be executed
+ */
+func runInit(cfg *initConfig) int {
+	// Only the inherited descriptors reach the command.
+	for _, fd := range []int{cfg.LogFd, cfg.TraceFd, cfg.NotifyFd, cfg.StartFd} {
+		if fd >= 0 {
+			unix.CloseOnExec(fd)
+		}
+	}
+
+	childLog := logger.NewChildBuffer(cfg.LogFd, childLogSize)
+	log := childLog.Attach(cfg.LogLevel)
+	cfg.FS.Logger = log
+	var trace *childTrace
+	if cfg.TraceFd >= 0 {
+		trace = &childTrace{fd: cfg.TraceFd}
+	}
+	trace.begin()
+
+	// Ship the logs to the parent before exiting.
+	fail := func(code int) int {
+		childLog.Flush()
+		trace.fail()
+		return code
+	}
+
+	// Set the sandbox hostname.
+	if cfg.Hostname != "" {
+		if err := unix.Sethostname([]byte(cfg.Hostname)); err != nil {
+			log.Warn("setting sandbox hostname failed", slog.Any("err", err))
+		}
+	}
+	trace.mark(childPhaseHostname)
+
+	// Setup filesystem.
+	if err := fs.SetupFS(cfg.FS); err != nil {
+		log.Error("failed to setup filesystem", slog.Any("err", err))
+		return fail(1)
+	}
+	trace.mark(childPhaseFS)
+
+	// Enter the working directory of the command.
+	if cfg.Cwd != "" {
+		if err := unix.Chdir(cfg.Cwd); err != nil {
+			log.Error("failed to enter working directory", slog.String("cwd", cfg.Cwd), slog.Any("err", err))
+			return fail(1)
+		}
+	}
+
+	// Apply the transparent huge page policy.
+	if err := ApplyThpMode(cfg.Thp); err != nil {
+		log.Warn("failed to apply THP policy", slog.String("thp", cfg.Thp.String()), slog.Any("err", err))
+	}
+	trace.mark(childPhaseThp)
+
+	// Apply resource limits, which may be raised only before
+	// capabilities are dropped.
+	if err := applyRlimits(cfg.Rlimits); err != nil {
+		log.Error("failed to apply resource limits", slog.Any("err", err))
+		return fail(1)
+	}
+
+	// Drop capabilities.
+	if err := cfg.Capabilities.Apply(); err != nil {
+		log.Error("failed to apply capabilities", slog.Any("err", err))
+		return fail(1)
+	}
+	trace.mark(childPhaseCapabilities)
+
+	// Setup seccomp filters.
+	if err := loadChildSeccomp(cfg.Filter, cfg.NotifyFd); err != nil {
+		log.Error("failed to setup seccomp rules", slog.Any("err", err))
+		return fail(1)
+	}
+	trace.mark(childPhaseSeccomp)
+
+	// The signals blocked across the clone are unblocked for the command.
+	var none unix.Sigset_t
+	if err := unix.PthreadSigmask(unix.SIG_SETMASK, &none, nil); err != nil {
+		log.Error("failed to unblock signals", slog.Any("err", err))
+		return fail(1)
+	}
+	trace.mark(childPhaseSignals)
+
+	// Once set up, tell the parent by closing the log pipe, and
+	// wait to be started.
+	if cfg.StartFd >= 0 {
+		childLog.Close()
+		if err := WaitForParent(cfg.StartFd); err != nil {
+			return 1
+		}
+	}
+
+	// Execute the specified command in the process.
+	childLog.Flush()
+	trace.flush()
+	err := unix.Exec(cfg.Commands[0], cfg.Commands, cfg.Env)
+
+	// If execve returns, something failed.
+	log.Error("failed to execute process", slog.Any("err", err))
+	return fail(127)
+}
@@ -0,0 +1,115 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"fmt"
+	"slices"
+
+	seccomp "github.com/seccomp/libseccomp-golang"
+)
+
+/**
+ * Opcodes of `io_uring_register(2)` (uapi/linux/io_uring.h).
+ */
+const (
+	ioringRegisterPersonality   = 9
+	ioringUnregisterPersonality = 10
+	ioringRegisterPbufStatus    = 26
+
+	// Flag of the opcode selecting a registered ring descriptor.
+	ioringRegisterUseRegisteredRing = 1 << 31
+)
+
+/**
+ * System calls of io_uring.
+ */
+var ioUringSyscalls = []string{"io_uring_setup", "io_uring_enter", "io_uring_register"}
+
+/**
+ * io_uring policy of a sandbox.
+ */
+type IoUringMode int
+
+/**
+ * io_uring policies.
+ */
+const (
+	// Deny the io_uring system calls, as part of the default deny list.
+	IoUringDeny IoUringMode = iota
+
+	// Allow rings, but only the `io_uring_register` opcodes registering
+	// resources, restrictions and enabling rings. The operations submitted
+	// to rings are not restricted, unless the service registers
+	// restrictions itself.
+	IoUringFilterRegister
+
+	// Allow the io_uring system calls.
+	IoUringAllow
+)
+
+/**
+ * @return a string representation of the io_uring policy.
+ */
+func (m IoUringMode) String() string {
+	switch m {
+	case IoUringDeny:
+		return "deny"
+	case IoUringFilterRegister:
+		return "filter-register"
+	case IoUringAllow:
+		return "allow"
+	default:
+		return "unknown"
+	}
+}
+
+/**
+ * Removes the io_uring system calls from a deny list when the policy
+ * allows rings, unless they are explicitly denied.
+ * @param mode the io_uring policy
+ * @param deny the merged deny list
+ * @param userDeny the system calls explicitly denied
+ * @return the deny list
+ */
+func applyIoUringMode(mode IoUringMode, deny, userDeny []string) []string {
+	if mode == IoUringDeny {
+		return deny
+	}
+	return slices.DeleteFunc(deny, func(s string) bool {
+		return slices.Contains(ioUringSyscalls, s) && !slices.Contains(userDeny, s)
+	})
+}
+
+/**
+ * Adds the rules of the filter-register io_uring policy to a filter. The
+ * opcode is compared on its low 31 bits, so that neither the upper half
+ * of the register nor the registered ring flag bypass the rules, and
+ * opcodes above `IORING_REGISTER_PBUF_STATUS`, which includes opcodes
+ * with the registered ring flag, are denied until reviewed. Personality
+ * registration is denied, as it lets requests run with other credentials.
+ * @param filter the filter
+ * @param deny the deny action
+ * @return error if any
+ */
+func addIoUringRules(filter *seccomp.ScmpFilter, deny seccomp.ScmpAction) error {
+	sc, err := seccomp.GetSyscallFromName("io_uring_register")
+	if err != nil {
+		return fmt.Errorf("seccomp: io_uring_register: %w", err)
+	}
+	const low = ioringRegisterUseRegisteredRing - 1
+	for _, op := range []uint64{ioringRegisterPersonality, ioringUnregisterPersonality} {
+		cond, err := seccomp.MakeCondition(1, seccomp.CompareMaskedEqual, low, op)
+		if err != nil {
+			return err
+		}
+		if err := filter.AddRuleConditional(sc, deny, []seccomp.ScmpCondition{cond}); err != nil {
+			return err
+		}
+	}
+	cond, err := seccomp.MakeCondition(1, seccomp.CompareGreater, ioringRegisterPbufStatus)
+	if err != nil {
+		return err
+	}
+	return filter.AddRuleConditional(sc, deny, []seccomp.ScmpCondition{cond})
+}
@@ -0,0 +1,555 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"bytes"
+	"errors"
+	"fmt"
+	"log/slog"
+	"slices"
+	"strconv"
+	"strings"
+	"syscall"
+	"unsafe"
+
+	"github.com/HQarroum/microbox/metrics"
+	seccomp "github.com/seccomp/libseccomp-golang"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// `SECCOMP_FILTER_FLAG_NEW_LISTENER` flag of seccomp(2).
+	seccompFilterFlagNewListener = 1 << 3
+
+	// Flags of the tmpfs mounts emulated for sandboxes.
+	notifyMountFlags = unix.MS_RDONLY | unix.MS_NOSUID | unix.MS_NODEV | unix.MS_NOEXEC |
+		unix.MS_NOATIME | unix.MS_NODIRATIME | unix.MS_RELATIME | unix.MS_STRICTATIME | unix.MS_SILENT
+
+	// Default size of the tmpfs mounts emulated for sandboxes without storage limit.
+	notifyDefaultTmpfsSize = 64 << 20
+)
+
+/**
+ * Emulates a system call on behalf of a sandboxed thread.
+ * @param req the notification of the system call
+ * @return the error to fail the system call with, 0 on success
+ */
+type notifyHandler func(n *notifier, req *seccomp.ScmpNotifReq) unix.Errno
+
+/**
+ * Handlers of the system calls that can be emulated by the supervisor.
+ */
+var notifyHandlers = map[string]notifyHandler{
+	"mount": (*notifier).mount,
+}
+
+/**
+ * @return the sorted names of the system calls that can be emulated.
+ */
+func EmulatedSyscalls() []string {
+	out := make([]string, 0, len(notifyHandlers))
+	for name := range notifyHandlers {
+		out = append(out, name)
+	}
+	slices.Sort(out)
+	return out
+}
+
+/**
+ * Serves the seccomp notifications of a sandbox, emulating the system
+ * calls of the sandbox for which the filter returns
+ * `SECCOMP_RET_USER_NOTIF`. The emulation works on copies of the
+ * arguments, never on the memory of the sandbox after the policy
+ * checks, and is run by a helper process joining the mount namespace,
+ * root and working directory of the calling thread. When the sandbox has
+ * its own user namespace, the helper joins it too, and only has the
+ * privileges of the sandbox. Otherwise the helper keeps the privileges
+ * of the supervisor, and the policy checks are all that restrict it.
+ */
+type notifier struct {
+	log *slog.Logger
+
+	// Counter of the notifications, by system call and outcome.
+	notifications *metrics.Counter
+
+	// Listener descriptor.
+	fd seccomp.ScmpFd
+
+	// Handlers, by system call number, and their names.
+	handlers map[seccomp.ScmpSyscall]notifyHandler
+	names    map[seccomp.ScmpSyscall]string
+
+	// Maximum size of the emulated tmpfs mounts.
+	maxTmpfsSize uint64
+}
+
+/**
+ * Creates the notifier of a sandbox.
+ * @param opts the sandbox options
+ * @param log the supervisor logger of the sandbox
+ * @param notifications the counter of the notifications
+ * @return the notifier, or an error if a system call cannot be emulated
+ */
+func newNotifier(opts *SandboxOptions, log *slog.Logger, notifications *metrics.Counter) (*notifier, error) {
+	n := &notifier{
+		log:           log,
+		notifications: notifications,
+		handlers:      make(map[seccomp.ScmpSyscall]notifyHandler),
+		names:         make(map[seccomp.ScmpSyscall]string),
+		maxTmpfsSize:  opts.Storage,
+	}
+	if n.maxTmpfsSize == 0 {
+		n.maxTmpfsSize = notifyDefaultTmpfsSize
+	}
+	for _, name := range opts.Emulate {
+		h, ok := notifyHandlers[name]
+		if !ok {
+			return nil, fmt.Errorf("cannot emulate %s (one of %v)", name, EmulatedSyscalls())
+		}
+		sc, err := seccomp.GetSyscallFromName(name)
+		if err != nil {
+			return nil, fmt.Errorf("seccomp: %s: %w", name, err)
+		}
+		n.handlers[sc], n.names[sc] = h, name
+	}
+	return n, nil
+}
+
+/**
+ * Adds the rules notifying the supervisor of the emulated system calls.
+ * @param filter the filter
+ * @param names the emulated system calls
+ * @return error if any
+ */
+func addNotifyRules(filter *seccomp.ScmpFilter, names []string) error {
+	for _, name := range names {
+		if _, ok := notifyHandlers[name]; !ok {
+			return fmt.Errorf("cannot emulate %s (one of %v)", name, EmulatedSyscalls())
+		}
+		sc, err := seccomp.GetSyscallFromName(name)
+		if err != nil {
+			return fmt.Errorf("seccomp: %s: %w", name, err)
+		}
+		if err := filter.AddRule(sc, seccomp.ActNotify); err != nil {
+			return fmt.Errorf("seccomp: notify %s: %w", name, err)
+		}
+	}
+	return nil
+}
+
+/**
+ * Loads the seccomp program of a sandbox in the child. When system
+ * calls are emulated, the listener of the filter is sent to the
+ * supervisor over a socket, then closed, so that the sandboxed program
+ * never holds it.
+ * @param prog the BPF program
+ * @param sock the socket to the supervisor, -1 if nothing is emulated
+ * @return error if any
+ */
+func loadChildSeccomp(prog []unix.SockFilter, sock int) error {
+	if sock < 0 {
+		return LoadSeccomp(prog)
+	}
+	listener, err := loadSeccomp(prog, seccompFilterFlagNewListener)
+	if err != nil {
+		return err
+	}
+	err = unix.Sendmsg(sock, []byte{0}, unix.UnixRights(listener), nil, 0)
+	_ = unix.Close(listener)
+	_ = unix.Close(sock)
+	if err != nil {
+		return fmt.Errorf("seccomp: send listener: %w", err)
+	}
+	return nil
+}
+
+/**
+ * Receives the listener from the child, then serves notifications
+ * until the sandbox has exited.
+ * @param sock the socket to the child, closed once done
+ */
+func (n *notifier) serve(sock int) {
+	fd, err := receiveFd(sock)
+	_ = unix.Close(sock)
+	if err != nil {
+		// The child exited, or failed, before loading its filter.
+		return
+	}
+	defer unix.Close(fd)
+	n.fd = seccomp.ScmpFd(fd)
+
+	for {
+		// The listener hangs up once no thread uses the filter anymore.
+		fds := []unix.PollFd{{Fd: int32(fd), Events: unix.POLLIN}}
+		if _, err := unix.Poll(fds, -1); err != nil {
+			if err == unix.EINTR {
+				continue
+			}
+			n.log.Warn("failed to poll seccomp listener", slog.Any("err", err))
+			return
+		}
+		if fds[0].Revents&unix.POLLIN == 0 {
+			return
+		}
+		req, err := seccomp.NotifReceive(n.fd)
+		if err != nil {
+			// The calling thread was killed after notifying.
+			continue
+		}
+		n.respond(req)
+	}
+}
+
+/**
+ * Emulates a notified system call and responds to the calling thread.
+ * @param req the notification
+ */
+func (n *notifier) respond(req *seccomp.ScmpNotifReq) {
+	errno := unix.ENOSYS
+	if h, ok := n.handlers[req.Data.Syscall]; ok {
+		errno = h(n, req)
+	}
+	result := "ok"
+	if errno != 0 {
+		result = "denied"
+	}
+	n.notifications.Inc(n.names[req.Data.Syscall], result)
+
+	resp := &seccomp.ScmpNotifResp{ID: req.ID, Error: -int32(errno)}
+	if err := seccomp.NotifRespond(n.fd, resp); err != nil && !errors.Is(err, unix.ENOENT) {
+		n.log.Warn("failed to respond to seccomp notification", slog.Any("err", err))
+	}
+}
+
+/**
+ * Emulates `mount(2)` for tmpfs mounts, with a restricted set of flags
+ * and options, and a size capped to the storage of the sandbox.
+ * @param req the notification
+ * @return the error to fail the system call with, 0 on success
+ */
+func (n *notifier) mount(req *seccomp.ScmpNotifReq) unix.Errno {
+	pid, args := int(req.Pid), req.Data.Args
+	fstype, err := readString(pid, args[2])
+	if err != nil {
+		return unix.EFAULT
+	}
+	if fstype != "tmpfs" {
+		return unix.EPERM
+	}
+	flags := args[3]
+	if flags&^notifyMountFlags != 0 {
+		return unix.EPERM
+	}
+	target, err := readString(pid, args[1])
+	if err != nil {
+		return unix.EFAULT
+	}
+	var data string
+	if args[4] != 0 {
+		if data, err = readString(pid, args[4]); err != nil {
+			return unix.EFAULT
+		}
+	}
+	data, errno := n.tmpfsOptions(data)
+	if errno != 0 {
+		return errno
+	}
+
+	// The thread may have been killed, and its identifier reused, while
+	// its memory was read or its namespaces opened. Once opened, the
+	// descriptors keep referring to the namespaces of the thread that
+	// notified, provided that it is still waiting on the notification.
+	thread, err := openThread(pid)
+	if err != nil {
+		return unix.ESRCH
+	}
+	defer thread.close()
+	if seccomp.NotifIDValid(n.fd, req.ID) != nil {
+		return unix.ENOENT
+	}
+
+	flags |= unix.MS_NOSUID | unix.MS_NODEV
+	n.log.Info("emulating tmpfs mount", slog.Int("pid", pid), slog.String("target", target), slog.String("options", data))
+	return thread.mount(target, data, uintptr(flags))
+}
+
+/**
+ * Checks the options of a tmpfs mount, and caps its size.
+ * @param data the mount options
+ * @return the options to mount with, or the error to fail the mount with
+ */
+func (n *notifier) tmpfsOptions(data string) (string, unix.Errno) {
+	var out []string
+	sized := false
+	for _, o := range strings.Split(data, ",") {
+		key, val, _ := strings.Cut(o, "=")
+		switch key {
+		case "":
+			continue
+		case "size":
+			size, err := parseTmpfsSize(val)
+			if err != nil {
+				return "", unix.EINVAL
+			}
+			if size > n.maxTmpfsSize {
+				return "", unix.EPERM
+			}
+			sized = true
+		case "nr_inodes", "mode", "uid", "gid", "huge":
+		default:
+			return "", unix.EPERM
+		}
+		out = append(out, o)
+	}
+	if !sized {
+		out = append(out, "size="+strconv.FormatUint(n.maxTmpfsSize, 10))
+	}
+	return strings.Join(out, ","), 0
+}
+
+/**
+ * Parses the size of a tmpfs mount, in bytes with an optional `k`, `m`
+ * or `g` suffix. Sizes relative to the host memory are not accepted.
+ * @param s the size
+ * @return the size in bytes, or error if any
+ */
+func parseTmpfsSize(s string) (uint64, error) {
+	shift := 0
+	switch {
+	case strings.HasSuffix(s, "k"), strings.HasSuffix(s, "K"):
+		shift = 10
+	case strings.HasSuffix(s, "m"), strings.HasSuffix(s, "M"):
+		shift = 20
+	case strings.HasSuffix(s, "g"), strings.HasSuffix(s, "G"):
+		shift = 30
+	}
+	if shift > 0 {
+		s = s[:len(s)-1]
+	}
+	v, err := strconv.ParseUint(s, 10, 64)
+	if err != nil || v > (1<<64-1)>>shift {
+		return 0, fmt.Errorf("bad tmpfs size %q", s)
+	}
+	return v << shift, nil
+}
+
+/**
+ * Reads a string from the memory of a process, a page at most at a
+ * time, so that reads do not cross into unmapped pages.
+ * @param pid the process
+ * @param addr the address of the string
+ * @return the string, or error if any
+ */
+func readString(pid int, addr uint64) (string, error) {
+	if addr == 0 {
+		return "", unix.EFAULT
+	}
+	page := uint64(unix.Getpagesize())
+	buf := make([]byte, 0, 256)
+	chunk := make([]byte, page)
+	for len(buf) < unix.PathMax {
+		n := page - addr%page
+		local := []unix.Iovec{{Base: &chunk[0], Len: n}}
+		remote := []unix.RemoteIovec{{Base: uintptr(addr), Len: int(n)}}
+		read, err := unix.ProcessVMReadv(pid, local, remote, 0)
+		if err != nil {
+			return "", err
+		}
+		if i := bytes.IndexByte(chunk[:read], 0); i >= 0 {
+			return string(append(buf, chunk[:i]...)), nil
+		}
+		buf = append(buf, chunk[:read]...)
+		addr += uint64(read)
+	}
+	return "", unix.ENAMETOOLONG
+}
+
+/**
+ * Receives a file descriptor sent over a socket.
+ * @param sock the socket
+ * @return the file descriptor, or error if any
+ */
+func receiveFd(sock int) (int, error) {
+	buf := make([]byte, 1)
+	oob := make([]byte, unix.CmsgSpace(4))
+	_, oobn, _, _, err := unix.Recvmsg(sock, buf, oob, unix.MSG_CMSG_CLOEXEC)
+	if err != nil {
+		return -1, err
+	}
+	msgs, err := unix.ParseSocketControlMessage(oob[:oobn])
+	if err != nil {
+		return -1, err
+	}
+	if len(msgs) != 1 {
+		return -1, errors.New("no file descriptor received")
+	}
+	fds, err := unix.ParseUnixRights(&msgs[0])
+	if err != nil {
+		return -1, err
+	}
+	if len(fds) != 1 {
+		return -1, errors.New("no file descriptor received")
+	}
+	return fds[0], nil
+}
+
+/**
+ * Descriptors of the user and mount namespaces, the root and the working
+ * directory of a sandboxed thread.
+ */
+type threadFds [4]int
+
+/**
+ * Opens the namespaces, root and working directory of a sandboxed thread.
+ * @param tid the sandboxed thread
+ * @return the descriptors, or error if any
+ */
+func openThread(tid int) (*threadFds, error) {
+	var fds threadFds
+	for i, name := range []string{"ns/user", "ns/mnt", "root", "cwd"} {
+		flags := unix.O_RDONLY | unix.O_CLOEXEC
+		if i >= 2 {
+			flags = unix.O_PATH | unix.O_DIRECTORY | unix.O_CLOEXEC
+		}
+		fd, err := unix.Open(fmt.Sprintf("/proc/%d/%s", tid, name), flags, 0)
+		if err != nil {
+			for _, prev := range fds[:i] {
+				_ = unix.Close(prev)
+			}
+			return nil, err
+		}
+		fds[i] = fd
+	}
+	return &fds, nil
+}
+
+/**
+ * Closes the descriptors of a sandboxed thread.
+ */
+func (t *threadFds) close() {
+	for _, fd := range t {
+		_ = unix.Close(fd)
+	}
+}
+
+/**
+ * A tmpfs mount run by a helper process in the namespaces of a
+ * sandboxed thread, with its arguments prepared by the supervisor.
+ */
+type threadMount struct {
+	// Descriptors of the sandboxed thread.
+	fds *threadFds
+
+	// Whether the helper joins the user namespace of the thread.
+	joinUser bool
+
+	// Arguments of chroot and mount.
+	dot, fstype, target, data *byte
+	flags                     uintptr
+
+	// Signal masks blocking all signals across the clone, and restoring
+	// the mask of the parent thread.
+	mask, oldMask uint64
+}
+
+/**
+ * Mounts a tmpfs in a helper process, joining the mount namespace, the
+ * root and the working directory of a sandboxed thread, and its user
+ * namespace unless it is the one of the supervisor. The namespaces of a
+ * multithreaded process cannot be changed, hence the helper.
+ * @param target the mount point
+ * @param data the mount options
+ * @param flags the mount flags
+ * @return the error of the mount, 0 on success
+ */
+func (t *threadFds) mount(target, data string, flags uintptr) unix.Errno {
+	m := &threadMount{fds: t, flags: flags, mask: ^uint64(0)}
+
+	// Joining the user namespace of the supervisor itself fails.
+	m.joinUser = !sameFile(t[0], "/proc/self/ns/user")
+	m.dot, _ = unix.BytePtrFromString(".")
+	m.fstype, _ = unix.BytePtrFromString("tmpfs")
+	var err error
+	if m.target, err = unix.BytePtrFromString(target); err != nil {
+		return unix.EINVAL
+	}
+	if m.data, err = unix.BytePtrFromString(data); err != nil {
+		return unix.EINVAL
+	}
+
+	args := cloneArgs{ExitSignal: uint64(unix.SIGCHLD)}
+	syscall.ForkLock.Lock()
+	pid, errno := m.clone(&args)
+	syscall.ForkLock.Unlock()
+	if errno != 0 {
+		return unix.Errno(errno)
+	}
+
+	var ws unix.WaitStatus
+	for {
+		_, err := unix.Wait4(int(pid), &ws, 0, nil)
+		if err != unix.EINTR {
+			break
+		}
+	}
+	if !ws.Exited() {
+		return unix.EIO
+	}
+	return unix.Errno(ws.ExitStatus())
+}
+
+/**
+ * Clones the helper with all signals blocked. The helper is a copy of
+ * a multithreaded runtime whose other threads are gone, so it only
+ * runs raw system calls on the prepared arguments, and exits with the
+ * error of the first one that fails.
+ * @param args the clone3 arguments
+ * @return the PID of the helper, or the error of clone3
+ */
+//go:norace
+//go:nosplit
+func (m *threadMount) clone(args *cloneArgs) (uintptr, syscall.Errno) {
+	syscall.RawSyscall6(unix.SYS_RT_SIGPROCMASK, unix.SIG_SETMASK,
+		uintptr(unsafe.Pointer(&m.mask)), uintptr(unsafe.Pointer(&m.oldMask)), 8, 0, 0)
+	pid, _, errno := syscall.RawSyscall(unix.SYS_CLONE3, uintptr(unsafe.Pointer(args)), unsafe.Sizeof(*args), 0)
+	if errno != 0 || pid != 0 {
+		syscall.RawSyscall6(unix.SYS_RT_SIGPROCMASK, unix.SIG_SETMASK,
+			uintptr(unsafe.Pointer(&m.oldMask)), 0, 8, 0, 0)
+		return pid, errno
+	}
+
+	if m.joinUser {
+		if _, _, errno := syscall.RawSyscall(unix.SYS_SETNS, uintptr(m.fds[0]), unix.CLONE_NEWUSER, 0); errno != 0 {
+			syscall.RawSyscall(unix.SYS_EXIT_GROUP, uintptr(errno), 0, 0)
+		}
+	}
+	if _, _, errno := syscall.RawSyscall(unix.SYS_SETNS, uintptr(m.fds[1]), unix.CLONE_NEWNS, 0); errno != 0 {
+		syscall.RawSyscall(unix.SYS_EXIT_GROUP, uintptr(errno), 0, 0)
+	}
+	if _, _, errno := syscall.RawSyscall(unix.SYS_FCHDIR, uintptr(m.fds[2]), 0, 0); errno != 0 {
+		syscall.RawSyscall(unix.SYS_EXIT_GROUP, uintptr(errno), 0, 0)
+	}
+	if _, _, errno := syscall.RawSyscall(unix.SYS_CHROOT, uintptr(unsafe.Pointer(m.dot)), 0, 0); errno != 0 {
+		syscall.RawSyscall(unix.SYS_EXIT_GROUP, uintptr(errno), 0, 0)
+	}
+	if _, _, errno := syscall.RawSyscall(unix.SYS_FCHDIR, uintptr(m.fds[3]), 0, 0); errno != 0 {
+		syscall.RawSyscall(unix.SYS_EXIT_GROUP, uintptr(errno), 0, 0)
+	}
+	_, _, errno = syscall.RawSyscall6(unix.SYS_MOUNT,
+		uintptr(unsafe.Pointer(m.fstype)), uintptr(unsafe.Pointer(m.target)), uintptr(unsafe.Pointer(m.fstype)),
+		m.flags, uintptr(unsafe.Pointer(m.data)), 0)
+	syscall.RawSyscall(unix.SYS_EXIT_GROUP, uintptr(errno), 0, 0)
+	return 0, 0
+}
+
+/**
+ * @return whether a descriptor refers to the same file as a path.
+ */
+func sameFile(fd int, path string) bool {
+	var a, b unix.Stat_t
+	if unix.Fstat(fd, &a) != nil || unix.Stat(path, &b) != nil {
+		return false
+	}
+	return a.Dev == b.Dev && a.Ino == b.Ino
+}
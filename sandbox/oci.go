@@ -0,0 +1,365 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"time"
+
+	"golang.org/x/sys/unix"
+)
+
+const (
+	containerRoot = "/run/microbox/containers"
+
+	// Version of the runtime specification implemented by containers.
+	ociVersion = "1.0.2"
+)
+
+/**
+ * Statuses of a container.
+ */
+const (
+	ContainerCreated = "created"
+	ContainerRunning = "running"
+	ContainerStopped = "stopped"
+)
+
+/**
+ * The state of a container, as defined by the OCI runtime specification.
+ */
+type ContainerState struct {
+	OCIVersion  string            `json:"ociVersion"`
+	ID          string            `json:"id"`
+	Status      string            `json:"status"`
+	Pid         int               `json:"pid,omitempty"`
+	Bundle      string            `json:"bundle"`
+	Annotations map[string]string `json:"annotations,omitempty"`
+}
+
+/**
+ * The persisted record of a container, a sandbox created ahead of time
+ * and left running without its supervisor.
+ */
+type container struct {
+	// Container identifier.
+	ID string `json:"id"`
+
+	// Identifier of the sandbox running the container.
+	Sandbox string `json:"sandbox"`
+
+	// Absolute path of the bundle.
+	Bundle string `json:"bundle"`
+
+	// Host PID of the container process, and its start time in clock
+	// ticks since boot, telling it apart from a process reusing the PID.
+	Pid       int    `json:"pid"`
+	StartTime uint64 `json:"startTime"`
+
+	// Applied cgroup path.
+	CgroupPath string `json:"cgroupPath"`
+
+	// Creation time.
+	Created time.Time `json:"created"`
+
+	// Annotations of the bundle.
+	Annotations map[string]string `json:"annotations,omitempty"`
+}
+
+/**
+ * @return the state directory of the container with the given identifier.
+ */
+func containerDir(id string) string {
+	return filepath.Join(containerRoot, id)
+}
+
+/**
+ * @return the path of the FIFO starting the container with the given identifier.
+ */
+func startFifo(id string) string {
+	return filepath.Join(containerDir(id), "exec.fifo")
+}
+
+/**
+ * Creates a container from the options mapped from its bundle. The
+ * sandbox is set up, then waits on a FIFO in the container state
+ * directory until it is started by another invocation, as for the
+ * synchronization pipe between the parent and the child. The sandbox
+ * outlives the calling process, and must be deleted once stopped.
+ * @param id the container identifier
+ * @param bundle the absolute path of the bundle
+ * @param annotations the annotations of the bundle
+ * @param opts the sandbox options
+ * @return the host PID of the container process, or an error if any
+ */
+func (rt *Runtime) CreateContainer(id, bundle string, annotations map[string]string, opts *SandboxOptions) (int, error) {
+	if id == "" || filepath.Base(id) != id || id == "." || id == ".." {
+		return 0, fmt.Errorf("bad container identifier %q", id)
+	}
+	if err := os.MkdirAll(containerRoot, 0o700); err != nil {
+		return 0, fmt.Errorf("mkdir %s: %w", containerRoot, err)
+	}
+	dir := containerDir(id)
+	if err := os.Mkdir(dir, 0o700); err != nil {
+		if errors.Is(err, os.ErrExist) {
+			return 0, fmt.Errorf("container %q already exists", id)
+		}
+		return 0, fmt.Errorf("mkdir %s: %w", dir, err)
+	}
+	fail := func(err error) (int, error) {
+		_ = os.RemoveAll(dir)
+		return 0, err
+	}
+	if err := unix.Mkfifo(startFifo(id), 0o600); err != nil {
+		return fail(fmt.Errorf("mkfifo: %w", err))
+	}
+
+	o := *opts
+	o.StartFifo = startFifo(id)
+	p, err := rt.NewSandbox(context.Background(), &o)
+	if err != nil {
+		return fail(err)
+	}
+
+	// Wait for the sandbox to be set up, so that setup failures fail
+	// the creation.
+	if !p.WaitSetup() {
+		_, _ = p.Wait()
+		return fail(fmt.Errorf("container %q exited during setup", id))
+	}
+
+	c := &container{
+		ID:          id,
+		Sandbox:     p.uuid,
+		Bundle:      bundle,
+		Pid:         p.pid,
+		CgroupPath:  p.cgPath,
+		Created:     time.Now(),
+		Annotations: annotations,
+	}
+	if c.StartTime, _, err = procStat(p.pid); err == nil {
+		err = c.save()
+	}
+	if err != nil {
+		_ = p.Kill()
+		_, _ = p.Wait()
+		return fail(err)
+	}
+	p.detach()
+	return c.Pid, nil
+}
+
+/**
+ * Starts a created container.
+ * @param id the container identifier
+ * @return error if any
+ */
+func StartContainer(id string) error {
+	c, err := loadContainer(id)
+	if err != nil {
+		return err
+	}
+	if status := c.status(); status != ContainerCreated {
+		return fmt.Errorf("container %q is %s", id, status)
+	}
+
+	// Opening the FIFO fails if the container no longer waits on it.
+	fd, err := unix.Open(startFifo(id), unix.O_WRONLY|unix.O_NONBLOCK|unix.O_CLOEXEC, 0)
+	if err != nil {
+		return fmt.Errorf("container %q is not waiting to start: %w", id, err)
+	}
+	if err := SignalChild(fd); err != nil {
+		return fmt.Errorf("start container %q: %w", id, err)
+	}
+	return os.Remove(startFifo(id))
+}
+
+/**
+ * Reads the state of a container.
+ * @param id the container identifier
+ * @return the container state, or an error if no such container exists
+ */
+func LoadContainerState(id string) (*ContainerState, error) {
+	c, err := loadContainer(id)
+	if err != nil {
+		return nil, err
+	}
+	st := &ContainerState{
+		OCIVersion:  ociVersion,
+		ID:          c.ID,
+		Status:      c.status(),
+		Bundle:      c.Bundle,
+		Annotations: c.Annotations,
+	}
+	if st.Status != ContainerStopped {
+		st.Pid = c.Pid
+	}
+	return st, nil
+}
+
+/**
+ * Sends a signal to the process of a container.
+ * @param id the container identifier
+ * @param sig the signal
+ * @return error if any
+ */
+func KillContainer(id string, sig unix.Signal) error {
+	c, err := loadContainer(id)
+	if err != nil {
+		return err
+	}
+	pidfd, err := unix.PidfdOpen(c.Pid, 0)
+	if err != nil {
+		return fmt.Errorf("container %q is %s", id, ContainerStopped)
+	}
+	defer unix.Close(pidfd)
+
+	// Check that the descriptor refers to the container process, and
+	// not to a process which reused its PID.
+	if !c.alive() {
+		return fmt.Errorf("container %q is %s", id, ContainerStopped)
+	}
+	return unix.PidfdSendSignal(pidfd, sig, nil, 0)
+}
+
+/**
+ * Deletes a container, releasing its cgroup and state.
+ * @param id the container identifier
+ * @param force whether to kill the container if it is not stopped
+ * @return error if any
+ */
+func (rt *Runtime) DeleteContainer(id string, force bool) error {
+	c, err := loadContainer(id)
+	if err != nil {
+		return err
+	}
+	if status := c.status(); status != ContainerStopped && !force {
+		return fmt.Errorf("container %q is %s", id, status)
+	}
+
+	// Killing the cgroup is asynchronous, so it may be busy for a while.
+	for i := 0; ; i++ {
+		err = rt.cgroups.Cleanup(c.CgroupPath)
+		if err == nil || !errors.Is(err, unix.EBUSY) || i == 100 {
+			break
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+	if err != nil {
+		return fmt.Errorf("delete container %q: %w", id, err)
+	}
+	return os.RemoveAll(containerDir(id))
+}
+
+/**
+ * Loads the record of a container.
+ * @param id the container identifier
+ * @return the container record, or an error if no such container exists
+ */
+func loadContainer(id string) (*container, error) {
+	if id == "" || filepath.Base(id) != id {
+		return nil, fmt.Errorf("no such container: %q", id)
+	}
+	b, err := os.ReadFile(filepath.Join(containerDir(id), "state.json"))
+	if errors.Is(err, os.ErrNotExist) {
+		return nil, fmt.Errorf("no such container: %q", id)
+	} else if err != nil {
+		return nil, err
+	}
+	c := &container{}
+	if err := json.Unmarshal(b, c); err != nil {
+		return nil, fmt.Errorf("parse state of container %s: %w", id, err)
+	}
+	return c, nil
+}
+
+/**
+ * Persists the record of the container.
+ * @return error if any
+ */
+func (c *container) save() error {
+	b, err := json.Marshal(c)
+	if err != nil {
+		return err
+	}
+	dir := containerDir(c.ID)
+	tmp := filepath.Join(dir, "state.json.tmp")
+	if err := os.WriteFile(tmp, b, 0o600); err != nil {
+		return err
+	}
+	return os.Rename(tmp, filepath.Join(dir, "state.json"))
+}
+
+/**
+ * @return the status of the container.
+ */
+func (c *container) status() string {
+	if !c.alive() {
+		return ContainerStopped
+	}
+	if _, err := os.Stat(startFifo(c.ID)); err == nil {
+		return ContainerCreated
+	}
+	return ContainerRunning
+}
+
+/**
+ * @return whether the container process is running.
+ */
+func (c *container) alive() bool {
+	start, state, err := procStat(c.Pid)
+	return err == nil && start == c.StartTime && state != 'Z' && state != 'X'
+}
+
+/**
+ * Reads the start time and state of a process.
+ * @param pid the process identifier
+ * @return the start time in clock ticks since boot, the state, or an error if any
+ */
+func procStat(pid int) (uint64, byte, error) {
+	b, err := os.ReadFile("/proc/" + strconv.Itoa(pid) + "/stat")
+	if err != nil {
+		return 0, 0, err
+	}
+
+	// Fields follow the parenthesized command name, starting with the
+	// state (3rd field), up to the start time (22nd field).
+	i := strings.LastIndexByte(string(b), ')')
+	if i < 0 {
+		return 0, 0, fmt.Errorf("bad stat of process %d", pid)
+	}
+	fields := strings.Fields(string(b[i+1:]))
+	if len(fields) < 20 || len(fields[0]) != 1 {
+		return 0, 0, fmt.Errorf("bad stat of process %d", pid)
+	}
+	start, err := strconv.ParseUint(fields[19], 10, 64)
+	if err != nil {
+		return 0, 0, fmt.Errorf("bad stat of process %d: %w", pid, err)
+	}
+	return start, fields[0][0], nil
+}
+
+/**
+ * Leaves the sandbox running without its supervisor, which no longer
+ * tracks, reaps nor releases it.
+ */
+func (p *SandboxProcess) detach() {
+	p.watch.stop()
+	p.takePerf().close()
+	p.untrack()
+	p.span.Finish()
+
+	p.mu.Lock()
+	if p.pidfd >= 0 {
+		_ = unix.Close(p.pidfd)
+		p.pidfd = -1
+	}
+	p.mu.Unlock()
+}
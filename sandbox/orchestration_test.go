@@ -0,0 +1,203 @@
+//go:build linux
+
+package sandbox_test
+
+import (
+	"context"
+	"fmt"
+	"path/filepath"
+	"testing"
+
+	"github.com/HQarroum/microbox/fakes"
+	"github.com/HQarroum/microbox/fs"
+	mnet "github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/sandbox"
+)
+
+/**
+ * The fakes of the host, and a runtime operating on them.
+ */
+type fakeHost struct {
+	cgroups *fakes.CgroupTree
+	links   *fakes.Netlink
+	mounts  *fakes.MountRecorder
+	rt      *sandbox.Runtime
+
+	// Scratch directory, holding the IPAM database and the layers.
+	dir string
+
+	// Next fake PID.
+	pid int
+}
+
+/**
+ * Creates fakes of the host, and a runtime operating on them.
+ * @param b the benchmark
+ * @return the fakes
+ */
+func newFakeHost(b *testing.B) *fakeHost {
+	h := &fakeHost{
+		cgroups: fakes.NewCgroupTree("/sys/fs/cgroup"),
+		links:   fakes.NewNetlink(),
+		mounts:  fakes.NewMountRecorder(false),
+		dir:     b.TempDir(),
+		pid:     100000,
+	}
+	h.rt = sandbox.NewRuntime(sandbox.RuntimeOptions{
+		CgroupFS: h.cgroups,
+		Mounter:  h.mounts,
+		Netlink:  h.links,
+		Firewall: fakes.NewFirewall(),
+	})
+	return h
+}
+
+/**
+ * @return a new fake PID.
+ */
+func (h *fakeHost) nextPID() int {
+	h.pid++
+	return h.pid
+}
+
+/**
+ * Counts the cgroups, links and mounts, to check that teardown
+ * releases everything set up.
+ */
+func (h *fakeHost) count() [3]int {
+	return [3]int{h.cgroups.Len(), h.links.Len(), h.mounts.Len()}
+}
+
+/**
+ * Creates the cgroup of a sandbox, moves a process into it, then
+ * releases it.
+ */
+func (h *fakeHost) cgroupCycle(pid int) error {
+	cgPath, err := h.rt.Cgroups().Create(fmt.Sprintf("%d", pid), 0.5, 64<<20)
+	if err != nil {
+		return err
+	}
+	if err := h.rt.Cgroups().Attach(cgPath, pid); err != nil {
+		return err
+	}
+	return h.rt.Cgroups().Cleanup(cgPath)
+}
+
+/**
+ * Sets up the bridge network of a sandbox, then releases it as when
+ * the sandbox exits.
+ */
+func (h *fakeHost) networkCycle(pid int) error {
+	res, err := h.setupNetwork(pid)
+	if err != nil {
+		return err
+	}
+	return h.releaseNetwork(res, pid)
+}
+
+/**
+ * Sets up the bridge network of a sandbox.
+ */
+func (h *fakeHost) setupNetwork(pid int) (*mnet.NetworkResult, error) {
+	return h.rt.Network().SetupContainerNetworking(context.Background(), mnet.NetworkConfig{
+		ChildPID: pid,
+		Mode:     mnet.NetBridge,
+		IpamDB:   filepath.Join(h.dir, "ipam.db"),
+	})
+}
+
+/**
+ * Releases the network of a sandbox, then deletes its namespace. The
+ * kernel destroys namespaces asynchronously, so the host veth is still
+ * there when the supervisor deletes it.
+ */
+func (h *fakeHost) releaseNetwork(res *mnet.NetworkResult, pid int) error {
+	err := res.Cleanup()
+	h.links.DeleteNetns(pid, "")
+	return err
+}
+
+/**
+ * Mounts the writable layer of a sandbox, then releases it.
+ */
+func (h *fakeHost) layerCycle(pid int) error {
+	dir := filepath.Join(h.dir, fmt.Sprintf("layer-%d", pid))
+	if err := fs.PrepareLayer(h.mounts, dir, 64<<20, ""); err != nil {
+		return err
+	}
+	return fs.ReleaseLayer(h.mounts, dir)
+}
+
+/**
+ * Sets up the cgroup, network and layer of a sandbox, then releases
+ * them in the order of the supervisor once the sandbox exits.
+ */
+func (h *fakeHost) fullCycle(pid int) error {
+	cgPath, err := h.rt.Cgroups().Create(fmt.Sprintf("%d", pid), 0.5, 64<<20)
+	if err != nil {
+		return err
+	}
+	if err := h.rt.Cgroups().Attach(cgPath, pid); err != nil {
+		return err
+	}
+	res, err := h.setupNetwork(pid)
+	if err != nil {
+		return err
+	}
+	layer := filepath.Join(h.dir, fmt.Sprintf("layer-%d", pid))
+	if err := fs.PrepareLayer(h.mounts, layer, 64<<20, ""); err != nil {
+		return err
+	}
+
+	if err := fs.ReleaseLayer(h.mounts, layer); err != nil {
+		return err
+	}
+	if err := h.releaseNetwork(res, pid); err != nil {
+		return err
+	}
+	return h.rt.Cgroups().Cleanup(cgPath)
+}
+
+/**
+ * Benchmarks the control plane of sandboxes on in-memory fakes of the
+ * host, so that it runs without root and measures microbox itself
+ * rather than the kernel. Runs a setup and teardown cycle per
+ * iteration, failing the benchmark if the teardown leaked resources.
+ */
+func runCycles(b *testing.B, cycle func(h *fakeHost, pid int) error) {
+	h := newFakeHost(b)
+
+	// Warm up, so that the bridge and cgroup parent count as baseline.
+	if err := cycle(h, h.nextPID()); err != nil {
+		b.Fatal(err)
+	}
+	before := h.count()
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := cycle(h, h.nextPID()); err != nil {
+			b.Fatal(err)
+		}
+	}
+	b.StopTimer()
+	if after := h.count(); after != before {
+		b.Fatalf("teardown leaked resources: cgroups/links/mounts %v -> %v", before, after)
+	}
+}
+
+func BenchmarkCgroupCycle(b *testing.B) {
+	runCycles(b, (*fakeHost).cgroupCycle)
+}
+
+func BenchmarkNetworkCycle(b *testing.B) {
+	runCycles(b, (*fakeHost).networkCycle)
+}
+
+func BenchmarkLayerCycle(b *testing.B) {
+	runCycles(b, (*fakeHost).layerCycle)
+}
+
+func BenchmarkSandboxCycle(b *testing.B) {
+	runCycles(b, (*fakeHost).fullCycle)
+}
@@ -0,0 +1,304 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"encoding/binary"
+	"fmt"
+	"log/slog"
+	"os"
+	"strconv"
+	"strings"
+	"unsafe"
+
+	"github.com/HQarroum/microbox/tracing"
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * A performance counter, with the software counter used in its place
+ * when the PMU is not accessible, if any.
+ */
+type perfEvent struct {
+	name     string
+	typ      uint32
+	config   uint64
+	fallback *perfEvent
+}
+
+/**
+ * Counters opened on the cgroup of a sandbox.
+ */
+var perfEvents = []perfEvent{
+	{"cycles", unix.PERF_TYPE_HARDWARE, unix.PERF_COUNT_HW_CPU_CYCLES,
+		&perfEvent{"cpu-clock-ns", unix.PERF_TYPE_SOFTWARE, unix.PERF_COUNT_SW_CPU_CLOCK, nil}},
+	{"instructions", unix.PERF_TYPE_HARDWARE, unix.PERF_COUNT_HW_INSTRUCTIONS, nil},
+	{"cache-misses", unix.PERF_TYPE_HARDWARE, unix.PERF_COUNT_HW_CACHE_MISSES, nil},
+	{"context-switches", unix.PERF_TYPE_SOFTWARE, unix.PERF_COUNT_SW_CONTEXT_SWITCHES, nil},
+	{"page-faults", unix.PERF_TYPE_SOFTWARE, unix.PERF_COUNT_SW_PAGE_FAULTS, nil},
+}
+
+/**
+ * Totals of the performance counters of a sandbox.
+ */
+type PerfCounts struct {
+	// Counter totals, by name.
+	Values map[string]uint64
+
+	// Instructions per cycle, if both are counted.
+	IPC float64
+}
+
+/**
+ * Performance counters scoped to a cgroup. Cgroup events only count
+ * on a given CPU, so each counter is opened on every online CPU.
+ */
+type perfCounters struct {
+	names []string
+	fds   [][]int
+
+	// Totals counted during the setup of the sandbox, subtracted from
+	// the reported totals, nil if not taken.
+	setup []uint64
+}
+
+/**
+ * @return the total of a counter over all CPUs.
+ */
+func (pc *perfCounters) read(i int) uint64 {
+	var total uint64
+	for _, fd := range pc.fds[i] {
+		total += readPerfEvent(fd)
+	}
+	return total
+}
+
+/**
+ * Records the totals counted so far as those of the setup of the
+ * sandbox, once it executes its command.
+ */
+func (pc *perfCounters) snapshot() {
+	if pc == nil {
+		return
+	}
+	pc.setup = make([]uint64, len(pc.names))
+	for i := range pc.names {
+		pc.setup[i] = pc.read(i)
+	}
+}
+
+/**
+ * Opens the performance counters of a cgroup.
+ * @param cgPath the path of the cgroup
+ * @return the counters, or error if none could be opened
+ */
+func openPerfCounters(cgPath string) (*perfCounters, error) {
+	cg, err := unix.Open(cgPath, unix.O_RDONLY|unix.O_DIRECTORY|unix.O_CLOEXEC, 0)
+	if err != nil {
+		return nil, fmt.Errorf("open cgroup: %w", err)
+	}
+	defer unix.Close(cg)
+
+	cpus, err := onlineCPUs()
+	if err != nil {
+		return nil, err
+	}
+
+	pc := &perfCounters{}
+	var lastErr error
+	for i := range perfEvents {
+		for ev := &perfEvents[i]; ev != nil; ev = ev.fallback {
+			fds, err := openPerfEvent(ev, cg, cpus)
+			if err == nil {
+				pc.names = append(pc.names, ev.name)
+				pc.fds = append(pc.fds, fds)
+				break
+			}
+			lastErr = err
+		}
+	}
+	if len(pc.fds) == 0 {
+		return nil, fmt.Errorf("perf_event_open: %w", lastErr)
+	}
+	return pc, nil
+}
+
+/**
+ * Opens a counter of a cgroup on the given CPUs.
+ * @return the counter descriptors, or error if any
+ */
+func openPerfEvent(ev *perfEvent, cg int, cpus []int) ([]int, error) {
+	attr := unix.PerfEventAttr{
+		Type:        ev.typ,
+		Config:      ev.config,
+		Size:        uint32(unsafe.Sizeof(unix.PerfEventAttr{})),
+		Read_format: unix.PERF_FORMAT_TOTAL_TIME_ENABLED | unix.PERF_FORMAT_TOTAL_TIME_RUNNING,
+		Bits:        unix.PerfBitExcludeHv,
+	}
+	fds := make([]int, 0, len(cpus))
+	for _, cpu := range cpus {
+		fd, err := unix.PerfEventOpen(&attr, cg, cpu, -1, unix.PERF_FLAG_PID_CGROUP|unix.PERF_FLAG_FD_CLOEXEC)
+		if err != nil {
+			closeFds(fds)
+			return nil, err
+		}
+		fds = append(fds, fd)
+	}
+	return fds, nil
+}
+
+/**
+ * Reads and closes the counters.
+ * @return the counter totals, without those of the setup if recorded
+ */
+func (pc *perfCounters) close() *PerfCounts {
+	if pc == nil {
+		return nil
+	}
+	counts := &PerfCounts{Values: make(map[string]uint64, len(pc.names))}
+	for i, name := range pc.names {
+		total := pc.read(i)
+		if pc.setup != nil {
+			total -= min(total, pc.setup[i])
+		}
+		closeFds(pc.fds[i])
+		counts.Values[name] = total
+	}
+	if c := counts.Values["cycles"]; c > 0 {
+		if n, ok := counts.Values["instructions"]; ok {
+			counts.IPC = float64(n) / float64(c)
+		}
+	}
+	return counts
+}
+
+/**
+ * @return the counters as `name=value` pairs, in report order.
+ */
+func (c *PerfCounts) String() string {
+	var b strings.Builder
+	for _, ev := range perfEventNames() {
+		if v, ok := c.Values[ev]; ok {
+			fmt.Fprintf(&b, "%s=%d ", ev, v)
+		}
+	}
+	if c.IPC > 0 {
+		fmt.Fprintf(&b, "ipc=%.2f ", c.IPC)
+	}
+	return strings.TrimSuffix(b.String(), " ")
+}
+
+/**
+ * Detaches the performance counters from the sandbox, so that they
+ * are closed once.
+ * @return the counters, nil if none
+ */
+func (p *SandboxProcess) takePerf() *perfCounters {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+	pc := p.perf
+	p.perf = nil
+	return pc
+}
+
+/**
+ * @return the totals of the performance counters of the sandbox once it
+ * has exited, nil if not counted.
+ */
+func (p *SandboxProcess) PerfCounts() *PerfCounts {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+	return p.perfCounts
+}
+
+/**
+ * Reports the performance counters of the sandbox in its logs and trace.
+ * @param counts the counter totals
+ */
+func (p *SandboxProcess) reportPerf(counts *PerfCounts) {
+	attrs := make([]any, 0, len(counts.Values)+2)
+	attrs = append(attrs, slog.String("id", p.uuid))
+	for _, ev := range perfEventNames() {
+		if v, ok := counts.Values[ev]; ok {
+			attrs = append(attrs, slog.Uint64(ev, v))
+			p.runSpan.Set(tracing.Int("perf."+ev, int64(v)))
+		}
+	}
+	if counts.IPC > 0 {
+		attrs = append(attrs, slog.Float64("ipc", counts.IPC))
+		p.runSpan.Set(tracing.Float("perf.ipc", counts.IPC))
+	}
+	p.log.Info("sandbox performance counters", attrs...)
+}
+
+/**
+ * @return the names of the counters and their fallbacks, in report order.
+ */
+func perfEventNames() []string {
+	var names []string
+	for i := range perfEvents {
+		for ev := &perfEvents[i]; ev != nil; ev = ev.fallback {
+			names = append(names, ev.name)
+		}
+	}
+	return names
+}
+
+/**
+ * Reads a counter, scaled up for the time it was not scheduled
+ * on the PMU because of multiplexing.
+ * @return the counter value
+ */
+func readPerfEvent(fd int) uint64 {
+	var buf [24]byte
+	if n, err := unix.Read(fd, buf[:]); err != nil || n != len(buf) {
+		return 0
+	}
+	value := binary.NativeEndian.Uint64(buf[0:])
+	enabled := binary.NativeEndian.Uint64(buf[8:])
+	running := binary.NativeEndian.Uint64(buf[16:])
+	if running == 0 {
+		return 0
+	}
+	if running < enabled {
+		value = uint64(float64(value) * float64(enabled) / float64(running))
+	}
+	return value
+}
+
+/**
+ * Closes the given file descriptors.
+ */
+func closeFds(fds []int) {
+	for _, fd := range fds {
+		_ = unix.Close(fd)
+	}
+}
+
+/**
+ * @return the online CPUs of the host.
+ */
+func onlineCPUs() ([]int, error) {
+	b, err := os.ReadFile("/sys/devices/system/cpu/online")
+	if err != nil {
+		return nil, err
+	}
+	var cpus []int
+	for _, r := range strings.Split(strings.TrimSpace(string(b)), ",") {
+		lo, hi, found := strings.Cut(r, "-")
+		first, err := strconv.Atoi(lo)
+		if err != nil {
+			return nil, fmt.Errorf("bad CPU list %q", b)
+		}
+		last := first
+		if found {
+			if last, err = strconv.Atoi(hi); err != nil {
+				return nil, fmt.Errorf("bad CPU list %q", b)
+			}
+		}
+		for cpu := first; cpu <= last; cpu++ {
+			cpus = append(cpus, cpu)
+		}
+	}
+	return cpus, nil
+}
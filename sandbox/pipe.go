@@ -28,11 +28,15 @@ func MakeSyncPipe() (int, int, error) {
  */
 func WaitForParent(rfd int) error {
 	var one [1]byte
-	_, err := unix.Read(rfd, one[:])
+	n, err := unix.Read(rfd, one[:])
 	_ = unix.Close(rfd)
 	if err != nil {
 		return err
 	}
+	if n == 0 {
+		// The parent closed the pipe without signaling.
+		return unix.ECANCELED
+	}
 	return nil
 }
 
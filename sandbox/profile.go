@@ -0,0 +1,122 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"encoding/json"
+	"fmt"
+	"os"
+	"path/filepath"
+
+	uuid "github.com/google/uuid"
+	"golang.org/x/sys/unix"
+)
+
+const (
+	profileRoot = "/var/cache/microbox/profiles"
+)
+
+/**
+ * A validated sandbox description, with its resolution work done ahead
+ * of time: parsed limits and modes, resolved capabilities, merged
+ * syscall lists and the compiled seccomp program.
+ */
+type Profile struct {
+	// Name of the profile.
+	Name string `json:"name"`
+
+	// Resolved sandbox options.
+	Options SandboxOptions `json:"options"`
+
+	// Merged deny list and compiled seccomp program, which also depends
+	// on the io_uring policy and the emulated system calls of the options.
+	DenySyscalls []string          `json:"denySyscalls"`
+	Seccomp      []unix.SockFilter `json:"seccomp"`
+
+	// Host paths the options depend on, as described, and resolved.
+	// A cached profile is stale once one of them resolves differently.
+	Paths map[string]string `json:"paths,omitempty"`
+}
+
+/**
+ * Compiles a profile from resolved sandbox options.
+ * @param name the profile name
+ * @param opts the sandbox options
+ * @return the profile, or an error if any
+ */
+func CompileProfile(name string, opts *SandboxOptions) (*Profile, error) {
+	prog, err := CompileSeccomp(opts)
+	if err != nil {
+		return nil, fmt.Errorf("profile %q: %w", name, err)
+	}
+	return &Profile{
+		Name:         name,
+		Options:      *opts,
+		DenySyscalls: denyList(opts),
+		Seccomp:      prog,
+	}, nil
+}
+
+/**
+ * Instantiates the options of a sandbox from the profile. The options
+ * carry the compiled seccomp program, so that creating the sandbox does
+ * not compile it again unless the options are changed.
+ * @return the sandbox options, with a new identifier
+ */
+func (p *Profile) NewOptions() *SandboxOptions {
+	opts := p.Options
+	opts.UUID = uuid.New()
+	if len(p.Seccomp) > 0 {
+		opts.precompiled = &compiledSeccomp{key: seccompKey(p.DenySyscalls, &p.Options), prog: p.Seccomp}
+	}
+	return &opts
+}
+
+/**
+ * Loads cached profiles.
+ * @param key the cache key of the profiles
+ * @return the profiles, or an error if they are not cached
+ */
+func LoadProfiles(key string) ([]*Profile, error) {
+	b, err := os.ReadFile(filepath.Join(profileRoot, key+".json"))
+	if err != nil {
+		return nil, err
+	}
+	var profiles []*Profile
+	if err := json.Unmarshal(b, &profiles); err != nil {
+		return nil, fmt.Errorf("bad cached profile %s: %w", key, err)
+	}
+	return profiles, nil
+}
+
+/**
+ * Caches compiled profiles.
+ * @param key the cache key of the profiles
+ * @param profiles the profiles
+ * @return error if any
+ */
+func SaveProfiles(key string, profiles []*Profile) error {
+	if err := os.MkdirAll(profileRoot, 0o700); err != nil {
+		return fmt.Errorf("mkdir %s: %w", profileRoot, err)
+	}
+	b, err := json.Marshal(profiles)
+	if err != nil {
+		return err
+	}
+
+	// Write atomically, as profiles may be loaded concurrently.
+	tmp, err := os.CreateTemp(profileRoot, key+".*.tmp")
+	if err != nil {
+		return err
+	}
+	if _, err := tmp.Write(b); err != nil {
+		tmp.Close()
+		_ = os.Remove(tmp.Name())
+		return err
+	}
+	if err := tmp.Close(); err != nil {
+		_ = os.Remove(tmp.Name())
+		return err
+	}
+	return os.Rename(tmp.Name(), filepath.Join(profileRoot, key+".json"))
+}
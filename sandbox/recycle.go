@@ -0,0 +1,141 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"context"
+	"errors"
+	"fmt"
+	"log/slog"
+	"os"
+	"path/filepath"
+
+	"github.com/HQarroum/microbox/net"
+	uuid "github.com/google/uuid"
+)
+
+/**
+ * A sandbox recycled between consecutive jobs sharing the same options.
+ * The network namespace, along with its interface and address, is created
+ * by the first job and kept for the following ones. Every job runs in a
+ * fresh mount namespace with a new writable layer, and in a new cgroup,
+ * so that no file, process or accounting leaks from one job to the next.
+ */
+type RecycledSandbox struct {
+	// Runtime creating the sandboxes of the jobs.
+	rt *Runtime
+
+	// Options shared by all jobs.
+	opts SandboxOptions
+
+	// Unique identifier of the recycled sandbox.
+	id string
+
+	// Bind-mounted network namespace, once created.
+	netnsPath string
+
+	// Network stack of the namespace, if bridged.
+	network *net.NetworkResult
+
+	// Number of jobs run so far.
+	jobs int
+}
+
+/**
+ * Creates a recycled sandbox. No resource is allocated until the
+ * first job is run.
+ * @param opts the options shared by all jobs
+ * @return the recycled sandbox
+ */
+func (rt *Runtime) NewRecycledSandbox(opts *SandboxOptions) *RecycledSandbox {
+	id := opts.UUID
+	if id == uuid.Nil {
+		id = uuid.New()
+	}
+	return &RecycledSandbox{rt: rt, opts: *opts, id: id.String()}
+}
+
+/**
+ * Runs a job in the recycled sandbox and waits for it to exit. Any
+ * process the job left behind is killed along with its cgroup.
+ * @param args the command line of the job
+ * @param env additional environment variables of the job
+ * @return the job exit code, or an error if any
+ */
+func (r *RecycledSandbox) Run(args []string, env EnvVars) (int, error) {
+	jopts := r.opts
+	jopts.UUID = uuid.New()
+	jopts.Commands = args
+	jopts.Env = overrideEnv(r.opts.Env, env)
+
+	// The first job creates the network namespace, later ones join it,
+	// unless the jobs join a named network namespace.
+	first := r.netnsPath == "" && r.opts.Net != net.NetHost && r.opts.NetNs == ""
+	if first {
+		jopts.PinNetns = filepath.Join(StateDir(r.id), "netns")
+	} else if r.netnsPath != "" {
+		jopts.JoinNetns = r.netnsPath
+	}
+
+	box, err := r.rt.NewSandbox(context.Background(), &jopts)
+	if err != nil {
+		return 0, err
+	}
+	if first {
+		// The recycled sandbox now owns the network.
+		r.netnsPath = jopts.PinNetns
+		r.network = box.detachNetwork()
+	}
+	r.jobs++
+
+	code, err := box.Wait()
+	if err != nil {
+		return 0, fmt.Errorf("job %d: %w", r.jobs, err)
+	}
+	return code, nil
+}
+
+/**
+ * Releases the network namespace and network stack of the sandbox.
+ * @return error if any
+ */
+func (r *RecycledSandbox) Close() error {
+	var errs []error
+
+	if r.network != nil {
+		if err := r.network.Cleanup(); err != nil {
+			errs = append(errs, err)
+		}
+		r.network = nil
+	}
+	if err := net.DeletePersistentNetns(r.netnsPath); err != nil {
+		errs = append(errs, err)
+	}
+	r.netnsPath = ""
+	if err := os.Remove(StateDir(r.id)); err != nil && !errors.Is(err, os.ErrNotExist) {
+		errs = append(errs, err)
+	}
+
+	r.rt.log(&r.opts).Debug("recycled sandbox closed", slog.String("id", r.id), slog.Int("jobs", r.jobs))
+	return errors.Join(errs...)
+}
+
+/**
+ * Overrides environment variables with the ones of a job.
+ * @param base the base environment variables
+ * @param env the environment variables of the job
+ * @return the resulting environment variables
+ */
+func overrideEnv(base, env EnvVars) EnvVars {
+	keys := make(map[string]struct{}, len(env))
+	for _, e := range env {
+		keys[e.Key] = struct{}{}
+	}
+	out := make(EnvVars, 0, len(base)+len(env))
+	for _, e := range base {
+		if _, ok := keys[e.Key]; !ok {
+			out = append(out, e)
+		}
+	}
+	return append(out, env...)
+}
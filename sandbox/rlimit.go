@@ -0,0 +1,76 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"fmt"
+	"strings"
+
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * A resource limit of the sandboxed process.
+ */
+type Rlimit struct {
+	// Resource, as one of the `RLIMIT_*` constants.
+	Resource int `json:"resource"`
+
+	// Soft and hard limits.
+	Soft uint64 `json:"soft"`
+	Hard uint64 `json:"hard"`
+}
+
+/**
+ * Resources by name.
+ */
+var rlimitNames = map[string]int{
+	"RLIMIT_AS":         unix.RLIMIT_AS,
+	"RLIMIT_CORE":       unix.RLIMIT_CORE,
+	"RLIMIT_CPU":        unix.RLIMIT_CPU,
+	"RLIMIT_DATA":       unix.RLIMIT_DATA,
+	"RLIMIT_FSIZE":      unix.RLIMIT_FSIZE,
+	"RLIMIT_LOCKS":      unix.RLIMIT_LOCKS,
+	"RLIMIT_MEMLOCK":    unix.RLIMIT_MEMLOCK,
+	"RLIMIT_MSGQUEUE":   unix.RLIMIT_MSGQUEUE,
+	"RLIMIT_NICE":       unix.RLIMIT_NICE,
+	"RLIMIT_NOFILE":     unix.RLIMIT_NOFILE,
+	"RLIMIT_NPROC":      unix.RLIMIT_NPROC,
+	"RLIMIT_RSS":        unix.RLIMIT_RSS,
+	"RLIMIT_RTPRIO":     unix.RLIMIT_RTPRIO,
+	"RLIMIT_RTTIME":     unix.RLIMIT_RTTIME,
+	"RLIMIT_SIGPENDING": unix.RLIMIT_SIGPENDING,
+	"RLIMIT_STACK":      unix.RLIMIT_STACK,
+}
+
+/**
+ * Creates a resource limit given the name of its resource.
+ * @param name the resource name, such as `RLIMIT_NOFILE`
+ * @param soft the soft limit
+ * @param hard the hard limit
+ * @return the resource limit, or an error if the resource is unknown
+ */
+func NewRlimit(name string, soft, hard uint64) (Rlimit, error) {
+	res, ok := rlimitNames[strings.ToUpper(name)]
+	if !ok {
+		return Rlimit{}, fmt.Errorf("unknown resource limit %q", name)
+	}
+	if soft > hard {
+		return Rlimit{}, fmt.Errorf("soft %s limit above the hard limit", name)
+	}
+	return Rlimit{Resource: res, Soft: soft, Hard: hard}, nil
+}
+
+/**
+ * Applies resource limits to the current process. Called in the child.
+ * @param limits the resource limits
+ * @return error if any
+ */
+func applyRlimits(limits []Rlimit) error {
+	for _, l := range limits {
+		if err := unix.Setrlimit(l.Resource, &unix.Rlimit{Cur: l.Soft, Max: l.Hard}); err != nil {
+			return fmt.Errorf("setrlimit %d: %w", l.Resource, err)
+		}
+	}
+	return nil
+}
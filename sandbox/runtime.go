@@ -0,0 +1,389 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"context"
+	"errors"
+	"io"
+	"log/slog"
+	stdnet "net"
+	"os"
+	"sync"
+	"time"
+
+	"github.com/HQarroum/microbox/events"
+	"github.com/HQarroum/microbox/fs"
+	"github.com/HQarroum/microbox/metrics"
+	"github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/tracing"
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * Error returned when creating sandboxes on a closed runtime.
+ */
+var ErrRuntimeClosed = errors.New("runtime closed")
+
+/**
+ * Options shared by the sandboxes of a runtime.
+ */
+type RuntimeOptions struct {
+	// Supervisor logger (defaults to slog.Default()).
+	Logger *slog.Logger
+
+	// Output of the logger, closed by Close once the sandboxes are
+	// released, if any.
+	LogOutput io.Closer
+
+	// Tracer recording the lifecycle of sandboxes, if any.
+	Tracer *tracing.Tracer
+
+	// Stream publishing the lifecycle events of sandboxes, if any.
+	Events *events.Stream
+
+	// Registry of the metrics of the runtime (defaults to a new registry).
+	// A registry serves a single runtime.
+	Metrics *metrics.Registry
+
+	// Host operations, defaulting to the host's. Tests and benchmarks
+	// replace them with in-memory fakes.
+	CgroupFS CgroupFS
+	Mounter  fs.Mounter
+	Netlink  net.Netlink
+	Firewall net.Firewall
+}
+
+/**
+ * Manages sandboxes from a Go program. A runtime is safe for concurrent
+ * use, and holds no state shared with other runtimes, except for the
+ * host-wide resources that sandboxes coordinate on (IPAM database,
+ * bridge, cgroup parent).
+ */
+type Runtime struct {
+	opts    RuntimeOptions
+	metrics *metrics.Supervisor
+	cgroups *Cgroups
+	network *net.Host
+	seccomp *seccompCache
+
+	// Sandboxes created by the runtime and not yet waited for, by identifier.
+	live sync.Map
+
+	mu     sync.Mutex
+	boxes  map[*Sandbox]struct{}
+	closed bool
+}
+
+/**
+ * A sandbox created by a runtime.
+ */
+type Sandbox struct {
+	rt   *Runtime
+	proc *SandboxProcess
+
+	// Closed once the sandbox has exited and its resources are released.
+	done chan struct{}
+	code int
+	err  error
+}
+
+/**
+ * Resource usage of a sandbox.
+ */
+type Stats struct {
+	// CPU time consumed by the sandbox.
+	CPU time.Duration
+
+	// Memory used by the sandbox, in bytes.
+	Memory uint64
+
+	// Number of processes killed by the OOM killer.
+	OOMKills uint64
+
+	// Traffic of the sandbox on its bridged interface, in bytes.
+	RxBytes uint64
+	TxBytes uint64
+
+	// Traffic of the sandbox on its bridged interface, in packets.
+	RxPackets uint64
+	TxPackets uint64
+}
+
+/**
+ * Creates a runtime.
+ * @param opts the runtime options
+ * @return the runtime
+ */
+func NewRuntime(opts RuntimeOptions) *Runtime {
+	if opts.Logger == nil {
+		opts.Logger = slog.Default()
+	}
+	if opts.Metrics == nil {
+		opts.Metrics = metrics.NewRegistry()
+	}
+	if opts.CgroupFS == nil {
+		opts.CgroupFS = hostCgroupFS{}
+	}
+	if opts.Mounter == nil {
+		opts.Mounter = fs.HostMounter{}
+	}
+	m := metrics.NewSupervisor(opts.Metrics)
+	rt := &Runtime{
+		opts:    opts,
+		metrics: m,
+		cgroups: &Cgroups{fs: opts.CgroupFS},
+		network: net.NewHost(net.HostOptions{Netlink: opts.Netlink, Firewall: opts.Firewall, Metrics: m}),
+		seccomp: newSeccompCache(m.SeccompCache),
+		boxes:   make(map[*Sandbox]struct{}),
+	}
+	rt.registerCollectors()
+	return rt
+}
+
+/**
+ * @return the registry of the metrics of the runtime.
+ */
+func (rt *Runtime) Metrics() *metrics.Registry {
+	return rt.opts.Metrics
+}
+
+/**
+ * @return the cgroups of the sandboxes of the runtime.
+ */
+func (rt *Runtime) Cgroups() *Cgroups {
+	return rt.cgroups
+}
+
+/**
+ * @return the host network of the runtime.
+ */
+func (rt *Runtime) Network() *net.Host {
+	return rt.network
+}
+
+/**
+ * Creates and starts a sandbox. The sandbox is killed if the context
+ * is done before it has started.
+ * @param ctx the context of the creation
+ * @param spec the sandbox options, which are not modified
+ * @return the sandbox, or an error if any
+ */
+func (rt *Runtime) Create(ctx context.Context, spec *SandboxOptions) (*Sandbox, error) {
+	if err := ctx.Err(); err != nil {
+		return nil, err
+	}
+	rt.mu.Lock()
+	closed := rt.closed
+	rt.mu.Unlock()
+	if closed {
+		return nil, ErrRuntimeClosed
+	}
+
+	opts := *spec
+	proc, err := rt.NewSandbox(ctx, &opts)
+	if err != nil {
+		return nil, err
+	}
+	s := &Sandbox{rt: rt, proc: proc, done: make(chan struct{})}
+	exited := proc.exitNotifier()
+
+	rt.mu.Lock()
+	rt.boxes[s] = struct{}{}
+	rt.mu.Unlock()
+	go s.reap(exited)
+
+	if err := ctx.Err(); err != nil {
+		_ = s.Kill()
+		<-s.done
+		return nil, err
+	}
+	return s, nil
+}
+
+/**
+ * Kills all the sandboxes of the runtime, waits for them to be released,
+ * then closes the output of its logger. No sandbox can be created once
+ * the runtime is closed.
+ * @param ctx the context bounding the wait
+ * @return error if any
+ */
+func (rt *Runtime) Close(ctx context.Context) error {
+	rt.mu.Lock()
+	rt.closed = true
+	boxes := make([]*Sandbox, 0, len(rt.boxes))
+	for s := range rt.boxes {
+		boxes = append(boxes, s)
+	}
+	rt.mu.Unlock()
+
+	for _, s := range boxes {
+		_ = s.Kill()
+	}
+	for _, s := range boxes {
+		select {
+		case <-s.done:
+		case <-ctx.Done():
+			return ctx.Err()
+		}
+	}
+	if rt.opts.LogOutput != nil {
+		return rt.opts.LogOutput.Close()
+	}
+	return nil
+}
+
+/**
+ * Waits for the process of a sandbox to exit, then reaps it and
+ * releases its resources.
+ * @param exited a function returning once the process has exited
+ */
+func (s *Sandbox) reap(exited func()) {
+	exited()
+	s.code, s.err = s.proc.Wait()
+
+	s.rt.mu.Lock()
+	delete(s.rt.boxes, s)
+	s.rt.mu.Unlock()
+	close(s.done)
+}
+
+/**
+ * @return the identifier of the sandbox.
+ */
+func (s *Sandbox) ID() string {
+	return s.proc.uuid
+}
+
+/**
+ * @return the host PID of the sandbox init process.
+ */
+func (s *Sandbox) Pid() int {
+	return s.proc.pid
+}
+
+/**
+ * @return the address of the sandbox on the bridge, empty if it is not bridged.
+ */
+func (s *Sandbox) Addr() string {
+	n := s.proc.networkStack()
+	if n == nil || n.IPAM == nil {
+		return ""
+	}
+	ip, _, err := stdnet.ParseCIDR(n.IPAM.IP())
+	if err != nil {
+		return ""
+	}
+	return ip.String()
+}
+
+/**
+ * Waits for the sandbox to exit and its resources to be released.
+ * The sandbox keeps running if the context is done first.
+ * @param ctx the context bounding the wait
+ * @return the exit status code, or an error if any
+ */
+func (s *Sandbox) Wait(ctx context.Context) (int, error) {
+	select {
+	case <-s.done:
+		return s.code, s.err
+	case <-ctx.Done():
+		return -1, ctx.Err()
+	}
+}
+
+/**
+ * Kills the processes of the sandbox.
+ * @return error if any
+ */
+func (s *Sandbox) Kill() error {
+	return s.proc.Kill()
+}
+
+/**
+ * Freezes the processes of the sandbox.
+ * @return error if any
+ */
+func (s *Sandbox) Pause() error {
+	return s.proc.Pause()
+}
+
+/**
+ * Thaws the processes of the sandbox.
+ * @return error if any
+ */
+func (s *Sandbox) Resume() error {
+	return s.proc.Resume()
+}
+
+/**
+ * Reads the resource usage of the sandbox.
+ * @return the resource usage, or an error if the sandbox has exited
+ */
+func (s *Sandbox) Stats() (Stats, error) {
+	select {
+	case <-s.done:
+		return Stats{}, unix.ESRCH
+	default:
+	}
+
+	var st Stats
+	if cpu, ok := cpuSeconds(s.proc); ok {
+		st.CPU = time.Duration(cpu * float64(time.Second))
+	}
+	if mem, ok := memoryBytes(s.proc); ok {
+		st.Memory = uint64(mem)
+	}
+	st.OOMKills, _ = s.rt.cgroups.readStat(s.proc.cgPath, "memory.events", "oom_kill")
+	if rx, ok := networkBytes(false)(s.proc); ok {
+		st.RxBytes = uint64(rx)
+	}
+	if tx, ok := networkBytes(true)(s.proc); ok {
+		st.TxBytes = uint64(tx)
+	}
+
+	// The host side receives what the sandbox transmits.
+	if n := s.proc.networkStack(); n != nil && n.HostIf != "" {
+		st.TxPackets, st.RxPackets, _ = s.rt.network.LinkPackets(n.HostIf)
+	}
+	return st, nil
+}
+
+/**
+ * Returns a function waiting for the process to exit without reaping it.
+ * The wait is done by the network poller on a duplicate of the process
+ * file descriptor, so that waiting for many sandboxes does not block as
+ * many threads.
+ * @return the wait function
+ */
+func (p *SandboxProcess) exitNotifier() func() {
+	p.mu.Lock()
+	fd, err := -1, error(unix.EBADF)
+	if p.pidfd >= 0 {
+		fd, err = unix.FcntlInt(uintptr(p.pidfd), unix.F_DUPFD_CLOEXEC, 0)
+	}
+	p.mu.Unlock()
+
+	// Without a process file descriptor, the reaper blocks in wait4.
+	if err != nil {
+		return func() {}
+	}
+	if err := unix.SetNonblock(fd, true); err != nil {
+		_ = unix.Close(fd)
+		return func() {}
+	}
+
+	f := os.NewFile(uintptr(fd), "pidfd")
+	return func() {
+		defer f.Close()
+		rc, err := f.SyscallConn()
+		if err != nil {
+			return
+		}
+		_ = rc.Read(func(fd uintptr) bool {
+			var info unix.Siginfo
+			err := unix.Waitid(unix.P_PIDFD, int(fd), &info, unix.WEXITED|unix.WNOHANG|unix.WNOWAIT, nil)
+			return err != nil || info.Signo != 0
+		})
+	}
+}
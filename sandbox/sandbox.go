@@ -3,23 +3,36 @@
 package sandbox
 
 import (
+	"context"
 	"fmt"
 	"log/slog"
+	"path/filepath"
+	"runtime"
+	"sync"
+	"syscall"
+	"time"
 	"unsafe"
 
+	"github.com/HQarroum/microbox/events"
 	"github.com/HQarroum/microbox/fs"
 	"github.com/HQarroum/microbox/logger"
 	"github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/profiling"
+	"github.com/HQarroum/microbox/tracing"
 	uuid "github.com/google/uuid"
 	"golang.org/x/sys/unix"
 )
 
+// Size of the log buffer of the init stage of the child.
+const childLogSize = 16 * 1024
+
 // Sandbox parameters.
 type SandboxOptions struct {
 	UUID          uuid.UUID
 	FS            fs.FsMount
 	ReadOnly      bool
 	Net           net.NetworkMode
+	NetPolicy     net.Policy
 	MountRO       []fs.MountSpec
 	MountRW       []fs.MountSpec
 	Capabilities  *CapabilityOpts
@@ -30,22 +43,73 @@ type SandboxOptions struct {
 	LogFormat     logger.LogFormat
 	AllowSys      []string
 	DenySys       []string
+	IoUring       IoUringMode
+	Emulate       []string
 	Commands      []string
 	Hostname      string
 	CPUs          float64
 	Memory        uint64
 	Storage       uint64
+	Thp           ThpMode
+	TmpfsHuge     string
+	HugePages     []fs.HugePages
+	Checkpoint    bool
+	PerfCounters  bool
+	Rlimits       []Rlimit
+	Cwd           string
+
+	// FIFO the sandbox waits on, once set up, before executing its command.
+	StartFifo string `json:"-"`
+
+	// Parent file descriptors inherited by the sandboxed process as 3, 4, ...
+	InheritFds []int `json:"-"`
+
+	// Leaf cgroup to run the process in, delegating the sandbox cgroup.
+	CgroupLeaf string `json:"-"`
+
+	// Named network namespace (see net.CreateNamedNetns) to join
+	// instead of creating one, resolved into JoinNetns on creation.
+	NetNs string
+
+	// Bind-mounted network namespace to join instead of creating one.
+	JoinNetns string `json:"-"`
+
+	// Path to bind-mount the created network namespace at.
+	PinNetns string `json:"-"`
+
+	// Tracer recording the lifecycle of the sandbox, if any.
+	Tracer *tracing.Tracer `json:"-"`
+
+	// Stream publishing the lifecycle events of the sandbox, if any.
+	Events *events.Stream `json:"-"`
+
+	// Logger of the supervisor side of the sandbox (defaults to the runtime's).
+	Logger *slog.Logger `json:"-"`
+
+	// Seccomp program precompiled by the profile of the options, if any.
+	precompiled *compiledSeccomp
 }
 
 // Describes a running sandbox process.
 type SandboxProcess struct {
 
+	// Runtime the sandbox has been created by.
+	rt *Runtime
+
 	// Unique sandbox identifier.
 	uuid string
 
-	// Process file descriptor.
+	// Process file descriptor, closed once the process is reaped.
 	pidfd int
 
+	// Guards the process file descriptor, whether the process is reaped,
+	// and the network stack once the sandbox is tracked.
+	mu     sync.Mutex
+	reaped bool
+
+	// Supervisor logger.
+	log *slog.Logger
+
 	// Process identifier.
 	pid int
 
@@ -54,6 +118,42 @@ type SandboxProcess struct {
 
 	// Applied cgroup path.
 	cgPath string
+
+	// Host-visible writable layer, if any.
+	layerDir string
+
+	// Filesystems of the huge page reservations, if any.
+	hugeDir string
+
+	// Bind-mounted network namespace, if any.
+	netnsPath string
+
+	// Whether the sandbox state has been persisted.
+	stateful bool
+
+	// Lifecycle span of the sandbox, and span of its execution.
+	span    *tracing.Span
+	runSpan *tracing.Span
+
+	// Lifecycle event stream, and cgroup watch reporting OOM kills and freezes.
+	events *events.Stream
+	watch  *cgroupWatch
+
+	// Performance counters of the sandbox cgroup, if any, and their
+	// totals once the sandbox has exited.
+	perf       *perfCounters
+	perfCounts *PerfCounts
+
+	// Whether the creation of the sandbox has been published.
+	created bool
+
+	// Closed once the trace of the child has been collected, and its
+	// execution published, nil if the child is not traced.
+	traced chan struct{}
+
+	// Receives, once the child has executed its command, is waiting to
+	// be started or has exited, whether it is waiting to be started.
+	setup chan bool
 }
 
 // Linux clone3 ABI struct (uapi/linux/sched.h)
@@ -102,14 +202,43 @@ var defaultFlags = unix.CLONE_NEWPID |
 	unix.CLONE_NEWTIME |
 	unix.CLONE_NEWNS
 
+/**
+ * @return the filesystem options based on the sandbox options.
+ */
+func (opts *SandboxOptions) fsOpts() *fs.FsOpts {
+	return &fs.FsOpts{
+		Nameservers: opts.NameServ,
+		Hostname:    opts.Hostname,
+		FS:          opts.FS,
+		ReadOnly:    opts.ReadOnly,
+		MountRO:     opts.MountRO,
+		MountRW:     opts.MountRW,
+		Storage:     opts.Storage,
+		TmpfsHuge:   opts.TmpfsHuge,
+		HugePages:   opts.HugePages,
+	}
+}
+
+/**
+ * @param opts the sandbox options
+ * @return the supervisor logger of a sandbox.
+ */
+func (rt *Runtime) log(opts *SandboxOptions) *slog.Logger {
+	if opts.Logger != nil {
+		return opts.Logger
+	}
+	return rt.opts.Logger
+}
+
 /**
  * @return clone3 flags based on the sandbox options.
  */
 func createSandboxFlags(opts *SandboxOptions) int {
 	flags := defaultFlags
 
-	// If host network is used, we don't create a new network namespace.
-	if opts.Net != net.NetHost {
+	// If host network is used, or an existing network namespace
+	// is joined, we don't create a new network namespace.
+	if opts.Net != net.NetHost && opts.JoinNetns == "" {
 		flags |= unix.CLONE_NEWNET
 	}
 
@@ -123,15 +252,79 @@ func createSandboxFlags(opts *SandboxOptions) int {
 
 /**
  * Create and start a new sandboxed process with the specified options
- * in new namespaces using the clone3 syscall.
+ * in new namespaces using the clone3 syscall. The creation stops at the
+ * next phase once the context is done.
+ * @param ctx the context of the creation
  * @param opts the sandbox options
  * @return the sandbox process descriptor, or an error if any
  */
-func NewSandbox(opts *SandboxOptions) (*SandboxProcess, error) {
+func (rt *Runtime) NewSandbox(ctx context.Context, opts *SandboxOptions) (*SandboxProcess, error) {
 	process := &SandboxProcess{
-		uuid:  uuid.New().String(),
-		pidfd: -1,
-		pid:   -1,
+		rt:     rt,
+		uuid:   opts.UUID.String(),
+		pidfd:  -1,
+		pid:    -1,
+		events: opts.Events,
+		log:    rt.log(opts),
+	}
+	if opts.UUID == uuid.Nil {
+		process.uuid = uuid.New().String()
+	}
+	if process.events == nil {
+		process.events = rt.opts.Events
+	}
+	tracer := opts.Tracer
+	if tracer == nil {
+		tracer = rt.opts.Tracer
+	}
+
+	process.span = tracer.Start("sandbox",
+		tracing.String("id", process.uuid),
+		tracing.String("hostname", opts.Hostname),
+		tracing.String("fs", opts.FS.Mode.String()),
+		tracing.String("net", opts.Net.String()),
+		tracing.Float("cpus", opts.CPUs),
+		tracing.Int("memory", int64(opts.Memory)),
+		tracing.Int("storage", int64(opts.Storage)),
+	)
+	var (
+		box *SandboxProcess
+		err error
+	)
+	profiling.Do("create", func() {
+		box, err = process.create(ctx, opts)
+	})
+	if err != nil {
+		process.span.Fail(err)
+		process.span.Finish()
+		if process.created {
+			process.publish(events.Event{Type: events.Failed, Error: err.Error()})
+		}
+	}
+	return box, err
+}
+
+/**
+ * Creates the sandboxed process.
+ * @param ctx the context of the creation
+ * @param opts the sandbox options
+ * @return the sandbox process descriptor, or an error if any
+ */
+func (p *SandboxProcess) create(ctx context.Context, opts *SandboxOptions) (_ *SandboxProcess, err error) {
+	process := p
+	rt := p.rt
+	if err := ctx.Err(); err != nil {
+		return nil, err
+	}
+
+	// Sandboxes in a named network namespace join it, the network having
+	// been set up once when the namespace was created.
+	if opts.NetNs != "" && opts.JoinNetns == "" {
+		ns, err := net.LoadNamedNetns(opts.NetNs)
+		if err != nil {
+			return nil, err
+		}
+		opts.JoinNetns = ns.Path
 	}
 	flags := createSandboxFlags(opts)
 
@@ -146,123 +339,506 @@ func NewSandbox(opts *SandboxOptions) (*SandboxProcess, error) {
 		return nil, fmt.Errorf("microbox must be run as root or with sudo")
 	}
 
+	fsOpts := opts.fsOpts()
+	fsOpts.Mounter = rt.opts.Mounter
+	timer := newPhaseTimer(process.span.Child("create"), rt.metrics)
+	defer timer.fail(&err)
+
+	// Checkpointable sandboxes keep their writable layer visible
+	// to the supervisor so that it can be archived.
+	if opts.Checkpoint && opts.FS.Mode != fs.FsHost {
+		process.layerDir = filepath.Join(StateDir(process.uuid), "layer")
+		if err := fs.PrepareLayer(rt.opts.Mounter, process.layerDir, opts.Storage, opts.TmpfsHuge); err != nil {
+			return nil, err
+		}
+		fsOpts.LayerDir = process.layerDir
+		timer.mark("layer")
+	}
+
+	// The huge page filesystems are mounted by the supervisor, as
+	// `hugetlbfs` cannot be mounted from the user namespace of the child.
+	if len(opts.HugePages) > 0 {
+		process.hugeDir = filepath.Join(StateDir(process.uuid), "hugepages")
+		if err := fs.PrepareHugePages(rt.opts.Mounter, process.hugeDir, opts.HugePages); err != nil {
+			process.release()
+			return nil, err
+		}
+		fsOpts.HugePagesDir = process.hugeDir
+		timer.mark("hugepages")
+	}
+
+	// Compile the seccomp filter before cloning, so that the child
+	// only has to load it.
+	filter, err := rt.seccomp.compile(opts)
+	if err != nil {
+		process.release()
+		return nil, err
+	}
+	timer.mark("seccomp")
+
+	// Emulated system calls are served by a goroutine of the supervisor,
+	// to which the child sends the listener of its filter.
+	var notify *notifier
+	notifyfds := [2]int{-1, -1}
+	if len(opts.Emulate) > 0 {
+		if notify, err = newNotifier(opts, process.log, rt.metrics.SeccompNotifications); err == nil {
+			notifyfds, err = unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+		}
+		if err != nil {
+			process.release()
+			return nil, err
+		}
+		defer func() {
+			for _, fd := range notifyfds {
+				if fd >= 0 {
+					_ = unix.Close(fd)
+				}
+			}
+		}()
+	}
+
+	// Sandboxes created ahead of time are started through a FIFO, which
+	// the child holds open for reading and writing so that it blocks
+	// until a byte is written to it.
+	startfd := -1
+	if opts.StartFifo != "" {
+		if startfd, err = unix.Open(opts.StartFifo, unix.O_RDWR|unix.O_CLOEXEC, 0); err != nil {
+			process.release()
+			return nil, fmt.Errorf("open %s: %w", opts.StartFifo, err)
+		}
+		defer unix.Close(startfd)
+	}
+
+	// Last chance to give up before the child is cloned.
+	if err := ctx.Err(); err != nil {
+		process.release()
+		return nil, err
+	}
+
 	// Create a synchronization pipe between parent and child.
 	rfd, wfd, err := MakeSyncPipe()
 	if err != nil {
+		process.release()
 		return nil, err
 	}
 
-	// Call clone3 to create the new process in a new namespace.
-	pid, _, errno := unix.Syscall(
-		unix.SYS_CLONE3,
-		uintptr(unsafe.Pointer(&cloneArgs)),
-		uintptr(unsafe.Sizeof(cloneArgs)),
-		0,
-	)
-	if errno != 0 {
+	// The child logs into a buffer shipped to the parent, so that it
+	// does not write to the output shared with the sandboxed program.
+	var logfds [2]int
+	if err := unix.Pipe2(logfds[:], unix.O_CLOEXEC); err != nil {
 		ClosePipe(rfd, wfd)
-		return nil, fmt.Errorf("cannot create sandbox: %w", errno)
+		process.release()
+		return nil, err
 	}
+	logfd := logfds[0]
 
-	if pid == 0 {
-		// Wait for parent to finish setup before proceeding.
-		if err := WaitForParent(rfd); err != nil {
-			unix.Exit(1)
+	// The child reports the timings of its setup, and when it executes
+	// its command, if traced, observed or counted.
+	var (
+		trace   *childTrace
+		tracefd = -1
+	)
+	if process.span != nil || process.events != nil || opts.PerfCounters {
+		if trace, tracefd, err = newChildTrace(); err != nil {
+			ClosePipe(logfds[0], logfds[1])
+			ClosePipe(rfd, wfd)
+			process.release()
+			return nil, err
 		}
+	}
 
-		// Set the sandbox hostname.
-		if opts.Hostname != "" {
-			if err := unix.Sethostname([]byte(opts.Hostname)); err != nil {
-				logger.Log.Warn("setting sandbox hostname failed", slog.Any("err", err))
-			}
+	// Closes the descriptors shared with the child when it cannot be cloned.
+	abortClone := func(err error) (*SandboxProcess, error) {
+		ClosePipe(logfds[0], logfds[1])
+		if trace != nil {
+			trace.closeParent()
+			_ = unix.Close(tracefd)
 		}
+		ClosePipe(rfd, wfd)
+		process.release()
+		return nil, err
+	}
 
-		// Setup filesystem.
-		if err := fs.SetupFS(&fs.FsOpts{
-			Nameservers: opts.NameServ,
-			Hostname:    opts.Hostname,
-			FS:          opts.FS,
-			ReadOnly:    opts.ReadOnly,
-			MountRO:     opts.MountRO,
-			MountRW:     opts.MountRW,
-			Storage:     opts.Storage,
-		}); err != nil {
-			logger.Log.Error("failed to setup filesystem", slog.Any("err", err))
-			unix.Exit(1)
+	// The child executes the init stage, placing the inherited
+	// descriptors first, followed by those of the init stage.
+	fds := append([]int(nil), opts.InheritFds...)
+	place := func(fd int) int {
+		if fd < 0 {
+			return -1
 		}
-
-		// Drop capabilities.
-		if err := opts.Capabilities.Apply(); err != nil {
-			logger.Log.Error("failed to apply capabilities", slog.Any("err", err))
-			unix.Exit(1)
+		fds = append(fds, fd)
+		return 2 + len(fds)
+	}
+	cfg := &initConfig{
+		Hostname:     opts.Hostname,
+		FS:           fsOpts,
+		Cwd:          opts.Cwd,
+		Thp:          opts.Thp,
+		Rlimits:      opts.Rlimits,
+		Capabilities: opts.Capabilities,
+		Filter:       filter,
+		Commands:     opts.Commands,
+		Env:          opts.Env.ToStringArray(),
+		LogLevel:     logger.MinLevel(process.log),
+		LogFd:        place(logfds[1]),
+		NotifyFd:     place(notifyfds[1]),
+		StartFd:      place(startfd),
+		TraceFd:      -1,
+	}
+	if trace != nil {
+		cfg.TraceFd = place(trace.fd)
+	}
+	cfgfd, err := writeInitConfig(cfg)
+	if err != nil {
+		return abortClone(err)
+	}
+	defer unix.Close(cfgfd)
+	place(cfgfd)
+	child, err := newInitClone(fds, rfd, len(fds)-1)
+	if err != nil {
+		return abortClone(err)
+	}
+	defer child.close()
+
+	// The child inherits the network namespace of the cloning thread.
+	var leaveNetns func() error
+	if opts.JoinNetns != "" {
+		runtime.LockOSThread()
+		if leaveNetns, err = net.EnterNetns(opts.JoinNetns); err != nil {
+			runtime.UnlockOSThread()
+			return abortClone(err)
 		}
+	}
 
-		// Setup seccomp filters.
-		if err := SetupSeccomp(opts); err != nil {
-			logger.Log.Error("failed to setup seccomp rules", slog.Any("err", err))
-			unix.Exit(1)
+	// Call clone3 to create the new process in a new namespace. As for
+	// os/exec, descriptors must not be created without close-on-exec by
+	// other goroutines while cloning. The child only runs raw system
+	// calls until it executes the init stage.
+	syscall.ForkLock.Lock()
+	pid, errno := child.clone(&cloneArgs)
+	syscall.ForkLock.Unlock()
+
+	// Switch the parent back to its network namespace. The thread stays
+	// locked, and is discarded by the runtime, if this fails.
+	if leaveNetns != nil {
+		if err := leaveNetns(); err != nil {
+			process.log.Error("failed to leave joined network namespace", slog.Any("err", err))
+		} else {
+			runtime.UnlockOSThread()
 		}
+	}
 
-		// Execute the specified command in the process.
-		err = unix.Exec(opts.Commands[0], opts.Commands, opts.Env.ToStringArray())
+	if errno != 0 {
+		return abortClone(fmt.Errorf("cannot create sandbox: %w", errno))
+	}
 
-		// If execve returns, something failed.
-		logger.Log.Error("failed to execute process", slog.Any("err", err))
-		unix.Exit(127)
+	// Forward the child logs until it executes its command.
+	_ = unix.Close(logfds[1])
+	_ = unix.Close(rfd)
+	process.setup = make(chan bool, 1)
+	go func() {
+		process.setup <- logger.ForwardChild(logfd, process.log)
+	}()
+	if trace != nil {
+		trace.closeParent()
+		process.traced = make(chan struct{})
+		go func() {
+			defer close(process.traced)
+			if execd := collectChildTrace(tracefd, process.span.Child("start")); !execd.IsZero() {
+				// Only count the events of the command.
+				process.mu.Lock()
+				process.perf.snapshot()
+				process.mu.Unlock()
+				process.publish(events.Event{Type: events.Execd})
+			}
+		}()
+	}
+	if notify != nil {
+		go notify.serve(notifyfds[0])
+		notifyfds[0] = -1
+	}
+	timer.mark("clone")
+	process.publish(events.Event{Type: events.Created, Pid: int(pid)})
+	process.created = true
+
+	// From now on, failures kill and reap the child before releasing
+	// what has been set up for it.
+	fail := func(err error) (*SandboxProcess, error) {
+		_ = unix.Close(wfd)
+		return process.abortCreate(int(pid), err)
 	}
 
 	// Set up user and group mappings for the child.
 	if opts.NamespaceMode != UserNamespaceHost {
 		if err := SetupIdMappings(int(pid)); err != nil {
-			ClosePipe(rfd, wfd)
-			return nil, err
+			return fail(err)
 		}
+		timer.mark("idmap")
 	}
 
 	// Setup CGroup limits.
-	cgPath, err := SetupCgroupLimits(int(pid), opts.CPUs, opts.Memory)
+	cgPath, err := rt.cgroups.SetupLimits(int(pid), opts.CPUs, opts.Memory)
 	if err != nil {
-		ClosePipe(rfd, wfd)
-		return nil, err
+		return fail(err)
+	}
+	process.cgPath = cgPath
+
+	// Limit the huge pages of the sandbox to its reservations.
+	if err := rt.cgroups.SetHugetlbLimits(cgPath, opts.HugePages); err != nil {
+		return fail(err)
 	}
 
+	// Run the process in a leaf cgroup if nested cgroups are needed.
+	if opts.CgroupLeaf != "" {
+		if _, err := rt.cgroups.Delegate(cgPath, opts.CgroupLeaf, int(pid)); err != nil {
+			return fail(err)
+		}
+	}
+	timer.mark("cgroup")
+
 	// Setup networking if using bridged networks.
-	if opts.Net != net.NetHost && opts.Net != net.NetNone {
-		result, err := net.SetupContainerNetworking(net.NetworkConfig{
+	if opts.Net != net.NetHost && opts.Net != net.NetNone && opts.JoinNetns == "" {
+		if err := ctx.Err(); err != nil {
+			return fail(err)
+		}
+		span := timer.begin("network")
+		result, err := rt.network.SetupContainerNetworking(ctx, net.NetworkConfig{
 			ChildPID: int(pid),
 			Mode:     opts.Net,
+			Policy:   &opts.NetPolicy,
+			Span:     span,
 		})
 		if err != nil {
-			ClosePipe(rfd, wfd)
-			return nil, err
+			span.Fail(err)
+			span.Finish()
+			return fail(err)
 		}
 		process.network = result
+		timer.end("network", span)
+		process.publish(events.Event{Type: events.NetworkReady, Pid: int(pid), IP: result.IPAM.IP()})
+	}
+
+	// Pin the network namespace so that it outlives the process.
+	if opts.PinNetns != "" && opts.JoinNetns == "" {
+		if err := net.PinNetns(int(pid), opts.PinNetns); err != nil {
+			return fail(err)
+		}
 	}
 
 	// Saving child process information.
-	process.pidfd = int(process.pidfd)
 	process.pid = int(pid)
-	process.cgPath = cgPath
+
+	// Persist the state of checkpointable sandboxes.
+	if opts.Checkpoint {
+		if err := process.saveState(opts); err != nil {
+			process.log.Warn("failed to save sandbox state", slog.Any("err", err))
+		}
+	}
+
+	// Count the events of the sandbox cgroup from the supervisor. The
+	// events of the setup of the child are subtracted once it executes
+	// its command.
+	if opts.PerfCounters {
+		if perf, err := openPerfCounters(cgPath); err != nil {
+			process.log.Warn("failed to open performance counters", slog.Any("err", err))
+		} else {
+			process.mu.Lock()
+			process.perf = perf
+			process.mu.Unlock()
+		}
+	}
 
 	// Signal the child to continue.
 	if err := SignalChild(wfd); err != nil {
-		return nil, err
+		return process.abortCreate(int(pid), err)
 	}
+	timer.done()
+	process.track()
+	if process.events != nil {
+		process.watch = process.watchCgroup()
+	}
+	process.span.Set(tracing.Int("pid", int64(pid)))
+	process.runSpan = process.span.Child("run")
 
 	return process, nil
 }
 
+/**
+ * Persists the state of the sandbox.
+ * @param opts the options the sandbox has been created with
+ * @return error if any
+ */
+func (p *SandboxProcess) saveState(opts *SandboxOptions) error {
+	if err := SaveState(&SandboxState{
+		ID:         p.uuid,
+		Pid:        p.pid,
+		CgroupPath: p.cgPath,
+		LayerDir:   p.layerDir,
+		NetnsPath:  p.netnsPath,
+		Created:    time.Now(),
+		Options:    opts,
+	}); err != nil {
+		return err
+	}
+	p.stateful = true
+	return nil
+}
+
+/**
+ * Kills and reaps a child whose creation failed after it was cloned,
+ * then releases its performance counters, network, cgroup and the
+ * resources released by release.
+ * @param pid the PID of the child
+ * @param err the error of the creation
+ * @return the error of the creation
+ */
+func (p *SandboxProcess) abortCreate(pid int, err error) (*SandboxProcess, error) {
+	if p.pidfd >= 0 {
+		_ = unix.PidfdSendSignal(p.pidfd, unix.SIGKILL, nil, 0)
+	} else {
+		_ = unix.Kill(pid, unix.SIGKILL)
+	}
+	var ws unix.WaitStatus
+	for {
+		if _, werr := unix.Wait4(pid, &ws, 0, nil); werr != unix.EINTR {
+			break
+		}
+	}
+	if p.pidfd >= 0 {
+		_ = unix.Close(p.pidfd)
+		p.pidfd = -1
+	}
+	if p.traced != nil {
+		<-p.traced
+	}
+	p.takePerf().close()
+	if p.network != nil {
+		if cerr := p.network.Cleanup(); cerr != nil {
+			p.log.Warn("failed to cleanup networking", slog.Any("err", cerr))
+		}
+		p.network = nil
+	}
+	if err := p.rt.cgroups.Cleanup(p.cgPath); err != nil {
+		p.rt.metrics.CleanupFailures.Inc("cgroup")
+	}
+	p.release()
+	return nil, err
+}
+
+/**
+ * Releases the host-side resources of the sandbox that outlive
+ * its processes: writable layer, network namespace and state.
+ */
+func (p *SandboxProcess) release() {
+	if err := fs.ReleaseLayer(p.rt.opts.Mounter, p.layerDir); err != nil {
+		p.rt.metrics.CleanupFailures.Inc("layer")
+		p.log.Warn("failed to release writable layer", slog.Any("err", err))
+	}
+	if err := net.DeletePersistentNetns(p.netnsPath); err != nil {
+		p.rt.metrics.CleanupFailures.Inc("netns")
+		p.log.Warn("failed to delete network namespace", slog.Any("err", err))
+	}
+	if err := fs.ReleaseHugePages(p.rt.opts.Mounter, p.hugeDir); err != nil {
+		p.rt.metrics.CleanupFailures.Inc("hugepages")
+		p.log.Warn("failed to release huge pages", slog.Any("err", err))
+	}
+	if p.stateful || p.layerDir != "" || p.hugeDir != "" {
+		_ = RemoveState(p.uuid)
+	}
+}
+
+/**
+ * @return the network stack of the sandbox, nil if it has none or it
+ * has been detached.
+ */
+func (p *SandboxProcess) networkStack() *net.NetworkResult {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+	return p.network
+}
+
+/**
+ * Detaches the network stack from the sandbox, so that it is not
+ * released when the sandbox exits.
+ * @return the network stack, nil if it has none
+ */
+func (p *SandboxProcess) detachNetwork() *net.NetworkResult {
+	p.mu.Lock()
+	defer p.mu.Unlock()
+	network := p.network
+	p.network = nil
+	return network
+}
+
+/**
+ * Waits for a sandbox created with a start FIFO to be set up, and to
+ * wait on the FIFO before executing its command.
+ * @return whether the sandbox waits to be started, false if it exited during setup
+ */
+func (p *SandboxProcess) WaitSetup() bool {
+	return <-p.setup
+}
+
+/**
+ * @return the host PID of the sandbox init process.
+ */
+func (p *SandboxProcess) Pid() int {
+	return p.pid
+}
+
+/**
+ * Kills the sandboxed process.
+ * @return error if any
+ */
+func (p *SandboxProcess) Kill() error {
+	if p == nil || p.pid <= 0 {
+		return fmt.Errorf("invalid process")
+	}
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	// The PID of a reaped process may have been reused.
+	if p.reaped {
+		return unix.ESRCH
+	}
+	if p.pidfd >= 0 {
+		return unix.PidfdSendSignal(p.pidfd, unix.SIGKILL, nil, 0)
+	}
+	return unix.Kill(p.pid, unix.SIGKILL)
+}
+
 /**
  * Waits for the sandboxed process to exit, and returns its exit status.
  * Also performs cleanup of cgroups, network interfaces, and IPAM allocations.
  * @return the exit status code, or an error if any
  */
-func (p *SandboxProcess) Wait() (int, error) {
+func (p *SandboxProcess) Wait() (code int, err error) {
 	if p == nil || p.pid <= 0 {
 		return 0, fmt.Errorf("invalid process")
 	}
+	profiling.Do("wait", func() {
+		code, err = p.wait()
+	})
+	return code, err
+}
+
+/**
+ * Reaps the sandboxed process and releases its resources.
+ * @return the exit status code, or an error if any
+ */
+func (p *SandboxProcess) wait() (int, error) {
+	var teardown *tracing.Span
 	defer func() {
-		_ = CleanupCgroup(p.cgPath)
+		span := teardown.Child("cgroup")
+		if err := p.rt.cgroups.Cleanup(p.cgPath); err != nil {
+			p.rt.metrics.CleanupFailures.Inc("cgroup")
+			span.Fail(err)
+		}
+		span.Finish()
+		teardown.Finish()
+		p.span.Finish()
+		p.untrack()
+		p.publish(events.Event{Type: events.CleanedUp})
 	}()
 
 	var ws unix.WaitStatus
@@ -279,18 +855,55 @@ func (p *SandboxProcess) Wait() (int, error) {
 		}
 	}
 
-	// Release IPAM allocation.
-	if p.network != nil {
-		if err := p.network.Cleanup(); err != nil {
-			logger.Log.Warn("failed to cleanup networking", slog.Any("err", err))
-		}
+	p.mu.Lock()
+	p.reaped = true
+	if p.pidfd >= 0 {
+		_ = unix.Close(p.pidfd)
+		p.pidfd = -1
+	}
+	p.mu.Unlock()
+
+	// The trace pipe is closed once the child has exited, so that the
+	// execution of the command, if any, is published before its exit.
+	if p.traced != nil {
+		<-p.traced
 	}
 
+	code := 0
 	if ws.Exited() {
-		return ws.ExitStatus(), nil
+		code = ws.ExitStatus()
+	} else if ws.Signaled() {
+		code = 128 + int(ws.Signal())
 	}
-	if ws.Signaled() {
-		return 128 + int(ws.Signal()), nil
+	exited := events.Event{Type: events.Exited, Code: &code}
+	if counts := p.takePerf().close(); counts != nil {
+		p.mu.Lock()
+		p.perfCounts = counts
+		p.mu.Unlock()
+		p.reportPerf(counts)
+		exited.Counters = counts.Values
+		exited.IPC = counts.IPC
 	}
-	return 0, nil
+	p.runSpan.Set(tracing.Int("code", int64(code)))
+	p.runSpan.Finish()
+	p.watch.stop()
+	p.publish(exited)
+	teardown = p.span.Child("teardown")
+
+	// Release IPAM allocation.
+	if network := p.detachNetwork(); network != nil {
+		span := teardown.Child("network")
+		if err := network.Cleanup(); err != nil {
+			p.log.Warn("failed to cleanup networking", slog.Any("err", err))
+			span.Fail(err)
+		}
+		span.Finish()
+	}
+
+	// Release the writable layer, network namespace and state.
+	span := teardown.Child("release")
+	p.release()
+	span.Finish()
+
+	return code, nil
 }
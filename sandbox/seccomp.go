@@ -3,14 +3,25 @@
 package sandbox
 
 import (
+	"encoding/binary"
 	"fmt"
 	"maps"
+	"os"
 	"slices"
+	"strings"
+	"sync"
+	"unsafe"
 
+	"github.com/HQarroum/microbox/metrics"
 	seccomp "github.com/seccomp/libseccomp-golang"
 	"golang.org/x/sys/unix"
 )
 
+/**
+ * `SECCOMP_SET_MODE_FILTER` operation of seccomp(2).
+ */
+const seccompSetModeFilter = 1
+
 /**
  * Default list of denied syscalls for the seccomp filter.
  */
@@ -69,6 +80,13 @@ var defaultDenySyscalls = []string{
 	"io_uring_setup", "io_uring_enter", "io_uring_register",
 }
 
+/**
+ * @return the system calls denied by default.
+ */
+func DefaultDenySyscalls() []string {
+	return slices.Clone(defaultDenySyscalls)
+}
+
 /**
  * A helper function to merge user-specified allow/deny syscall lists
  * with the default deny list.
@@ -97,6 +115,89 @@ func mergeSyscallLists(userAllow, userDeny []string) []string {
 	return out
 }
 
+/**
+ * Merges the deny list of a sandbox, according to its io_uring policy.
+ * Emulated system calls are notified to the supervisor instead.
+ * @param opts the sandbox options
+ * @return the final deny list
+ */
+func denyList(opts *SandboxOptions) []string {
+	deny := applyIoUringMode(opts.IoUring, mergeSyscallLists(opts.AllowSys, opts.DenySys), opts.DenySys)
+	return slices.DeleteFunc(deny, func(s string) bool {
+		return slices.Contains(opts.Emulate, s)
+	})
+}
+
+/**
+ * @param deny the merged deny list
+ * @param opts the sandbox options
+ * @return the key of a compiled seccomp program in the cache.
+ */
+func seccompKey(deny []string, opts *SandboxOptions) string {
+	emulate := slices.Clone(opts.Emulate)
+	slices.Sort(emulate)
+	return strings.Join(deny, ",") + ";io_uring=" + opts.IoUring.String() + ";emulate=" + strings.Join(emulate, ",")
+}
+
+/**
+ * A seccomp program compiled ahead of time, by a profile.
+ */
+type compiledSeccomp struct {
+	key  string
+	prog []unix.SockFilter
+}
+
+/**
+ * Cache of the compiled seccomp programs of a runtime, by merged deny
+ * list, io_uring policy and emulated system calls, so that sandboxes
+ * sharing a profile only pay for the compilation once, and so that the
+ * child only has to load the program.
+ */
+type seccompCache struct {
+	mu      sync.Mutex
+	progs   map[string][]unix.SockFilter
+	lookups *metrics.Counter
+}
+
+/**
+ * @param lookups the counter of the cache lookups, by result
+ * @return an empty cache.
+ */
+func newSeccompCache(lookups *metrics.Counter) *seccompCache {
+	return &seccompCache{progs: make(map[string][]unix.SockFilter), lookups: lookups}
+}
+
+/**
+ * Compiles the seccomp filter of a sandbox, or returns the cached
+ * program. The program precompiled by a profile is used if it still
+ * matches the options.
+ * @param opts the sandbox options
+ * @return the BPF program, or an error if any
+ */
+func (c *seccompCache) compile(opts *SandboxOptions) ([]unix.SockFilter, error) {
+	key := seccompKey(denyList(opts), opts)
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	if prog, ok := c.progs[key]; ok {
+		c.lookups.Inc("hit")
+		return prog, nil
+	}
+	if pre := opts.precompiled; pre != nil && pre.key == key {
+		c.lookups.Inc("hit")
+		c.progs[key] = pre.prog
+		return pre.prog, nil
+	}
+	c.lookups.Inc("miss")
+
+	prog, err := CompileSeccomp(opts)
+	if err != nil {
+		return nil, err
+	}
+	c.progs[key] = prog
+	return prog, nil
+}
+
 /**
  * SetupSeccomp installs a seccomp filter with default action ALLOW,
  * and adds ERRNO(EPERM) rules for all syscalls in the final deny-list.
@@ -104,37 +205,173 @@ func mergeSyscallLists(userAllow, userDeny []string) []string {
  * and right before Exec.
  */
 func SetupSeccomp(opts *SandboxOptions) error {
-	if err := unix.Prctl(unix.PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0); err != nil && err != unix.EINVAL {
-		return fmt.Errorf("prctl(NO_NEW_PRIVS): %w", err)
+	prog, err := CompileSeccomp(opts)
+	if err != nil {
+		return err
 	}
+	return LoadSeccomp(prog)
+}
+
+/**
+ * CompileSeccomp compiles the seccomp filter of a sandbox into a BPF
+ * program, without caching it.
+ * @param opts the sandbox options
+ * @return the BPF program, or an error if any
+ */
+func CompileSeccomp(opts *SandboxOptions) ([]unix.SockFilter, error) {
+	denySet := denyList(opts)
 
 	// By default, we allow syscalls not explicitly denied.
-	filter, err := seccomp.NewFilter(seccomp.ActAllow)
+	var extra []func(*seccomp.ScmpFilter) error
+	if opts.IoUring == IoUringFilterRegister {
+		extra = append(extra, func(f *seccomp.ScmpFilter) error {
+			return addIoUringRules(f, seccompDeny)
+		})
+	}
+	if len(opts.Emulate) > 0 {
+		extra = append(extra, func(f *seccomp.ScmpFilter) error {
+			return addNotifyRules(f, opts.Emulate)
+		})
+	}
+	return compileRules(seccomp.ActAllow, seccompDeny, denySet, extra...)
+}
+
+/**
+ * Deny action, returning ENOSYS to signal to applications that they
+ * might want to fallback to a different syscall.
+ */
+var seccompDeny = seccomp.ActErrno.SetReturnCode(int16(unix.ENOSYS))
+
+/**
+ * CompileAllowList compiles an allow-list seccomp filter, denying the
+ * system calls not in the list. Allow-lists are not cached.
+ * @param allow the allowed system calls
+ * @return the BPF program, or an error if any
+ */
+func CompileAllowList(allow []string) ([]unix.SockFilter, error) {
+	return compileRules(seccompDeny, seccomp.ActAllow, allow)
+}
+
+/**
+ * Compiles a seccomp filter applying an action to system calls, and a
+ * default action to the others. Unknown system calls are ignored.
+ * @param def the default action
+ * @param act the action of the listed system calls
+ * @param names the listed system calls
+ * @param extra functions adding other rules
+ * @return the BPF program, or an error if any
+ */
+func compileRules(def, act seccomp.ScmpAction, names []string, extra ...func(*seccomp.ScmpFilter) error) ([]unix.SockFilter, error) {
+	filter, err := seccomp.NewFilter(def)
 	if err != nil {
-		return err
+		return nil, err
 	}
 	defer filter.Release()
 
-	// Merge lists
-	denySet := mergeSyscallLists(opts.AllowSys, opts.DenySys)
-
-	// Deny by returning ENOSYS to signal to applications that they might
-	// want to fallback to a different syscall.
-	denyAct := seccomp.ActErrno.SetReturnCode(int16(unix.ENOSYS))
-	for _, name := range denySet {
+	for _, name := range names {
 		sc, err := seccomp.GetSyscallFromName(name)
 		if err != nil {
 			continue
 		}
-		if err := filter.AddRule(sc, denyAct); err != nil {
+		if err := filter.AddRule(sc, act); err != nil {
 			continue
 		}
 	}
+	for _, add := range extra {
+		if err := add(filter); err != nil {
+			return nil, err
+		}
+	}
+
+	prog, err := exportBPF(filter)
+	if err != nil {
+		return nil, fmt.Errorf("seccomp: export: %w", err)
+	}
+	return prog, nil
+}
 
-	// Load the filter.
-	if err := filter.Load(); err != nil {
-		return fmt.Errorf("seccomp: load: %w", err)
+/**
+ * @return the names of the system calls of the native architecture
+ * known to libseccomp.
+ */
+func KnownSyscalls() []string {
+	var out []string
+	for nr := 0; nr < 1024; nr++ {
+		if name, err := seccomp.ScmpSyscall(nr).GetName(); err == nil && name != "" {
+			out = append(out, name)
+		}
 	}
+	return out
+}
 
-	return nil
+/**
+ * Exports a seccomp filter as a BPF program.
+ * @param filter the filter to export
+ * @return the BPF program, or an error if any
+ */
+func exportBPF(filter *seccomp.ScmpFilter) ([]unix.SockFilter, error) {
+	fd, err := unix.MemfdCreate("microbox-seccomp", unix.MFD_CLOEXEC)
+	if err != nil {
+		return nil, err
+	}
+	f := os.NewFile(uintptr(fd), "microbox-seccomp")
+	defer f.Close()
+
+	if err := filter.ExportBPF(f); err != nil {
+		return nil, err
+	}
+	raw, err := os.ReadFile(fmt.Sprintf("/proc/self/fd/%d", fd))
+	if err != nil {
+		return nil, err
+	}
+
+	// struct sock_filter { __u16 code; __u8 jt; __u8 jf; __u32 k; }
+	const insnSize = 8
+	if len(raw) == 0 || len(raw)%insnSize != 0 {
+		return nil, fmt.Errorf("bad BPF program size %d", len(raw))
+	}
+	prog := make([]unix.SockFilter, len(raw)/insnSize)
+	for i := range prog {
+		insn := raw[i*insnSize:]
+		prog[i] = unix.SockFilter{
+			Code: binary.NativeEndian.Uint16(insn[0:2]),
+			Jt:   insn[2],
+			Jf:   insn[3],
+			K:    binary.NativeEndian.Uint32(insn[4:8]),
+		}
+	}
+	return prog, nil
+}
+
+/**
+ * Loads a compiled seccomp program in the calling process.
+ * @param prog the BPF program
+ * @return error if any
+ */
+func LoadSeccomp(prog []unix.SockFilter) error {
+	_, err := loadSeccomp(prog, 0)
+	return err
+}
+
+/**
+ * Loads a compiled seccomp program in the calling process.
+ * @param prog the BPF program
+ * @param flags the flags of seccomp(2)
+ * @return the result of seccomp(2), the listener descriptor of the
+ * filter with `SECCOMP_FILTER_FLAG_NEW_LISTENER`, or error if any
+ */
+func loadSeccomp(prog []unix.SockFilter, flags uintptr) (int, error) {
+	if err := unix.Prctl(unix.PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0); err != nil && err != unix.EINVAL {
+		return -1, fmt.Errorf("prctl(NO_NEW_PRIVS): %w", err)
+	}
+
+	fprog := unix.SockFprog{
+		Len:    uint16(len(prog)),
+		Filter: &prog[0],
+	}
+	ret, _, errno := unix.Syscall(unix.SYS_SECCOMP, seccompSetModeFilter, flags, uintptr(unsafe.Pointer(&fprog)))
+	if errno != 0 {
+		return -1, fmt.Errorf("seccomp: load: %w", errno)
+	}
+	return int(ret), nil
 }
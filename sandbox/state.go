@@ -0,0 +1,139 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"time"
+)
+
+const (
+	stateRoot = "/run/microbox/sandboxes"
+)
+
+/**
+ * The persisted state of a running sandbox, allowing other
+ * microbox invocations to operate on it.
+ */
+type SandboxState struct {
+	// Unique sandbox identifier.
+	ID string `json:"id"`
+
+	// Process identifier of the sandbox init process.
+	Pid int `json:"pid"`
+
+	// Applied cgroup path.
+	CgroupPath string `json:"cgroupPath"`
+
+	// Host-visible writable layer, if any.
+	LayerDir string `json:"layerDir,omitempty"`
+
+	// Bind-mounted network namespace, if any.
+	NetnsPath string `json:"netnsPath,omitempty"`
+
+	// Creation time.
+	Created time.Time `json:"created"`
+
+	// Options the sandbox has been created with.
+	Options *SandboxOptions `json:"options"`
+}
+
+/**
+ * @return the state directory of the sandbox with the given identifier.
+ */
+func StateDir(id string) string {
+	return filepath.Join(stateRoot, id)
+}
+
+/**
+ * Persists the state of a sandbox.
+ * @param st the sandbox state
+ * @return error if any
+ */
+func SaveState(st *SandboxState) error {
+	dir := StateDir(st.ID)
+	if err := os.MkdirAll(dir, 0o700); err != nil {
+		return fmt.Errorf("mkdir %s: %w", dir, err)
+	}
+
+	b, err := json.Marshal(st)
+	if err != nil {
+		return err
+	}
+
+	// Write atomically so that readers never see a partial state.
+	tmp := filepath.Join(dir, "state.json.tmp")
+	if err := os.WriteFile(tmp, b, 0o600); err != nil {
+		return err
+	}
+	return os.Rename(tmp, filepath.Join(dir, "state.json"))
+}
+
+/**
+ * Loads the state of a sandbox given its identifier or hostname.
+ * @param ref the sandbox identifier or hostname
+ * @return the sandbox state, or an error if no such sandbox exists
+ */
+func LoadState(ref string) (*SandboxState, error) {
+	if st, err := readState(ref); err == nil {
+		return st, nil
+	}
+
+	// Fall back to a lookup by hostname.
+	entries, err := os.ReadDir(stateRoot)
+	if err != nil && !errors.Is(err, os.ErrNotExist) {
+		return nil, err
+	}
+	for _, e := range entries {
+		st, err := readState(e.Name())
+		if err != nil {
+			continue
+		}
+		if st.Options != nil && st.Options.Hostname == ref {
+			return st, nil
+		}
+	}
+	return nil, fmt.Errorf("no such sandbox: %q", ref)
+}
+
+/**
+ * Removes the persisted state of a sandbox. The state directory is not
+ * removed recursively, as it may still hold the mountpoint of a layer.
+ * @param id the sandbox identifier
+ * @return error if any
+ */
+func RemoveState(id string) error {
+	if id == "" {
+		return nil
+	}
+	dir := StateDir(id)
+	if err := os.Remove(filepath.Join(dir, "state.json")); err != nil && !errors.Is(err, os.ErrNotExist) {
+		return err
+	}
+	if err := os.Remove(dir); err != nil && !errors.Is(err, os.ErrNotExist) {
+		return err
+	}
+	return nil
+}
+
+/**
+ * Reads the state file of the sandbox with the given identifier.
+ */
+func readState(id string) (*SandboxState, error) {
+	if id == "" || filepath.Base(id) != id {
+		return nil, os.ErrNotExist
+	}
+	b, err := os.ReadFile(filepath.Join(StateDir(id), "state.json"))
+	if err != nil {
+		return nil, err
+	}
+	st := &SandboxState{}
+	if err := json.Unmarshal(b, st); err != nil {
+		return nil, fmt.Errorf("parse state of %s: %w", id, err)
+	}
+	return st, nil
+}
@@ -0,0 +1,262 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"path/filepath"
+	"strconv"
+	"strings"
+	"time"
+
+	"github.com/HQarroum/microbox/metrics"
+	"github.com/HQarroum/microbox/net"
+	"github.com/HQarroum/microbox/tracing"
+)
+
+/**
+ * Registers the metrics computed from the live sandboxes of the runtime
+ * and the host on scrape.
+ */
+func (rt *Runtime) registerCollectors() {
+	r := rt.opts.Metrics
+	r.NewFunc(
+		"microbox_sandboxes_active",
+		"Number of running sandboxes.",
+		"gauge", rt.collectActive,
+	)
+	r.NewFunc(
+		"microbox_ipam_addresses_allocated",
+		"Number of allocated addresses, by subnet.",
+		"gauge", collectIpam, "subnet",
+	)
+	r.NewFunc(
+		"microbox_ipam_addresses_size",
+		"Number of host addresses, by subnet.",
+		"gauge", collectSubnetSize, "subnet",
+	)
+	r.NewFunc(
+		"microbox_sandbox_cpu_seconds_total",
+		"CPU time consumed by a sandbox.",
+		"counter", rt.collectSandboxes(cpuSeconds), "id",
+	)
+	r.NewFunc(
+		"microbox_sandbox_memory_bytes",
+		"Memory used by a sandbox.",
+		"gauge", rt.collectSandboxes(memoryBytes), "id",
+	)
+	r.NewFunc(
+		"microbox_sandbox_network_receive_bytes_total",
+		"Bytes received by a sandbox on its bridged interface.",
+		"counter", rt.collectSandboxes(networkBytes(false)), "id",
+	)
+	r.NewFunc(
+		"microbox_sandbox_network_transmit_bytes_total",
+		"Bytes transmitted by a sandbox on its bridged interface.",
+		"counter", rt.collectSandboxes(networkBytes(true)), "id",
+	)
+}
+
+/**
+ * Measures the phases of the creation of a sandbox, as metrics and
+ * as spans nested under the creation span.
+ */
+type phaseTimer struct {
+	start   time.Time
+	last    time.Time
+	span    *tracing.Span
+	metrics *metrics.Supervisor
+}
+
+/**
+ * @return a timer starting now.
+ */
+func newPhaseTimer(span *tracing.Span, m *metrics.Supervisor) *phaseTimer {
+	now := time.Now()
+	return &phaseTimer{start: now, last: now, span: span, metrics: m}
+}
+
+/**
+ * Records the end of a phase, which started at the end of the previous one.
+ * @param phase the phase name
+ */
+func (t *phaseTimer) mark(phase string) {
+	now := time.Now()
+	t.metrics.SpawnPhase.Observe(now.Sub(t.last).Seconds(), phase)
+	t.span.Record(phase, t.last, now)
+	t.last = now
+}
+
+/**
+ * Starts the span of a phase with sub-steps, which started at the end
+ * of the previous one.
+ * @param phase the phase name
+ * @return the span of the phase
+ */
+func (t *phaseTimer) begin(phase string) *tracing.Span {
+	s := t.span.Child(phase)
+	if s != nil {
+		s.Start = t.last
+	}
+	return s
+}
+
+/**
+ * Records the end of a phase started with begin.
+ * @param phase the phase name
+ * @param span the span of the phase
+ */
+func (t *phaseTimer) end(phase string, span *tracing.Span) {
+	now := time.Now()
+	t.metrics.SpawnPhase.Observe(now.Sub(t.last).Seconds(), phase)
+	span.EndAt(now)
+	t.last = now
+}
+
+/**
+ * Records the total creation latency.
+ */
+func (t *phaseTimer) done() {
+	now := time.Now()
+	t.metrics.SpawnPhase.Observe(now.Sub(t.start).Seconds(), "total")
+	t.span.EndAt(now)
+}
+
+/**
+ * Ends the creation span with the error of a failed creation, if not
+ * ended by done.
+ * @param err the creation error
+ */
+func (t *phaseTimer) fail(err *error) {
+	t.span.Fail(*err)
+	t.span.Finish()
+}
+
+/**
+ * Tracks a sandbox until it has been waited for.
+ */
+func (p *SandboxProcess) track() {
+	p.rt.live.Store(p.uuid, p)
+}
+
+/**
+ * Stops tracking a sandbox.
+ */
+func (p *SandboxProcess) untrack() {
+	p.rt.live.Delete(p.uuid)
+}
+
+/**
+ * @return the number of live sandboxes.
+ */
+func (rt *Runtime) collectActive() []metrics.Sample {
+	n := 0
+	rt.live.Range(func(_, _ any) bool {
+		n++
+		return true
+	})
+	return []metrics.Sample{{Value: float64(n)}}
+}
+
+/**
+ * @return the number of allocated addresses of each subnet.
+ */
+func collectIpam() []metrics.Sample {
+	usage, err := net.IpamUsage()
+	if err != nil {
+		return nil
+	}
+	out := make([]metrics.Sample, 0, len(usage))
+	for _, u := range usage {
+		out = append(out, metrics.Sample{Labels: []string{u.Subnet}, Value: float64(u.Allocated)})
+	}
+	return out
+}
+
+/**
+ * @return the number of host addresses of the bridge subnet, which
+ * does not need the IPAM database.
+ */
+func collectSubnetSize() []metrics.Sample {
+	subnet := net.BridgeSubnet()
+	return []metrics.Sample{{Labels: []string{subnet}, Value: float64(net.SubnetSize(subnet))}}
+}
+
+/**
+ * @return a collector of a value of each live sandbox.
+ */
+func (rt *Runtime) collectSandboxes(value func(p *SandboxProcess) (float64, bool)) func() []metrics.Sample {
+	return func() []metrics.Sample {
+		var out []metrics.Sample
+		rt.live.Range(func(_, v any) bool {
+			p := v.(*SandboxProcess)
+			if val, ok := value(p); ok {
+				out = append(out, metrics.Sample{Labels: []string{p.uuid}, Value: val})
+			}
+			return true
+		})
+		return out
+	}
+}
+
+/**
+ * @return the CPU time consumed by a sandbox, in seconds.
+ */
+func cpuSeconds(p *SandboxProcess) (float64, bool) {
+	usec, ok := p.rt.cgroups.readStat(p.cgPath, "cpu.stat", "usage_usec")
+	return float64(usec) / 1e6, ok
+}
+
+/**
+ * @return the memory used by a sandbox, in bytes.
+ */
+func memoryBytes(p *SandboxProcess) (float64, bool) {
+	b, err := p.rt.cgroups.fs.ReadFile(filepath.Join(p.cgPath, "memory.current"))
+	if err != nil {
+		return 0, false
+	}
+	v, err := strconv.ParseUint(strings.TrimSpace(string(b)), 10, 64)
+	return float64(v), err == nil
+}
+
+/**
+ * @return a reader of the traffic of a sandbox, seen from the sandbox.
+ */
+func networkBytes(transmit bool) func(p *SandboxProcess) (float64, bool) {
+	return func(p *SandboxProcess) (float64, bool) {
+		n := p.networkStack()
+		if n == nil || n.HostIf == "" {
+			return 0, false
+		}
+		rx, tx, err := p.rt.network.LinkStats(n.HostIf)
+		if err != nil {
+			return 0, false
+		}
+		// The host side receives what the sandbox transmits.
+		if transmit {
+			return float64(rx), true
+		}
+		return float64(tx), true
+	}
+}
+
+/**
+ * Reads a value from a flat keyed cgroup file.
+ * @param cgPath the cgroup path
+ * @param file the file name
+ * @param key the key of the value
+ * @return the value, and whether it was found
+ */
+func (cg *Cgroups) readStat(cgPath, file, key string) (uint64, bool) {
+	b, err := cg.fs.ReadFile(filepath.Join(cgPath, file))
+	if err != nil {
+		return 0, false
+	}
+	for _, line := range strings.Split(string(b), "\n") {
+		k, v, ok := strings.Cut(line, " ")
+		if ok && k == key {
+			n, err := strconv.ParseUint(v, 10, 64)
+			return n, err == nil
+		}
+	}
+	return 0, false
+}
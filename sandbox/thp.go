@@ -0,0 +1,99 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"errors"
+	"fmt"
+
+	"golang.org/x/sys/unix"
+)
+
+/**
+ * `PR_THP_DISABLE_EXCEPT_ADVISED` flag for `PR_SET_THP_DISABLE`
+ * (uapi/linux/prctl.h, since Linux 6.18).
+ */
+const prThpDisableExceptAdvised = 1 << 1
+
+/**
+ * Transparent huge page policy of a sandbox.
+ */
+type ThpMode int
+
+/**
+ * Transparent huge page policies.
+ */
+const (
+	// Keep the policy inherited from the host.
+	ThpInherit ThpMode = iota
+
+	// Never back the sandbox memory with huge pages.
+	ThpNever
+
+	// Only back `madvise(MADV_HUGEPAGE)` regions with huge pages.
+	ThpMadvise
+
+	// Follow the system-wide policy, clearing any inherited opt-out.
+	ThpAlways
+)
+
+/**
+ * @return a string representation of the THP policy.
+ */
+func (m ThpMode) String() string {
+	switch m {
+	case ThpInherit:
+		return "inherit"
+	case ThpNever:
+		return "never"
+	case ThpMadvise:
+		return "madvise"
+	case ThpAlways:
+		return "always"
+	default:
+		return "unknown"
+	}
+}
+
+/**
+ * @return the `huge=` tmpfs mount option matching the THP policy,
+ * or an empty string to keep the kernel default.
+ */
+func (m ThpMode) TmpfsHuge() string {
+	switch m {
+	case ThpNever:
+		return "never"
+	case ThpMadvise:
+		return "advise"
+	case ThpAlways:
+		return "always"
+	default:
+		return ""
+	}
+}
+
+/**
+ * Applies the THP policy to the calling process. The policy is inherited
+ * across fork and preserved across execve, so it must be applied in the
+ * child right before executing the sandboxed program.
+ * @param mode the THP policy to apply
+ * @return error if any
+ */
+func ApplyThpMode(mode ThpMode) error {
+	switch mode {
+	case ThpInherit:
+		return nil
+	case ThpNever:
+		return unix.Prctl(unix.PR_SET_THP_DISABLE, 1, 0, 0, 0)
+	case ThpMadvise:
+		err := unix.Prctl(unix.PR_SET_THP_DISABLE, 1, prThpDisableExceptAdvised, 0, 0)
+		if errors.Is(err, unix.EINVAL) {
+			return fmt.Errorf("per-process madvise THP mode not supported by kernel: %w", err)
+		}
+		return err
+	case ThpAlways:
+		return unix.Prctl(unix.PR_SET_THP_DISABLE, 0, 0, 0, 0)
+	default:
+		return unix.EINVAL
+	}
+}
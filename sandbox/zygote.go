@@ -0,0 +1,446 @@
+//go:build linux
+
+package sandbox
+
+import (
+	"bufio"
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"log/slog"
+	stdnet "net"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// Environment variable holding the zygote control descriptor.
+	zygoteFdEnv = "MICROBOX_ZYGOTE_FD"
+
+	// Leaf cgroup of the zygote process.
+	zygoteLeaf = "zygote"
+
+	// Maximum time for the zygote to fork and stop a job.
+	zygoteForkTimeout = 10 * time.Second
+
+	// Maximum size of a control message.
+	zygoteMsgSize = 64 * 1024
+)
+
+/**
+ * A job request, sent by clients to the zygote supervisor.
+ */
+type JobRequest struct {
+	// Arguments of the job, interpreted by the zygote.
+	Args []string `json:"args"`
+
+	// Environment of the job, interpreted by the zygote.
+	Env []string `json:"env,omitempty"`
+
+	// CPU limit of the job (0 => sandbox limit).
+	CPUs float64 `json:"cpus,omitempty"`
+
+	// Memory limit of the job in bytes (0 => sandbox limit).
+	Memory uint64 `json:"memory,omitempty"`
+}
+
+/**
+ * A control message exchanged with the zygote process.
+ */
+type zygoteMsg struct {
+	// Message type (fork, forked, exit, error).
+	Type string `json:"type"`
+
+	// Job identifier.
+	ID uint64 `json:"id"`
+
+	// Job arguments and environment (fork).
+	Args []string `json:"args,omitempty"`
+	Env  []string `json:"env,omitempty"`
+
+	// Job PID in the sandbox PID namespace (forked).
+	Pid int `json:"pid,omitempty"`
+
+	// Job exit code (exit).
+	Code int `json:"code,omitempty"`
+
+	// Error description (error).
+	Error string `json:"error,omitempty"`
+}
+
+/**
+ * A job forked by the zygote.
+ */
+type Job struct {
+	// Job identifier.
+	ID uint64
+
+	// Job PID on the host.
+	Pid int
+
+	// Job cgroup, and the cgroups of the runtime.
+	cgPath  string
+	cgroups *Cgroups
+
+	// Whether the job is killed once forked, its request having timed out.
+	abandoned bool
+
+	// Receives the forked message, then the exit message.
+	events chan zygoteMsg
+}
+
+/**
+ * A sandboxed fork-server. The zygote process is started once with a
+ * control socket, preloads its runtime, and forks a child for each job.
+ * Each child is moved into its own cgroup, nested under the sandbox
+ * cgroup, before it starts running.
+ */
+type Zygote struct {
+	// The sandbox running the zygote process.
+	box *SandboxProcess
+
+	// Supervisor end of the control socket.
+	conn int
+
+	// Serializes writes on the control socket.
+	wmu sync.Mutex
+
+	// Pending jobs, by identifier.
+	mu   sync.Mutex
+	jobs map[uint64]*Job
+	next uint64
+	err  error
+}
+
+/**
+ * Starts a zygote process in a new sandbox. The zygote receives its end
+ * of the control socket as file descriptor 3, advertised in the
+ * MICROBOX_ZYGOTE_FD environment variable.
+ * @param opts the sandbox options
+ * @return the zygote, or an error if any
+ */
+func (rt *Runtime) NewZygote(opts *SandboxOptions) (*Zygote, error) {
+	fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+	if err != nil {
+		return nil, fmt.Errorf("socketpair: %w", err)
+	}
+
+	zopts := *opts
+	zopts.InheritFds = append([]int{fds[1]}, opts.InheritFds...)
+	zopts.Env = append(append(EnvVars{}, opts.Env...), EnvVar{Key: zygoteFdEnv, Val: "3"})
+	zopts.CgroupLeaf = zygoteLeaf
+
+	box, err := rt.NewSandbox(context.Background(), &zopts)
+	_ = unix.Close(fds[1])
+	if err != nil {
+		_ = unix.Close(fds[0])
+		return nil, err
+	}
+
+	z := &Zygote{
+		box:  box,
+		conn: fds[0],
+		jobs: make(map[uint64]*Job),
+	}
+	go z.readLoop()
+	return z, nil
+}
+
+/**
+ * @return the sandbox running the zygote process.
+ */
+func (z *Zygote) Sandbox() *SandboxProcess {
+	return z.box
+}
+
+/**
+ * Reads control messages from the zygote and dispatches them to jobs.
+ */
+func (z *Zygote) readLoop() {
+	buf := make([]byte, zygoteMsgSize)
+
+	for {
+		n, err := unix.Read(z.conn, buf)
+		if err == unix.EINTR {
+			continue
+		}
+		if err != nil || n == 0 {
+			if err == nil {
+				err = errors.New("zygote exited")
+			}
+			z.fail(err)
+			return
+		}
+
+		msg := zygoteMsg{}
+		if err := json.Unmarshal(buf[:n], &msg); err != nil {
+			z.box.log.Warn("bad zygote message", slog.Any("err", err))
+			continue
+		}
+
+		z.mu.Lock()
+		job := z.jobs[msg.ID]
+		abandoned := job != nil && job.abandoned
+		if job != nil && msg.Type != "forked" {
+			delete(z.jobs, msg.ID)
+		}
+		z.mu.Unlock()
+
+		if abandoned {
+			if msg.Type == "forked" {
+				z.kill(msg.Pid)
+			}
+			continue
+		}
+		if job != nil {
+			job.events <- msg
+		}
+	}
+}
+
+/**
+ * Fails all pending jobs after the control socket is closed.
+ */
+func (z *Zygote) fail(err error) {
+	z.mu.Lock()
+	defer z.mu.Unlock()
+
+	z.err = err
+	for id, job := range z.jobs {
+		job.events <- zygoteMsg{Type: "error", ID: id, Error: err.Error()}
+		delete(z.jobs, id)
+	}
+}
+
+/**
+ * Sends a control message to the zygote.
+ */
+func (z *Zygote) send(msg *zygoteMsg) error {
+	b, err := json.Marshal(msg)
+	if err != nil {
+		return err
+	}
+	z.wmu.Lock()
+	defer z.wmu.Unlock()
+	_, err = unix.Write(z.conn, b)
+	return err
+}
+
+/**
+ * Asks the zygote to fork a job, and moves the job into a fresh cgroup
+ * before resuming it. The zygote must stop the forked child with SIGSTOP
+ * before reporting it, so that the job runs under its own limits from
+ * its first instruction.
+ * @param req the job request
+ * @return the started job, or an error if any
+ */
+func (z *Zygote) Spawn(req *JobRequest) (*Job, error) {
+	z.mu.Lock()
+	if z.err != nil {
+		z.mu.Unlock()
+		return nil, z.err
+	}
+	z.next++
+	job := &Job{ID: z.next, cgroups: z.box.rt.cgroups, events: make(chan zygoteMsg, 2)}
+	z.jobs[job.ID] = job
+	z.mu.Unlock()
+
+	abort := func(err error) (*Job, error) {
+		z.mu.Lock()
+		delete(z.jobs, job.ID)
+		z.mu.Unlock()
+		return nil, err
+	}
+
+	if err := z.send(&zygoteMsg{Type: "fork", ID: job.ID, Args: req.Args, Env: req.Env}); err != nil {
+		return abort(fmt.Errorf("send fork request: %w", err))
+	}
+
+	// Wait for the zygote to report the forked child.
+	var msg zygoteMsg
+	select {
+	case msg = <-job.events:
+	case <-time.After(zygoteForkTimeout):
+		// The zygote may still fork the job, which would stay stopped:
+		// kill it once reported, for the zygote to reap it.
+		z.mu.Lock()
+		job.abandoned = true
+		z.mu.Unlock()
+		select {
+		case msg = <-job.events:
+			if msg.Type == "forked" {
+				z.kill(msg.Pid)
+			}
+		default:
+		}
+		return nil, fmt.Errorf("zygote did not fork job %d in time", job.ID)
+	}
+	if msg.Type != "forked" {
+		return nil, fmt.Errorf("zygote failed to fork job %d: %s", job.ID, msg.Error)
+	}
+
+	// Resolve the host PID of the child from its sandbox PID.
+	leaf := filepath.Join(z.box.cgPath, zygoteLeaf)
+	pid, err := z.box.rt.cgroups.resolveNsPid(leaf, msg.Pid)
+	if err != nil {
+		return abort(err)
+	}
+	job.Pid = pid
+
+	// Move the stopped child into its own cgroup, then resume it.
+	if err := waitStopped(pid, zygoteForkTimeout); err != nil {
+		_ = unix.Kill(pid, unix.SIGKILL)
+		return abort(err)
+	}
+	cgPath, err := job.cgroups.CreateChild(z.box.cgPath, "job-"+strconv.FormatUint(job.ID, 10), req.CPUs, req.Memory)
+	if err == nil {
+		err = job.cgroups.Attach(cgPath, pid)
+	}
+	if err != nil {
+		_ = unix.Kill(pid, unix.SIGKILL)
+		_ = job.cgroups.Cleanup(cgPath)
+		return abort(err)
+	}
+	job.cgPath = cgPath
+
+	if err := unix.Kill(pid, unix.SIGCONT); err != nil {
+		return nil, fmt.Errorf("resume job %d: %w", job.ID, err)
+	}
+	return job, nil
+}
+
+/**
+ * Kills a child forked by the zygote, which reaps it.
+ * @param nsPid the PID of the child in the sandbox PID namespace
+ */
+func (z *Zygote) kill(nsPid int) {
+	pid, err := z.box.rt.cgroups.resolveNsPid(filepath.Join(z.box.cgPath, zygoteLeaf), nsPid)
+	if err == nil {
+		err = unix.Kill(pid, unix.SIGKILL)
+	}
+	if err != nil {
+		z.box.log.Warn("failed to kill abandoned zygote job", slog.Int("pid", nsPid), slog.Any("err", err))
+	}
+}
+
+/**
+ * Waits for a job to exit and cleans up its cgroup, killing any
+ * process it left behind.
+ * @return the job exit code, or an error if any
+ */
+func (j *Job) Wait() (int, error) {
+	msg := <-j.events
+	_ = j.cgroups.Cleanup(j.cgPath)
+	if msg.Type != "exit" {
+		return 0, fmt.Errorf("job %d: %s", j.ID, msg.Error)
+	}
+	return msg.Code, nil
+}
+
+/**
+ * Serves job requests on a listener. Each connection carries a single
+ * JSON-encoded JobRequest, and receives a JSON line once the job has
+ * started, then another one when it has exited.
+ * @param l the listener
+ * @return error if any
+ */
+func (z *Zygote) Serve(l stdnet.Listener) error {
+	for {
+		c, err := l.Accept()
+		if err != nil {
+			return err
+		}
+		go z.handle(c)
+	}
+}
+
+/**
+ * Handles a client connection.
+ */
+func (z *Zygote) handle(c stdnet.Conn) {
+	defer c.Close()
+	enc := json.NewEncoder(c)
+
+	req := &JobRequest{}
+	if err := json.NewDecoder(bufio.NewReader(c)).Decode(req); err != nil {
+		_ = enc.Encode(map[string]string{"error": err.Error()})
+		return
+	}
+
+	job, err := z.Spawn(req)
+	if err != nil {
+		_ = enc.Encode(map[string]string{"error": err.Error()})
+		return
+	}
+	_ = enc.Encode(map[string]any{"id": job.ID, "pid": job.Pid})
+
+	code, err := job.Wait()
+	if err != nil {
+		_ = enc.Encode(map[string]any{"id": job.ID, "error": err.Error()})
+		return
+	}
+	_ = enc.Encode(map[string]any{"id": job.ID, "exit": code})
+}
+
+/**
+ * Finds the host PID of a process of a cgroup given its PID in
+ * the innermost PID namespace.
+ * @param cgPath the cgroup of the process
+ * @param nsPid the PID in the innermost PID namespace
+ * @return the host PID, or error if any
+ */
+func (cg *Cgroups) resolveNsPid(cgPath string, nsPid int) (int, error) {
+	b, err := cg.fs.ReadFile(filepath.Join(cgPath, "cgroup.procs"))
+	if err != nil {
+		return 0, err
+	}
+	want := strconv.Itoa(nsPid)
+	for _, f := range strings.Fields(string(b)) {
+		status, err := os.ReadFile("/proc/" + f + "/status")
+		if err != nil {
+			continue
+		}
+		for _, line := range strings.Split(string(status), "\n") {
+			if !strings.HasPrefix(line, "NSpid:") {
+				continue
+			}
+			ids := strings.Fields(strings.TrimPrefix(line, "NSpid:"))
+			if len(ids) > 0 && ids[len(ids)-1] == want {
+				return strconv.Atoi(f)
+			}
+			break
+		}
+	}
+	return 0, fmt.Errorf("no process with sandbox pid %d in %s", nsPid, cgPath)
+}
+
+/**
+ * Waits for a process to enter the stopped state.
+ * @param pid the host PID of the process
+ * @param timeout the maximum time to wait
+ * @return error if any
+ */
+func waitStopped(pid int, timeout time.Duration) error {
+	deadline := time.Now().Add(timeout)
+	for {
+		b, err := os.ReadFile("/proc/" + strconv.Itoa(pid) + "/stat")
+		if err != nil {
+			return err
+		}
+		// The state follows the parenthesized command name.
+		if i := strings.LastIndexByte(string(b), ')'); i >= 0 && i+2 < len(b) && b[i+2] == 'T' {
+			return nil
+		}
+		if time.Now().After(deadline) {
+			return fmt.Errorf("process %d did not stop in time", pid)
+		}
+		time.Sleep(time.Millisecond)
+	}
+}
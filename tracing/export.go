@@ -0,0 +1,226 @@
+//go:build linux
+
+package tracing
+
+import (
+	"encoding/json"
+	"fmt"
+	"io"
+	"os"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"time"
+)
+
+/**
+ * Writes the finished spans to a file, replaced atomically so that
+ * readers never see a partial export.
+ * @param path the path of the file
+ * @return error if any
+ */
+func (t *Tracer) WriteFile(path string) error {
+	f, err := os.CreateTemp(filepath.Dir(path), "."+filepath.Base(path)+".*")
+	if err != nil {
+		return fmt.Errorf("create trace file: %w", err)
+	}
+	if err := t.Write(f); err != nil {
+		f.Close()
+		_ = os.Remove(f.Name())
+		return err
+	}
+	if err := f.Close(); err != nil {
+		_ = os.Remove(f.Name())
+		return err
+	}
+	if err := os.Rename(f.Name(), path); err != nil {
+		_ = os.Remove(f.Name())
+		return fmt.Errorf("replace trace file: %w", err)
+	}
+	return nil
+}
+
+/**
+ * Periodically writes the finished spans to a file, for long-running
+ * supervisors which would otherwise only export them on exit.
+ * @param path the path of the file
+ * @param interval the interval between writes
+ * @param onError called with the error of a failed write
+ * @return a function stopping the writes
+ */
+func (t *Tracer) WriteFileEvery(path string, interval time.Duration, onError func(error)) func() {
+	ticker := time.NewTicker(interval)
+	done := make(chan struct{})
+	stopped := make(chan struct{})
+	go func() {
+		defer close(stopped)
+		for {
+			select {
+			case <-ticker.C:
+				if err := t.WriteFile(path); err != nil {
+					onError(err)
+				}
+			case <-done:
+				return
+			}
+		}
+	}()
+	return func() {
+		ticker.Stop()
+		close(done)
+		<-stopped
+	}
+}
+
+/**
+ * Writes the finished spans in the export format of the tracer.
+ * @param w the writer
+ * @return error if any
+ */
+func (t *Tracer) Write(w io.Writer) error {
+	t.mu.Lock()
+	spans := append([]*Span(nil), t.spans...)
+	t.mu.Unlock()
+
+	sort.SliceStable(spans, func(i, j int) bool {
+		return spans[i].Start.Before(spans[j].Start)
+	})
+
+	var doc any
+	if t.format == FormatOTLP {
+		doc = otlpDocument(spans)
+	} else {
+		doc = chromeDocument(spans)
+	}
+	enc := json.NewEncoder(w)
+	return enc.Encode(doc)
+}
+
+/**
+ * A Chrome trace event.
+ */
+type chromeEvent struct {
+	Name string         `json:"name"`
+	Cat  string         `json:"cat"`
+	Ph   string         `json:"ph"`
+	Ts   float64        `json:"ts"`
+	Dur  float64        `json:"dur"`
+	Pid  int            `json:"pid"`
+	Tid  int            `json:"tid"`
+	Args map[string]any `json:"args,omitempty"`
+}
+
+/**
+ * Builds a Chrome trace-event document, with each trace on its own
+ * track. Viewers nest the spans of a track by their times.
+ */
+func chromeDocument(spans []*Span) any {
+	pid := os.Getpid()
+	events := make([]chromeEvent, 0, len(spans))
+	for _, s := range spans {
+		args := map[string]any{
+			"traceId": hexID(s.TraceID[:]),
+			"spanId":  hexID(s.SpanID[:]),
+		}
+		for _, a := range s.Attrs {
+			args[a.Key] = a.Value
+		}
+		events = append(events, chromeEvent{
+			Name: s.Name,
+			Cat:  "microbox",
+			Ph:   "X",
+			Ts:   float64(s.Start.UnixNano()) / 1e3,
+			Dur:  float64(s.End.Sub(s.Start).Nanoseconds()) / 1e3,
+			Pid:  pid,
+			Tid:  s.track,
+			Args: args,
+		})
+	}
+	return map[string]any{
+		"traceEvents":     events,
+		"displayTimeUnit": "ms",
+	}
+}
+
+/**
+ * An OTLP attribute.
+ */
+type otlpAttr struct {
+	Key   string         `json:"key"`
+	Value map[string]any `json:"value"`
+}
+
+/**
+ * An OTLP span.
+ */
+type otlpSpan struct {
+	TraceID      string     `json:"traceId"`
+	SpanID       string     `json:"spanId"`
+	ParentSpanID string     `json:"parentSpanId,omitempty"`
+	Name         string     `json:"name"`
+	Kind         int        `json:"kind"`
+	Start        string     `json:"startTimeUnixNano"`
+	End          string     `json:"endTimeUnixNano"`
+	Attributes   []otlpAttr `json:"attributes,omitempty"`
+}
+
+/**
+ * Builds an OTLP/JSON document.
+ */
+func otlpDocument(spans []*Span) any {
+	out := make([]otlpSpan, 0, len(spans))
+	for _, s := range spans {
+		o := otlpSpan{
+			TraceID: hexID(s.TraceID[:]),
+			SpanID:  hexID(s.SpanID[:]),
+			Name:    s.Name,
+			Kind:    1, // SPAN_KIND_INTERNAL
+			Start:   strconv.FormatInt(s.Start.UnixNano(), 10),
+			End:     strconv.FormatInt(s.End.UnixNano(), 10),
+		}
+		if s.ParentID != ([8]byte{}) {
+			o.ParentSpanID = hexID(s.ParentID[:])
+		}
+		for _, a := range s.Attrs {
+			o.Attributes = append(o.Attributes, otlpAttr{Key: a.Key, Value: otlpValue(a.Value)})
+		}
+		out = append(out, o)
+	}
+
+	return map[string]any{
+		"resourceSpans": []any{
+			map[string]any{
+				"resource": map[string]any{
+					"attributes": []otlpAttr{
+						{Key: "service.name", Value: otlpValue("microbox")},
+					},
+				},
+				"scopeSpans": []any{
+					map[string]any{
+						"scope": map[string]any{"name": "microbox"},
+						"spans": out,
+					},
+				},
+			},
+		},
+	}
+}
+
+/**
+ * @return the OTLP representation of an attribute value.
+ */
+func otlpValue(v any) map[string]any {
+	switch v := v.(type) {
+	case string:
+		return map[string]any{"stringValue": v}
+	case int64:
+		// 64-bit integers are encoded as strings in OTLP/JSON.
+		return map[string]any{"intValue": strconv.FormatInt(v, 10)}
+	case float64:
+		return map[string]any{"doubleValue": v}
+	case bool:
+		return map[string]any{"boolValue": v}
+	default:
+		return map[string]any{"stringValue": fmt.Sprint(v)}
+	}
+}
@@ -0,0 +1,271 @@
+//go:build linux
+
+package tracing
+
+import (
+	"crypto/rand"
+	"encoding/hex"
+	"fmt"
+	"sync"
+	"time"
+)
+
+/**
+ * Represents a trace export format.
+ */
+type Format int
+
+/**
+ * Supported trace export formats.
+ */
+const (
+	// Chrome trace-event format, loadable in Perfetto or chrome://tracing.
+	FormatChrome Format = iota
+
+	// OpenTelemetry OTLP/JSON format.
+	FormatOTLP
+)
+
+/**
+ * A span attribute.
+ */
+type Attr struct {
+	Key   string
+	Value any
+}
+
+/**
+ * A timed operation, possibly nested in a parent span.
+ */
+type Span struct {
+	tracer *Tracer
+
+	// Span name.
+	Name string
+
+	// Trace, span and parent span identifiers.
+	TraceID  [16]byte
+	SpanID   [8]byte
+	ParentID [8]byte
+
+	// Start and end times.
+	Start time.Time
+	End   time.Time
+
+	// Span attributes.
+	Attrs []Attr
+
+	// Track the span is displayed on, shared by the spans of a trace.
+	track int
+
+	mu    sync.Mutex
+	ended bool
+}
+
+/**
+ * Maximum number of finished spans kept by a tracer. Beyond, the oldest
+ * quarter is dropped, so that long-running supervisors keep bounded
+ * memory between exports.
+ */
+const MaxSpans = 1 << 16
+
+/**
+ * Collects finished spans, and exports them on close.
+ */
+type Tracer struct {
+	format Format
+
+	mu      sync.Mutex
+	spans   []*Span
+	tracks  int
+	dropped uint64
+}
+
+/**
+ * Creates a tracer.
+ * @param format the export format
+ * @return the tracer
+ */
+func New(format Format) *Tracer {
+	return &Tracer{format: format}
+}
+
+/**
+ * @return the spans finished so far, in the order they finished.
+ */
+func (t *Tracer) Spans() []*Span {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+	return append([]*Span(nil), t.spans...)
+}
+
+/**
+ * @return the number of finished spans dropped beyond MaxSpans.
+ */
+func (t *Tracer) Dropped() uint64 {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+	return t.dropped
+}
+
+/**
+ * Starts a root span, beginning a new trace. Safe to call on a nil
+ * tracer, in which case a nil span is returned.
+ * @param name the span name
+ * @param attrs the span attributes
+ * @return the span
+ */
+func (t *Tracer) Start(name string, attrs ...Attr) *Span {
+	if t == nil {
+		return nil
+	}
+	s := &Span{tracer: t, Name: name, Start: time.Now(), Attrs: attrs}
+	_, _ = rand.Read(s.TraceID[:])
+	_, _ = rand.Read(s.SpanID[:])
+
+	t.mu.Lock()
+	t.tracks++
+	s.track = t.tracks
+	t.mu.Unlock()
+	return s
+}
+
+/**
+ * Starts a child span. Safe to call on a nil span.
+ * @param name the span name
+ * @param attrs the span attributes
+ * @return the child span
+ */
+func (s *Span) Child(name string, attrs ...Attr) *Span {
+	if s == nil {
+		return nil
+	}
+	c := &Span{
+		tracer:   s.tracer,
+		Name:     name,
+		TraceID:  s.TraceID,
+		ParentID: s.SpanID,
+		Start:    time.Now(),
+		Attrs:    attrs,
+		track:    s.track,
+	}
+	_, _ = rand.Read(c.SpanID[:])
+	return c
+}
+
+/**
+ * Records a finished child span with explicit times, e.g. measured by
+ * another process. Safe to call on a nil span.
+ * @param name the span name
+ * @param start the start time
+ * @param end the end time
+ * @param attrs the span attributes
+ */
+func (s *Span) Record(name string, start, end time.Time, attrs ...Attr) {
+	if c := s.Child(name, attrs...); c != nil {
+		c.Start = start
+		c.EndAt(end)
+	}
+}
+
+/**
+ * Adds attributes to the span. Safe to call on a nil span.
+ * @param attrs the attributes
+ */
+func (s *Span) Set(attrs ...Attr) {
+	if s == nil {
+		return
+	}
+	s.mu.Lock()
+	s.Attrs = append(s.Attrs, attrs...)
+	s.mu.Unlock()
+}
+
+/**
+ * Sets the error of the span, if any. Safe to call on a nil span.
+ * @param err the error
+ */
+func (s *Span) Fail(err error) {
+	if err != nil {
+		s.Set(Attr{"error", err.Error()})
+	}
+}
+
+/**
+ * Ends the span now. Safe to call on a nil span, and more than once.
+ */
+func (s *Span) Finish() {
+	s.EndAt(time.Now())
+}
+
+/**
+ * Ends the span at the given time.
+ * @param end the end time
+ */
+func (s *Span) EndAt(end time.Time) {
+	if s == nil {
+		return
+	}
+	s.mu.Lock()
+	if s.ended {
+		s.mu.Unlock()
+		return
+	}
+	s.ended = true
+	s.End = end
+	s.mu.Unlock()
+
+	t := s.tracer
+	t.mu.Lock()
+	if len(t.spans) >= MaxSpans {
+		n := copy(t.spans, t.spans[MaxSpans/4:])
+		clear(t.spans[n:])
+		t.spans = t.spans[:n]
+		t.dropped += MaxSpans / 4
+	}
+	t.spans = append(t.spans, s)
+	t.mu.Unlock()
+}
+
+/**
+ * @return the identifier of a span, as a hex string.
+ */
+func hexID(b []byte) string {
+	return hex.EncodeToString(b)
+}
+
+/**
+ * Creates a string attribute.
+ */
+func String(k, v string) Attr { return Attr{k, v} }
+
+/**
+ * Creates an integer attribute.
+ */
+func Int(k string, v int64) Attr { return Attr{k, v} }
+
+/**
+ * Creates a floating-point attribute.
+ */
+func Float(k string, v float64) Attr { return Attr{k, v} }
+
+/**
+ * Creates a boolean attribute.
+ */
+func Bool(k string, v bool) Attr { return Attr{k, v} }
+
+/**
+ * Parses a trace format name.
+ * @param s the format name (chrome|otlp)
+ * @return the format, or error if any
+ */
+func ParseFormat(s string) (Format, error) {
+	switch s {
+	case "chrome":
+		return FormatChrome, nil
+	case "otlp":
+		return FormatOTLP, nil
+	default:
+		return FormatChrome, fmt.Errorf("unknown trace format: %q", s)
+	}
+}